@@ -22,4 +22,16 @@
 #cmakedefine CONFIG_X86_FXSR 1
 #cmakedefine CONFIG_X86_SYSENTER 1
 #cmakedefine CONFIG_IOAPIC 1
+#cmakedefine CONFIG_SMP 1
+#cmakedefine CONFIG_MAX_CPUS @CONFIG_MAX_CPUS@
+/* Lowest trace point level kept, see trace.h. Not a cmakedefine as level 0 must be defined too. */
+#define CONFIG_TRACE_LEVEL @CONFIG_TRACE_LEVEL@
+/* 1 to use the unwinding exception system, 0 for setjmp/longjmp. See exceptions.h. */
+#define CONFIG_EXCEPTIONS_UNWIND @CONFIG_EXCEPTIONS_UNWIND@
 #cmakedefine PCIBUS_TEST 1
+#cmakedefine PCIBUS_DUMP 1
+#cmakedefine IDC_BENCHMARK 1
+#cmakedefine THREADS_BENCHMARK 1
+#cmakedefine CONSOLE_BENCHMARK 1
+#cmakedefine EXCEPTIONS_BENCHMARK 1
+#cmakedefine VIRTIO_NET_BENCHMARK 1
@@ -73,4 +73,24 @@ void bga::set_caps()
     kconsole << "Maximum supported mode " << xres_max << "x" << yres_max << "_" << bpp_max << endl;
 }
 
+static const pci_device_id_t bga_ids[] = {
+    { 0x1234, 0x1111 }, // QEMU and Bochs standard VGA
+    { 0, 0 }
+};
+
+static bool bga_probe(pci_device_t* dev)
+{
+    static bga card;
+    card.configure(dev);
+    if (!card.is_available())
+    {
+        kconsole << "BGA init failed!" << endl;
+        return false;
+    }
+    card.init();
+    return true;
+}
+
+const pci_driver_t bga_pci_driver = { "bga", bga_ids, bga_probe };
+
 } // namespace graphics
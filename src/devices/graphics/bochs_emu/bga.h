@@ -11,6 +11,7 @@
 #include "types.h"
 
 class pci_device_t;
+struct pci_driver_t;
 
 namespace graphics {
 
@@ -47,4 +48,6 @@ public:
 	inline void* get_lfb() { return lfb; }
 };
 
+extern const pci_driver_t bga_pci_driver;
+
 } // namespace graphics
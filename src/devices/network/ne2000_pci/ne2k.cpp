@@ -314,3 +314,25 @@ void ne2k::send_packet(void* buf, uint16_t size)
 
 
 
+
+static const pci_device_id_t ne2k_ids[] = {
+    { 0x10ec, 0x8029 }, // Realtek RTL8029
+    { 0, 0 }
+};
+
+static bool ne2k_probe(pci_device_t* dev)
+{
+    static ne2k card;
+    card.configure(dev);
+    card.init();
+
+    // Send a nice hello world to everyone
+    uint8_t hello[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                       0xb0, 0xc4, 0x20, 0x00, 0x00, 0x00,
+                       0x00, 0x10,
+                       'H', 'e', 'l', 'l', 'o', ' ', 'n', 'e', 't', ' ', 'w', 'o', 'r', 'l', 'd', '!'};
+    card.send_packet(hello, sizeof(hello));
+    return true;
+}
+
+const pci_driver_t ne2k_pci_driver = { "ne2k", ne2k_ids, ne2k_probe };
@@ -12,6 +12,7 @@
 #include "isr.h"
 
 class pci_device_t;
+struct pci_driver_t;
 
 /**
  * NE2000 NIC driver.
@@ -50,3 +51,5 @@ public:
 	void packet_transmitted();
 	void send_packet(void* buf, uint16_t length);
 };
+
+extern const pci_driver_t ne2k_pci_driver;
@@ -0,0 +1,172 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "types.h"
+#include "macros.h"
+
+/**
+ * @brief virtio network device registers and split virtqueue layout.
+ */
+namespace virtio_card
+{
+
+// @sa http://docs.oasis-open.org/virtio/virtio/v1.0/virtio-v1.0.html
+enum {
+	VENDOR_ID = 0x1af4,
+	DEVICE_ID_NET_LEGACY = 0x1000, // Transitional device, has both interfaces.
+	DEVICE_ID_NET_MODERN = 0x1041,
+};
+
+// Legacy interface, registers in the I/O BAR0.
+enum {
+	LEGACY_DEVICE_FEATURES_R = 0x00, // 32-bit
+	LEGACY_DRIVER_FEATURES_RW = 0x04, // 32-bit
+	LEGACY_QUEUE_ADDRESS_RW = 0x08, // 32-bit, page frame number of the queue
+	LEGACY_QUEUE_SIZE_R = 0x0c, // 16-bit
+	LEGACY_QUEUE_SELECT_RW = 0x0e, // 16-bit
+	LEGACY_QUEUE_NOTIFY_W = 0x10, // 16-bit
+	LEGACY_DEVICE_STATUS_RW = 0x12, // 8-bit
+	LEGACY_ISR_STATUS_R = 0x13, // 8-bit, read clears
+	LEGACY_NET_MAC_R = 0x14, // 6 bytes, when MSI-X is disabled
+};
+
+// Legacy interface lays the queue out in one block with the used ring on the next page.
+enum { LEGACY_QUEUE_ALIGN = 4096 };
+
+// Modern interface, structures are found through vendor specific PCI capabilities.
+enum {
+	PCI_CAPABILITY_LIST = 0x34,
+	PCI_STATUS_CAPABILITIES = 0x10, // in the PCI status register
+	PCI_CAP_ID_VENDOR = 0x09,
+
+	CAP_NEXT = 1,
+	CAP_CFG_TYPE = 3,
+	CAP_BAR = 4,
+	CAP_OFFSET = 8,
+	CAP_LENGTH = 12,
+	CAP_NOTIFY_OFF_MULTIPLIER = 16,
+
+	CFG_TYPE_COMMON = 1,
+	CFG_TYPE_NOTIFY = 2,
+	CFG_TYPE_ISR = 3,
+	CFG_TYPE_DEVICE = 4,
+};
+
+// Common configuration structure.
+enum {
+	COMMON_DEVICE_FEATURE_SELECT_RW = 0x00, // 32-bit
+	COMMON_DEVICE_FEATURE_R = 0x04, // 32-bit
+	COMMON_DRIVER_FEATURE_SELECT_RW = 0x08, // 32-bit
+	COMMON_DRIVER_FEATURE_RW = 0x0c, // 32-bit
+	COMMON_MSIX_CONFIG_RW = 0x10, // 16-bit
+	COMMON_NUM_QUEUES_R = 0x12, // 16-bit
+	COMMON_DEVICE_STATUS_RW = 0x14, // 8-bit
+	COMMON_CONFIG_GENERATION_R = 0x15, // 8-bit
+	COMMON_QUEUE_SELECT_RW = 0x16, // 16-bit
+	COMMON_QUEUE_SIZE_RW = 0x18, // 16-bit
+	COMMON_QUEUE_MSIX_VECTOR_RW = 0x1a, // 16-bit
+	COMMON_QUEUE_ENABLE_RW = 0x1c, // 16-bit
+	COMMON_QUEUE_NOTIFY_OFF_R = 0x1e, // 16-bit
+	COMMON_QUEUE_DESC_RW = 0x20, // 64-bit
+	COMMON_QUEUE_DRIVER_RW = 0x28, // 64-bit, the avail ring
+	COMMON_QUEUE_DEVICE_RW = 0x30, // 64-bit, the used ring
+};
+
+// Device specific configuration of network devices.
+enum {
+	NET_MAC_R = 0x00, // 6 bytes
+	NET_STATUS_R = 0x06, // 16-bit
+};
+
+// Device status bits.
+enum {
+	STATUS_ACKNOWLEDGE = 0x01,
+	STATUS_DRIVER = 0x02,
+	STATUS_DRIVER_OK = 0x04,
+	STATUS_FEATURES_OK = 0x08,
+	STATUS_NEEDS_RESET = 0x40,
+	STATUS_FAILED = 0x80,
+};
+
+// Feature bit numbers.
+enum {
+	FEATURE_NET_MAC = 5,
+	FEATURE_NET_STATUS = 16,
+	FEATURE_ANY_LAYOUT = 27,
+	FEATURE_VERSION_1 = 32,
+};
+
+// ISR status bits.
+enum {
+	ISR_QUEUE = 0x01,
+	ISR_CONFIG = 0x02,
+};
+
+enum {
+	RX_QUEUE = 0,
+	TX_QUEUE = 1,
+};
+
+// Split virtqueue.
+enum {
+	DESC_F_NEXT = 1,
+	DESC_F_WRITE = 2, // Buffer is written by the device.
+	AVAIL_F_NO_INTERRUPT = 1,
+	USED_F_NO_NOTIFY = 1,
+};
+
+struct desc_t
+{
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} PACKED;
+
+struct avail_t
+{
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[]; // followed by uint16_t used_event
+} PACKED;
+
+struct used_elem_t
+{
+	uint32_t id;
+	uint32_t len;
+} PACKED;
+
+struct used_t
+{
+	uint16_t flags;
+	uint16_t idx;
+	used_elem_t ring[]; // followed by uint16_t avail_event
+} PACKED;
+
+/**
+ * Header in front of every packet. Legacy devices without mergeable rx buffers omit num_buffers.
+ */
+struct net_header_t
+{
+	uint8_t flags;
+	uint8_t gso_type;
+	uint16_t hdr_len;
+	uint16_t gso_size;
+	uint16_t csum_start;
+	uint16_t csum_offset;
+	uint16_t num_buffers;
+} PACKED;
+
+enum {
+	NET_HEADER_SIZE_LEGACY = 10,
+	NET_HEADER_SIZE_MODERN = 12,
+};
+
+} // namespace virtio_card
@@ -0,0 +1,475 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "virtio_net.h"
+#include "default_console.h"
+#include "pci_bus.h"
+#include "cpu.h"
+#include "atomic.h"
+#include "memutils.h"
+#include "nucleus.h"
+#include "config.h"
+
+using namespace virtio_card;
+
+#if VIRTIO_NET_BENCHMARK
+extern void virtio_net_benchmark(virtio_net& card); // virtio_net_bench.cpp
+#endif
+
+// Keep the compiler from moving memory accesses across, x86 does not reorder stores with stores or loads with loads.
+#define compiler_barrier() asm volatile("" ::: "memory")
+
+template <typename T>
+static inline T mmio_read(volatile uint8_t* base, size_t offset)
+{
+    return *reinterpret_cast<volatile T*>(base + offset);
+}
+
+template <typename T>
+static inline void mmio_write(volatile uint8_t* base, size_t offset, T value)
+{
+    *reinterpret_cast<volatile T*>(base + offset) = value;
+}
+
+//======================================================================================================================
+// virtqueue_t
+//======================================================================================================================
+
+static inline size_t used_offset(uint16_t size)
+{
+    size_t rings = sizeof(desc_t) * size + sizeof(avail_t) + sizeof(uint16_t) * (size + 1);
+    return (rings + LEGACY_QUEUE_ALIGN - 1) & ~size_t(LEGACY_QUEUE_ALIGN - 1);
+}
+
+size_t virtqueue_t::memory_size(uint16_t size)
+{
+    return used_offset(size) + sizeof(used_t) + sizeof(used_elem_t) * size + sizeof(uint16_t);
+}
+
+void virtqueue_t::init(void* memory, address_t phys, uint16_t size_)
+{
+    memutils::clear_memory(memory, memory_size(size_));
+
+    size = size_;
+    avail_idx = 0;
+    last_used = 0;
+
+    uint8_t* base = reinterpret_cast<uint8_t*>(memory);
+    desc = reinterpret_cast<desc_t*>(base);
+    avail = reinterpret_cast<avail_t*>(base + sizeof(desc_t) * size);
+    used = reinterpret_cast<used_t*>(base + used_offset(size));
+
+    desc_phys = phys;
+    avail_phys = phys + sizeof(desc_t) * size;
+    used_phys = phys + used_offset(size);
+}
+
+bool virtqueue_t::publish()
+{
+    // Ring entries must be visible before the index that covers them.
+    compiler_barrier();
+    *reinterpret_cast<volatile uint16_t*>(&avail->idx) = avail_idx;
+    // The device may be checking the index right now, it must see the store before we look at its flags.
+    atomic_ops::membar();
+    return !(*reinterpret_cast<volatile uint16_t*>(&used->flags) & USED_F_NO_NOTIFY);
+}
+
+bool virtqueue_t::get_used(uint16_t& id, uint32_t& len)
+{
+    if (last_used == *reinterpret_cast<volatile uint16_t*>(&used->idx))
+        return false;
+    // Read the entry only after seeing the index which covers it.
+    compiler_barrier();
+
+    used_elem_t& e = used->ring[last_used & (size - 1)];
+    id = e.id;
+    len = e.len;
+    ++last_used;
+    return true;
+}
+
+void virtqueue_t::suppress_interrupts(bool suppress)
+{
+    *reinterpret_cast<volatile uint16_t*>(&avail->flags) = suppress ? AVAIL_F_NO_INTERRUPT : 0;
+}
+
+//======================================================================================================================
+// virtio_net
+//======================================================================================================================
+
+void virtio_net::irq_handler::run(registers_t*)
+{
+    parent->handle_irq();
+}
+
+uint8_t virtio_net::read_status()
+{
+    if (modern)
+        return mmio_read<uint8_t>(common, COMMON_DEVICE_STATUS_RW);
+    return x86_cpu_t::inb(io_base + LEGACY_DEVICE_STATUS_RW);
+}
+
+void virtio_net::write_status(uint8_t status)
+{
+    if (modern)
+        mmio_write<uint8_t>(common, COMMON_DEVICE_STATUS_RW, status);
+    else
+        x86_cpu_t::outb(io_base + LEGACY_DEVICE_STATUS_RW, status);
+}
+
+/**
+ * Map the structure a virtio capability points to, nullptr if its BAR is not memory below 4GiB.
+ */
+volatile uint8_t* virtio_net::map_capability(pci_device_t* card, uint8_t cap)
+{
+    uint8_t bar = card->read_config_space(cap + CAP_BAR) & 0xff;
+    if (bar > 5)
+        return nullptr;
+
+    uint32_t bar_value = card->read_config_space(PCI_CONFIG_BAR0 + bar * 4);
+    if (bar_value & 1)
+        return nullptr;
+    // 64-bit BAR, the upper half is in the next one.
+    if ((bar_value & 0x6) == 0x4 && (bar == 5 || card->read_config_space(PCI_CONFIG_BAR0 + bar * 4 + 4) != 0))
+        return nullptr;
+
+    uint32_t offset = card->read_config_space(cap + CAP_OFFSET);
+    uint32_t length = card->read_config_space(cap + CAP_LENGTH);
+    return reinterpret_cast<volatile uint8_t*>(pci_bus_t::map_registers((bar_value & PCI_MEM_ADDRESS_MASK) + offset, length));
+}
+
+/**
+ * Walk the capability list for modern interface structures.
+ * @return true if all structures the driver uses were found and mapped.
+ */
+bool virtio_net::find_capabilities(pci_device_t* card)
+{
+    if (!((card->read_config_space(PCI_CONFIG_COMMAND) >> 16) & PCI_STATUS_CAPABILITIES))
+        return false;
+
+    // Only the first capability of each type is used, devices may list alternatives after it.
+    uint8_t cap = card->read_config_space(PCI_CAPABILITY_LIST) & 0xfc;
+    while (cap)
+    {
+        uint32_t header = card->read_config_space(cap);
+        if ((header & 0xff) == PCI_CAP_ID_VENDOR)
+        {
+            switch ((header >> (CAP_CFG_TYPE * 8)) & 0xff)
+            {
+                case CFG_TYPE_COMMON:
+                    if (!common)
+                        common = map_capability(card, cap);
+                    break;
+                case CFG_TYPE_NOTIFY:
+                    if (!notify_base)
+                    {
+                        notify_base = map_capability(card, cap);
+                        notify_multiplier = card->read_config_space(cap + CAP_NOTIFY_OFF_MULTIPLIER);
+                    }
+                    break;
+                case CFG_TYPE_ISR:
+                    if (!isr)
+                        isr = map_capability(card, cap);
+                    break;
+                case CFG_TYPE_DEVICE:
+                    if (!device_config)
+                        device_config = map_capability(card, cap);
+                    break;
+            }
+        }
+        cap = (header >> (CAP_NEXT * 8)) & 0xfc;
+    }
+    return common && notify_base && isr && device_config;
+}
+
+bool virtio_net::configure(pci_device_t* card)
+{
+    // Rings and buffers are in host memory, the device must be able to master the bus.
+    uint32_t command = card->read_config_space(PCI_CONFIG_COMMAND) & 0xffff;
+    card->write_config_space(PCI_CONFIG_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+    irq = card->interrupt_line();
+
+    modern = find_capabilities(card);
+    if (!modern)
+    {
+        // Only transitional devices have the legacy interface.
+        uint32_t bar0 = card->read_config_space(PCI_CONFIG_BAR0);
+        if (card->device() != DEVICE_ID_NET_LEGACY || !(bar0 & 1))
+        {
+            kconsole << "WARNING: This virtio-net has no usable register interface." << endl;
+            return false;
+        }
+        io_base = bar0 & PCI_IO_ADDRESS_MASK;
+    }
+
+    header_size = modern ? NET_HEADER_SIZE_MODERN : NET_HEADER_SIZE_LEGACY;
+
+    kconsole << "This virtio-net uses the " << (modern ? "modern" : "legacy") << " interface and irq line " << int32_t(irq) << endl;
+    return true;
+}
+
+bool virtio_net::negotiate_features()
+{
+    if (modern)
+    {
+        mmio_write<uint32_t>(common, COMMON_DEVICE_FEATURE_SELECT_RW, 0);
+        uint32_t low = mmio_read<uint32_t>(common, COMMON_DEVICE_FEATURE_R);
+        mmio_write<uint32_t>(common, COMMON_DEVICE_FEATURE_SELECT_RW, 1);
+        uint32_t high = mmio_read<uint32_t>(common, COMMON_DEVICE_FEATURE_R);
+        if (!(high & (1 << (FEATURE_VERSION_1 - 32))))
+            return false;
+
+        mmio_write<uint32_t>(common, COMMON_DRIVER_FEATURE_SELECT_RW, 0);
+        mmio_write<uint32_t>(common, COMMON_DRIVER_FEATURE_RW, low & (1 << FEATURE_NET_MAC));
+        mmio_write<uint32_t>(common, COMMON_DRIVER_FEATURE_SELECT_RW, 1);
+        mmio_write<uint32_t>(common, COMMON_DRIVER_FEATURE_RW, 1 << (FEATURE_VERSION_1 - 32));
+
+        write_status(read_status() | STATUS_FEATURES_OK);
+        if (!(read_status() & STATUS_FEATURES_OK))
+            return false;
+
+        if (low & (1 << FEATURE_NET_MAC))
+            for (size_t i = 0; i < sizeof(mac); ++i)
+                mac[i] = mmio_read<uint8_t>(device_config, NET_MAC_R + i);
+        return true;
+    }
+
+    // The header shares a descriptor with the frame, which legacy devices allow only with ANY_LAYOUT.
+    uint32_t features = x86_cpu_t::inl(io_base + LEGACY_DEVICE_FEATURES_R);
+    if (!(features & (1 << FEATURE_ANY_LAYOUT)))
+        return false;
+    x86_cpu_t::outl(io_base + LEGACY_DRIVER_FEATURES_RW, features & ((1 << FEATURE_NET_MAC) | (1 << FEATURE_ANY_LAYOUT)));
+
+    if (features & (1 << FEATURE_NET_MAC))
+        for (size_t i = 0; i < sizeof(mac); ++i)
+            mac[i] = x86_cpu_t::inb(io_base + LEGACY_NET_MAC_R + i);
+    return true;
+}
+
+bool virtio_net::setup_queue(uint16_t index, virtqueue_t& queue)
+{
+    uint16_t size;
+    if (modern)
+    {
+        mmio_write<uint16_t>(common, COMMON_QUEUE_SELECT_RW, index);
+        size = mmio_read<uint16_t>(common, COMMON_QUEUE_SIZE_RW);
+        // Modern devices take a smaller size, sizes are powers of 2.
+        if (size > MAX_QUEUE_SIZE)
+        {
+            size = MAX_QUEUE_SIZE;
+            mmio_write<uint16_t>(common, COMMON_QUEUE_SIZE_RW, size);
+        }
+    }
+    else
+    {
+        x86_cpu_t::outw(io_base + LEGACY_QUEUE_SELECT_RW, index);
+        size = x86_cpu_t::inw(io_base + LEGACY_QUEUE_SIZE_R);
+    }
+    if (size == 0)
+        return false;
+
+    address_t phys;
+    void* memory = pci_bus_t::allocate_dma(virtqueue_t::memory_size(size), phys);
+    if (!memory)
+        return false;
+    queue.init(memory, phys, size);
+
+    if (modern)
+    {
+        mmio_write<uint64_t>(common, COMMON_QUEUE_DESC_RW, queue.desc_phys);
+        mmio_write<uint64_t>(common, COMMON_QUEUE_DRIVER_RW, queue.avail_phys);
+        mmio_write<uint64_t>(common, COMMON_QUEUE_DEVICE_RW, queue.used_phys);
+        uint16_t notify_off = mmio_read<uint16_t>(common, COMMON_QUEUE_NOTIFY_OFF_R);
+        notify[index] = reinterpret_cast<volatile uint16_t*>(notify_base + notify_off * notify_multiplier);
+        mmio_write<uint16_t>(common, COMMON_QUEUE_ENABLE_RW, 1);
+    }
+    else
+    {
+        // Frames are page aligned, which is what the legacy layout needs.
+        x86_cpu_t::outl(io_base + LEGACY_QUEUE_ADDRESS_RW, phys / LEGACY_QUEUE_ALIGN);
+    }
+    return true;
+}
+
+void virtio_net::kick(uint16_t index)
+{
+    ++notifications;
+    if (modern)
+        *notify[index] = index;
+    else
+        x86_cpu_t::outw(io_base + LEGACY_QUEUE_NOTIFY_W, index);
+}
+
+bool virtio_net::init()
+{
+    kconsole << "Initializing virtio-net." << endl;
+
+    // Locally administered address, in case the device does not provide one.
+    uint8_t default_mac[] = { 0xb2, 0xc4, 0x20, 0x00, 0x00, 0x01 };
+    memutils::copy_memory(mac, default_mac, sizeof(mac));
+
+    write_status(0); // reset
+    write_status(STATUS_ACKNOWLEDGE);
+    write_status(STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+    if (!negotiate_features())
+    {
+        kconsole << "WARNING: virtio-net does not offer the features we need." << endl;
+        write_status(STATUS_FAILED);
+        return false;
+    }
+
+    if (!setup_queue(RX_QUEUE, rx) || !setup_queue(TX_QUEUE, tx)
+        || !(pool = reinterpret_cast<uint8_t*>(pci_bus_t::allocate_dma((RX_BUFFERS + TX_BUFFERS) * BUFFER_SIZE, pool_phys, &pool_stretch))))
+    {
+        kconsole << "WARNING: Out of memory for virtio-net queues." << endl;
+        write_status(STATUS_FAILED);
+        return false;
+    }
+
+    // Descriptors stay bound to their buffers: rx descriptor i to buffer i, tx descriptor i to buffer RX_BUFFERS + i.
+    n_rx = rx.queue_size() < RX_BUFFERS ? rx.queue_size() : size_t(RX_BUFFERS);
+    for (size_t i = 0; i < n_rx; ++i)
+    {
+        rx.set_buffer(i, pool_phys + i * BUFFER_SIZE, BUFFER_SIZE, DESC_F_WRITE);
+        rx.post(i);
+    }
+
+    // No offloads are negotiated, so the tx header is all zeroes and is written once.
+    n_tx = tx.queue_size() < TX_BUFFERS ? tx.queue_size() : size_t(TX_BUFFERS);
+    for (size_t i = 0; i < n_tx; ++i)
+    {
+        memutils::clear_memory(buffer(RX_BUFFERS + i), header_size);
+        tx.set_buffer(i, pool_phys + (RX_BUFFERS + i) * BUFFER_SIZE, 0, 0);
+        tx_free[n_tx_free++] = i;
+    }
+    tx.suppress_interrupts(true);
+
+    nucleus::install_irq_handler(irq, &handler);
+
+    write_status(read_status() | STATUS_DRIVER_OK);
+    if (rx.publish())
+        kick(RX_QUEUE);
+
+    kconsole << "Finished initializing virtio-net with MAC " << mac[0] << ":" << mac[1] << ":" << mac[2] << ":" << mac[3] << ":" << mac[4] << ":" << mac[5]
+             << ", " << int32_t(n_rx) << " rx and " << int32_t(n_tx) << " tx buffers." << endl;
+    return true;
+}
+
+void virtio_net::handle_irq()
+{
+    // Reading the ISR status acknowledges the interrupt, the line may be shared so check it is ours.
+    uint8_t status = modern ? *isr : x86_cpu_t::inb(io_base + LEGACY_ISR_STATUS_R);
+    if ((status & ISR_QUEUE) && !polling)
+        rx_poll(n_rx);
+}
+
+void virtio_net::set_polling(bool poll)
+{
+    polling = poll;
+    rx.suppress_interrupts(poll);
+    // Frames which arrived while interrupts were off would not raise one now.
+    if (!poll)
+        rx_poll(n_rx);
+}
+
+size_t virtio_net::rx_poll(size_t budget)
+{
+    size_t received = 0;
+    uint16_t id;
+    uint32_t length;
+
+    while (received < budget && rx.get_used(id, length))
+    {
+        if (rx_handler && length > header_size)
+            rx_handler(rx_context, buffer(id) + header_size, length - header_size);
+        rx.post(id);
+        ++received;
+    }
+
+    if (received)
+    {
+        rx_packets += received;
+        if (rx.publish())
+            kick(RX_QUEUE);
+    }
+    return received;
+}
+
+uint8_t* virtio_net::tx_buffer()
+{
+    if (!n_tx_free)
+        tx_reclaim();
+    if (!n_tx_free)
+        return nullptr;
+    return buffer(RX_BUFFERS + tx_free[--n_tx_free]) + header_size;
+}
+
+void virtio_net::tx_queue(uint8_t* frame, size_t length)
+{
+    uint16_t id = (frame - header_size - pool) / BUFFER_SIZE - RX_BUFFERS;
+    tx.set_length(id, header_size + length);
+    tx.post(id);
+    ++tx_queued;
+}
+
+void virtio_net::tx_flush()
+{
+    if (!tx_queued)
+        return;
+    tx_packets += tx_queued;
+    tx_queued = 0;
+    if (tx.publish())
+        kick(TX_QUEUE);
+}
+
+void virtio_net::tx_reclaim()
+{
+    uint16_t id;
+    uint32_t length;
+    while (tx.get_used(id, length))
+        tx_free[n_tx_free++] = id;
+}
+
+/*
+ * buf must contain properly prepared ethernet frame, without the CRC.
+ */
+bool virtio_net::send_packet(const void* buf, uint16_t length)
+{
+    if (length > BUFFER_SIZE - header_size)
+        return false;
+    uint8_t* frame = tx_buffer();
+    if (!frame)
+        return false;
+    memutils::copy_memory(frame, buf, length);
+    tx_queue(frame, length);
+    tx_flush();
+    return true;
+}
+
+static const pci_device_id_t virtio_net_ids[] = {
+    { VENDOR_ID, DEVICE_ID_NET_LEGACY },
+    { VENDOR_ID, DEVICE_ID_NET_MODERN },
+    { 0, 0 }
+};
+
+static bool virtio_net_probe(pci_device_t* dev)
+{
+    static virtio_net card;
+    if (card.buffers()) // Only one card is driven.
+        return false;
+    if (!card.configure(dev) || !card.init())
+        return false;
+#if VIRTIO_NET_BENCHMARK
+    virtio_net_benchmark(card);
+#endif
+    return true;
+}
+
+const pci_driver_t virtio_net_pci_driver = { "virtio-net", virtio_net_ids, virtio_net_probe };
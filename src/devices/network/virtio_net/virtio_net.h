@@ -0,0 +1,186 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "types.h"
+#include "isr.h"
+#include "card_registers.h"
+#include "stretch_v1_interface.h"
+
+class pci_device_t;
+struct pci_driver_t;
+
+/**
+ * Split virtqueue.
+ *
+ * Every descriptor is bound to one packet buffer when the queue is set up, so making a buffer available is a single
+ * store of its descriptor index into the avail ring. New entries become visible to the device only in publish(),
+ * which lets callers batch any number of buffers per notification.
+ */
+class virtqueue_t
+{
+    virtio_card::desc_t*  desc;
+    virtio_card::avail_t* avail;
+    virtio_card::used_t*  used;
+    uint16_t size;
+    uint16_t avail_idx;  // Next free avail ring entry, device sees avail->idx.
+    uint16_t last_used;  // Next used ring entry to consume.
+
+public:
+    address_t desc_phys, avail_phys, used_phys;
+
+    /** Memory taken by a queue of given size in the legacy layout, which suits the modern interface too. */
+    static size_t memory_size(uint16_t size);
+
+    void init(void* memory, address_t phys, uint16_t size);
+
+    inline uint16_t queue_size() const { return size; }
+
+    inline void set_buffer(uint16_t id, address_t addr, uint32_t len, uint16_t flags)
+    {
+        desc[id].addr = addr;
+        desc[id].len = len;
+        desc[id].flags = flags;
+        desc[id].next = 0;
+    }
+
+    inline void set_length(uint16_t id, uint32_t len) { desc[id].len = len; }
+
+    inline void post(uint16_t id)
+    {
+        avail->ring[avail_idx & (size - 1)] = id;
+        ++avail_idx;
+    }
+
+    /**
+     * Make posted buffers visible to the device.
+     * @return true if the device wants to be notified.
+     */
+    bool publish();
+
+    /**
+     * Take the next buffer the device is done with.
+     * @return false if there is none.
+     */
+    bool get_used(uint16_t& id, uint32_t& len);
+
+    /** Ask the device not to interrupt when it uses buffers of this queue. */
+    void suppress_interrupts(bool suppress);
+};
+
+/**
+ * virtio network device driver for both legacy (I/O port registers) and modern (memory mapped registers found
+ * through PCI capabilities) devices.
+ *
+ * Packet buffers come from a pool in a stretch of their own, the first RX_BUFFERS are always posted to the
+ * receive queue, the rest are taken for transmission. Frames are handed out in place: rx handlers get a pointer
+ * into the pool and tx callers fill a buffer returned by tx_buffer(), nothing is copied.
+ */
+class virtio_net
+{
+public:
+    enum { BUFFER_SIZE = 2048, RX_BUFFERS = 128, TX_BUFFERS = 128, MAX_QUEUE_SIZE = 256 };
+
+    /** Called for every received frame, the frame is only valid until the handler returns. */
+    typedef void (*rx_handler_t)(void* context, const uint8_t* frame, size_t length);
+
+private:
+    bool modern;
+    uint16_t io_base;                 // Legacy registers.
+    volatile uint8_t* common;         // Modern common configuration.
+    volatile uint8_t* isr;            // Modern ISR status.
+    volatile uint8_t* device_config;  // Modern device specific configuration.
+    volatile uint8_t* notify_base;
+    uint32_t notify_multiplier;
+    volatile uint16_t* notify[2];
+    uint16_t irq;
+
+    size_t header_size;
+    virtqueue_t rx, tx;
+
+    uint8_t* pool;
+    address_t pool_phys;
+    stretch_v1::closure_t* pool_stretch;
+
+    size_t n_rx, n_tx;   // Buffers in use, fewer than configured if the device has short queues.
+    uint16_t tx_free[TX_BUFFERS];
+    size_t n_tx_free;
+    size_t tx_queued;    // Posted but not yet published.
+
+    bool polling;
+    rx_handler_t rx_handler;
+    void* rx_context;
+
+    class irq_handler : public interrupt_service_routine_t
+    {
+        virtio_net* parent;
+    public:
+        irq_handler(virtio_net* p) : parent(p) {}
+        virtual void run(registers_t*);
+    };
+
+    irq_handler handler;
+
+    uint8_t read_status();
+    void write_status(uint8_t status);
+    volatile uint8_t* map_capability(pci_device_t* card, uint8_t cap);
+    bool find_capabilities(pci_device_t* card);
+    bool negotiate_features();
+    bool setup_queue(uint16_t index, virtqueue_t& queue);
+    void kick(uint16_t index);
+
+    inline uint8_t* buffer(size_t index) { return pool + index * BUFFER_SIZE; }
+
+public:
+    uint8_t mac[6];
+    uint64_t rx_packets, tx_packets, notifications;
+
+    virtio_net() : modern(false), io_base(0), common(0), isr(0), device_config(0), notify_base(0),
+        notify_multiplier(0), irq(0), header_size(0), pool(0), pool_phys(0), pool_stretch(0), n_rx(0), n_tx(0),
+        n_tx_free(0), tx_queued(0), polling(false), rx_handler(0), rx_context(0), handler(this),
+        rx_packets(0), tx_packets(0), notifications(0) {}
+
+    bool configure(pci_device_t* card);
+    bool init();
+    void handle_irq();
+
+    /** Stretch holding the packet buffers, to be shared with a network stack domain. */
+    inline stretch_v1::closure_t* buffers() { return pool_stretch; }
+
+    /**
+     * In polling mode the device does not interrupt on received packets, the owner calls rx_poll() instead.
+     * Transmit completions never interrupt, buffers are reclaimed when tx_buffer() runs out of them.
+     */
+    void set_polling(bool poll);
+    inline void set_rx_handler(rx_handler_t h, void* context) { rx_handler = h; rx_context = context; }
+
+    /**
+     * Pass up to budget received frames to the rx handler and repost their buffers with one notification.
+     * @return number of frames received.
+     */
+    size_t rx_poll(size_t budget);
+
+    /** Frame buffer to fill for transmission, nullptr if all are in flight. */
+    uint8_t* tx_buffer();
+    /** Queue a frame filled in a tx_buffer(), it is not sent until tx_flush(). */
+    void tx_queue(uint8_t* frame, size_t length);
+    /** Hand queued frames to the device, with one notification for all of them. */
+    void tx_flush();
+    /** Take back buffers of frames the device has sent. */
+    void tx_reclaim();
+    /** Number of tx buffers not in flight. */
+    inline size_t tx_available() { return n_tx_free; }
+    /** True when the device has sent every queued frame and its buffers were reclaimed. */
+    inline bool tx_idle() { return n_tx_free == n_tx; }
+
+    /** Copy a frame into a tx buffer and send it right away. */
+    bool send_packet(const void* buf, uint16_t length);
+};
+
+extern const pci_driver_t virtio_net_pci_driver;
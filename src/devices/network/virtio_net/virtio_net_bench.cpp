@@ -0,0 +1,131 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// virtio-net polling mode benchmark: transmit rate of minimum and full sized frames, sent one per notification
+// and in batches, then the receive rate over one second.
+//
+// Receiving needs a traffic source on the host side, e.g. qemu -netdev tap with a packet generator on the tap
+// interface. With user mode networking almost nothing arrives and the receive numbers are meaningless.
+//
+#include "virtio_net.h"
+#include "default_console.h"
+#include "memutils.h"
+#include "cpu.h"
+
+static const uint32_t TX_FRAMES = 20000;
+static const size_t frame_sizes[] = { 60, 1514 };
+static const size_t batch_sizes[] = { 1, 32 };
+static const uint32_t RX_SECONDS = 1;
+static const uint16_t ETHERTYPE_EXPERIMENTAL = 0x88b5;
+
+/**
+ * TSC ticks per millisecond, counted over 10ms of PIT channel 2.
+ */
+static uint64_t tsc_per_ms()
+{
+    const uint16_t PIT_TICKS = 11932; // 10ms of the 1.193182MHz input clock.
+
+    // Gate channel 2 on, speaker off, then count down once in mode 0.
+    x86_cpu_t::outb(0x61, (x86_cpu_t::inb(0x61) & ~0x02) | 0x01);
+    x86_cpu_t::outb(0x43, 0xb0);
+    x86_cpu_t::outb(0x42, PIT_TICKS & 0xff);
+    x86_cpu_t::outb(0x42, PIT_TICKS >> 8);
+
+    uint64_t start = x86_cpu_t::read_tsc();
+    while (!(x86_cpu_t::inb(0x61) & 0x20)) {}
+    return (x86_cpu_t::read_tsc() - start) / 10;
+}
+
+static void report(const char* what, uint64_t frames, uint64_t bytes, uint64_t cycles, uint64_t cycles_per_ms, uint64_t notifications)
+{
+    uint64_t us = cycles * 1000 / cycles_per_ms;
+    if (!us)
+        us = 1;
+    uint64_t mbps = bytes * 8 / us;
+    int32_t fraction = mbps % 1000;
+
+    kconsole << what << ": " << int32_t(frames * 1000000 / us) << " pps, " << int32_t(mbps / 1000) << "."
+             << (fraction < 100 ? "0" : "") << (fraction < 10 ? "0" : "") << fraction << " Gbit/s, "
+             << int32_t(notifications) << " notifications" << endl;
+}
+
+static void fill_header(uint8_t* frame, const uint8_t* mac)
+{
+    memutils::fill_memory(frame, 0xff, 6);
+    memutils::copy_memory(frame + 6, mac, 6);
+    frame[12] = ETHERTYPE_EXPERIMENTAL >> 8;
+    frame[13] = ETHERTYPE_EXPERIMENTAL & 0xff;
+}
+
+static void count_frame(void* context, const uint8_t*, size_t length)
+{
+    *reinterpret_cast<uint64_t*>(context) += length;
+}
+
+void virtio_net_benchmark(virtio_net& card)
+{
+    kconsole << "=================================" << endl
+             << "      virtio-net benchmark"        << endl
+             << "=================================" << endl;
+
+    uint64_t cycles_per_ms = tsc_per_ms();
+    kconsole << "TSC runs at " << int32_t(cycles_per_ms / 1000) << " MHz" << endl;
+
+    card.set_polling(true);
+
+    for (auto size : frame_sizes)
+    {
+        for (auto batch : batch_sizes)
+        {
+            uint64_t notifications = card.notifications;
+            uint32_t sent = 0;
+            size_t queued = 0;
+
+            uint64_t start = x86_cpu_t::read_tsc();
+            while (sent < TX_FRAMES)
+            {
+                uint8_t* frame = card.tx_buffer();
+                if (!frame)
+                {
+                    // Everything is in flight, let the device have the partial batch too.
+                    card.tx_flush();
+                    queued = 0;
+                    continue;
+                }
+                fill_header(frame, card.mac);
+                card.tx_queue(frame, size);
+                ++sent;
+                if (++queued == batch)
+                {
+                    card.tx_flush();
+                    queued = 0;
+                }
+            }
+            card.tx_flush();
+            while (!card.tx_idle())
+                card.tx_reclaim();
+            uint64_t cycles = x86_cpu_t::read_tsc() - start;
+
+            kconsole << "tx " << int32_t(size) << " bytes, batch " << int32_t(batch);
+            report("", TX_FRAMES, uint64_t(TX_FRAMES) * size, cycles, cycles_per_ms, card.notifications - notifications);
+        }
+    }
+
+    uint64_t rx_bytes = 0;
+    card.set_rx_handler(count_frame, &rx_bytes);
+    uint64_t rx_frames = card.rx_packets;
+    uint64_t notifications = card.notifications;
+    uint64_t start = x86_cpu_t::read_tsc();
+    uint64_t cycles;
+    while ((cycles = x86_cpu_t::read_tsc() - start) < RX_SECONDS * 1000 * cycles_per_ms)
+        card.rx_poll(32);
+    report("rx", card.rx_packets - rx_frames, rx_bytes, cycles, cycles_per_ms, card.notifications - notifications);
+
+    card.set_rx_handler(nullptr, nullptr);
+    card.set_polling(false);
+}
@@ -0,0 +1,93 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "interface_v1_state.h"
+
+/**
+ * FNV-1a hash of the first n characters of an interface name, seed selects one of a family of hashes.
+ * meddler -registry computes the same hash, keep them in sync.
+ */
+constexpr uint32_t interface_name_hash_step(const char* s, size_t n, uint32_t hash)
+{
+    return n ? interface_name_hash_step(s + 1, n - 1, (hash ^ uint8_t(*s)) * 16777619u) : hash;
+}
+
+constexpr uint32_t interface_name_hash(const char* s, size_t n, uint32_t seed = 0)
+{
+    return interface_name_hash_step(s, n, 2166136261u ^ (seed * 2654435761u));
+}
+
+/**
+ * All interfaces of the interface repository, generated by meddler -registry into interface_registry.cpp.
+ *
+ * Entries are sorted by type code. Names are looked up with a minimal perfect hash: the plain name hash selects
+ * a bucket, the bucket's seed selects a hash which maps every name in the repository to a different slot.
+ */
+struct interface_registry_t
+{
+    struct entry_t
+    {
+        types::code             code;
+        uint32_t                name_hash; // interface_name_hash() of the name with seed 0.
+        interface_v1::state_t*  rep;
+    };
+
+    size_t          count;
+    const entry_t*  entries;
+    size_t          buckets;
+    const uint16_t* seeds;   // One per bucket.
+    const uint16_t* slots;   // Entry index for each of count slots.
+
+    /**
+     * Index of the only entry which may have this name.
+     */
+    constexpr size_t slot(const char* name, size_t n) const
+    {
+        return slots[interface_name_hash(name, n, seeds[interface_name_hash(name, n) % buckets]) % count];
+    }
+
+    static constexpr bool sorted(const entry_t* e, size_t n)
+    {
+        return n < 2 || (e[0].code < e[1].code && sorted(e + 1, n - 1));
+    }
+
+    inline interface_v1::state_t* find(types::code code) const
+    {
+        size_t lo = 0, hi = count;
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (entries[mid].code < code)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo < count && entries[lo].code == code ? entries[lo].rep : nullptr;
+    }
+
+    /**
+     * Find interface by the first n characters of name, which need not be NUL terminated.
+     */
+    inline interface_v1::state_t* find(const char* name, size_t n) const
+    {
+        if (!count)
+            return nullptr;
+        const entry_t& e = entries[slot(name, n)];
+        if (e.name_hash != interface_name_hash(name, n))
+            return nullptr;
+        const char* rep_name = e.rep->rep.name;
+        for (size_t i = 0; i < n; ++i)
+            if (rep_name[i] != name[i])
+                return nullptr;
+        return rep_name[n] == 0 ? e.rep : nullptr;
+    }
+};
+
+extern const interface_registry_t interface_registry;
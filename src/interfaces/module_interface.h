@@ -35,3 +35,17 @@ void closure_init(C* closure, O* ops, S* state)
 #define EXPORT_CLOSURE_TO_ROOTDOM(_name, _version, _cl) \
 extern "C" const _name##_##_version::closure_t* const exported_##_name##_rootdom = &_cl; \
 extern "C" const any exported_##_name##_any = { _name##_##_version::type_code, { .ptr32value = &_cl } }
+
+/**
+ * Identity of an exception declared in an interface, meddler emits one per exception, e.g. heap_v1::no_memory_id.
+ * Raising and catching by these compares pointers, or type codes for copies linked into different modules,
+ * instead of names. The marker byte tells an id apart from an exception name string, which is never empty.
+ */
+struct exception_id_t
+{
+    enum { MARKER = 0 };
+
+    char        marker;
+    uint64_t    code; // Type code of the interface plus the exception number.
+    const char* name; // "interface.exception"
+};
@@ -44,6 +44,7 @@ enum bootrec_tag_e
     bootrec_virtual_mapping, // initial virtual-to-physical mapping
     bootrec_command_line,    // command line info
     bootrec_device_tree,
+    bootrec_pci_ecam,        // PCI Express memory mapped configuration space
     end
 };
 
@@ -85,6 +86,15 @@ public:
     char* cmdline;
 };
 
+// Identity mapped ECAM window of PCI segment 0, see pci_ecam_prepare().
+class bootrec_pci_ecam_t : public bootrec_t
+{
+public:
+    uint64_t base;      // MCFG base address, where bus 0 configuration space would be
+    uint8_t  start_bus;
+    uint8_t  end_bus;
+};
+
 union bootrec_info_t
 {
     bootrec_t*            rec;
@@ -92,6 +102,7 @@ union bootrec_info_t
     bootrec_mmap_entry_t* memmap;
     bootrec_vmap_entry_t* vmemmap;
     bootrec_cmdline_t*    cmdline;
+    bootrec_pci_ecam_t*   pci_ecam;
     char*                 generic;
 };
 
@@ -244,6 +255,24 @@ bool bootinfo_t::get_cmdline(const char*& cmdline)
     return false;
 }
 
+bool bootinfo_t::get_pci_ecam(address_t& base, uint8_t& start_bus, uint8_t& end_bus)
+{
+    bootrec_info_t info;
+    info.generic = reinterpret_cast<char*>(this + 1);
+    while (info.generic < free)
+    {
+        if (info.rec->tag == bootrec_pci_ecam)
+        {
+            base = info.pci_ecam->base;
+            start_bus = info.pci_ecam->start_bus;
+            end_bus = info.pci_ecam->end_bus;
+            return true;
+        }
+        info.generic += info.rec->size;
+    }
+    return false;
+}
+
 bootinfo_t::mmap_iterator bootinfo_t::mmap_begin()
 {
     bootrec_info_t info;
@@ -382,6 +411,25 @@ bool bootinfo_t::append_cmdline(const char* cmdline)
     return true;
 }
 
+bool bootinfo_t::append_pci_ecam(address_t base, uint8_t start_bus, uint8_t end_bus)
+{
+    size_t size = sizeof(bootrec_pci_ecam_t);
+
+    if (will_overflow(size))
+        return false;
+
+    bootrec_pci_ecam_t* ecam = new(free) bootrec_pci_ecam_t;
+    ecam->tag = bootrec_pci_ecam;
+    ecam->size = size;
+
+    ecam->base = base;
+    ecam->start_bus = start_bus;
+    ecam->end_bus = end_bus;
+
+    free += size;
+    return true;
+}
+
 address_t bootinfo_t::find_usable_physical_memory_top()
 {
     address_t top = 0;
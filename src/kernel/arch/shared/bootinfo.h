@@ -160,6 +160,7 @@ public:
     // Load module by name.
 //     bool get_module(const char* name, module_info_t& mod);
     bool get_cmdline(const char*& cmdline);
+    bool get_pci_ecam(address_t& base, uint8_t& start_bus, uint8_t& end_bus);
 
     mmap_iterator mmap_begin();
     mmap_iterator mmap_end();
@@ -175,6 +176,7 @@ public:
     bool append_mmap(multiboot_t::mmap_entry_t* entry);
     bool append_vmap(address_t vstart, address_t pstart, size_t size);
     bool append_cmdline(const char* cmdline);
+    bool append_pci_ecam(address_t base, uint8_t start_bus, uint8_t end_bus);
 
     address_t find_usable_physical_memory_top();
     address_t find_highmem_range_of_at_least(size_t bytes);
@@ -11,13 +11,14 @@
 #include "types.h"
 #include "pervasives_v1_interface.h"
 #include "infopage.h"
+#include "fpu.h"
 
 // continuation (it records the state of the running computation at the point where it takes off).
 class continuation_t
 {
     // continuation flags
     static const int F_CPU_VALID = 1; // CPU context is valid.
-    static const int F_FPU_VALID = 2; // FPU context is valid.
+    // 2 was F_FPU_VALID, now tracked by fpu_state_t::valid.
     static const int F_PERV_VALID = 4; // Pervasives pointer is valid.
 
 public:
@@ -45,15 +46,13 @@ private:
     pervasives_v1::rec* pervasives;
     uint32_t flags;
     uint32_t cs, ds;
-    uint32_t fpregs[27]; // FPU registers
-    uint32_t pad[23]; // use it for e.g. some words on stack too?
+    fpu_state_t fpu; // Saved lazily by the #NM handler when another context takes over the FPU.
 };
 
 extern "C" void asm_activate(continuation_t::gpregs_t* gpregs, uint32_t cs, uint32_t ds);
 
 // A privileged method to activate (throw) a continuation.
-// Ideally, the FPU stuff should be initialiazed only if process hits FPU exception by using FPU commands after
-// activation. Saves some switch time.
+// FPU registers are not restored here, the context gets them on its first FPU instruction via #NM trap.
 void continuation_t::activate()
 {
     // restore pervasives pointer
@@ -61,11 +60,8 @@ void continuation_t::activate()
     {
         INFO_PAGE.pervasives = pervasives;
     }
-    // restore FPU registers
-    if (flags & F_FPU_VALID)
-    {
-        asm volatile ("frstor %0" :: "m"(*fpregs));
-    }
+    // hand over FPU lazily
+    x86_fpu_t::switch_to(&fpu);
     // restore CPU registers
     // set cs:ds:es, flags and stack pointer
     // iret
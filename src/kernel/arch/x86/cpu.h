@@ -12,6 +12,7 @@
 #include "macros.h"
 #include "cpu_flags.h"
 #include "cpu_information.h"
+#include "infopage.h"
 #include "ia32.h"
 
 /**
@@ -31,6 +32,17 @@ public:
         asm volatile ("movl %0, %%cr0\n" :: "r"(dummy));
     }
 
+    /**
+     * Clear a flag in CR0.
+     */
+    static inline void cr0_clear_flag(uint32_t flag) ALWAYS_INLINE
+    {
+        uint32_t dummy;
+        asm volatile ("movl %%cr0, %0\n" : "=r"(dummy));
+        dummy &= ~flag;
+        asm volatile ("movl %0, %%cr0\n" :: "r"(dummy));
+    }
+
     /**
      * Set a flag in CR4.
      */
@@ -67,6 +79,14 @@ public:
         asm volatile ("outl %0, %1" :: "a" (value), "dN" (port));
     }
 
+    /**
+     * Write @c count bytes from @c data out to the specified port with a single string instruction.
+     */
+    static inline void outsb(uint16_t port, const void* data, size_t count) ALWAYS_INLINE
+    {
+        asm volatile ("cld; rep outsb" : "+S" (data), "+c" (count) : "d" (port) : "memory");
+    }
+
     /**
      * Read a byte in from the specified port.
      */
@@ -142,9 +162,10 @@ public:
     }
 
     //! id of current processor.
-    static inline cpu_id_t id() { return 0; }
+    static inline cpu_id_t id() { return INFO_PAGE.cpu.id; }
 
-    static inline cpu_information_t& current_cpu() { return cpu_information; }
+    //! Per-CPU data of current processor, kept in its information page.
+    static inline cpu_information_t& current_cpu() { return INFO_PAGE.cpu; }
 
     static inline bool has_cpuid()
     {
@@ -194,7 +215,18 @@ public:
                       : "a" (func));
     }
 
-    /* Clear TS bit so we don't trap on FPU instructions. */
+    /**
+     * CPUID for leaves with subleaves in ECX.
+     */
+    static inline void cpuid_count(uint32_t func, uint32_t subfunc, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) ALWAYS_INLINE
+    {
+        asm volatile ("cpuid"
+                      : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                      : "a" (func), "c" (subfunc));
+    }
+
+
+    /* Clear TS bit so we don't trap on FPU instructions. Lazy FPU switching is in fpu.h */
     static inline void enable_fpu() ALWAYS_INLINE
     {
         asm volatile ("fninit");
@@ -228,6 +260,19 @@ public:
         cr4_set_flag(IA32_CR4_PCE); /* enable read from user land */
     }
 
-private:
-    static cpu_information_t cpu_information;
+    /**
+     * Relax inside a spin-wait loop.
+     */
+    static inline void pause() ALWAYS_INLINE
+    {
+        asm volatile ("pause" ::: "memory");
+    }
+
+    /**
+     * Stop until next interrupt.
+     */
+    static inline void halt() ALWAYS_INLINE
+    {
+        asm volatile ("hlt");
+    }
 };
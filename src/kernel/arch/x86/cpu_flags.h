@@ -44,7 +44,10 @@
 #define X86_32_FEAT_PBE    (1 << 31)
 
 /* CPUID.1 ECX */
-#define X86_32_FEAT2_VMX   (1 << 5)
+#define X86_32_FEAT2_VMX     (1 << 5)
+#define X86_32_FEAT2_XSAVE   (1 << 26)
+#define X86_32_FEAT2_OSXSAVE (1 << 27)
+#define X86_32_FEAT2_AVX     (1 << 28)
 
 /**********************************************************************
  *    FLAGS register
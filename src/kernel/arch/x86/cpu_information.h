@@ -9,11 +9,65 @@
 #pragma once
 
 #include "types.h"
+#include "lockable.h"
+#include "domain.h"
 // #include "protection_domain.h"
 
 typedef address_t cpu_id_t;
 typedef uint8_t  apic_id_t;
 
+struct fpu_state_t; // fpu.h
+
+/**
+ * Queue of domains runnable on a particular CPU.
+ *
+ * Domains are linked through dcb_ro_t::run_queue_link, so a domain can sit on at most one run queue at a time.
+ * Other CPUs may push to the queue (cross-CPU wakeup), hence the spinlock.
+ */
+class run_queue_t
+{
+public:
+    inline void init()
+    {
+        head.init();
+        length = 0;
+    }
+
+    inline void enqueue(dcb_ro_t* dcb)
+    {
+        lockable_scope_lock_t guard(lock);
+        dcb->run_queue_link.init(dcb);
+        head.add_to_tail(dcb->run_queue_link);
+        ++length;
+    }
+
+    /**
+     * @returns next runnable domain or nullptr if the queue is empty.
+     */
+    inline dcb_ro_t* dequeue()
+    {
+        lockable_scope_lock_t guard(lock);
+        dl_link_t<dcb_ro_t>* link = head.next();
+        if (!link)
+            return nullptr;
+        link->remove();
+        link->init(*link);
+        --length;
+        return *link;
+    }
+
+    inline bool is_empty() const { return length == 0; }
+
+private:
+    lockable_t lock;
+    dl_link_t<dcb_ro_t> head;
+    volatile size_t length;
+};
+
+/**
+ * Per-CPU data. Lives in the CPU's own information page, so it is never constructed,
+ * the launcher calls init() for every CPU it brings up.
+ */
 class cpu_information_t
 {
 public:
@@ -25,14 +79,40 @@ public:
 //             return protection_domain_t::privileged();
 //     }
 
-    cpu_information_t(cpu_id_t cpu_id) : id(cpu_id)/*, protection_domain(&protection_domain_t::privileged())*/ {}
+    inline void init(cpu_id_t cpu_id, apic_id_t apic)
+    {
+        id = cpu_id;
+        apic_id = apic;
+        online = false;
+        wakeups = 0;
+        tlb_shootdowns = 0;
+        fpu_mode = 0;
+        fpu_xcr0 = 0;
+        fpu_owner = fpu_context = nullptr;
+        fpu_traps = fpu_saves = 0;
+        run_queue.init();
+//         protection_domain = &protection_domain_t::privileged();
+    }
+
+    cpu_id_t id;
+    apic_id_t apic_id;
+    volatile bool online;        //!< Set by the CPU itself once it runs with its own GDT and IDT.
+    volatile uint32_t wakeups;   //!< Wakeup IPIs received.
+    volatile uint32_t tlb_shootdowns; //!< TLB shootdown IPIs serviced.
+    run_queue_t run_queue;
+
+    // Lazy FPU switching state, see fpu.h
+    uint32_t fpu_mode;              //!< x86_fpu_t::mode_e
+    uint64_t fpu_xcr0;              //!< XSAVE components enabled.
+    fpu_state_t* fpu_owner;         //!< Whose state is in the FPU registers now.
+    fpu_state_t* fpu_context;       //!< State of the running context.
+    uint32_t fpu_traps;             //!< #NM traps taken.
+    uint32_t fpu_saves;             //!< FPU state saves, traps - saves = traps where the owner came back.
 
 private:
     cpu_information_t();
     cpu_information_t(const cpu_information_t&);
     cpu_information_t& operator =(const cpu_information_t&);
 
-private:
-    cpu_id_t id;
 //     protection_domain_t* protection_domain;
 };
@@ -10,6 +10,9 @@
 #include "logger.h"
 #include "default_console.h"
 #include "registers.h"
+#include "memory.h"
+#include "trace_buffer.h"
+#include "mmu.h"
 
 namespace logger {
 
@@ -129,6 +132,61 @@ void debugger_t::print_backtrace(address_t base_pointer, address_t eip, int n)
     }
 }
 
+void debugger_t::print_stack_snapshot(address_t esp, address_t eip, address_t ebp, size_t words, address_t stack_top)
+{
+    if (stack_top == 0)
+    {
+        // Stacks span several pages, keep going while the following page is mapped.
+        stack_top = page_align_down(esp) + PAGE_SIZE;
+        while (stack_top != 0 && (stack_top - esp) / sizeof(address_t) < words && ia32_mmu_t::is_mapped(stack_top))
+            stack_top += PAGE_SIZE;
+    }
+    if (stack_top > esp && words > (stack_top - esp) / sizeof(address_t))
+        words = (stack_top - esp) / sizeof(address_t);
+    if (stack_top <= esp)
+        words = 0;
+
+    kconsole << GREEN << "*** Stack snapshot *** eip " << (uint32_t)eip << " esp " << (uint32_t)esp
+             << " ebp " << (uint32_t)ebp << endl;
+    address_t* p = reinterpret_cast<address_t*>(esp);
+    for (size_t i = 0; i < words; ++i)
+    {
+        if (i % 8 == 0)
+            kconsole << "@ " << (uint32_t)(esp + i * sizeof(address_t));
+        kconsole << " " << (uint32_t)p[i];
+        if (i % 8 == 7 || i + 1 == words)
+            kconsole << endl;
+    }
+    kconsole << "*** End of snapshot ***" << endl;
+}
+
+void debugger_t::print_trace(uint32_t cpu, size_t records)
+{
+    trace_buffer_t* buffer = trace_buffer_t::for_cpu(cpu);
+    if (buffer->magic != trace_buffer_t::MAGIC)
+        return;
+
+    uint32_t head = buffer->head;
+    size_t kept = head < trace_buffer_t::RECORDS ? head : trace_buffer_t::RECORDS;
+    if (records == 0 || records > kept)
+        records = kept;
+
+    kconsole << GREEN << "*** Trace buffer *** cpu " << cpu << " head " << head << endl;
+    for (uint32_t seq = head - records; seq != head; ++seq)
+    {
+        const trace_record_t& r = buffer->records[seq % trace_buffer_t::RECORDS];
+        // Records still being written by an interrupted trace point are skipped.
+        if (r.sequence != seq + 1)
+            continue;
+        kconsole << "T " << r.sequence << " " << r.format << " " << uint32_t(r.timestamp >> 32) << " "
+                 << uint32_t(r.timestamp);
+        for (int i = 0; i < trace_record_t::ARGS; ++i)
+            kconsole << " " << r.args[i];
+        kconsole << endl;
+    }
+    kconsole << "*** End of trace ***" << endl;
+}
+
 void debugger_t::print_stacktrace(unsigned int n)
 {
     address_t esp = read_stack_pointer();
@@ -40,6 +40,21 @@ public:
      */
     static void print_backtrace(address_t base_pointer = 0, address_t eip = 0, int n = 0);
 
+    /**
+     * Print a compact copy of the stack for offline unwinding with call frame information, which works without
+     * frame pointers. Prints @c eip, @c esp and @c ebp followed by up to @c words stack words from @c esp, eight per
+     * line. Without @c stack_top the copy stops at the first unmapped page after @c esp, so it cannot fault.
+     * Decode with "parsedwarf batch".
+     */
+    static void print_stack_snapshot(address_t esp, address_t eip, address_t ebp, size_t words = 256,
+                                     address_t stack_top = 0);
+
+    /**
+     * Print the last @c records records of trace buffer of CPU @c cpu as raw words, all kept records if @c records
+     * is 0. Decode with tracedump.
+     */
+    static void print_trace(uint32_t cpu, size_t records = 0);
+
     /**
      * Prints first @c n words from the stack
      */
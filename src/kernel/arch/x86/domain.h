@@ -64,6 +64,7 @@ struct dcb_ro_t
     uint32_t max_phys_frame_count;
     ramtab_entry_t* ramtab;
     region_list_t memory_region_list;
+    dl_link_t<dcb_ro_t> run_queue_link; /* Link in the owning CPU's run queue */
 };
 
 /**
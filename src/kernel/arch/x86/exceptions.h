@@ -9,11 +9,14 @@
 /**
  * Metta exceptions support. Quite primitive for now. Mostly borrowed from Nemesis.
  *
- * C++ exceptions must be disabled in the kernel and modules for this to work reliably.
+ * With CONFIG_EXCEPTIONS_UNWIND disabled every OS_TRY pushes a context with a setjmp buffer and C++ exceptions
+ * must be disabled in the kernel and modules for this to work reliably. With it enabled OS_TRY is a C++ try block,
+ * raise unwinds the stack using the DWARF unwind tables of the loaded modules and entering a TRY block costs nothing.
  */
 #pragma once
 
 #include <algorithm> // for std::min
+#include "config.h"
 #include "setjmp.h"
 #include "infopage.h"
 #include "registers.h"
@@ -42,6 +45,9 @@ enum xcp_state_t
  * OS_TRY clause.  These context blocks are linked to form a stack of
  * all current OS_TRY blocks in the current thread.  Each context block
  * contains a jump buffer for use by setjmp and longjmp.  
+ *
+ * The unwinding exception system uses only the state and the exception
+ * record fields, a copy of the record is what is thrown.
  */
 struct xcp_context_t
 {
@@ -49,7 +55,7 @@ struct xcp_context_t
 	xcp_context_t *up;       // Link up to the next context block in stack.
 	xcp_context_t *down;     // Link down to the previous context block in stack (zero at the bottom).
 	xcp_state_t    state;    // State of handling for this OS_TRY.
-	const char*    name;     // Name of the current exception.
+	exception_support_v1::id id; // Current exception, an exception_id_t or a name string.
 	address_t      args;     // Exception arguments record address
 	const char*    filename; // Which file raised it
 	const char*    funcname; // Which function raised it
@@ -64,25 +70,139 @@ struct xcp_context_t
 #define xcp_longjmp(buf, j)    (__sjljeh_longjmp(buf, j))
 
 /**
- * Define "routine" to determine if two exceptions match.
+ * Exceptions are raised and caught either by the exception_id_t meddler emits for every exception declared in an
+ * interface, e.g. heap_v1::no_memory_id, or by name, e.g. "heap_v1.no_memory". Names remain for older code and
+ * for exceptions coming over IDC, which carries only the name.
+ */
+inline exception_support_v1::id xcp_id(const exception_id_t& e) { return exception_support_v1::id(&e); }
+inline exception_support_v1::id xcp_id(const char* name) { return exception_support_v1::id(name); }
+inline exception_support_v1::id xcp_id(exception_support_v1::id i) { return i; }
+
+inline const exception_id_t* xcp_as_id(exception_support_v1::id i)
+{
+    const exception_id_t* e = reinterpret_cast<const exception_id_t*>(i);
+    return e->marker == exception_id_t::MARKER ? e : nullptr;
+}
+
+inline const char* xcp_name(exception_support_v1::id i)
+{
+    const exception_id_t* e = xcp_as_id(i);
+    return e ? e->name : reinterpret_cast<const char*>(i);
+}
+
+/**
+ * Determine if two exceptions match.
  *
- * Effectively just strcmp(), but can't use the stack (at least, not much).
- */
-#define xcp_matches(e1,e2) \
-({						\
-    const char *s=e1, *d=e2;				\
-    while(*s == *d && *s != 0 && *d != 0)	\
-    {						\
-	s++;					\
-	d++;					\
-    }						\
-    (*s == 0 && *d == 0)? 1 : 0;		\
-})
+ * Same id or the same id linked into another module, names are compared only if either side is a name.
+ * Can't use the stack (at least, not much).
+ */
+inline bool xcp_matches(exception_support_v1::id e1, exception_support_v1::id e2)
+{
+    if (e1 == e2)
+        return true;
+
+    const exception_id_t* i1 = xcp_as_id(e1);
+    const exception_id_t* i2 = xcp_as_id(e2);
+    if (i1 && i2)
+        return i1->code == i2->code;
+
+    const char *s = i1 ? i1->name : reinterpret_cast<const char*>(e1);
+    const char *d = i2 ? i2->name : reinterpret_cast<const char*>(e2);
+    while (*s == *d && *s != 0)
+    {
+        s++;
+        d++;
+    }
+    return *s == *d;
+}
 
 // Exception handling macros.
 // Use these when writing server code.
-#define OS_RAISE(e, args) PVS(exceptions)->raise(e, args, __FILE__, __LINE__, __FUNCTION__)
-#define OS_RERAISE        PVS(exceptions)->raise(__xcp_ctx.name, __xcp_ctx.args, __FILE__, __LINE__, __FUNCTION__)
+#define OS_RAISE(e, args) PVS(exceptions)->raise(xcp_id(e), args, __FILE__, __LINE__, __FUNCTION__)
+#define OS_RERAISE        PVS(exceptions)->raise(__xcp_ctx.id, __xcp_ctx.args, __FILE__, __LINE__, __FUNCTION__)
+
+#if CONFIG_EXCEPTIONS_UNWIND
+
+/**
+ * Take the exception caught by the C++ catch clause of an OS_TRY block.
+ *
+ * Returns true if the exception was raised from the guarded code, then handler clauses must be tried. If it was
+ * raised by a handler or the FINALLY clause it replaces the one being handled and is propagated after ENDTRY.
+ */
+inline bool xcp_catch(xcp_context_t& ctx, xcp_context_t& raised)
+{
+    bool guarded = ctx.state == xcp_none;
+    ctx.state    = xcp_active;
+    ctx.id       = raised.id;
+    ctx.args     = raised.args;
+    ctx.filename = raised.filename;
+    ctx.funcname = raised.funcname;
+    ctx.line     = raised.line;
+    asm volatile("" ::: "memory");
+    raised.state = xcp_popped; // The exception system may free it now.
+    return guarded;
+}
+
+/**
+ * Start a new TRY block.
+ *
+ *   Only the state of the exception is kept on the stack, nothing is pushed. The guarded statements, the handlers
+ *   and the FINALLY clause are all inside one C++ try block, which catches the exception record thrown by raise.
+ *   Handlers are entered by jumping back to the start of the try block with the state set to "active", jumps out of
+ *   a handler are allowed while jumps into a try block are not.
+ */
+#define OS_TRY \
+	{ \
+		__label__ __xcp_dispatch; \
+		xcp_context_t __xcp_ctx; \
+		__xcp_ctx.state = xcp_none; \
+	__xcp_dispatch: \
+		try { \
+			if (__xcp_ctx.state == xcp_none) \
+			{
+				/* user's code goes here */
+
+/**
+ * Define a CATCH(e) clause, entered if the raised exception matches e.
+ */
+#define OS_CATCH(e) \
+			} \
+			else if (__xcp_ctx.state == xcp_active && xcp_matches(__xcp_ctx.id, xcp_id(e))) { \
+				__xcp_ctx.state = xcp_handled;
+				/* user's code goes here */
+
+/**
+ * Define a CATCH_ALL clause, entered for any exception not handled by the previous clauses.
+ */
+#define OS_CATCH_ALL \
+			} \
+			else if (__xcp_ctx.state == xcp_active) { \
+				__xcp_ctx.state = xcp_handled;
+				/* user's code goes here */
+
+/**
+ * Define a FINALLY clause, entered both after the guarded statements and after an exception was not handled.
+ */
+#define OS_FINALLY \
+			} \
+			{
+				/* user's code goes here */
+
+/**
+ * End the whole TRY clause, propagating the exception if it was not handled.
+ */
+#define OS_ENDTRY \
+			} \
+		} \
+		catch (xcp_context_t& __xcp_raised) { \
+			if (xcp_catch(__xcp_ctx, __xcp_raised)) \
+				goto __xcp_dispatch; \
+		} \
+		if (__xcp_ctx.state == xcp_active) \
+			OS_RERAISE; \
+	}
+
+#else // CONFIG_EXCEPTIONS_UNWIND
 
 /**
  * Start a new TRY block, which may contain exception handlers
@@ -116,7 +236,7 @@ struct xcp_context_t
  */
 #define OS_CATCH(e) \
 		} \
-		else if (xcp_matches(__xcp_ctx.name, (e))) { \
+		else if (xcp_matches(__xcp_ctx.id, xcp_id(e))) { \
 			__xcp_ctx.state = xcp_handled;
 			/* user's code goes here */
 
@@ -174,3 +294,4 @@ struct xcp_context_t
 		if (__xcp_ctx.state == xcp_none || __xcp_ctx.state == xcp_active) xcp_pop_context(&__xcp_ctx); \
 	}
 
+#endif // CONFIG_EXCEPTIONS_UNWIND
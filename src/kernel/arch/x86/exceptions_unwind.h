@@ -0,0 +1,44 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Exception object thrown by the unwinding exception system, see CONFIG_EXCEPTIONS_UNWIND in exceptions.h.
+ *
+ * Components are linked separately and only exceptions_mod contains libunwind. Landing pads of the other components
+ * still call __gxx_personality_v0 and _Unwind_Resume, the copies of these in runtime forward the calls to
+ * exceptions_mod through the ops of the exception being unwound.
+ */
+#pragma once
+
+#include "types.h"
+#include "unwind.h"
+
+struct xcp_unwind_exception_t
+{
+    static const uint64_t CLASS = 0x4d455454414f5300ull; // "METTAOS\0", vendor and language of the exception.
+
+    typedef _Unwind_Reason_Code (*personality_t)(int version, _Unwind_Action actions, uint64_t exception_class,
+                                                 _Unwind_Exception* exception, _Unwind_Context* context);
+
+    struct ops_t
+    {
+        personality_t personality;
+        void (*resume)(_Unwind_Exception* exception);
+    };
+
+    _Unwind_Exception       unwind;
+    const ops_t*            ops;
+    void*                   thrown; // The xcp_context_t record the catch clause of OS_ENDTRY receives.
+    xcp_unwind_exception_t* next;   // Next raised exception, kept by the exception system until its record is popped.
+
+    static inline xcp_unwind_exception_t* from(_Unwind_Exception* e)
+    {
+        return reinterpret_cast<xcp_unwind_exception_t*>(
+            reinterpret_cast<char*>(e) - __builtin_offsetof(xcp_unwind_exception_t, unwind));
+    }
+};
@@ -0,0 +1,191 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Lazy FPU/SSE context switching.
+//
+// FPU state stays in the registers until some other context executes an FPU or SSE instruction.
+// Activating a context that does not own the FPU only sets CR0.TS, first FPU use then raises #NM
+// and the handler saves the previous owner's state and loads the new one.
+//
+#pragma once
+
+#include "types.h"
+#include "macros.h"
+#include "cpu.h"
+#include "ia32.h"
+#include "memutils.h"
+
+/**
+ * Saved FPU state of an execution context.
+ * Area is big enough for FSAVE, FXSAVE and XSAVE with x87, SSE and AVX components.
+ */
+struct fpu_state_t
+{
+    enum { AREA_SIZE = 1024 };
+
+    uint8_t area[AREA_SIZE] ALIGNED(64); // FXSAVE needs 16 bytes alignment, XSAVE needs 64.
+    bool valid;                          // area holds saved registers, otherwise context starts with fninit.
+
+    // XRSTOR faults on nonzero reserved bytes of the XSAVE header at offset 512, XSAVE only writes XSTATE_BV.
+    fpu_state_t() : valid(false) { memutils::clear_memory(area, AREA_SIZE); }
+};
+
+/**
+ * FPU ownership management for the current CPU.
+ * All operations are privileged.
+ */
+class x86_fpu_t
+{
+public:
+    enum mode_e
+    {
+        FSAVE  = 0, //!< x87 only
+        FXSAVE = 1, //!< x87 and SSE
+        XSAVE  = 2  //!< all components enabled in XCR0
+    };
+
+    /**
+     * Enable FPU and SSE on this CPU, pick the save instruction and leave FPU unowned with TS set.
+     * Uses explicit cpu info because launcher calls it before %gs is set up.
+     */
+    static inline void init(cpu_information_t& cpu)
+    {
+        uint32_t eax, ebx, ecx, edx;
+        x86_cpu_t::cpuid(1, &eax, &ebx, &ecx, &edx);
+
+        x86_cpu_t::cr0_clear_flag(IA32_CR0_EM);
+        x86_cpu_t::cr0_set_flag(IA32_CR0_MP | IA32_CR0_NE);
+
+        cpu.fpu_mode = FSAVE;
+        cpu.fpu_xcr0 = 0;
+
+        if (edx & X86_32_FEAT_FXSR)
+        {
+            x86_cpu_t::cr4_set_flag(IA32_CR4_OSFXSR);
+            if (edx & X86_32_FEAT_XMM)
+                x86_cpu_t::cr4_set_flag(IA32_CR4_OSXMMEXCPT);
+            cpu.fpu_mode = FXSAVE;
+        }
+
+        if (ecx & X86_32_FEAT2_XSAVE)
+        {
+            x86_cpu_t::cr4_set_flag(IA32_CR4_OSXSAVE);
+
+            uint64_t xcr0 = X86_XCR0_X87 | X86_XCR0_SSE;
+            if (ecx & X86_32_FEAT2_AVX)
+                xcr0 |= X86_XCR0_AVX;
+            write_xcr0(xcr0);
+
+            // EBX of leaf 0xd reports save area size for currently enabled components.
+            x86_cpu_t::cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx);
+            if (ebx > fpu_state_t::AREA_SIZE)
+            {
+                xcr0 = X86_XCR0_X87 | X86_XCR0_SSE;
+                write_xcr0(xcr0);
+            }
+
+            cpu.fpu_mode = XSAVE;
+            cpu.fpu_xcr0 = xcr0;
+        }
+
+        clear_ts();
+        asm volatile ("fninit");
+        cpu.fpu_owner = nullptr;
+        cpu.fpu_context = nullptr;
+        set_ts();
+    }
+
+    static inline void set_ts() ALWAYS_INLINE
+    {
+        x86_cpu_t::cr0_set_flag(IA32_CR0_TS);
+    }
+
+    static inline void clear_ts() ALWAYS_INLINE
+    {
+        asm volatile ("clts");
+    }
+
+    static inline void save(cpu_information_t& cpu, fpu_state_t* state)
+    {
+        switch (cpu.fpu_mode)
+        {
+            case XSAVE:
+                asm volatile ("xsave %0" : "=m"(state->area) : "a"(uint32_t(cpu.fpu_xcr0)), "d"(uint32_t(cpu.fpu_xcr0 >> 32)));
+                break;
+            case FXSAVE:
+                asm volatile ("fxsave %0" : "=m"(state->area));
+                break;
+            default:
+                asm volatile ("fnsave %0" : "=m"(state->area));
+                break;
+        }
+        state->valid = true;
+    }
+
+    static inline void restore(cpu_information_t& cpu, fpu_state_t* state)
+    {
+        switch (cpu.fpu_mode)
+        {
+            case XSAVE:
+                asm volatile ("xrstor %0" :: "m"(state->area), "a"(uint32_t(cpu.fpu_xcr0)), "d"(uint32_t(cpu.fpu_xcr0 >> 32)));
+                break;
+            case FXSAVE:
+                asm volatile ("fxrstor %0" :: "m"(state->area));
+                break;
+            default:
+                asm volatile ("frstor %0" :: "m"(state->area));
+                break;
+        }
+    }
+
+    /**
+     * Make given state the current FPU context of this CPU. Called on every context activation.
+     * Registers are not touched, if the context is still the owner we just let it use the FPU.
+     */
+    static inline void switch_to(fpu_state_t* next)
+    {
+        cpu_information_t& cpu = x86_cpu_t::current_cpu();
+        cpu.fpu_context = next;
+        if (cpu.fpu_owner == next)
+            clear_ts();
+        else
+            set_ts();
+    }
+
+    /**
+     * Device-not-available (#NM) trap: current context wants the FPU.
+     */
+    static inline void handle_trap()
+    {
+        cpu_information_t& cpu = x86_cpu_t::current_cpu();
+        clear_ts();
+        ++cpu.fpu_traps;
+
+        if (cpu.fpu_owner == cpu.fpu_context)
+            return;
+
+        if (cpu.fpu_owner)
+        {
+            save(cpu, cpu.fpu_owner);
+            ++cpu.fpu_saves;
+        }
+
+        if (cpu.fpu_context && cpu.fpu_context->valid)
+            restore(cpu, cpu.fpu_context);
+        else
+            asm volatile ("fninit");
+
+        cpu.fpu_owner = cpu.fpu_context;
+    }
+
+private:
+    static inline void write_xcr0(uint64_t value)
+    {
+        asm volatile ("xsetbv" :: "c"(0), "a"(uint32_t(value)), "d"(uint32_t(value >> 32)));
+    }
+};
@@ -53,6 +53,10 @@ static const size_t    FRAME_WIDTH = 12;
 
 // CR0 register
 #define IA32_CR0_PE (1 <<  0)   /**< enable protected mode                                       */
+#define IA32_CR0_MP (1 <<  1)   /**< monitor coprocessor, wait/fwait also honour TS              */
+#define IA32_CR0_EM (1 <<  2)   /**< emulate FPU, all FPU instructions trap                      */
+#define IA32_CR0_TS (1 <<  3)   /**< task switched, next FPU instruction raises #NM              */
+#define IA32_CR0_NE (1 <<  5)   /**< report FPU errors via #MF instead of IRQ13                  */
 #define IA32_CR0_WP (1 << 16)   /**< force write protection on user read only pages for kernel   */
 #define IA32_CR0_AM (1 << 18)   /**< enable alignment checks                                     */
 #define IA32_CR0_PG (1 << 31)   /**< enable paging                                               */
@@ -81,3 +85,9 @@ static const size_t    FRAME_WIDTH = 12;
 #define X86_MSR_PMCTR1  0xc2
 #define X86_MSR_EVSEL0  0x186
 #define X86_MSR_EVSEL1  0x187
+#define X86_MSR_APIC_BASE 0x1b
+
+// Extended control registers
+#define X86_XCR0_X87    (1 << 0)
+#define X86_XCR0_SSE    (1 << 1)
+#define X86_XCR0_AVX    (1 << 2)
@@ -8,13 +8,26 @@
 //
 #pragma once
 
+#include "config.h"
+#include "macros.h"
+#include "cpu_information.h"
 #include "time_v1_interface.h"
 #include "pervasives_v1_interface.h"
 #include "stretch_v1_interface.h"
 
+/**
+ * Every CPU has its own information page, they are laid out one page apart starting at ADDRESS.
+ * Each CPU's GDT contains a CPU_LOCAL_DS segment based at its own page, which is kept in %gs both in the nucleus
+ * and in user domains, so current() is a single segment-relative load.
+ */
 struct information_page_t
 {
-    enum { ADDRESS = 0x1000 };
+    enum { ADDRESS = 0x1000, STRIDE = 0x1000 };
+#if CONFIG_SMP
+    enum { MAX_CPUS = CONFIG_MAX_CPUS };
+#else
+    enum { MAX_CPUS = 1 };
+#endif
 
     volatile time_v1::ns  now;       /* 00 Current system time              */
     volatile time_v1::ns  alarm;     /* 08 Alarm time                       */
@@ -35,9 +48,32 @@ struct information_page_t
     bool mmu_ok;
 
     stretch_v1::closure_t** stretch_mapping;
+
+    information_page_t*   self;      /* Linear address of this page, read through %gs */
+    cpu_information_t     cpu;       /* Per-CPU data, run queue */
+
+    static inline information_page_t* for_cpu(cpu_id_t cpu) ALWAYS_INLINE
+    {
+        return reinterpret_cast<information_page_t*>(ADDRESS + cpu * STRIDE);
+    }
+
+    /**
+     * Information page of the CPU we are running on.
+     * Valid only after the nucleus has installed this CPU's GDT, the launcher must use for_cpu() before that.
+     */
+    static inline information_page_t* current() ALWAYS_INLINE
+    {
+#if CONFIG_SMP
+        information_page_t* page;
+        asm volatile ("movl %%gs:%c1, %0" : "=r"(page) : "i"(__builtin_offsetof(information_page_t, self)));
+        return page;
+#else
+        return for_cpu(0);
+#endif
+    }
 };
 
-#define INFO_PAGE (*((information_page_t*)information_page_t::ADDRESS))
+#define INFO_PAGE (*information_page_t::current())
 
 // Pervasives accessor.
 #define PVS(member) (INFO_PAGE.pervasives->member)
@@ -0,0 +1,141 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Local xAPIC access, used for AP startup and inter-processor interrupts.
+//
+#pragma once
+
+#include "cpu.h"
+#include "ia32.h"
+
+/**
+ * Vectors of inter-processor interrupts, above the ones used by the remapped PIC.
+ * Keep in sync with interrupt.nasm!
+ */
+enum ipi_vector_e
+{
+    IPI_WAKEUP        = 0xf0, //!< Target CPU run queue got new work.
+    IPI_TLB_SHOOTDOWN = 0xf1, //!< Target CPU must flush its TLB.
+    APIC_SPURIOUS     = 0xff
+};
+
+/**
+ * Memory-mapped local APIC of the current CPU. The register window is at the same physical address on every CPU
+ * and is mapped 1-1 by the launcher.
+ */
+class local_apic_t
+{
+    enum {
+        APIC_BASE_ENABLE = (1 << 11),
+        APIC_BASE_BSP    = (1 << 8),
+
+        REG_ID       = 0x020,
+        REG_VERSION  = 0x030,
+        REG_TPR      = 0x080,
+        REG_EOI      = 0x0b0,
+        REG_SVR      = 0x0f0,
+        REG_ICR_LOW  = 0x300,
+        REG_ICR_HIGH = 0x310,
+
+        SVR_ENABLE   = (1 << 8),
+
+        ICR_FIXED        = (0 << 8),
+        ICR_INIT         = (5 << 8),
+        ICR_STARTUP      = (6 << 8),
+        ICR_PENDING      = (1 << 12),
+        ICR_ASSERT       = (1 << 14),
+        ICR_LEVEL        = (1 << 15),
+        ICR_ALL_BUT_SELF = (3 << 18)
+    };
+
+    // Register window, read from the APIC base MSR on first use. Defined by every binary using the APIC,
+    // see smp.cpp and init_nucleus.cpp.
+    static address_t base_address;
+
+public:
+    static inline address_t base()
+    {
+        if (!base_address)
+            base_address = static_cast<address_t>(x86_cpu_t::read_msr(X86_MSR_APIC_BASE)) & ~(PAGE_SIZE - 1);
+        return base_address;
+    }
+
+    static inline bool is_bsp()
+    {
+        return (x86_cpu_t::read_msr(X86_MSR_APIC_BASE) & APIC_BASE_BSP) != 0;
+    }
+
+    static inline uint32_t read(uint32_t reg)
+    {
+        return *reinterpret_cast<volatile uint32_t*>(base() + reg);
+    }
+
+    static inline void write(uint32_t reg, uint32_t value)
+    {
+        *reinterpret_cast<volatile uint32_t*>(base() + reg) = value;
+    }
+
+    static inline apic_id_t id()
+    {
+        return read(REG_ID) >> 24;
+    }
+
+    /**
+     * Software-enable the local APIC and let all interrupt priorities through.
+     */
+    static inline void enable()
+    {
+        x86_cpu_t::write_msr(X86_MSR_APIC_BASE, x86_cpu_t::read_msr(X86_MSR_APIC_BASE) | APIC_BASE_ENABLE);
+        write(REG_SVR, SVR_ENABLE | APIC_SPURIOUS);
+        write(REG_TPR, 0);
+    }
+
+    static inline void eoi()
+    {
+        write(REG_EOI, 0);
+    }
+
+    static inline void wait_icr_idle()
+    {
+        while (read(REG_ICR_LOW) & ICR_PENDING)
+            x86_cpu_t::pause();
+    }
+
+    static inline void send_ipi(apic_id_t target, uint8_t vector)
+    {
+        wait_icr_idle();
+        write(REG_ICR_HIGH, uint32_t(target) << 24);
+        write(REG_ICR_LOW, ICR_FIXED | ICR_ASSERT | vector);
+    }
+
+    static inline void broadcast_ipi(uint8_t vector)
+    {
+        wait_icr_idle();
+        write(REG_ICR_LOW, ICR_ALL_BUT_SELF | ICR_FIXED | ICR_ASSERT | vector);
+    }
+
+    static inline void send_init(apic_id_t target)
+    {
+        wait_icr_idle();
+        write(REG_ICR_HIGH, uint32_t(target) << 24);
+        write(REG_ICR_LOW, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+        wait_icr_idle();
+        write(REG_ICR_HIGH, uint32_t(target) << 24);
+        write(REG_ICR_LOW, ICR_INIT | ICR_LEVEL);
+    }
+
+    /**
+     * Start target CPU in real mode at physical address vector_page * 4096.
+     */
+    static inline void send_startup(apic_id_t target, uint8_t vector_page)
+    {
+        wait_icr_idle();
+        write(REG_ICR_HIGH, uint32_t(target) << 24);
+        write(REG_ICR_LOW, ICR_STARTUP | vector_page);
+    }
+};
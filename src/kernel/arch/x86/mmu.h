@@ -60,6 +60,7 @@ public:
     static inline address_t get_pagefault_address(void);
     static inline physical_address_t get_active_pagetable(void);
     static inline void set_active_pagetable(physical_address_t page_dir_physical);
+    static inline bool is_mapped(address_t linear);
 //     static void set_active_pagetable(x86_protection_domain_t& pdom);
 };
 
@@ -180,6 +181,25 @@ inline void ia32_mmu_t::set_active_pagetable(physical_address_t page_dir_physica
     asm volatile ("movl %0, %%cr3\n" :: "r"(page_dir_physical));
 }
 
+/**
+ * Check if a linear address can be read without faulting.
+ * Page tables are mapped one to one in the kernel address space, so the walk reads them at their physical addresses.
+ * Without paging every address is readable.
+ */
+inline bool ia32_mmu_t::is_mapped(address_t linear)
+{
+    if (!paged_mode_enabled())
+        return true;
+    const uint32_t* directory = reinterpret_cast<const uint32_t*>(get_active_pagetable() & PAGE_MASK);
+    uint32_t pde = directory[linear >> 22];
+    if (!(pde & IA32_PAGE_PRESENT))
+        return false;
+    if (pde & IA32_PAGE_4MB)
+        return true;
+    const uint32_t* table = reinterpret_cast<const uint32_t*>(pde & PAGE_MASK);
+    return (table[(linear >> PAGE_WIDTH) & 0x3ff] & IA32_PAGE_PRESENT) != 0;
+}
+
 // inline void ia32_mmu_t::set_active_pagetable(x86_protection_domain_t& pdom)
 // {
 //     set_active_pagetable(pdom.physical_page_directory);
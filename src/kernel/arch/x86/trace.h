@@ -0,0 +1,95 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+/**
+ * Binary tracing for hot paths.
+ *
+ * A trace point stores a record with the format id, timestamp counter and up to four raw 32-bit arguments into the
+ * trace buffer of the current CPU, no formatting is done in the system. Format strings use printf conversions,
+ * each consuming one argument. Strings cannot be traced as they are not copied, 64-bit values must be split.
+ *
+ * @example
+ *     TRACE("heap_t::allocate(%u) returning %p", size, ptr);
+ * @endexample
+ *
+ * Trace points below CONFIG_TRACE_LEVEL (0 trace, 1 debug, 2 info, 3 none) compile to nothing, arguments
+ * included. Like INFO_PAGE, tracing works only once the nucleus has installed the CPU's GDT.
+ */
+
+#include "config.h"
+#include "trace_buffer.h"
+#include "infopage.h"
+#include "cpu.h"
+
+namespace trace {
+
+template <typename T>
+inline uint32_t word(T* v) { return reinterpret_cast<address_t>(v); }
+template <typename T>
+inline uint32_t word(T v)
+{
+    static_assert(sizeof(T) <= sizeof(uint32_t), "Trace arguments are 32 bits wide");
+    return static_cast<uint32_t>(v);
+}
+
+inline trace_buffer_t* current()
+{
+    return trace_buffer_t::for_cpu(INFO_PAGE.cpu.id);
+}
+
+template <typename... Args>
+inline void record(uint32_t format, Args... args)
+{
+    static_assert(sizeof...(Args) <= trace_record_t::ARGS, "Too many trace arguments");
+    uint32_t words[trace_record_t::ARGS] = { word(args)... };
+
+    // Interrupts on this CPU may trace too, a slot is reserved atomically before it is written.
+    trace_buffer_t* buffer = current();
+    uint32_t seq = __sync_fetch_and_add(&buffer->head, 1);
+    trace_record_t& r = buffer->records[seq % trace_buffer_t::RECORDS];
+    r.sequence = 0;
+    asm volatile("" ::: "memory");
+    r.format = format;
+    r.timestamp = x86_cpu_t::read_tsc();
+    for (int i = 0; i < trace_record_t::ARGS; ++i)
+        r.args[i] = words[i];
+    asm volatile("" ::: "memory");
+    r.sequence = seq + 1;
+}
+
+} // namespace trace
+
+// Format strings go to a section of their own, they are not loaded but kept in the ELF file for tracedump.
+#define TRACE_RECORD(fmt, ...) \
+    do { \
+        __attribute__((section(".trace_formats"), used)) static const char trace_format_[] = fmt; \
+        constexpr uint32_t trace_format_id_ = trace_format_id(fmt); \
+        trace::record(trace_format_id_, ##__VA_ARGS__); \
+    } while (0)
+
+#define TRACE_NOTHING(fmt, ...) do {} while (0)
+
+#if CONFIG_TRACE_LEVEL <= 0
+#define TRACE TRACE_RECORD
+#else
+#define TRACE TRACE_NOTHING
+#endif
+
+#if CONFIG_TRACE_LEVEL <= 1
+#define TRACE_DEBUG TRACE_RECORD
+#else
+#define TRACE_DEBUG TRACE_NOTHING
+#endif
+
+#if CONFIG_TRACE_LEVEL <= 2
+#define TRACE_INFO TRACE_RECORD
+#else
+#define TRACE_INFO TRACE_NOTHING
+#endif
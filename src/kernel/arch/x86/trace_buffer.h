@@ -0,0 +1,73 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "types.h"
+
+/**
+ * One trace event. Records are written unformatted, the format string is identified by the hash of its text and
+ * turned back into text on the host by tracedump, which finds format strings in the .trace_formats section of
+ * the component ELF files.
+ */
+struct trace_record_t
+{
+    enum { ARGS = 4 };
+
+    uint32_t sequence;  //!< Number of the record in the buffer plus one, 0 while the record is being written.
+    uint32_t format;    //!< trace_format_id() of the format string.
+    uint64_t timestamp; //!< CPU timestamp counter.
+    uint32_t args[ARGS];
+};
+
+/**
+ * Trace records of one CPU, a ring of the last RECORDS events.
+ *
+ * Buffers are laid out STRIDE apart starting at ADDRESS, like the information pages, so the region can be saved
+ * from a debugger or emulator as a whole and given to tracedump.
+ */
+struct trace_buffer_t
+{
+    enum {
+        ADDRESS = 0x10000,
+        STRIDE = 0x4000,
+        MAGIC = 0x43415254, // "TRAC"
+        HEADER_SIZE = 32,
+        RECORDS = (STRIDE - HEADER_SIZE) / sizeof(trace_record_t)
+    };
+
+    uint32_t magic;
+    uint32_t cpu;
+    volatile uint32_t head; //!< Records ever reserved, the next one goes to records[head % RECORDS].
+    uint32_t reserved[5];
+    trace_record_t records[RECORDS];
+
+    static inline trace_buffer_t* for_cpu(uint32_t cpu)
+    {
+        return reinterpret_cast<trace_buffer_t*>(ADDRESS + cpu * STRIDE);
+    }
+
+    inline void init(uint32_t cpu_id)
+    {
+        magic = MAGIC;
+        cpu = cpu_id;
+        head = 0;
+        for (uint32_t i = 0; i < RECORDS; ++i)
+            records[i].sequence = 0;
+    }
+};
+
+static_assert(sizeof(trace_buffer_t) <= trace_buffer_t::STRIDE, "Trace buffer overlaps the next CPU's");
+
+/**
+ * FNV-1a hash of a format string, evaluated by the compiler for trace points.
+ */
+constexpr uint32_t trace_format_id(const char* s, uint32_t hash = 2166136261u)
+{
+    return *s ? trace_format_id(s + 1, (hash ^ uint8_t(*s)) * 16777619u) : hash;
+}
@@ -109,4 +109,22 @@ public:
     {
         return __sync_sub_and_fetch(lock, inc);
     }
+
+    /**
+     * Fetch and bitwise or.
+     * @return the value that had previously been in memory.
+     */
+    static inline address_t fetch_or(address_t *lock, address_t mask)
+    {
+        return __sync_fetch_and_or(lock, mask);
+    }
+
+    /**
+     * Fetch and bitwise and.
+     * @return the value that had previously been in memory.
+     */
+    static inline address_t fetch_and(address_t *lock, address_t mask)
+    {
+        return __sync_fetch_and_and(lock, mask);
+    }
 };
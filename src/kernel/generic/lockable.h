@@ -29,8 +29,10 @@ public:
         // If we exchange the lock value with 1 and get 1 out, it was locked.
         while (atomic_ops::tas(&lock_value, new_val) == 1)
         {
-            // Do nothing. Could notify scheduler here.
-            kconsole << "object already locked, spinning!" << endl;
+            // Spin on a plain read so the cache line stays shared until the holder releases it,
+            // instead of bouncing it between CPUs with locked exchanges. Could notify scheduler here.
+            while (*const_cast<volatile uint32_t*>(&lock_value))
+                asm volatile ("pause" ::: "memory");
         }
         // We got the lock, return.
     }
@@ -109,7 +109,7 @@ void print_module_map()
             break;
         }
 
-        kconsole << "*** " << module->name << " @ " << module->entry.load_base << ".." << module->entry.load_base + module->entry.loaded_size << ", size " << int(module->entry.loaded_size) << " bytes. Entry " << module->entry.entry_point << ", symtab " << module->entry.symtab_start << ", strtab " << module->entry.strtab_start << endl;
+        kconsole << "*** " << module->name << " @ " << module->entry.load_base << ".." << module->entry.load_base + module->entry.loaded_size << ", size " << int(module->entry.loaded_size) << " bytes. Entry " << module->entry.entry_point << ", symtab " << module->entry.symtab_start << ", strtab " << module->entry.strtab_start << ", eh_frame " << module->entry.eh_frame_start << endl;
         module = module->previous;
     }
     kconsole << "**********************************" << endl;
@@ -156,6 +156,48 @@ module_loader_t::loaded_module_names()
     return out;
 }
 
+//======================================================================================================================
+// module_loader_t::iterator
+//======================================================================================================================
+
+static module_descriptor_t* descriptor_at(address_t end)
+{
+    module_descriptor_t* module = reinterpret_cast<module_descriptor_t*>(end - sizeof(module_descriptor_t));
+    return module->magic == four_cc<'M','D','U','L'>::value ? module : 0;
+}
+
+void module_loader_t::iterator::set(void* entry)
+{
+    module_descriptor_t* module = reinterpret_cast<module_descriptor_t*>(entry);
+    ptr = (module && module->magic == four_cc<'M','D','U','L'>::value) ? module : 0;
+}
+
+module_loader_t::iterator::iterator(module_entry* entry)
+{
+    set(entry ? reinterpret_cast<char*>(entry) - __builtin_offsetof(module_descriptor_t, entry) : 0);
+}
+
+module_loader_t::module_entry& module_loader_t::iterator::operator *()
+{
+    return reinterpret_cast<module_descriptor_t*>(ptr)->entry;
+}
+
+void module_loader_t::iterator::operator ++()
+{
+    set(reinterpret_cast<module_descriptor_t*>(ptr)->previous);
+}
+
+module_loader_t::iterator module_loader_t::begin()
+{
+    module_descriptor_t* last = descriptor_at(*d_last_available_address);
+    return iterator(last ? &last->entry : 0);
+}
+
+module_loader_t::iterator module_loader_t::end()
+{
+    return iterator(0);
+}
+
 static bool starts_with(const cstring_t& str, const char* prefix)
 {
     uint32_t i = 0;
@@ -470,6 +512,14 @@ void* module_loader_t::load_module(const char* name, elf_parser_t& module, const
 
             *d_last_available_address += string_table->size;
         }
+
+        // Unwind tables are loaded like any other allocated section, remember where for the exception system.
+        elf32::section_header_t* eh_frame = module.section_header(".eh_frame");
+        if (eh_frame && (eh_frame->flags & SHF_ALLOC))
+        {
+            this_loaded_module.entry.eh_frame_start = eh_frame->vaddr;
+            this_loaded_module.entry.eh_frame_size = eh_frame->size;
+        }
     }
     else
         PANIC("Do not know how to load ELF file!");
@@ -50,6 +50,8 @@ public:
         address_t entry_point;  // main() entry point address.
         address_t symtab_start; // address of symbol table for lookups
         address_t strtab_start; // address of string table for name lookups
+        address_t eh_frame_start; // loaded .eh_frame section for the unwinding exception system, 0 if none
+        size_t    eh_frame_size;
     } PACKED;
 
     /** Iterator for going over available modules. */
@@ -83,7 +85,7 @@ public:
     module_symbols_t symtab_for(const char* name, const char* suffix);
     strvec loaded_module_names();
 
-    // These two methods allow iterating instantiated modules in a standard fashion.
+    // These two methods allow iterating instantiated modules in a standard fashion, last loaded module first.
     iterator begin();
     iterator end();
 
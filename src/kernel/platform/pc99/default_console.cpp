@@ -33,14 +33,37 @@ default_console_t::default_console_t()
 void default_console_t::clear()
 {
     memutils::clear_memory((void*)rambuf, sizeof(rambuf));
-    blit();
+    dirty_first = 0;
+    dirty_last = LINE_COUNT - 1;
     locate(0,0);
+    flush();
     attr = 0x07;
 }
 
+void default_console_t::flush()
+{
+    blit();
+    if (cursor_moved)
+    {
+        cursor_moved = false;
+        // Set VGA hardware cursor, it counts characters, not bytes.
+        unsigned int position = cursor / 2;
+        x86_cpu_t::outb(0x3d4, 14);              // Tell the VGA board we are setting the high cursor byte.
+        x86_cpu_t::outb(0x3d5, position >> 8);   // Send the high cursor byte.
+        x86_cpu_t::outb(0x3d4, 15);              // Tell the VGA board we are setting the low cursor byte.
+        x86_cpu_t::outb(0x3d5, position & 0xff); // Send the low cursor byte.
+    }
+    drain_output();
+}
+
 void default_console_t::blit()
 {
-    memutils::copy_memory((void*)videoram, (void*)rambuf, sizeof(rambuf));
+    if (dirty_first > dirty_last)
+        return;
+    memutils::copy_memory((void*)(videoram + dirty_first * LINE_PITCH), (void*)(rambuf + dirty_first * LINE_PITCH),
+                          (dirty_last - dirty_first + 1) * LINE_PITCH);
+    dirty_first = LINE_COUNT;
+    dirty_last = 0;
 }
 
 void default_console_t::set_color(Color col)
@@ -59,26 +82,25 @@ void default_console_t::set_attr(Color fore, Color back)
     set_background(back);
 }
 
+// Hardware cursor is moved on the next flush.
 void default_console_t::locate(int row, int col)
 {
     cursor = (row * LINE_PITCH) + (col * 2);
-    // Set VGA hardware cursor
-    x86_cpu_t::outb(0x3d4, 14);            // Tell the VGA board we are setting the high cursor byte.
-    x86_cpu_t::outb(0x3d5, cursor >> 8);   // Send the high cursor byte.
-    x86_cpu_t::outb(0x3d4, 15);            // Tell the VGA board we are setting the low cursor byte.
-    x86_cpu_t::outb(0x3d5, cursor & 0xff); // Send the low cursor byte.
+    cursor_moved = true;
 }
 
 void default_console_t::scroll_up()
 {
     memutils::move_memory((void*)rambuf, (void*)(rambuf+LINE_PITCH), sizeof(rambuf)-LINE_PITCH);
     memutils::fill_memory((void*)(rambuf+LINE_PITCH*(LINE_COUNT-1)), 0, LINE_PITCH);
+    dirty_first = 0;
+    dirty_last = LINE_COUNT - 1;
 }
 
 void default_console_t::newline()
 {
     print_char(eol);
-    blit();
+    flush();
 }
 
 /** Print decimal integer */
@@ -108,7 +130,7 @@ void default_console_t::print_int(int n)
         n = n % div;
         div /= 10;
     }
-    blit();
+    flush();
 }
 
 inline void default_console_t::print_byte_internal(unsigned char n)
@@ -124,7 +146,7 @@ inline void default_console_t::print_byte_internal(unsigned char n)
 void default_console_t::print_byte(unsigned char n)
 {
     print_byte_internal(n);
-    blit();
+    flush();
 }
 
 /** Print hexadecimal integer */
@@ -135,7 +157,7 @@ void default_console_t::print_hex(uint32_t n)
     print_byte_internal((n >> 16) & 0xff);
     print_byte_internal((n >> 8) & 0xff);
     print_byte_internal(n & 0xff);
-    blit();
+    flush();
 }
 
 void default_console_t::print_hex2(uint16_t n)
@@ -143,7 +165,7 @@ void default_console_t::print_hex2(uint16_t n)
     print_str("0x");
     print_byte_internal((n >> 8) & 0xff);
     print_byte_internal(n & 0xff);
-    blit();
+    flush();
 }
 
 /** Print 64 bit hex integer */
@@ -152,7 +174,7 @@ void default_console_t::print_hex8(unsigned long long n)
     print_str("0x");
     for(int i = 8; i > 0; i--)
         print_byte_internal((n >> (i-1)*8) & 0xFF);
-    blit();
+    flush();
 }
 
 /* Minimal support for startup I/O */
@@ -197,8 +219,39 @@ static void init_serial(void)
     x86_cpu_t::inb(MSR);
 }
 
+/* The UART takes a FIFO worth of characters each time its transmitter is empty. */
+static void serial_print(const char* str, size_t count)
+{
+    #define FIFO_SIZE 16
+    #define LSR_THRE  0x20
+
+    while (count > 0)
+    {
+        while ((x86_cpu_t::inb(LSR) & LSR_THRE) == 0) {}
+        for (size_t n = count < FIFO_SIZE ? count : FIFO_SIZE; n > 0; --n, --count)
+            x86_cpu_t::outb(COMPORT, *str++);
+    }
+}
+
 #endif  /* CONFIG_COMPORT */
 
+/**
+ * Characters are buffered so the debug port and serial line are written in bulk at flush points.
+ * The QEMU/Bochs debug console on port 0xe9 takes the whole buffer with one string instruction.
+ */
+void default_console_t::drain_output()
+{
+    if (outbuf_used == 0)
+        return;
+#if BOCHS_IO_HACKS
+    x86_cpu_t::outsb(0xe9, outbuf, outbuf_used);
+#endif
+#if defined(CONFIG_COMPORT)
+    serial_print(outbuf, outbuf_used);
+#endif
+    outbuf_used = 0;
+}
+
 /** Print a single character */
 void default_console_t::print_char(char ch)
 {
@@ -218,6 +271,13 @@ void default_console_t::print_char(char ch)
         cursor = LINE_PITCH * (LINE_COUNT - 1);
     }
 
+    // Tabs and newlines never cross the end of the line.
+    unsigned int line = cursor / LINE_PITCH;
+    if (line < dirty_first)
+        dirty_first = line;
+    if (line > dirty_last)
+        dirty_last = line;
+
     switch (ch)
     {
         case '\r':
@@ -245,8 +305,12 @@ void default_console_t::print_char(char ch)
             rambuf[cursor++] = attr; /* foreground, background colors. */
     }
 
-    bochs_console_print_char(ch);
-//     serial_print_char(ch);
+    // Output is batched up to the end of line.
+    outbuf[outbuf_used++] = ch;
+    if (ch == eol)
+        flush();
+    else if (outbuf_used == sizeof(outbuf))
+        drain_output();
 }
 
 void default_console_t::print_unprintable(char ch)
@@ -259,6 +323,8 @@ void default_console_t::print_unprintable(char ch)
 /** Wait for Enter key press and release on keyboard */
 void default_console_t::wait_ack()
 {
+    flush();
+
     uint8_t keycode;
     uint8_t irqmask = x86_cpu_t::inb(0x21);
     x86_cpu_t::outb(0x21, irqmask | 0x02); // mask irq1 - keyboard
@@ -285,7 +351,7 @@ void default_console_t::print_str(const char *str)
     char *b = (char *)str;
     while (*b)
         print_char(*b++);
-    blit();
+    flush();
 }
 
 void default_console_t::debug_log(const char *str, ...)
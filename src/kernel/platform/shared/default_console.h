@@ -54,13 +54,21 @@ public:
 private:
     default_console_t();
 
-    void blit(); // Blit rambuf to videoram
+    void flush(); // Bring screen, hardware cursor and debug output up to date
+    void blit(); // Blit dirty lines of rambuf to videoram
+    void drain_output(); // Send buffered characters to the debug port and serial line
     void print_byte_internal(unsigned char n);
 
     uint8_t rambuf[160*25];
     unsigned char* videoram{(unsigned char*)0xb8000};
     unsigned int            cursor;
     unsigned char           attr;
+    // Lines changed since the last blit, none if dirty_first > dirty_last.
+    unsigned int            dirty_first{25};
+    unsigned int            dirty_last{0};
+    bool                    cursor_moved{false};
+    char                    outbuf[128];
+    unsigned int            outbuf_used{0};
 };
 
 
@@ -16,6 +16,7 @@
 #include "debugger.h"
 #include "module_loader.h"
 #include "bootimage.h"
+#include "cpu_information.h"
 
 /**
  * Check if a valid multiboot info structure is present.
@@ -67,6 +68,7 @@ bool mbi_probe()
 //*****************************************************************************************************************
 
 extern "C" void arch_prepare();
+extern void smp_startup(void (*nucleus_init)(cpu_id_t));
 
 /**
  * Init function that understands multiboot info structure.
@@ -75,6 +77,7 @@ extern "C" void arch_prepare();
  * - We have mbi inside the bootinfo page already.
  * - ELF-load the proper nucleus module.
  * - initialize it and mark memory as used.
+ * - start application processors.
  * - ELF-load the root-domain bootstrapper.
  * - return entry point of root-domain kick-off sequence. root-domain will run in ring3.
  * @return entry point for the kernel.
@@ -101,8 +104,11 @@ address_t mbi_prepare()
     elf_parser_t elf(bootimage.find_module("nucleus").start);
     if (!elf.is_valid())
         PANIC("Invalid nucleus ELF image!");
-    void (*nucleus_init)() = reinterpret_cast<void (*)()>(bi->modules().load_module("nucleus", elf, "nucleus_init"));
-    nucleus_init();
+    void (*nucleus_init)(cpu_id_t) = reinterpret_cast<void (*)(cpu_id_t)>(bi->modules().load_module("nucleus", elf, "nucleus_init"));
+    nucleus_init(0);
+
+    // Bring up application processors, they park in the nucleus idle loop.
+    smp_startup(nucleus_init);
 
     // Load and relocate root domain bootstrapper.
     bootimage_t::modinfo_t mi = bootimage.find_root_domain(0);
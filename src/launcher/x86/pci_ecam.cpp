@@ -0,0 +1,157 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// PCI Express enhanced configuration access (ECAM) discovery.
+//
+// The memory mapped configuration window is described by the ACPI MCFG table (qemu -machine q35 provides one).
+// The launcher still runs with paging off, so the tables are read directly, the window is then identity mapped and
+// recorded in the bootinfo page for the pcibus module. Without MCFG the bus is accessed through ports 0xcf8/0xcfc.
+//
+#include "bootinfo.h"
+#include "memutils.h"
+#include "default_console.h"
+#include "logger.h"
+
+namespace {
+
+// Every bus takes 1MiB of the window, map only as many as a small machine may have to keep page tables small.
+// Buses past the mapped part of the window are accessed through the ports.
+const size_t MAX_ECAM_BUSES = 32;
+const size_t ECAM_BUS_SIZE = 1*MiB;
+
+struct rsdp_t
+{
+    char     signature[8]; // "RSD PTR "
+    uint8_t  checksum;
+    char     oem_id[6];
+    uint8_t  revision;
+    uint32_t rsdt;
+} PACKED;
+
+struct sdt_header_t
+{
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED;
+
+struct mcfg_allocation_t
+{
+    uint64_t base;
+    uint16_t segment;
+    uint8_t  start_bus;
+    uint8_t  end_bus;
+    uint32_t reserved;
+} PACKED;
+
+struct mcfg_t
+{
+    sdt_header_t      header; // "MCFG"
+    uint64_t          reserved;
+    mcfg_allocation_t allocations[];
+} PACKED;
+
+bool checksum_ok(const void* p, size_t length)
+{
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+    uint8_t sum = 0;
+    while (length--)
+        sum += *b++;
+    return sum == 0;
+}
+
+rsdp_t* scan_rsdp(address_t start, size_t length)
+{
+    for (address_t p = start; p < start + length; p += 16)
+    {
+        rsdp_t* rsdp = reinterpret_cast<rsdp_t*>(p);
+        if (memutils::is_memory_equal(rsdp->signature, "RSD PTR ", 8) && checksum_ok(rsdp, sizeof(rsdp_t)))
+            return rsdp;
+    }
+    return nullptr;
+}
+
+/**
+ * Look for the root system description pointer in the first KiB of EBDA and BIOS ROM.
+ */
+rsdp_t* find_rsdp()
+{
+    address_t ebda = address_t(*reinterpret_cast<uint16_t*>(0x40e)) << 4;
+    rsdp_t* rsdp = ebda ? scan_rsdp(ebda, 1*KiB) : nullptr;
+    return rsdp ? rsdp : scan_rsdp(0xe0000, 0x20000);
+}
+
+mcfg_t* find_mcfg(rsdp_t* rsdp)
+{
+    sdt_header_t* rsdt = reinterpret_cast<sdt_header_t*>(rsdp->rsdt);
+    if (!memutils::is_memory_equal(rsdt->signature, "RSDT", 4) || !checksum_ok(rsdt, rsdt->length))
+        return nullptr;
+
+    uint32_t* tables = reinterpret_cast<uint32_t*>(rsdt + 1);
+    size_t n_tables = (rsdt->length - sizeof(sdt_header_t)) / sizeof(uint32_t);
+    for (size_t i = 0; i < n_tables; ++i)
+    {
+        sdt_header_t* table = reinterpret_cast<sdt_header_t*>(tables[i]);
+        if (memutils::is_memory_equal(table->signature, "MCFG", 4) && checksum_ok(table, table->length))
+            return reinterpret_cast<mcfg_t*>(table);
+    }
+    return nullptr;
+}
+
+} // anon namespace
+
+/**
+ * Find the ECAM window of PCI segment 0, map it and record it in the bootinfo page.
+ */
+void pci_ecam_prepare(bootinfo_t* bi)
+{
+    logger::function_scope fs("pci_ecam_prepare");
+
+    rsdp_t* rsdp = find_rsdp();
+    mcfg_t* mcfg = rsdp ? find_mcfg(rsdp) : nullptr;
+    if (!mcfg)
+    {
+        kconsole << "No ACPI MCFG table found, PCI configuration space is accessed through ports." << endl;
+        return;
+    }
+
+    size_t n_allocations = (mcfg->header.length - sizeof(mcfg_t)) / sizeof(mcfg_allocation_t);
+    for (size_t i = 0; i < n_allocations; ++i)
+    {
+        mcfg_allocation_t& a = mcfg->allocations[i];
+        // Other segments are not reachable through the ports either, the pcibus module only knows segment 0.
+        if (a.segment != 0 || a.start_bus > a.end_bus)
+            continue;
+
+        uint8_t end_bus = size_t(a.end_bus - a.start_bus) >= MAX_ECAM_BUSES ? a.start_bus + MAX_ECAM_BUSES - 1 : a.end_bus;
+        // The allocation's base address is where bus 0 would be, even if the segment starts at a later bus.
+        uint64_t start = a.base + uint64_t(a.start_bus) * ECAM_BUS_SIZE;
+        size_t size = (end_bus - a.start_bus + 1) * ECAM_BUS_SIZE;
+        if (start + size > 0x100000000ull)
+        {
+            kconsole << "ECAM window above 4GiB is not supported." << endl;
+            return;
+        }
+
+        address_t base = a.base;
+        if (!bi->append_vmap(start, start, size) || !bi->append_pci_ecam(base, a.start_bus, end_bus))
+        {
+            kconsole << RED << "Bootinfo page is full, not using ECAM." << endl;
+            return;
+        }
+
+        kconsole << "PCI ECAM window at " << address_t(start) << " for buses " << int(a.start_bus) << ".." << int(end_bus) << endl;
+        return;
+    }
+}
@@ -0,0 +1,273 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Application processors discovery and startup.
+//
+// CPUs are found via the Intel MultiProcessor Specification tables (qemu -smp N provides them)
+// and started with the INIT-SIPI-SIPI sequence one at a time.
+//
+#include "config.h"
+#include "bootinfo.h"
+#include "infopage.h"
+#include "local_apic.h"
+#include "mmu.h"
+#include "fpu.h"
+#include "memutils.h"
+#include "default_console.h"
+#include "logger.h"
+#include "panic.h"
+
+#if CONFIG_SMP
+
+address_t local_apic_t::base_address;
+
+// ap_trampoline.nasm
+extern "C" char ap_trampoline[], ap_trampoline_params[], ap_trampoline_end[];
+
+namespace {
+
+const address_t TRAMPOLINE_BASE = 0x7000; // Keep in sync with ap_trampoline.nasm!
+
+static_assert(information_page_t::ADDRESS + information_page_t::MAX_CPUS * information_page_t::STRIDE <= TRAMPOLINE_BASE,
+    "Information pages of all CPUs must fit below the AP trampoline, lower CONFIG_MAX_CPUS.");
+
+typedef void (*nucleus_init_t)(cpu_id_t);
+
+/**
+ * Parameter block at the end of the trampoline.
+ */
+struct ap_params_t
+{
+    uint32_t cpu;
+    uint32_t stack;
+    void (*entry)(cpu_id_t);
+} PACKED;
+
+struct mp_floating_pointer_t
+{
+    char     signature[4]; // "_MP_"
+    uint32_t config_table;
+    uint8_t  length;       // in 16 byte units
+    uint8_t  revision;
+    uint8_t  checksum;
+    uint8_t  features[5];
+} PACKED;
+
+struct mp_config_table_t
+{
+    char     signature[4]; // "PCMP"
+    uint16_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[8];
+    char     product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t local_apic;
+    uint16_t ext_length;
+    uint8_t  ext_checksum;
+    uint8_t  reserved;
+} PACKED;
+
+struct mp_processor_entry_t
+{
+    enum { TYPE = 0, SIZE = 20, ENABLED = 1, BSP = 2 };
+    uint8_t  type;
+    uint8_t  apic_id;
+    uint8_t  apic_version;
+    uint8_t  flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} PACKED;
+
+// All other entry types are 8 bytes long.
+const size_t MP_OTHER_ENTRY_SIZE = 8;
+
+cpu_id_t n_cpus = 1;
+nucleus_init_t nucleus_entry;
+
+// One boot stack is enough, APs are started one by one and leave it as soon as they enter the nucleus.
+uint32_t ap_boot_stack[1024] ALIGNED(16);
+
+bool checksum_ok(const void* p, size_t length)
+{
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+    uint8_t sum = 0;
+    while (length--)
+        sum += *b++;
+    return sum == 0;
+}
+
+mp_floating_pointer_t* scan_mp_floating_pointer(address_t start, size_t length)
+{
+    for (address_t p = start; p < start + length; p += 16)
+    {
+        mp_floating_pointer_t* mpf = reinterpret_cast<mp_floating_pointer_t*>(p);
+        if (memutils::is_memory_equal(mpf->signature, "_MP_", 4) && checksum_ok(mpf, mpf->length * 16))
+            return mpf;
+    }
+    return nullptr;
+}
+
+/**
+ * Look for the floating pointer structure in the first KiB of EBDA, last KiB of base memory and BIOS ROM.
+ */
+mp_floating_pointer_t* find_mp_floating_pointer()
+{
+    mp_floating_pointer_t* mpf;
+    address_t ebda = address_t(*reinterpret_cast<uint16_t*>(0x40e)) << 4;
+    address_t basemem_top = address_t(*reinterpret_cast<uint16_t*>(0x413)) * KiB;
+
+    if (ebda && (mpf = scan_mp_floating_pointer(ebda, KiB)))
+        return mpf;
+    if (basemem_top && (mpf = scan_mp_floating_pointer(basemem_top - KiB, KiB)))
+        return mpf;
+    return scan_mp_floating_pointer(0xf0000, 0x10000);
+}
+
+/**
+ * Approximately wait for given number of microseconds, port 0x80 write takes about 1us.
+ */
+void io_delay(unsigned usecs)
+{
+    while (usecs--)
+        x86_cpu_t::outb(0x80, 0);
+}
+
+void ap_entry(cpu_id_t cpu) NEVER_RETURNS;
+
+void ap_entry(cpu_id_t cpu)
+{
+    // Mirror the BSP setup from check_cpu_features() and arch_prepare().
+    uint32_t features = information_page_t::for_cpu(cpu)->cpu_features;
+    if (features & X86_32_FEAT_PSE)
+        ia32_mmu_t::enable_4mb_pages();
+    if (features & X86_32_FEAT_PGE)
+        ia32_mmu_t::enable_global_pages();
+    x86_fpu_t::init(information_page_t::for_cpu(cpu)->cpu);
+
+    nucleus_entry(cpu); // does not return for APs
+    PANIC("nucleus_init returned on AP");
+}
+
+bool start_ap(cpu_id_t cpu)
+{
+    information_page_t* info = information_page_t::for_cpu(cpu);
+    ap_params_t* params = reinterpret_cast<ap_params_t*>(TRAMPOLINE_BASE + (ap_trampoline_params - ap_trampoline));
+
+    params->cpu = cpu;
+    params->stack = reinterpret_cast<uint32_t>(ap_boot_stack + 1024);
+    params->entry = ap_entry;
+
+    local_apic_t::send_init(info->cpu.apic_id);
+    io_delay(10000);
+
+    for (int sipi = 0; sipi < 2 && !info->cpu.online; ++sipi)
+    {
+        local_apic_t::send_startup(info->cpu.apic_id, TRAMPOLINE_BASE / PAGE_SIZE);
+        io_delay(200);
+    }
+
+    for (int timeout = 100000; timeout > 0 && !info->cpu.online; --timeout)
+        io_delay(1);
+
+    return info->cpu.online;
+}
+
+} // anonymous namespace
+
+/**
+ * Find CPUs and assign them information pages. Called before the nucleus is loaded.
+ */
+void smp_prepare(bootinfo_t* bi)
+{
+    logger::function_scope fs("smp_prepare");
+
+    if (!(information_page_t::for_cpu(0)->cpu_features & X86_32_FEAT_APIC))
+    {
+        kconsole << "No local APIC, running uniprocessor." << endl;
+        return;
+    }
+
+    apic_id_t bsp_apic = local_apic_t::id();
+    information_page_t::for_cpu(0)->cpu.init(0, bsp_apic);
+
+    mp_floating_pointer_t* mpf = find_mp_floating_pointer();
+    if (!mpf || !mpf->config_table)
+    {
+        kconsole << "No MP configuration table found, running uniprocessor." << endl;
+        return;
+    }
+
+    mp_config_table_t* config = reinterpret_cast<mp_config_table_t*>(mpf->config_table);
+    if (!memutils::is_memory_equal(config->signature, "PCMP", 4) || !checksum_ok(config, config->length))
+    {
+        kconsole << "Bad MP configuration table, running uniprocessor." << endl;
+        return;
+    }
+
+    uint8_t* entry = reinterpret_cast<uint8_t*>(config + 1);
+    for (size_t i = 0; i < config->entry_count; ++i)
+    {
+        if (*entry != mp_processor_entry_t::TYPE)
+        {
+            entry += MP_OTHER_ENTRY_SIZE;
+            continue;
+        }
+
+        mp_processor_entry_t* proc = reinterpret_cast<mp_processor_entry_t*>(entry);
+        entry += mp_processor_entry_t::SIZE;
+
+        if (!(proc->flags & mp_processor_entry_t::ENABLED) || (proc->apic_id == bsp_apic))
+            continue;
+
+        if (n_cpus == information_page_t::MAX_CPUS)
+        {
+            kconsole << "Ignoring CPU with APIC id " << int(proc->apic_id) << ", CONFIG_MAX_CPUS reached." << endl;
+            continue;
+        }
+
+        information_page_t::for_cpu(n_cpus)->cpu.init(n_cpus, proc->apic_id);
+        ++n_cpus;
+    }
+
+    kconsole << "Found " << n_cpus << " CPUs." << endl;
+
+    // Nucleus sends IPIs through the local APIC registers, keep them accessible after paging is on.
+    bi->append_vmap(local_apic_t::base(), local_apic_t::base(), PAGE_SIZE);
+    bi->use_memory(TRAMPOLINE_BASE, PAGE_SIZE, multiboot_t::mmap_entry_t::loader_reclaimable);
+}
+
+/**
+ * Start all application processors found by smp_prepare(). Called after the nucleus is initialised on BSP.
+ */
+void smp_startup(void (*nucleus_init)(cpu_id_t))
+{
+    if (n_cpus == 1)
+        return;
+
+    logger::function_scope fs("smp_startup");
+
+    nucleus_entry = nucleus_init;
+    memutils::copy_memory(reinterpret_cast<void*>(TRAMPOLINE_BASE), ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+    for (cpu_id_t cpu = 1; cpu < n_cpus; ++cpu)
+    {
+        if (!start_ap(cpu))
+            kconsole << RED << "CPU " << cpu << " did not come up!" << endl;
+    }
+}
+
+#else
+
+void smp_prepare(bootinfo_t*) {}
+void smp_startup(void (*)(cpu_id_t)) {}
+
+#endif
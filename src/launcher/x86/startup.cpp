@@ -13,9 +13,11 @@
 #include "default_console.h"
 #include "bootinfo.h"
 #include "infopage.h"
+#include "trace_buffer.h"
 #include "frames_module_v1_interface.h"
 #include "timer_v1_interface.h"
 #include "mmu.h"
+#include "fpu.h"
 #include "c++ctors.h"
 #include "new"
 #include "debugger.h"
@@ -179,28 +181,38 @@ static void SECTION(".init.cpu") check_cpu_features()
         x86_cpu_t::enable_user_pmctr();
     }
 
-    INFO_PAGE.cpu_features = avail_features;
+    // %gs is not set up yet, so INFO_PAGE cannot be used here.
+    for (cpu_id_t cpu = 0; cpu < information_page_t::MAX_CPUS; ++cpu)
+        information_page_t::for_cpu(cpu)->cpu_features = avail_features;
 }
 
-/* Clear out the information page */
-static void prepare_infopage()
+/* Clear out the information pages and trace buffers of all CPUs */
+static void prepare_infopages()
 {
-    INFO_PAGE.pervasives = 0;
-    INFO_PAGE.scheduler_heartbeat = 0; // Scheduler passes
-    INFO_PAGE.irqs_heartbeat      = 0; // IRQ calls
-    INFO_PAGE.glue_heartbeat      = 0; // glue code calls
-    INFO_PAGE.faults_heartbeat    = 0; // protection faults
-    INFO_PAGE.cpu_features        = 0;
+    for (cpu_id_t cpu = 0; cpu < information_page_t::MAX_CPUS; ++cpu)
+    {
+        information_page_t* info = information_page_t::for_cpu(cpu);
+        info->pervasives = 0;
+        info->scheduler_heartbeat = 0; // Scheduler passes
+        info->irqs_heartbeat      = 0; // IRQ calls
+        info->glue_heartbeat      = 0; // glue code calls
+        info->faults_heartbeat    = 0; // protection faults
+        info->cpu_features        = 0;
+        info->self                = info;
+        info->cpu.init(cpu, 0); // APIC ids are filled in by smp_prepare()
+        trace_buffer_t::for_cpu(cpu)->init(cpu);
+    }
 }
 
 extern timer_v1::closure_t* init_timer(); // YIKES external declaration! FIXME
+extern void smp_prepare(bootinfo_t* bi); // smp.cpp
+extern void pci_ecam_prepare(bootinfo_t* bi); // pci_ecam.cpp
 
 /**
  * Get the system going.
  *
- * Prepare all system-specific structures and initialise BP and APs.
- *
- * @todo Relate Pistachio SMP startup routines here.
+ * Prepare all system-specific structures and initialise BP.
+ * APs are started later by smp_startup(), once the nucleus is installed.
  */
 extern "C" void arch_prepare()
 {
@@ -213,8 +225,10 @@ extern "C" void arch_prepare()
     bootinfo_t* bi = new(bootinfo_t::ADDRESS) bootinfo_t;
 
     parse_cmdline(bi);
-    prepare_infopage(); // <-- init domain info page
+    prepare_infopages(); // <-- init domain info pages
     check_cpu_features(); // cmdline might affect used CPU feats? (i.e. noacpi flag)
+    smp_prepare(bi);
+    pci_ecam_prepare(bi);
     
     // TODO: CREATE INITIAL MEMORY MAPPINGS PROPERLY HERE
     // TEMPORARY: just map all mem 0..min(16Mb, RAMtop) to 1-1 mapping? for simplicity
@@ -226,7 +240,7 @@ extern "C" void arch_prepare()
     // timer->enable(0); // enable timer interrupts
     // kconsole << "Timer interrupt enabled." << endl;
 
-    // FPU should be enabled here orly?
-    x86_cpu_t::enable_fpu();
-    kconsole << "FPU enabled." << endl;
+    // FPU is handed to contexts lazily, first use traps to the nucleus #NM handler.
+    x86_fpu_t::init(information_page_t::for_cpu(0)->cpu);
+    kconsole << "FPU enabled, save mode " << information_page_t::for_cpu(0)->cpu.fpu_mode << "." << endl;
 }
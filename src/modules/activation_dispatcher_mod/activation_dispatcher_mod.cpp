@@ -0,0 +1,477 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Activation dispatcher: on each activation demultiplex pending channel events to attached channel_notify handlers,
+// run expired time_notify handlers, then pass the activation on to the chained handler (usually the user-level
+// scheduler) or block the vcpu until the earliest pending timeout.
+//
+#include "activation_dispatcher_factory_v1_interface.h"
+#include "activation_dispatcher_factory_v1_impl.h"
+#include "activation_dispatcher_v1_interface.h"
+#include "activation_dispatcher_v1_impl.h"
+#include "activation_v1_interface.h"
+#include "activation_v1_impl.h"
+#include "channel_notify_v1_interface.h"
+#include "time_notify_v1_interface.h"
+#include "vcpu_v1_interface.h"
+#include "heap_v1_interface.h"
+#include "channel_v1_interface.h"
+#include "exceptions.h"
+#include "time_macros.h"
+#include "heap_new.h"
+#include "timer_wheel.h"
+
+struct channel_slot_t
+{
+    channel_notify_v1::closure_t* notify;
+    bool masked;
+    bool deferred; //!< Event arrived while masked, endpoint is on the deferred list.
+};
+
+struct activation_dispatcher_v1::state_t
+{
+    activation_dispatcher_v1::closure_t closure;
+    activation_v1::closure_t            activation;
+    activation_v1::closure_t*           handler;    //!< Chained activation handler.
+
+    vcpu_v1::closure_t*                 vcpu;
+    time_v1::closure_t*                 time;
+    heap_v1::closure_t*                 heap;
+
+    uint32_t                            num_channels;
+    channel_slot_t*                     channels;
+    channel_v1::endpoint*               deferred;   //!< Endpoints with events held back by masking.
+    uint32_t                            num_deferred;
+    bool                                events_masked;
+
+    timer_wheel_t                       wheel;
+    timeout_t*                          timeouts;   //!< Pool of num_timeouts entries.
+    dl_link_t<timeout_t>                free_timeouts;
+    dl_link_t<timeout_t>*               buckets;    //!< Hash of pending timeouts.
+    uint32_t                            bucket_mask;
+    bool                                timeouts_masked;
+};
+
+/**
+ * Dispatcher state is touched both from the activation handler and from normal context, keep activations off
+ * while it is updated.
+ */
+class activations_off_t
+{
+    vcpu_v1::closure_t* vcpu;
+    bool reenable;
+public:
+    inline activations_off_t(vcpu_v1::closure_t* vcpu_) : vcpu(vcpu_)
+    {
+        reenable = vcpu->are_activations_enabled();
+        if (reenable)
+            vcpu->disable_activations();
+    }
+    inline ~activations_off_t()
+    {
+        if (reenable)
+            vcpu->enable_activations();
+    }
+};
+
+//======================================================================================================================
+// Helper functions.
+//======================================================================================================================
+
+static inline dl_link_t<timeout_t>& bucket(activation_dispatcher_v1::state_t* st, time_v1::time deadline, void* handle)
+{
+    uint32_t h = uint32_t(reinterpret_cast<address_t>(handle)) ^ uint32_t(deadline >> timer_wheel_t::TICK_SHIFT);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return st->buckets[h & st->bucket_mask];
+}
+
+static void release_timeout(activation_dispatcher_v1::state_t* st, timeout_t* t)
+{
+    t->hash_link.remove();
+    st->free_timeouts.add_to_head(t->link);
+}
+
+static void check_endpoint(activation_dispatcher_v1::state_t* st, channel_v1::endpoint ep)
+{
+    if (ep >= st->num_channels)
+        OS_RAISE(channel_v1::invalid_id, ep);
+}
+
+static void notify_channel(activation_dispatcher_v1::state_t* st, channel_v1::endpoint ep, channel_v1::endpoint_type type,
+                           event_v1::value val, channel_v1::state state)
+{
+    channel_slot_t& slot = st->channels[ep];
+
+    if (st->events_masked || slot.masked)
+    {
+        if (!slot.deferred)
+        {
+            slot.deferred = true;
+            st->deferred[st->num_deferred++] = ep;
+        }
+        return;
+    }
+
+    if (slot.notify)
+        slot.notify->notify(ep, type, val, state);
+}
+
+/**
+ * Redeliver events held back while their endpoints were masked. Current endpoint state is queried from the vcpu,
+ * as it may have changed since the event arrived.
+ */
+static void dispatch_deferred(activation_dispatcher_v1::state_t* st)
+{
+    if (st->events_masked)
+        return;
+
+    uint32_t i = 0;
+    while (i < st->num_deferred)
+    {
+        channel_v1::endpoint ep = st->deferred[i];
+        channel_slot_t& slot = st->channels[ep];
+
+        if (slot.masked)
+        {
+            ++i;
+            continue;
+        }
+
+        slot.deferred = false;
+        st->deferred[i] = st->deferred[--st->num_deferred];
+
+        if (slot.notify)
+        {
+            channel_v1::endpoint_type type;
+            event_v1::value val, ack;
+            channel_v1::state state = st->vcpu->query_channel(ep, &type, &val, &ack);
+            slot.notify->notify(ep, type, val, state);
+        }
+    }
+}
+
+/**
+ * Drain the vcpu list of endpoints requiring attention.
+ * @returns true if any events were seen.
+ */
+static bool dispatch_events(activation_dispatcher_v1::state_t* st)
+{
+    channel_v1::endpoint ep;
+    channel_v1::endpoint_type type;
+    event_v1::value val;
+    channel_v1::state state;
+    bool seen = (st->num_deferred > 0) && !st->events_masked;
+
+    dispatch_deferred(st);
+
+    while (st->vcpu->get_next_event(&ep, &type, &val, &state))
+    {
+        if (ep >= st->num_channels)
+            continue;
+        notify_channel(st, ep, type, val, state);
+        seen = true;
+    }
+
+    return seen;
+}
+
+/**
+ * Run handlers of all expired timeouts. Handlers may add and remove timeouts.
+ * @returns true if any handlers were run.
+ */
+static bool dispatch_timeouts(activation_dispatcher_v1::state_t* st)
+{
+    if (st->timeouts_masked)
+        return false;
+
+    bool seen = false;
+    time_v1::time now = st->time->now();
+    timeout_t* t;
+
+    while ((t = st->wheel.next_expired(now)) != nullptr)
+    {
+        time_notify_v1::closure_t* notify = t->notify;
+        time_v1::time deadline = t->deadline;
+        void* handle = t->handle;
+
+        release_timeout(st, t);
+        notify->notify(now, deadline, handle);
+        seen = true;
+    }
+
+    return seen;
+}
+
+/**
+ * Nothing left to do: block until an event arrives or the earliest timeout expires.
+ * Only this single deadline is armed, the rest of the wheel is inspected when we are activated again.
+ */
+static void block(activation_dispatcher_v1::state_t* st)
+{
+    timeout_t* t = st->timeouts_masked ? nullptr : st->wheel.earliest();
+    st->vcpu->rfa_block(t ? t->deadline : FOREVER);
+}
+
+//======================================================================================================================
+// activation_v1 implementation
+//======================================================================================================================
+
+static void
+activation_v1_go(activation_v1::closure_t* self, vcpu_v1::closure_t* vcpu, activation_v1::reason reason)
+{
+    activation_dispatcher_v1::state_t* st = reinterpret_cast<activation_dispatcher_v1::state_t*>(self->d_state);
+
+    dispatch_events(st);
+    dispatch_timeouts(st);
+
+    if (st->handler)
+        st->handler->go(vcpu, reason);
+
+    block(st);
+}
+
+static const activation_v1::ops_t activation_v1_methods =
+{
+    activation_v1_go
+};
+
+//======================================================================================================================
+// activation_dispatcher_v1 implementation
+//======================================================================================================================
+
+static channel_notify_v1::closure_t*
+activation_dispatcher_v1_attach(activation_dispatcher_v1::closure_t* self, channel_notify_v1::closure_t* notify, channel_v1::rx rx)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+    check_endpoint(st, rx);
+
+    if (notify)
+    {
+        channel_v1::endpoint_type type;
+        event_v1::value val, ack;
+        channel_v1::state state = st->vcpu->query_channel(rx, &type, &val, &ack);
+        if (type == channel_v1::endpoint_type_tx || state == channel_v1::state_free || state == channel_v1::state_dead)
+            OS_RAISE(channel_v1::bad_state_id, rx);
+    }
+
+    activations_off_t off(st->vcpu);
+    channel_notify_v1::closure_t* old = st->channels[rx].notify;
+    st->channels[rx].notify = notify;
+    return old;
+}
+
+static bool
+activation_dispatcher_v1_mask_event(activation_dispatcher_v1::closure_t* self, channel_v1::rx rx)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+    check_endpoint(st, rx);
+
+    activations_off_t off(st->vcpu);
+    bool was_masked = st->channels[rx].masked;
+    st->channels[rx].masked = true;
+    return !was_masked;
+}
+
+static bool
+activation_dispatcher_v1_unmask_event(activation_dispatcher_v1::closure_t* self, channel_v1::rx rx)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+    check_endpoint(st, rx);
+
+    activations_off_t off(st->vcpu);
+    bool was_masked = st->channels[rx].masked;
+    st->channels[rx].masked = false;
+    return was_masked;
+}
+
+static void
+activation_dispatcher_v1_mask_events(activation_dispatcher_v1::closure_t* self)
+{
+    self->d_state->events_masked = true;
+}
+
+static void
+activation_dispatcher_v1_unmask_events(activation_dispatcher_v1::closure_t* self)
+{
+    self->d_state->events_masked = false;
+}
+
+static bool
+activation_dispatcher_v1_add_timeout(activation_dispatcher_v1::closure_t* self, time_notify_v1::closure_t* notify,
+                                     time_v1::time deadline, void* handle)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+
+    if (deadline <= st->time->now())
+        return false;
+
+    activations_off_t off(st->vcpu);
+
+    if (st->free_timeouts.is_empty())
+        OS_RAISE(activation_dispatcher_v1::too_many_timeouts_id, 0);
+
+    timeout_t* t = *st->free_timeouts.next();
+    t->link.remove();
+    t->deadline = deadline;
+    t->notify = notify;
+    t->handle = handle;
+
+    st->wheel.insert(t);
+    bucket(st, deadline, handle).add_to_head(t->hash_link);
+    return true;
+}
+
+static bool
+activation_dispatcher_v1_remove_timeout(activation_dispatcher_v1::closure_t* self, time_v1::time deadline, void* handle)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+    activations_off_t off(st->vcpu);
+
+    dl_link_t<timeout_t>& head = bucket(st, deadline, handle);
+    for (dl_link_t<timeout_t>* l = head.next(); l && l != &head; l = l->next())
+    {
+        timeout_t* t = *l;
+        if (t->deadline == deadline && t->handle == handle)
+        {
+            st->wheel.remove(t);
+            release_timeout(st, t);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+activation_dispatcher_v1_mask_timeouts(activation_dispatcher_v1::closure_t* self)
+{
+    self->d_state->timeouts_masked = true;
+}
+
+static void
+activation_dispatcher_v1_unmask_timeouts(activation_dispatcher_v1::closure_t* self)
+{
+    self->d_state->timeouts_masked = false;
+}
+
+static activation_v1::closure_t*
+activation_dispatcher_v1_set_handler(activation_dispatcher_v1::closure_t* self, activation_v1::closure_t* activation)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+    activations_off_t off(st->vcpu);
+    activation_v1::closure_t* old = st->handler;
+    st->handler = activation;
+    return old;
+}
+
+/**
+ * Return to the caller if anything was dispatched, so it can run whatever has become runnable,
+ * otherwise block until the next event or timeout.
+ */
+static void
+activation_dispatcher_v1_reactivate(activation_dispatcher_v1::closure_t* self)
+{
+    activation_dispatcher_v1::state_t* st = self->d_state;
+
+    st->vcpu->disable_activations();
+
+    bool events = dispatch_events(st);
+    bool timeouts = dispatch_timeouts(st);
+
+    if (events || timeouts)
+    {
+        st->vcpu->rfa();
+        return;
+    }
+
+    block(st);
+}
+
+static const activation_dispatcher_v1::ops_t activation_dispatcher_v1_methods =
+{
+    activation_dispatcher_v1_attach,
+    activation_dispatcher_v1_mask_event,
+    activation_dispatcher_v1_unmask_event,
+    activation_dispatcher_v1_mask_events,
+    activation_dispatcher_v1_unmask_events,
+    activation_dispatcher_v1_add_timeout,
+    activation_dispatcher_v1_remove_timeout,
+    activation_dispatcher_v1_mask_timeouts,
+    activation_dispatcher_v1_unmask_timeouts,
+    activation_dispatcher_v1_set_handler,
+    activation_dispatcher_v1_reactivate
+};
+
+//======================================================================================================================
+// activation_dispatcher_factory_v1 implementation
+//======================================================================================================================
+
+static activation_dispatcher_v1::closure_t*
+activation_dispatcher_factory_v1_create(activation_dispatcher_factory_v1::closure_t* self, vcpu_v1::closure_t* vcpu,
+                                        time_v1::closure_t* time, heap_v1::closure_t* heap, uint32_t num_timeouts,
+                                        activation_v1::closure_t** activation_handler)
+{
+    activation_dispatcher_v1::state_t* st = new(heap) activation_dispatcher_v1::state_t;
+    if (!st)
+        OS_RAISE(heap_v1::no_memory_id, 0);
+
+    st->handler = nullptr;
+    st->vcpu = vcpu;
+    st->time = time;
+    st->heap = heap;
+    st->events_masked = false;
+    st->timeouts_masked = false;
+
+    st->num_channels = vcpu->num_channels();
+    st->channels = new(heap) channel_slot_t [st->num_channels];
+    st->deferred = new(heap) channel_v1::endpoint [st->num_channels];
+    st->num_deferred = 0;
+    for (uint32_t i = 0; i < st->num_channels; ++i)
+    {
+        st->channels[i].notify = nullptr;
+        st->channels[i].masked = false;
+        st->channels[i].deferred = false;
+    }
+
+    uint32_t num_buckets = 1;
+    while (num_buckets < num_timeouts)
+        num_buckets <<= 1;
+    st->bucket_mask = num_buckets - 1;
+    st->buckets = new(heap) dl_link_t<timeout_t> [num_buckets];
+
+    st->timeouts = new(heap) timeout_t [num_timeouts];
+    st->free_timeouts.init();
+    for (uint32_t i = 0; i < num_timeouts; ++i)
+    {
+        st->timeouts[i].link.init(&st->timeouts[i]);
+        st->timeouts[i].hash_link.init(&st->timeouts[i]);
+        st->free_timeouts.add_to_tail(st->timeouts[i].link);
+    }
+
+    st->wheel.init(time->now());
+
+    closure_init(&st->closure, &activation_dispatcher_v1_methods, st);
+    closure_init(&st->activation, &activation_v1_methods, reinterpret_cast<activation_v1::state_t*>(st));
+
+    *activation_handler = &st->activation;
+    return &st->closure;
+}
+
+static const activation_dispatcher_factory_v1::ops_t activation_dispatcher_factory_v1_methods =
+{
+    activation_dispatcher_factory_v1_create
+};
+
+static activation_dispatcher_factory_v1::closure_t clos =
+{
+    &activation_dispatcher_factory_v1_methods,
+    NULL
+};
+
+EXPORT_CLOSURE_TO_ROOTDOM(activation_dispatcher_factory, v1, clos);
@@ -0,0 +1,189 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "types.h"
+#include "doubly_linked_list.h"
+#include "time_v1_interface.h"
+#include "time_notify_v1_interface.h"
+
+/**
+ * Pending timeout, allocated from the dispatcher's fixed pool.
+ */
+struct timeout_t
+{
+    dl_link_t<timeout_t>        link;      //!< Wheel slot, overflow list or free list.
+    dl_link_t<timeout_t>        hash_link; //!< Lookup by (deadline, handle) for remove_timeout().
+    time_v1::time               deadline;
+    time_notify_v1::closure_t*  notify;
+    void*                       handle;
+    uint8_t                     level;     //!< Wheel level, LEVELS for the overflow list.
+    uint8_t                     slot;
+};
+
+/**
+ * Hierarchical timing wheel.
+ *
+ * Time is counted in ticks of 2^TICK_SHIFT ns. A timeout goes to the level of the highest group of SLOT_BITS bits
+ * in which its tick differs from the current tick, and to the slot given by that group of its tick. Therefore
+ * every timeout on level n expires after every timeout on levels below n, and within a level slots are ordered
+ * by time, so the earliest timeout is found with one bit scan per level. Timeouts further away than the top level
+ * covers are kept on an unordered overflow list.
+ *
+ * Adding and removing a timeout are O(1). Advancing the current tick cascades at most one slot per level.
+ */
+class timer_wheel_t
+{
+public:
+    static const unsigned TICK_SHIFT = 20; // ~1ms
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1 << SLOT_BITS;
+    static const unsigned LEVELS = 4;      // 2^44ns, ~4.9 hours
+
+    void init(time_v1::time now)
+    {
+        current = tick(now);
+        for (unsigned l = 0; l < LEVELS; ++l)
+        {
+            occupied[l] = 0;
+            for (unsigned s = 0; s < SLOTS; ++s)
+                slots[l][s].init();
+        }
+        overflow.init();
+    }
+
+    void insert(timeout_t* t)
+    {
+        uint64_t diff = tick(t->deadline) ^ current;
+        unsigned level = diff ? (63 - __builtin_clzll(diff)) / SLOT_BITS : 0;
+
+        if (level >= LEVELS)
+        {
+            t->level = LEVELS;
+            overflow.add_to_tail(t->link);
+            return;
+        }
+
+        t->level = level;
+        t->slot = (tick(t->deadline) >> (level * SLOT_BITS)) & (SLOTS - 1);
+        slots[level][t->slot].add_to_tail(t->link);
+        occupied[level] |= 1ULL << t->slot;
+    }
+
+    void remove(timeout_t* t)
+    {
+        t->link.remove();
+        if (t->level < LEVELS && slots[t->level][t->slot].is_empty())
+            occupied[t->level] &= ~(1ULL << t->slot);
+    }
+
+    /**
+     * Find the earliest pending timeout.
+     * @returns nullptr if there are none.
+     */
+    timeout_t* earliest()
+    {
+        for (unsigned l = 0; l < LEVELS; ++l)
+            if (occupied[l])
+                return earliest_in(slots[l][__builtin_ctzll(occupied[l])]);
+        return earliest_in(overflow);
+    }
+
+    /**
+     * Remove and return one timeout with deadline at or before "now".
+     * @returns nullptr if nothing has expired.
+     */
+    timeout_t* next_expired(time_v1::time now)
+    {
+        timeout_t* t = earliest();
+
+        if (!t || t->deadline > now)
+        {
+            advance(t ? min(tick(now), tick(t->deadline)) : tick(now));
+            return nullptr;
+        }
+
+        advance(tick(t->deadline));
+        remove(t);
+        return t;
+    }
+
+private:
+    dl_link_t<timeout_t> slots[LEVELS][SLOTS];
+    uint64_t             occupied[LEVELS]; //!< Bitmap of non-empty slots per level.
+    dl_link_t<timeout_t> overflow;
+    uint64_t             current;          //!< Tick the wheel is positioned at.
+
+    static inline uint64_t tick(time_v1::time t)
+    {
+        return uint64_t(t) >> TICK_SHIFT;
+    }
+
+    static inline uint64_t min(uint64_t a, uint64_t b)
+    {
+        return a < b ? a : b;
+    }
+
+    static timeout_t* earliest_in(dl_link_t<timeout_t>& list)
+    {
+        timeout_t* result = nullptr;
+        for (dl_link_t<timeout_t>* l = list.next(); l && l != &list; l = l->next())
+            if (!result || (*l)->deadline < result->deadline)
+                result = *l;
+        return result;
+    }
+
+    /**
+     * Move all timeouts from a list back into the wheel, relative to the current tick.
+     */
+    void redistribute(dl_link_t<timeout_t>& list)
+    {
+        // Detach everything first, overflow entries may go straight back to the overflow list.
+        dl_link_t<timeout_t> pending;
+        while (!list.is_empty())
+        {
+            timeout_t* t = *list.next();
+            t->link.remove();
+            pending.add_to_tail(t->link);
+        }
+        while (!pending.is_empty())
+        {
+            timeout_t* t = *pending.next();
+            t->link.remove();
+            insert(t);
+        }
+    }
+
+    /**
+     * Move the wheel to tick "to", which must not be past the earliest pending timeout.
+     * Under that condition the only timeouts out of place are in the slots that "to" selects on each level
+     * where it differs from the old tick; those are cascaded down, top level first.
+     */
+    void advance(uint64_t to)
+    {
+        uint64_t from = current;
+        if (to <= from)
+            return;
+        current = to;
+
+        if ((to >> (LEVELS * SLOT_BITS)) != (from >> (LEVELS * SLOT_BITS)))
+            redistribute(overflow);
+
+        for (unsigned l = LEVELS - 1; l > 0; --l)
+        {
+            if ((to >> (l * SLOT_BITS)) == (from >> (l * SLOT_BITS)))
+                continue;
+            unsigned s = (to >> (l * SLOT_BITS)) & (SLOTS - 1);
+            if (!(occupied[l] & (1ULL << s)))
+                continue;
+            occupied[l] &= ~(1ULL << s);
+            redistribute(slots[l][s]);
+        }
+    }
+};
@@ -15,6 +15,7 @@
 #include "module_interface.h"
 #include "exceptions.h"
 #include "panic.h"
+#include "trace.h"
 #include <unordered_map>
 #include "heap_new.h"
 #include "heap_allocator.h"
@@ -40,7 +41,7 @@ struct hash<const char*>
     size_t operator ()(const char* key) const
     {
         size_t hash = elf32::elf_hash(key);
-        logger::trace() << "hash: key '" << key << "', hash " << hash;
+        TRACE_DEBUG("naming_context: key %p hashes to %08x", key, hash);
         return hash;
     }
 };
@@ -51,7 +52,7 @@ class equal_to<const char*>
 public:
     bool operator ()(const char* left, const char* right) const
     {
-        logger::trace() << "equal_to: left '" << left << "' and right '" << right << "'";
+        TRACE_DEBUG("naming_context: comparing keys %p and %p", left, right);
         return stringref_t(left) == stringref_t(right);
     }
 };
@@ -100,12 +101,7 @@ get(naming_context_v1::closure_t *self, const char *key, types::any *out_value)
     if (!refs.second.empty())
         key = string_n_copy(refs.first.data(), refs.first.size(), PVS(heap)); // @todo MEMLEAK
 
-    logger::trace() << "naming_context.get: listing existing keys";
-    for (auto x : self->d_state->map) // TODO: remove this loop, debug only!
-    {
-        stringref_t k(x.first);
-        logger::trace() << k.data() << ", length " << k.size();
-    }
+    TRACE_DEBUG("naming_context.get: %u keys, looking up %p", state->map.size(), key);
 
     // D(stringref_t k(key);
     // kconsole << "naming_context.get: finding key " << k.data() << ", length " << k.size();)
@@ -150,7 +146,7 @@ get(naming_context_v1::closure_t *self, const char *key, types::any *out_value)
             {
                 // Have to check for exceptions presence, since get is caled before exception system is set up.
                 if(PVS(exceptions)) {
-                    OS_RAISE((exception_support_v1::id)"naming_context_v1.not_context", 0);
+                    OS_RAISE(naming_context_v1::not_context_id, 0);
                 } else {
                     logger::warning() << __FUNCTION__ << ": not a context " << (*it).first;
                     return false;
@@ -201,11 +197,11 @@ add(naming_context_v1::closure_t *self, const char *key, types::any value)
     {
         if (it != state->map.end())
         {
-            OS_RAISE((exception_support_v1::id)"naming_context_v1.exists", 0);
+            OS_RAISE(naming_context_v1::exists_id, 0);
         }
         else
         {
-            logger::trace() << "adding " << key << "=>" << value;
+            TRACE_DEBUG("naming_context.add: key %p", key);
             state->map.insert(make_pair(key, value));
             return;
         }
@@ -233,11 +229,11 @@ add(naming_context_v1::closure_t *self, const char *key, types::any value)
             }
             else
             {
-                OS_RAISE((exception_support_v1::id)"naming_context_v1.not_context", 0);
+                OS_RAISE(naming_context_v1::not_context_id, 0);
             }
         }
         // Haven't found this item
-        OS_RAISE((exception_support_v1::id)"naming_context_v1.not_found", (exception_support_v1::args)key);
+        OS_RAISE(naming_context_v1::not_found_id, (exception_support_v1::args)key);
     }
 }
 
@@ -267,7 +263,7 @@ remove(naming_context_v1::closure_t *self, const char *key)
         }
         else
         {
-            OS_RAISE((exception_support_v1::id)"naming_context_v1.not_found", (exception_support_v1::args)key);
+            OS_RAISE(naming_context_v1::not_found_id, (exception_support_v1::args)key);
         }
     }
     else
@@ -288,11 +284,11 @@ remove(naming_context_v1::closure_t *self, const char *key)
             }
             else
             {
-                OS_RAISE((exception_support_v1::id)"naming_context_v1.not_context", 0);
+                OS_RAISE(naming_context_v1::not_context_id, 0);
             }
         }
         // Haven't found this item
-        OS_RAISE((exception_support_v1::id)"naming_context_v1.not_found", (exception_support_v1::args)key);
+        OS_RAISE(naming_context_v1::not_found_id, (exception_support_v1::args)key);
     }
 }
 
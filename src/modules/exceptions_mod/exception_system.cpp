@@ -49,13 +49,13 @@ internal_raise(bool initial_raise, exception_support_v1::closure_t* self, except
 
     if (!ctx)
     {
-        kconsole << "Unhandled exception " << (const char*)i << " raised from " << filename << ":" << (int)lineno << " (in function " << funcname << ")" << endl;
+        kconsole << "Unhandled exception " << xcp_name(i) << " raised from " << filename << ":" << (int)lineno << " (in function " << funcname << ")" << endl;
         PANIC("unhandled exception system abort");
         /* TODO: abort domain; threads' top-level fn should have a handler */
     }
 
     ctx->state    = xcp_active;
-    ctx->name     = (const char*)i;
+    ctx->id       = i;
     ctx->args     = a;
     ctx->filename = filename;
     ctx->line     = lineno;
@@ -124,7 +124,7 @@ exception_support_setjmp_v1_pop_context(exception_support_setjmp_v1::closure_t*
     if (prev_state == xcp_active)
     {
         /* Exception was active, so propagate it up. */
-        internal_raise(false, reinterpret_cast<exception_support_v1::closure_t*>(self), (exception_support_v1::id)ctx->name, ctx->args, filename, lineno, funcname);
+        internal_raise(false, reinterpret_cast<exception_support_v1::closure_t*>(self), ctx->id, ctx->args, filename, lineno, funcname);
         /* NOTREACHED */
     }
     else if (ctx->args)
@@ -0,0 +1,554 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "nemesis/exception_support_setjmp_v1_interface.h"
+#include "nemesis/exception_support_setjmp_v1_impl.h"
+#include "nemesis/exception_system_v1_interface.h"
+#include "nemesis/exception_system_v1_impl.h"
+#include "heap_v1_interface.h"
+#include "infopage.h"
+#include "logger.h"
+#include "default_console.h"
+#include "module_interface.h"
+#include "heap_new.h"
+#include "exceptions.h"
+#include "exceptions_unwind.h"
+#include "bootinfo.h"
+#include "lockable.h"
+#include "memutils.h"
+#include "panic.h"
+#include "libunwind.h"
+
+/**
+ * Unwinding exception system.
+ *
+ * OS_TRY blocks are C++ try blocks (see CONFIG_EXCEPTIONS_UNWIND in exceptions.h). Raise throws the exception record
+ * with libunwind, which finds the handlers using the .eh_frame unwind tables of the loaded modules and the
+ * personality routine below. Nothing is done on entry to a TRY block, all the cost is in the raise.
+ *
+ * There is no dynamic linker to report loaded modules to libunwind, so .eh_frame of every module found by the module
+ * loader is indexed and registered as a dynamic unwind table before the exception is thrown.
+ */
+
+//=====================================================================================================================
+// DWARF pointer encodings, used by both .eh_frame and LSDA.
+//=====================================================================================================================
+
+enum
+{
+    DW_EH_PE_absptr  = 0x00,
+    DW_EH_PE_uleb128 = 0x01,
+    DW_EH_PE_udata2  = 0x02,
+    DW_EH_PE_udata4  = 0x03,
+    DW_EH_PE_udata8  = 0x04,
+    DW_EH_PE_sleb128 = 0x09,
+    DW_EH_PE_sdata2  = 0x0a,
+    DW_EH_PE_sdata4  = 0x0b,
+    DW_EH_PE_sdata8  = 0x0c,
+    DW_EH_PE_pcrel   = 0x10,
+    DW_EH_PE_funcrel = 0x40,
+    DW_EH_PE_aligned = 0x50,
+    DW_EH_PE_indirect = 0x80,
+    DW_EH_PE_omit    = 0xff
+};
+
+static uint32_t read_uleb128(const uint8_t*& p)
+{
+    uint32_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+        byte = *p++;
+        result |= uint32_t(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return result;
+}
+
+static int32_t read_sleb128(const uint8_t*& p)
+{
+    uint32_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+        byte = *p++;
+        result |= uint32_t(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if ((byte & 0x40) && shift < 32)
+        result |= ~0u << shift;
+    return int32_t(result);
+}
+
+template <typename T>
+static inline T read_unaligned(const uint8_t* p)
+{
+    T value;
+    memutils::copy_memory(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Read a pointer in the given encoding. Only pc-relative application is supported, which is what the compiler emits
+ * for i386 besides absolute pointers, function-relative values are returned as offsets.
+ */
+static address_t read_encoded(const uint8_t*& p, uint8_t encoding)
+{
+    if (encoding == DW_EH_PE_omit)
+        return 0;
+
+    const uint8_t* start = p;
+    address_t result;
+    switch (encoding & 0x0f)
+    {
+        case DW_EH_PE_absptr:  result = read_unaligned<uint32_t>(p); p += 4; break;
+        case DW_EH_PE_uleb128: result = read_uleb128(p); break;
+        case DW_EH_PE_udata2:  result = read_unaligned<uint16_t>(p); p += 2; break;
+        case DW_EH_PE_udata4:  result = read_unaligned<uint32_t>(p); p += 4; break;
+        case DW_EH_PE_udata8:  result = read_unaligned<uint64_t>(p); p += 8; break;
+        case DW_EH_PE_sleb128: result = read_sleb128(p); break;
+        case DW_EH_PE_sdata2:  result = read_unaligned<int16_t>(p); p += 2; break;
+        case DW_EH_PE_sdata4:  result = read_unaligned<int32_t>(p); p += 4; break;
+        case DW_EH_PE_sdata8:  result = read_unaligned<int64_t>(p); p += 8; break;
+        default:
+            PANIC("Unsupported DWARF pointer encoding");
+    }
+
+    if (result && (encoding & 0x70) == DW_EH_PE_pcrel)
+        result += address_t(start);
+    if (result && (encoding & DW_EH_PE_indirect))
+        result = *reinterpret_cast<const address_t*>(result);
+    return result;
+}
+
+//=====================================================================================================================
+// Unwind tables registration.
+//=====================================================================================================================
+
+/**
+ * Sorted index of one module's .eh_frame in the format libunwind searches, offsets are relative to .eh_frame start.
+ */
+struct fde_index_t
+{
+    int32_t start_ip_offset;
+    int32_t fde_offset;
+};
+
+// Registration record of one module, followed by its index.
+struct module_unwind_info_t
+{
+    unw_dyn_info_t info;
+
+    inline fde_index_t* index() { return reinterpret_cast<fde_index_t*>(this + 1); }
+};
+
+static lockable_t registration_lock;
+static module_loader_t::module_entry* last_registered = 0; // Modules are added at the front of the list.
+
+// Augmentation of a CIE this module cares about: how FDE addresses are encoded.
+static bool parse_cie(const uint8_t* cie, uint8_t& fde_encoding)
+{
+    const uint8_t* p = cie + 8; // length and CIE id
+    uint8_t version = *p++;
+    const char* augmentation = reinterpret_cast<const char*>(p);
+    while (*p++)
+        ;
+    if (augmentation[0] == 'e' && augmentation[1] == 'h')
+        p += sizeof(address_t);
+    read_uleb128(p); // code alignment
+    read_sleb128(p); // data alignment
+    if (version == 1)
+        ++p;
+    else
+        read_uleb128(p); // return address register
+
+    fde_encoding = DW_EH_PE_absptr;
+    if (augmentation[0] != 'z')
+        return augmentation[0] == 0;
+
+    read_uleb128(p); // augmentation data length
+    for (const char* a = augmentation + 1; *a; ++a)
+    {
+        switch (*a)
+        {
+            case 'R': fde_encoding = *p++; break;
+            case 'L': ++p; break;
+            case 'P': { uint8_t enc = *p++; read_encoded(p, enc & ~DW_EH_PE_indirect); break; }
+            case 'S': break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+static void register_module(module_loader_t::module_entry& module)
+{
+    if (!module.eh_frame_start || !module.eh_frame_size)
+        return;
+
+    const uint8_t* eh_frame = reinterpret_cast<const uint8_t*>(module.eh_frame_start);
+    const uint8_t* end = eh_frame + module.eh_frame_size;
+
+    size_t n_fdes = 0;
+    for (const uint8_t* p = eh_frame; p + 4 <= end; )
+    {
+        uint32_t length = read_unaligned<uint32_t>(p);
+        if (length == 0 || length == 0xffffffff)
+            break;
+        if (read_unaligned<uint32_t>(p + 4) != 0)
+            ++n_fdes;
+        p += length + 4;
+    }
+    if (!n_fdes)
+        return;
+
+    module_unwind_info_t* unwind = reinterpret_cast<module_unwind_info_t*>(
+        PVS(heap)->allocate(sizeof(module_unwind_info_t) + n_fdes * sizeof(fde_index_t)));
+    memutils::clear_memory(unwind, sizeof(module_unwind_info_t));
+    fde_index_t* index = unwind->index();
+
+    const uint8_t* cie = 0;
+    uint8_t fde_encoding = DW_EH_PE_absptr;
+    address_t lowest = ~0U, highest = 0;
+    size_t count = 0;
+    for (const uint8_t* p = eh_frame; p + 4 <= end; )
+    {
+        uint32_t length = read_unaligned<uint32_t>(p);
+        if (length == 0 || length == 0xffffffff)
+            break;
+        uint32_t cie_offset = read_unaligned<uint32_t>(p + 4);
+        if (cie_offset != 0)
+        {
+            const uint8_t* fde_cie = p + 4 - cie_offset;
+            if (fde_cie != cie)
+            {
+                cie = fde_cie;
+                if (!parse_cie(cie, fde_encoding))
+                {
+                    logger::warning() << "Unsupported CIE augmentation in .eh_frame at " << address_t(cie);
+                    cie = 0;
+                }
+            }
+
+            const uint8_t* q = p + 8;
+            address_t pc_begin = read_encoded(q, fde_encoding);
+            address_t pc_range = read_encoded(q, fde_encoding & 0x0f);
+            if (cie && pc_range)
+            {
+                index[count].start_ip_offset = int32_t(pc_begin - module.eh_frame_start);
+                index[count].fde_offset = int32_t(address_t(p) - module.eh_frame_start);
+                ++count;
+                lowest = std::min(lowest, pc_begin);
+                highest = std::max(highest, pc_begin + pc_range);
+            }
+        }
+        p += length + 4;
+    }
+
+    std::sort(index, index + count,
+        [](const fde_index_t& a, const fde_index_t& b) { return a.start_ip_offset < b.start_ip_offset; });
+
+    unwind->info.format = UNW_INFO_FORMAT_REMOTE_TABLE;
+    unwind->info.start_ip = lowest;
+    unwind->info.end_ip = highest;
+    unwind->info.u.rti.name_ptr = address_t(module.name);
+    unwind->info.u.rti.segbase = module.eh_frame_start;
+    unwind->info.u.rti.table_len = count * sizeof(fde_index_t) / sizeof(unw_word_t);
+    unwind->info.u.rti.table_data = address_t(index);
+    _U_dyn_register(&unwind->info);
+
+    logger::debug() << "Registered " << int(count) << " FDEs for " << lowest << ".." << highest;
+}
+
+/**
+ * Register unwind tables of the modules loaded since the last call.
+ */
+static void register_new_modules()
+{
+    bootinfo_t* bi = new(bootinfo_t::ADDRESS) bootinfo_t;
+    module_loader_t modules = bi->modules();
+
+    lockable_scope_lock_t lock(registration_lock);
+
+    auto first = modules.begin();
+    for (auto it = first; it != modules.end() && &*it != last_registered; ++it)
+        register_module(*it);
+    if (first != modules.end())
+        last_registered = &*first;
+}
+
+//=====================================================================================================================
+// Personality routine.
+//=====================================================================================================================
+
+/**
+ * Find the landing pad for the exception in the frame of the given context.
+ *
+ * Handlers are the catch clauses of OS_ENDTRY, which all catch xcp_context_t, so a handler is any catch clause with
+ * a type. Handlers are chosen by exception id after landing, in OS_CATCH. Catch-all clauses and exception
+ * specifications are only emitted by the compiler to call std::terminate from noexcept functions, they are skipped:
+ * like the setjmp exception system, raise passes through such functions.
+ */
+static _Unwind_Reason_Code
+xcp_personality(int version, _Unwind_Action actions, uint64_t exception_class,
+                _Unwind_Exception* exception, _Unwind_Context* context)
+{
+    if (version != 1 || exception_class != xcp_unwind_exception_t::CLASS)
+        return _URC_FATAL_PHASE1_ERROR;
+
+    const uint8_t* lsda = reinterpret_cast<const uint8_t*>(_Unwind_GetLanguageSpecificData(context));
+    if (!lsda)
+        return _URC_CONTINUE_UNWIND;
+
+    address_t func_start = _Unwind_GetRegionStart(context);
+    address_t ip = _Unwind_GetIP(context) - 1; // Return address may already be past the call site.
+
+    uint8_t lpstart_encoding = *lsda++;
+    address_t lpstart = func_start;
+    if (lpstart_encoding != DW_EH_PE_omit)
+        lpstart = read_encoded(lsda, lpstart_encoding);
+
+    uint8_t ttype_encoding = *lsda++;
+    const uint8_t* ttype_base = 0;
+    if (ttype_encoding != DW_EH_PE_omit)
+    {
+        uint32_t offset = read_uleb128(lsda);
+        ttype_base = lsda + offset;
+    }
+
+    uint8_t call_site_encoding = *lsda++;
+    uint32_t call_site_length = read_uleb128(lsda);
+    const uint8_t* call_site_end = lsda + call_site_length;
+    const uint8_t* action_table = call_site_end;
+
+    while (lsda < call_site_end)
+    {
+        address_t start = read_encoded(lsda, call_site_encoding);
+        address_t length = read_encoded(lsda, call_site_encoding);
+        address_t landing_pad = read_encoded(lsda, call_site_encoding);
+        uint32_t action = read_uleb128(lsda);
+
+        if (ip < func_start + start)
+            break; // Call sites are sorted, ip is not in any.
+        if (ip >= func_start + start + length)
+            continue;
+        if (!landing_pad)
+            return _URC_CONTINUE_UNWIND;
+
+        int32_t selector = 0;
+        bool cleanup = action == 0;
+        if (action)
+        {
+            const uint8_t* a = action_table + action - 1;
+            for (;;)
+            {
+                int32_t filter = read_sleb128(a);
+                const uint8_t* next_record = a;
+                int32_t next = read_sleb128(a);
+
+                if (filter == 0)
+                    cleanup = true;
+                else if (filter > 0 && ttype_base)
+                {
+                    size_t entry_size = (ttype_encoding & 0x0f) == DW_EH_PE_udata2 ? 2 : 4;
+                    const uint8_t* type_entry = ttype_base - filter * entry_size;
+                    if (read_encoded(type_entry, ttype_encoding))
+                    {
+                        selector = filter;
+                        break;
+                    }
+                }
+
+                if (!next)
+                    break;
+                a = next_record + next;
+            }
+        }
+
+        if (actions & _UA_SEARCH_PHASE)
+            return selector ? _URC_HANDLER_FOUND : _URC_CONTINUE_UNWIND;
+
+        // The handler frame gets the selector of the handler found in the search phase, others run cleanups only.
+        if (!(actions & _UA_HANDLER_FRAME))
+        {
+            if (!cleanup)
+                return _URC_CONTINUE_UNWIND;
+            selector = 0;
+        }
+
+        _Unwind_SetGR(context, __builtin_eh_return_data_regno(0), address_t(exception));
+        _Unwind_SetGR(context, __builtin_eh_return_data_regno(1), selector);
+        _Unwind_SetIP(context, lpstart + landing_pad);
+        return _URC_INSTALL_CONTEXT;
+    }
+
+    // Not in the call site table: the frame cannot throw from here, leave it alone.
+    return _URC_CONTINUE_UNWIND;
+}
+
+// Resume is referenced by its libunwind alias, so that libunwind's one is linked in instead of the runtime forwarder.
+extern "C" void __libunwind_Unwind_Resume(_Unwind_Exception* exception);
+
+static const xcp_unwind_exception_t::ops_t unwind_ops =
+{
+    xcp_personality,
+    __libunwind_Unwind_Resume
+};
+
+//=====================================================================================================================
+// Unwinding exception system.
+//=====================================================================================================================
+
+struct xcp_raised_t : xcp_unwind_exception_t
+{
+    xcp_context_t record;
+};
+
+struct exception_support_setjmp_v1::state_t
+{
+    xcp_context_t*          handlers; // Contexts pushed with push_context, unused by OS_TRY.
+    lockable_t              lock;
+    xcp_unwind_exception_t* raised;   // Raised exceptions not yet freed.
+};
+
+// Free exceptions whose record has been taken by xcp_catch(). The one being raised is not on the list yet.
+static void free_caught(exception_support_setjmp_v1::state_t* state)
+{
+    lockable_scope_lock_t lock(state->lock);
+
+    xcp_unwind_exception_t** link = &state->raised;
+    while (*link)
+    {
+        xcp_raised_t* x = static_cast<xcp_raised_t*>(*link);
+        if (*const_cast<volatile xcp_state_t*>(&x->record.state) == xcp_popped)
+        {
+            *link = x->next;
+            PVS(heap)->free(address_t(x));
+        }
+        else
+            link = &x->next;
+    }
+}
+
+static void
+exception_support_setjmp_v1_raise(exception_support_v1::closure_t* self, exception_support_v1::id i, exception_support_v1::args a, const char* filename, uint32_t lineno, const char* funcname)
+{
+    logger::debug() << "__ exception_support_unwind::raise";
+    exception_support_setjmp_v1::state_t* state = reinterpret_cast<exception_support_setjmp_v1::closure_t*>(self)->d_state;
+
+    register_new_modules();
+    free_caught(state);
+
+    xcp_raised_t* x = new(PVS(heap)) xcp_raised_t;
+    if (!x)
+        PANIC("No memory to raise an exception");
+
+    memutils::clear_memory(&x->unwind, sizeof(x->unwind));
+    x->unwind.exception_class = xcp_unwind_exception_t::CLASS;
+    x->ops = &unwind_ops;
+    x->thrown = &x->record;
+    x->record.state = xcp_active;
+    x->record.id = i;
+    x->record.args = a;
+    x->record.filename = filename;
+    x->record.line = lineno;
+    x->record.funcname = funcname;
+    {
+        lockable_scope_lock_t lock(state->lock);
+        x->next = state->raised;
+        state->raised = x;
+    }
+
+    _Unwind_Reason_Code reason = _Unwind_RaiseException(&x->unwind);
+
+    // Returns only if there was no handler.
+    if (reason == _URC_END_OF_STACK)
+        kconsole << "Unhandled exception " << xcp_name(i) << " raised from " << filename << ":" << (int)lineno << " (in function " << funcname << ")" << endl;
+    else
+        kconsole << "Cannot unwind exception " << xcp_name(i) << " raised from " << filename << ":" << (int)lineno << " (in function " << funcname << "), reason " << int(reason) << endl;
+    PANIC("unhandled exception system abort");
+}
+
+static void
+exception_support_setjmp_v1_push_context(exception_support_setjmp_v1::closure_t* self, exception_support_setjmp_v1::context c)
+{
+    xcp_context_t* ctx = reinterpret_cast<xcp_context_t*>(c);
+    ctx->state = xcp_none;
+    ctx->up = self->d_state->handlers;
+    ctx->down = 0;
+    ctx->args = 0;
+    self->d_state->handlers = ctx;
+}
+
+/* precondition: ctx.state = none or active */
+static void
+exception_support_setjmp_v1_pop_context(exception_support_setjmp_v1::closure_t* self, exception_support_setjmp_v1::context c, const char* filename, uint32_t lineno, const char* funcname)
+{
+    xcp_context_t* ctx = reinterpret_cast<xcp_context_t*>(c);
+    xcp_state_t prev_state = ctx->state;
+
+    ctx->state = xcp_popped;
+    self->d_state->handlers = ctx->up;
+
+    if (prev_state == xcp_active)
+        exception_support_setjmp_v1_raise(reinterpret_cast<exception_support_v1::closure_t*>(self), ctx->id, ctx->args, filename, lineno, funcname);
+}
+
+static exception_support_v1::args
+exception_support_setjmp_v1_allocate_args(exception_support_setjmp_v1::closure_t* self, memory_v1::size size)
+{
+    logger::trace() << "__ exception_support_unwind::allocate_args " << size;
+    return PVS(heap)->allocate(size);
+}
+
+static const exception_support_setjmp_v1::ops_t exception_support_setjmp_v1_methods =
+{
+    exception_support_setjmp_v1_raise,
+    exception_support_setjmp_v1_push_context,
+    exception_support_setjmp_v1_pop_context,
+    exception_support_setjmp_v1_allocate_args
+};
+
+//=====================================================================================================================
+// The Factory
+//=====================================================================================================================
+
+static exception_support_setjmp_v1::closure_t*
+exception_system_v1_create(exception_system_v1::closure_t* self)
+{
+    kconsole << " ** Exception system - create (unwinding)" << endl;
+
+    exception_support_setjmp_v1::closure_t* cl = new(PVS(heap)) exception_support_setjmp_v1::closure_t;
+    exception_support_setjmp_v1::state_t* state = new(PVS(heap)) exception_support_setjmp_v1::state_t;
+    if (!cl || !state)
+    {
+        kconsole << " + FAILED to get memory for exception system. This is quite fatal." << endl;
+        return 0; // Not much point in raising an exception here.
+    }
+
+    state->handlers = 0;
+    state->raised = 0;
+    closure_init(cl, &exception_support_setjmp_v1_methods, state);
+
+    // Frames of the modules loaded so far are on the stack of every raise, index them once now.
+    register_new_modules();
+    return cl;
+}
+
+static const exception_system_v1::ops_t exception_system_v1_methods =
+{
+    exception_system_v1_create
+};
+
+static exception_system_v1::closure_t clos =
+{
+    &exception_system_v1_methods,
+    NULL
+};
+
+EXPORT_CLOSURE_TO_ROOTDOM(exception_system, v1, clos);
@@ -10,6 +10,7 @@
 #include "memory.h"
 #include "debugger.h"
 #include "logger.h"
+#include "trace.h"
 #include "default_console.h"
 #include "panic.h"
 #include "config.h" // for HEAP_DEBUG
@@ -296,7 +297,7 @@ void *heap_t::allocate(size_t size)
     check_integrity();
 #endif
 
-    logger::trace() << "heap_t::allocate(" << size << ") returning " << (free_block + 1);
+    TRACE_DEBUG("heap_t::allocate(%u) returning %p", size, free_block + 1);
     return free_block + 1;
 }
 
@@ -317,7 +318,7 @@ void heap_t::free(void *p)
     }
     
     to_free = reinterpret_cast<heap_rec_t*>(p) - 1;
-    logger::trace() << "heap_t::free(" << p << ") freeing " << to_free;
+    TRACE_DEBUG("heap_t::free(%p) freeing %p", p, to_free);
     nextblock = next_block(to_free);
     
     to_free->next = blocks[to_free->index];
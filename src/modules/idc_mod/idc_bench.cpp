@@ -0,0 +1,114 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// IDC ping-pong benchmark: round trip latency and bulk throughput through generated idc_ping_v1 stubs
+// over the shared memory transport.
+//
+// Until the domain manager can start a second domain both ends run in the calling domain, the server end
+// is served from the client's wait loop. Numbers therefore include marshalling, copying and signalling
+// through shared stretches, but not the cost of a domain switch.
+//
+#include "shm_transport.h"
+#include "idc_ping_v1_interface.h"
+#include "idc_ping_v1_impl.h"
+#include "closure_interface.h"
+#include "closure_impl.h"
+#include "default_console.h"
+#include "cpu.h"
+
+static const size_t BUFFER_SIZE = 64*KiB;
+static const uint32_t PING_ROUNDS = 10000;
+static const uint32_t PUT_ROUNDS = 1000;
+static const size_t put_sizes[] = { 64, 1*KiB, 16*KiB, 60*KiB };
+
+//======================================================================================================================
+// idc_ping_v1 server
+//======================================================================================================================
+
+static uint32_t idc_ping_v1_ping(idc_ping_v1::closure_t* self, uint32_t seq)
+{
+    return seq;
+}
+
+static uint32_t idc_ping_v1_put(idc_ping_v1::closure_t* self, idc_ping_v1::payload data)
+{
+    return data.size();
+}
+
+static const idc_ping_v1::ops_t idc_ping_v1_methods =
+{
+    idc_ping_v1_ping,
+    idc_ping_v1_put
+};
+
+//======================================================================================================================
+// Benchmark entry
+//======================================================================================================================
+
+static void report(const char* what, uint32_t rounds, uint64_t cycles, size_t bytes)
+{
+    kconsole << what << ": " << int32_t(rounds) << " calls, " << int32_t(cycles / rounds) << " cycles per call";
+    if (bytes)
+        kconsole << ", " << int32_t(uint64_t(bytes) * rounds * 1000 / cycles) << " bytes per kcycle";
+    kconsole << endl;
+}
+
+static void entry(closure::closure_t* self)
+{
+    kconsole << "=================================" << endl
+             << "   IDC shared memory benchmark"    << endl
+             << "=================================" << endl;
+
+    idc_ping_v1::closure_t server;
+    closure_init(&server, &idc_ping_v1_methods, static_cast<idc_ping_v1::state_t*>(nullptr));
+
+    channel_v1::pair polling = { 0, 0 };
+    shm_transport_v1::server srv;
+    auto binding = shm_transport_closure.connect(BUFFER_SIZE, &server,
+        reinterpret_cast<shm_transport_v1::dispatcher>(idc_ping_v1::idc::dispatch), polling, polling, &srv);
+    shm_transport_set_loopback(srv);
+
+    idc_ping_v1::closure_t client;
+    idc_ping_v1::idc::init_surrogate(&client, binding);
+
+    uint64_t start = x86_cpu_t::read_tsc();
+    for (uint32_t i = 0; i < PING_ROUNDS; ++i)
+    {
+        if (client.ping(i) != i)
+        {
+            kconsole << RED << "IDC ping returned wrong sequence number at round " << int32_t(i) << WHITE << endl;
+            break;
+        }
+    }
+    report("ping", PING_ROUNDS, x86_cpu_t::read_tsc() - start, 0);
+
+    for (auto size : put_sizes)
+    {
+        idc_ping_v1::payload data(size);
+        start = x86_cpu_t::read_tsc();
+        for (uint32_t i = 0; i < PUT_ROUNDS; ++i)
+            client.put(data);
+        report("put", PUT_ROUNDS, x86_cpu_t::read_tsc() - start, size);
+    }
+
+    binding->destroy();
+    shm_transport_closure.close(srv);
+}
+
+static const closure::ops_t methods =
+{
+    entry
+};
+
+static const closure::closure_t clos =
+{
+    &methods,
+    NULL
+};
+
+extern "C" const closure::closure_t* const exported_idc_bench_rootdom = &clos;
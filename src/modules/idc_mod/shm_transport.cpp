@@ -0,0 +1,316 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Same-machine IDC transport: request and reply stretches shared between client and server,
+// messages are announced through event counts attached to a pair of event channels.
+//
+#include "shm_transport.h"
+#include "shm_transport_v1_impl.h"
+#include "idc_client_binding_v1_impl.h"
+#include "events_v1_interface.h"
+#include "heap_v1_interface.h"
+#include "system_stretch_allocator_v1_interface.h"
+#include "shm_transport_v1_interface.h"
+#include "exceptions.h"
+#include "heap_new.h"
+#include "memory.h"
+#include "cpu.h"
+
+//======================================================================================================================
+// Signalling helpers.
+//======================================================================================================================
+
+/**
+ * Make the message visible to the peer. x86 does not reorder stores, so a compiler barrier is enough to
+ * have the payload written before the sequence number.
+ */
+static void shm_publish(shm_header_t* header, uint32_t sequence, shm_end_t& end)
+{
+    asm volatile("" ::: "memory");
+    header->sequence = sequence;
+    if (end.tx)
+        PVS(events)->advance(end.tx, 1);
+}
+
+static inline bool shm_arrived(shm_header_t* header, uint32_t sequence)
+{
+    return int32_t(header->sequence - sequence) >= 0;
+}
+
+static void shm_wait(shm_header_t* header, uint32_t sequence, shm_end_t& end)
+{
+    if (end.rx)
+        PVS(events)->await(end.rx, sequence);
+
+    while (!shm_arrived(header, sequence))
+    {
+        if (end.idle)
+            end.idle(end.idle_arg);
+        else
+            x86_cpu_t::pause();
+    }
+    asm volatile("" ::: "memory");
+}
+
+static inline address_t shm_payload(shm_header_t* header)
+{
+    return reinterpret_cast<address_t>(header + 1);
+}
+
+static void shm_attach(shm_end_t& end, channel_v1::pair channels)
+{
+    end.tx = end.rx = nullptr;
+    end.idle = nullptr;
+    end.idle_arg = nullptr;
+
+    if (!channels.sender && !channels.receiver)
+        return;
+
+    event_v1::pair events;
+    events.sender = end.tx = PVS(events)->create();
+    events.receiver = end.rx = PVS(events)->create();
+    PVS(events)->attach_pair(events, channels);
+}
+
+static void shm_detach(shm_end_t& end)
+{
+    if (end.tx)
+        PVS(events)->destroy(end.tx);
+    if (end.rx)
+        PVS(events)->destroy(end.rx);
+    end.tx = end.rx = nullptr;
+}
+
+//======================================================================================================================
+// idc_client_binding_v1 implementation
+//======================================================================================================================
+
+static idc_v1::buffer_desc start_request(idc_client_binding_v1::closure_t* self, uint32_t operation, uint32_t flags)
+{
+    idc_client_binding_v1::state_t* state = self->d_state;
+    shm_connection_t* conn = state->connection;
+
+    conn->request->operation = operation;
+    conn->request->flags = flags;
+    marshal::reset(&state->request, shm_payload(conn->request), conn->payload_size);
+    return &state->request;
+}
+
+static idc_v1::buffer_desc
+idc_client_binding_v1_init_call(idc_client_binding_v1::closure_t* self, uint32_t proc, const char* name)
+{
+    return start_request(self, proc, 0);
+}
+
+static idc_v1::buffer_desc
+idc_client_binding_v1_init_cast(idc_client_binding_v1::closure_t* self, uint32_t ann, const char* name)
+{
+    return start_request(self, ann, shm_header_t::NO_REPLY);
+}
+
+static void
+idc_client_binding_v1_send_call(idc_client_binding_v1::closure_t* self, idc_v1::buffer_desc b)
+{
+    idc_client_binding_v1::state_t* state = self->d_state;
+    shm_connection_t* conn = state->connection;
+
+    conn->request->length = marshal::used(b);
+    shm_publish(conn->request, ++state->calls, conn->client);
+}
+
+static uint32_t
+idc_client_binding_v1_receive_reply(idc_client_binding_v1::closure_t* self, idc_v1::buffer_desc* b, const char** name)
+{
+    idc_client_binding_v1::state_t* state = self->d_state;
+    shm_connection_t* conn = state->connection;
+
+    shm_wait(conn->reply, state->calls, conn->client);
+
+    marshal::reset(&state->reply, shm_payload(conn->reply), conn->reply->length);
+    *b = &state->reply;
+    *name = (conn->reply->operation == marshal::raised) ? conn->reply->exception : nullptr;
+    return conn->reply->operation;
+}
+
+/**
+ * Results are unmarshalled directly from the shared reply stretch, nothing to release until the next call.
+ */
+static void
+idc_client_binding_v1_ack_receive(idc_client_binding_v1::closure_t* self, idc_v1::buffer_desc b)
+{
+}
+
+static void
+idc_client_binding_v1_destroy(idc_client_binding_v1::closure_t* self)
+{
+    idc_client_binding_v1::state_t* state = self->d_state;
+    shm_connection_t* conn = state->connection;
+
+    conn->request->flags = shm_header_t::CLOSED;
+    conn->request->length = 0;
+    shm_publish(conn->request, ++state->calls, conn->client);
+
+    shm_detach(conn->client);
+    conn->heap->free(reinterpret_cast<memory_v1::address>(state));
+}
+
+static const idc_client_binding_v1::ops_t idc_client_binding_v1_methods =
+{
+    idc_client_binding_v1_init_call,
+    idc_client_binding_v1_init_cast,
+    idc_client_binding_v1_send_call,
+    idc_client_binding_v1_receive_reply,
+    idc_client_binding_v1_ack_receive,
+    idc_client_binding_v1_destroy
+};
+
+//======================================================================================================================
+// shm_transport_v1 implementation
+//======================================================================================================================
+
+static stretch_v1::closure_t* create_buffer(size_t size, shm_header_t** header)
+{
+    auto stretch = PVS(stretch_allocator)->create(size, stretch_v1::rights(stretch_v1::right_read).add(stretch_v1::right_write));
+    memory_v1::size stretch_size;
+    *header = reinterpret_cast<shm_header_t*>(stretch->info(&stretch_size));
+    memutils::fill_memory(*header, 0, sizeof(shm_header_t));
+    return stretch;
+}
+
+/**
+ * @todo Peer protection domain must be granted access to both stretches, this is the binder's job.
+ */
+static idc_client_binding_v1::closure_t*
+shm_transport_v1_connect(shm_transport_v1::closure_t* self, memory_v1::size size, void* service,
+                         shm_transport_v1::dispatcher dispatch, channel_v1::pair client_channels,
+                         channel_v1::pair server_channels, shm_transport_v1::server* srv)
+{
+    heap_v1::closure_t* heap = PVS(heap);
+    size_t stretch_size = page_align_up<size_t>(size + sizeof(shm_header_t));
+
+    shm_connection_t* conn = new(heap) shm_connection_t;
+    idc_client_binding_v1::state_t* client = new(heap) idc_client_binding_v1::state_t;
+    if (!conn || !client)
+        OS_RAISE(shm_transport_v1::failure_id, 0);
+
+    conn->heap = heap;
+    conn->payload_size = stretch_size - sizeof(shm_header_t);
+    conn->request_stretch = create_buffer(stretch_size, &conn->request);
+    conn->reply_stretch = create_buffer(stretch_size, &conn->reply);
+    conn->service = service;
+    conn->dispatch = reinterpret_cast<marshal::dispatch_t>(dispatch);
+    conn->served = 0;
+    conn->server_request.heap = conn->server_reply.heap = heap;
+    shm_attach(conn->client, client_channels);
+    shm_attach(conn->server, server_channels);
+
+    client->connection = conn;
+    client->calls = 0;
+    client->request.heap = client->reply.heap = heap;
+    closure_init(&client->closure, &idc_client_binding_v1_methods, client);
+
+    *srv = conn;
+    return &client->closure;
+}
+
+/**
+ * Handle one request that is known to have arrived.
+ * @returns false if the client has closed the connection.
+ */
+static bool serve_request(shm_connection_t* conn)
+{
+    shm_header_t* request = conn->request;
+    shm_header_t* reply = conn->reply;
+
+    ++conn->served;
+
+    if (request->flags & shm_header_t::CLOSED)
+        return false;
+
+    marshal::reset(&conn->server_request, shm_payload(request), request->length);
+    marshal::reset(&conn->server_reply, shm_payload(reply), conn->payload_size);
+
+    uint32_t result = marshal::ok;
+    OS_TRY {
+        result = conn->dispatch(conn->service, request->operation, &conn->server_request, &conn->server_reply);
+    }
+    OS_CATCH_ALL {
+        memutils::copy_string(reply->exception, xcp_name(__xcp_ctx.id), shm_header_t::EXCEPTION_NAME_SIZE);
+        result = marshal::raised;
+    }
+    OS_ENDTRY;
+
+    if (request->flags & shm_header_t::NO_REPLY)
+        return true;
+
+    reply->operation = result;
+    reply->length = marshal::used(&conn->server_reply);
+    shm_publish(reply, conn->served, conn->server);
+    return true;
+}
+
+static bool
+shm_transport_v1_serve(shm_transport_v1::closure_t* self, shm_transport_v1::server srv)
+{
+    shm_connection_t* conn = reinterpret_cast<shm_connection_t*>(srv);
+    shm_wait(conn->request, conn->served + 1, conn->server);
+    return serve_request(conn);
+}
+
+static bool
+shm_transport_v1_poll(shm_transport_v1::closure_t* self, shm_transport_v1::server srv)
+{
+    shm_connection_t* conn = reinterpret_cast<shm_connection_t*>(srv);
+    if (!shm_arrived(conn->request, conn->served + 1))
+        return false;
+    asm volatile("" ::: "memory");
+    serve_request(conn);
+    return true;
+}
+
+static void
+shm_transport_v1_close(shm_transport_v1::closure_t* self, shm_transport_v1::server srv)
+{
+    shm_connection_t* conn = reinterpret_cast<shm_connection_t*>(srv);
+    shm_detach(conn->server);
+    PVS(stretch_allocator)->destroy_stretch(conn->request_stretch);
+    PVS(stretch_allocator)->destroy_stretch(conn->reply_stretch);
+    conn->heap->free(reinterpret_cast<memory_v1::address>(conn));
+}
+
+static const shm_transport_v1::ops_t shm_transport_v1_methods =
+{
+    shm_transport_v1_connect,
+    shm_transport_v1_serve,
+    shm_transport_v1_poll,
+    shm_transport_v1_close
+};
+
+shm_transport_v1::closure_t shm_transport_closure =
+{
+    &shm_transport_v1_methods,
+    NULL
+};
+
+EXPORT_CLOSURE_TO_ROOTDOM(shm_transport, v1, shm_transport_closure);
+
+//======================================================================================================================
+// Loopback mode.
+//======================================================================================================================
+
+static void loopback_idle(void* arg)
+{
+    shm_transport_v1_poll(&shm_transport_closure, arg);
+}
+
+void shm_transport_set_loopback(shm_transport_v1::server srv)
+{
+    shm_connection_t* conn = reinterpret_cast<shm_connection_t*>(srv);
+    conn->client.idle = loopback_idle;
+    conn->client.idle_arg = conn;
+}
@@ -0,0 +1,82 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "idc_client_binding_v1_interface.h"
+#include "shm_transport_v1_interface.h"
+#include "event_v1_interface.h"
+#include "stretch_v1_interface.h"
+#include "idc_marshal.h"
+
+/**
+ * Header at the start of each shared stretch, the message payload follows it.
+ * Writer fills in the payload and the other fields first and publishes the message by bumping the sequence number.
+ */
+struct shm_header_t
+{
+    enum {
+        EXCEPTION_NAME_SIZE = 64,
+        NO_REPLY = 1,        //!< Announcement, server does not write a reply.
+        CLOSED   = 2         //!< Client destroyed the binding.
+    };
+
+    volatile uint32_t sequence;          //!< Number of the last complete message.
+    uint32_t operation;                  //!< Method number in requests, marshal::result_e in replies.
+    uint32_t flags;
+    uint32_t length;                     //!< Payload bytes.
+    char exception[EXCEPTION_NAME_SIZE]; //!< Name of the exception raised by server.
+};
+
+/**
+ * Signalling for one end of a connection: tx event count is advanced for each message we write,
+ * rx event count follows the peer's messages. Both are nullptr when the end polls the shared header.
+ */
+struct shm_end_t
+{
+    event_v1::count tx;
+    event_v1::count rx;
+    void (*idle)(void* arg); //!< Called while polling for a message.
+    void* idle_arg;
+};
+
+struct shm_connection_t
+{
+    stretch_v1::closure_t* request_stretch;
+    stretch_v1::closure_t* reply_stretch;
+    shm_header_t*          request;
+    shm_header_t*          reply;
+    size_t                 payload_size;
+    heap_v1::closure_t*    heap;
+
+    shm_end_t client;
+    shm_end_t server;
+
+    void*               service;
+    marshal::dispatch_t dispatch;
+    idc_v1::buffer_rec  server_request;
+    idc_v1::buffer_rec  server_reply;
+    uint32_t            served;
+};
+
+struct idc_client_binding_v1::state_t
+{
+    idc_client_binding_v1::closure_t closure;
+    shm_connection_t*  connection;
+    idc_v1::buffer_rec request;
+    idc_v1::buffer_rec reply;
+    uint32_t           calls;
+};
+
+/**
+ * Serve calls from the client's wait loop instead of a separate server domain.
+ * Used to benchmark both ends of a polling connection in a single domain.
+ */
+void shm_transport_set_loopback(shm_transport_v1::server srv);
+
+extern shm_transport_v1::closure_t shm_transport_closure;
@@ -9,6 +9,8 @@
 #pragma once
 
 #include "cpu.h"
+#include "pci_bus_v1_interface.h"
+#include "stretch_v1_interface.h"
 
 /** Offsets into PCI configuration space. */
 #define PCI_CONFIG_VENDOR_ID        0x00    /**< Vendor ID        - 16-bit. */
@@ -35,6 +37,10 @@
 #define PCI_CONFIG_BAR5         0x24    /**< BAR5             - 32-bit. */
 #define PCI_CONFIG_CARDBUS_CIS      0x28    /**< Cardbus CIS Ptr  - 32-bit. */
 
+#define PCI_CONFIG_PRIMARY_BUS      0x18    /**< Bridge primary bus     - 8-bit. */
+#define PCI_CONFIG_SECONDARY_BUS    0x19    /**< Bridge secondary bus   - 8-bit. */
+#define PCI_CONFIG_SUBORDINATE_BUS  0x1A    /**< Bridge subordinate bus - 8-bit. */
+
 #define PCI_CONFIG_SUBSYS_VENDOR    0x2C    /**< Subsystem vendor - 16-bit. */
 #define PCI_CONFIG_SUBSYS_ID        0x2E    /**< Subsystem ID     - 16-bit. */
 
@@ -133,6 +139,14 @@ if (pci_bus_t::detect())
 */
 
 
+
+/**
+ * Configuration space access.
+ *
+ * PCI Express machines map configuration space of every function into memory (ECAM), the launcher finds the window
+ * in ACPI MCFG table and records it in the bootinfo page, see pci_ecam_prepare(). Buses outside the window are
+ * accessed with the port I/O mechanism 1, which also only reaches the first 256 bytes of configuration space.
+ */
 class pci_bus_t
 {
     /**
@@ -146,22 +160,41 @@ class pci_bus_t
     static const int PCI_CONFIG_ADDRESS = 0xcf8;
     static const int PCI_CONFIG_DATA = 0xcfc;
 
-    // Standard PCI read mechanism.
-    static uint32_t pci_read_mechanism_1(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+    static address_t ecam_base; // Where bus 0 of the segment would be, only buses in start..end are mapped.
+    static uint8_t ecam_start_bus, ecam_end_bus;
+
+    static inline address_t mechanism_1_address(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset)
     {
-        /* create configuration address */
-        address_t address = (static_cast<address_t>(bus & 0xff) << 16) |
-                            (static_cast<address_t>(slot & 0x3f) << 11) |
-                            (static_cast<address_t>(func & 0x7) << 8) |
-                            (static_cast<address_t>(offset & 0xfc)) |
-                            0x80000000U; // enable bit
- 
-        /* write out the address */
-        x86_cpu_t::outl(PCI_CONFIG_ADDRESS, address);
-        /* read in the data */
-        return x86_cpu_t::inl(PCI_CONFIG_DATA);
+        return (static_cast<address_t>(bus & 0xff) << 16) |
+               (static_cast<address_t>(slot & 0x1f) << 11) |
+               (static_cast<address_t>(func & 0x7) << 8) |
+               (static_cast<address_t>(offset & 0xfc)) |
+               0x80000000U; // enable bit
+    }
+
+    static inline volatile uint32_t* ecam_address(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset)
+    {
+        return reinterpret_cast<volatile uint32_t*>(ecam_base +
+            ((static_cast<address_t>(bus) << 20) |
+             (static_cast<address_t>(slot & 0x1f) << 15) |
+             (static_cast<address_t>(func & 0x7) << 12) |
+             (static_cast<address_t>(offset & 0xffc))));
     }
 
+    static inline bool in_ecam(uint8_t bus)
+    {
+        return ecam_base && (bus >= ecam_start_bus) && (bus <= ecam_end_bus);
+    }
+
+public:
+    /** Number of configuration space reads, to keep an eye on the enumeration cost. */
+    static size_t config_reads;
+
+    /**
+     * Pick up the ECAM window recorded by the launcher.
+     */
+    static void init();
+
     /**
      * Detect the presence of PCI bus.
      * Should be arch-dependent, this one is x86 specific.
@@ -172,105 +205,123 @@ class pci_bus_t
         return x86_cpu_t::inl(PCI_CONFIG_ADDRESS) == 0x80000000U;
     }
 
-public:
-    pci_bus_t()
+    static inline bool has_ecam() { return ecam_base != 0; }
+
+    static uint32_t read_config_space(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset)
     {
+        ++config_reads;
+        if (in_ecam(bus))
+            return *ecam_address(bus, slot, func, offset);
+        if (offset > 0xff)
+            return 0xffffffff;
+        x86_cpu_t::outl(PCI_CONFIG_ADDRESS, mechanism_1_address(bus, slot, func, offset));
+        return x86_cpu_t::inl(PCI_CONFIG_DATA);
     }
 
-    static uint32_t read_config_space(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset)
+    static void write_config_space(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offset, uint32_t value)
     {
-        return pci_read_mechanism_1(bus, slot, func, offset);
+        if (in_ecam(bus))
+        {
+            *ecam_address(bus, slot, func, offset) = value;
+            return;
+        }
+        if (offset > 0xff)
+            return;
+        x86_cpu_t::outl(PCI_CONFIG_ADDRESS, mechanism_1_address(bus, slot, func, offset));
+        x86_cpu_t::outl(PCI_CONFIG_DATA, value);
     }
-/*
-    void pci_bus_t::scan_device(device_tree_node_t* node, int bus, int slot, int func)
-    {
-        pci_device_t dev(bus, slot, func);
 
-        if (!dev.is_present())
-            return;
+    /**
+     * Memory for descriptor rings and packet buffers: physically contiguous frames mapped into a stretch of their
+     * own, so it can be shared with the domains using the device. Returns the virtual address or nullptr.
+     */
+    static void* allocate_dma(size_t bytes, address_t& phys, stretch_v1::closure_t** stretch = nullptr);
 
-        subnode = new(PVS(heap)) device_tree_node_t(name, node, dev.attrs());
-        node->append_child(subnode);
+    /**
+     * Map registers of a memory BAR, uncached. Returns the virtual address or nullptr.
+     */
+    static void* map_registers(address_t phys, size_t bytes);
+};
 
-        if (dev.is_pci_to_pci_bridge())
-            scan(subnode, dev.bridge_id());
-    }
+class pci_device_t;
 
-    void pci_bus_t::scan(device_tree_node_t* node, int bus_id)
-    {
-        // up to 32 slots on a bus
-        i = 0..31
-        pci_device_t dev(bus_id, i, 0);
-        if (dev.is_multifunction_device())
-        {
-            // scan each function separately
-            f = 0..7
-            scan_device(node, bus_id, i, f);
-        }
-        else
-        {
-            scan_device(node, bus_id, i, 0);
-        }
-    }*/
+/** Device matched by a driver, PCI_ANY_ID in device matches all devices of the vendor. */
+struct pci_device_id_t
+{
+    uint16_t vendor;
+    uint16_t device;
 };
 
-class pci_driver_t
+#define PCI_ANY_ID 0xffff
+
+/**
+ * Drivers describe which devices they support with a match table, the pcibus module calls probe() for every
+ * function found that matches it. Probe returns true if the driver took the device. A driver that took the device
+ * keeps its state, and any interrupt handler it registered, alive after probe() returns, usually as a static.
+ */
+struct pci_driver_t
 {
+    const char* name;
+    const pci_device_id_t* ids; /**< Terminated by an entry with zero vendor. */
+    bool (*probe)(pci_device_t* dev);
+
+    bool matches(const pci_bus_v1::device& dev) const
+    {
+        for (const pci_device_id_t* id = ids; id->vendor; ++id)
+            if ((id->vendor == dev.vendor) && ((id->device == PCI_ANY_ID) || (id->device == dev.device_id)))
+                return true;
+        return false;
+    }
 };
 
 class pci_device_t
 {
-    pci_driver_t* driver;
+    const pci_driver_t* driver;
     device_tree_node_t* node;
-
-    /** Location of the device. */
-    uint8_t bus;                /**< Bus ID. */
-    uint8_t slot;               /**< Device number. */
-    uint8_t function;           /**< Function number. */
-
-    /** Information about the device. */
-    uint16_t vendor_id;         /**< Vendor ID. */
-    uint16_t device_id;         /**< Device ID. */
-    uint8_t base_class;         /**< Class ID. */
-    uint8_t sub_class;          /**< Sub-class ID. */
-    uint8_t prog_iface;         /**< Programming interface. */
-    uint8_t revision;           /**< Revision. */
-    uint8_t cache_line_size;    /**< Cache line size (number of DWORDs). */
-    uint8_t header_type;        /**< Header type. */
-    uint16_t subsys_vendor;     /**< Subsystem vendor. */
-    uint16_t subsys_id;         /**< Subsystem ID. */
-    uint8_t interrupt_line;     /**< Interrupt line. */
-    uint8_t interrupt_pin;      /**< Interrupt pin. */
+    pci_bus_v1::device info;
 
 public:
-    pci_device_t(uint8_t _bus, uint8_t _slot, uint8_t _func) : driver(0), node(0), bus(_bus), slot(_slot), function(_func)
+    /**
+     * Read the device at the given location, needs one configuration read if there is none and five otherwise.
+     */
+    pci_device_t(uint8_t _bus, uint8_t _slot, uint8_t _func) : driver(0), node(0), info()
     {
-        uint32_t vendor_device = read_config_space(0x0);
-        vendor_id = vendor_device & 0xffff;
-        device_id = (vendor_device >> 16) & 0xffff;
+        info.bus = _bus;
+        info.slot = _slot;
+        info.function = _func;
+
+        uint32_t vendor_device = read_config_space(PCI_CONFIG_VENDOR_ID);
+        info.vendor = vendor_device & 0xffff;
+        info.device_id = (vendor_device >> 16) & 0xffff;
 
         if (!is_present())
             return;
 
-        uint32_t class_subclass = read_config_space(0x8);
-        base_class = (class_subclass >> 24) & 0xff;
-        sub_class = (class_subclass >> 16) & 0xff;
-        prog_iface = (class_subclass >> 8) & 0xff;
-        revision = (class_subclass) & 0xff;
+        uint32_t class_subclass = read_config_space(PCI_CONFIG_REVISION);
+        info.base_class = (class_subclass >> 24) & 0xff;
+        info.sub_class = (class_subclass >> 16) & 0xff;
+        info.prog_iface = (class_subclass >> 8) & 0xff;
+        info.revision = (class_subclass) & 0xff;
 
-        uint32_t header = read_config_space(0xc);
-        cache_line_size = (header) & 0xff;
-        header_type = (header >> 16) & 0xff;
+        uint32_t header = read_config_space(PCI_CONFIG_CACHE_LINE_SIZE);
+        info.header_type = (header >> 16) & 0xff;
 
-        uint32_t subsys = read_config_space(0x2c);
-        subsys_vendor = subsys & 0xffff;
-        subsys_id = (subsys >> 16) & 0xffff;
+        // Bridges keep bus numbers and windows in place of the subsystem ids.
+        if ((info.header_type & 0x7f) == 0)
+        {
+            uint32_t subsys = read_config_space(PCI_CONFIG_SUBSYS_VENDOR);
+            info.subsys_vendor = subsys & 0xffff;
+            info.subsys_id = (subsys >> 16) & 0xffff;
+        }
 
-        uint32_t interrupt = read_config_space(0x3c);
-        interrupt_line = interrupt & 0xff;
-        interrupt_pin = (interrupt >> 8) & 0xff;
+        uint32_t interrupt = read_config_space(PCI_CONFIG_INTERRUPT_LINE);
+        info.interrupt_line = interrupt & 0xff;
+        info.interrupt_pin = (interrupt >> 8) & 0xff;
     }
 
+    /** Device recorded in the device table, no configuration reads are needed. */
+    pci_device_t(const pci_bus_v1::device& dev) : driver(0), node(0), info(dev) {}
+
     inline bool is_present()
     {
         return vendor() != 0xffff;
@@ -278,20 +329,36 @@ public:
 
     inline bool is_pci_to_pci_bridge()
     {
-        return is_present() && (base_class == 0x06) && (sub_class == 0x04);
+        return is_present() && (info.base_class == 0x06) && (info.sub_class == 0x04);
     }
 
     inline bool is_multifunction_device()
     {
-        return is_present() && (header_type & 0x80);
+        return is_present() && (info.header_type & 0x80);
     }
 
-    inline uint16_t vendor() { return vendor_id; }
-    inline uint16_t device() { return device_id; }
+    /** Bus behind a PCI-to-PCI bridge. */
+    inline uint8_t secondary_bus()
+    {
+        return (read_config_space(PCI_CONFIG_PRIMARY_BUS) >> 8) & 0xff;
+    }
+
+    inline uint16_t vendor() { return info.vendor; }
+    inline uint16_t device() { return info.device_id; }
+    inline uint16_t subsystem_id() { return info.subsys_id; }
+    inline uint8_t interrupt_line() { return info.interrupt_line; }
+    inline const pci_bus_v1::device& description() { return info; }
+
+    inline void set_driver(const pci_driver_t* drv) { driver = drv; info.driven = true; }
 
     inline uint32_t read_config_space(uint16_t offset)
     {
-        return pci_bus_t::read_config_space(bus, slot, function, offset);
+        return pci_bus_t::read_config_space(info.bus, info.slot, info.function, offset);
+    }
+
+    inline void write_config_space(uint16_t offset, uint32_t value)
+    {
+        pci_bus_t::write_config_space(info.bus, info.slot, info.function, offset, value);
     }
 
     void dump();
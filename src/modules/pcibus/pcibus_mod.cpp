@@ -7,13 +7,23 @@
 // (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 #include "pci_bus.h"
+#include "pci_bus_v1_impl.h"
+#include "naming_context_v1_interface.h"
+#include "frame_allocator_v1_interface.h"
+#include "system_stretch_allocator_v1_interface.h"
+#include "type_system_v1_interface.h"
+#include "bootinfo.h"
+#include "infopage.h"
+#include "exceptions.h"
 #include "closure_interface.h"
 #include "closure_impl.h"
 #include "default_console.h"
+#include "config.h" // for PCIBUS_DUMP
+#include "any.h"
 
-// temporary testing
 #include "../../devices/network/ne2000_pci/ne2k.h"
 #include "../../devices/graphics/bochs_emu/bga.h"
+#include "../../devices/network/virtio_net/virtio_net.h"
 
 static const char* class2string(int class_id)
 {
@@ -44,13 +54,13 @@ static const char* class2string(int class_id)
 
 void pci_device_t::dump()
 {
-	kconsole << "PCI device: bus " << bus << ", slot " << slot << ", func " << function << ", vendor " << vendor_id << ", device " << device_id << ", class " << base_class << ", subclass " << sub_class << ", header type " << header_type << endl;
-	kconsole << "ProgIF " << prog_iface << ", revision " << revision << ", cache line size " << cache_line_size << ", subsys vendor " << subsys_vendor << ", subsys id " << subsys_id << ", INT# line " << interrupt_line << ", INT# pin " << interrupt_pin << endl;
-	if (header_type & 0x80)
+	kconsole << "PCI device: bus " << info.bus << ", slot " << info.slot << ", func " << info.function << ", vendor " << info.vendor << ", device " << info.device_id << ", class " << info.base_class << ", subclass " << info.sub_class << ", header type " << info.header_type << endl;
+	kconsole << "ProgIF " << info.prog_iface << ", revision " << info.revision << ", subsys vendor " << info.subsys_vendor << ", subsys id " << info.subsys_id << ", INT# line " << info.interrupt_line << ", INT# pin " << info.interrupt_pin << endl;
+	if (info.header_type & 0x80)
 		kconsole << "  Multifunction device";
 	else
 		kconsole << "  Single function device";
-	switch (header_type & 0x7f)
+	switch (info.header_type & 0x7f)
 	{
 		case 0:
 			kconsole << ", standard header." << endl;
@@ -65,60 +75,281 @@ void pci_device_t::dump()
 			kconsole << ", unknown header type." << endl;
 			break;
 	}
-	kconsole << "  Class ID: " << class2string(base_class) << endl;
+	kconsole << "  Class ID: " << class2string(info.base_class) << endl;
 }
 
+address_t pci_bus_t::ecam_base = 0;
+uint8_t pci_bus_t::ecam_start_bus = 0;
+uint8_t pci_bus_t::ecam_end_bus = 0;
+size_t pci_bus_t::config_reads = 0;
+
+void pci_bus_t::init()
+{
+    bootinfo_t* bi = new(bootinfo_t::ADDRESS) bootinfo_t;
+    if (!bi->get_pci_ecam(ecam_base, ecam_start_bus, ecam_end_bus))
+        ecam_base = 0;
+}
+
+static stretch_v1::closure_t* map_stretch(size_t bytes, address_t phys, memory_v1::attr_flags attr)
+{
+    memory_v1::physmem_desc pmem = { phys, bytes >> FRAME_WIDTH, FRAME_WIDTH, attr };
+    return PVS(stretch_allocator)->create_over(bytes, stretch_v1::rights(stretch_v1::right_read).add(stretch_v1::right_write),
+        ANY_ADDRESS, memory_v1::attrs_regular, PAGE_WIDTH, pmem);
+}
+
+void* pci_bus_t::allocate_dma(size_t bytes, address_t& phys, stretch_v1::closure_t** stretch)
+{
+    any v;
+    if (!PVS(root)->get("System.FramesAllocator", &v))
+        return nullptr;
+    auto frames = reinterpret_cast<frame_allocator_v1::closure_t*>(PVS(types)->narrow(v, frame_allocator_v1::type_code));
+
+    bytes = page_align_up<size_t>(bytes);
+    phys = frames->allocate(bytes, FRAME_WIDTH);
+    if (phys == NO_ADDRESS)
+        return nullptr;
+
+    auto str = map_stretch(bytes, phys, memory_v1::attr_flags(memory_v1::attrs_dma));
+    if (!str)
+    {
+        frames->free(phys, bytes);
+        return nullptr;
+    }
+    if (stretch)
+        *stretch = str;
+
+    memory_v1::size size;
+    return reinterpret_cast<void*>(str->info(&size));
+}
+
+void* pci_bus_t::map_registers(address_t phys, size_t bytes)
+{
+    address_t base = page_align_down(phys);
+    bytes = page_align_up<size_t>(phys + bytes - base);
+
+    auto str = map_stretch(bytes, base, memory_v1::attr_flags(memory_v1::attrs_non_memory).add(memory_v1::attrs_no_cache));
+    if (!str)
+        return nullptr;
+
+    memory_v1::size size;
+    return reinterpret_cast<void*>(str->info(&size) + (phys - base));
+}
+
+//====
+// Device table
+//====
+
+// Functions found on all buses, sorted by vendor, device and class. Functions with equal keys stay in bus order.
+static const size_t MAX_DEVICES = 128;
+static pci_bus_v1::device devices[MAX_DEVICES];
+static size_t n_devices = 0;
+
+static inline bool key_less(const pci_bus_v1::device& a, uint16_t vendor, uint16_t device_id, uint8_t base_class, uint8_t sub_class)
+{
+    if (a.vendor != vendor)
+        return a.vendor < vendor;
+    if (a.device_id != device_id)
+        return a.device_id < device_id;
+    if (a.base_class != base_class)
+        return a.base_class < base_class;
+    return a.sub_class < sub_class;
+}
+
+static void record_device(const pci_bus_v1::device& dev)
+{
+    if (n_devices == MAX_DEVICES)
+    {
+        kconsole << "PCI device table is full, ignoring " << dev.bus << ":" << dev.slot << "." << dev.function << endl;
+        return;
+    }
+    size_t i = n_devices++;
+    for (; i > 0 && key_less(dev, devices[i-1].vendor, devices[i-1].device_id, devices[i-1].base_class, devices[i-1].sub_class); --i)
+        devices[i] = devices[i-1];
+    devices[i] = dev;
+}
+
+//====
+// Enumeration
+//====
+
+// Only functions that exist are visited: function 0 of every slot, other functions of multifunction devices and
+// buses behind PCI-to-PCI bridges. This takes a few hundred configuration reads instead of probing every address.
+
+static void scan_bus(uint8_t bus);
+
+static void scan_function(pci_device_t& dev)
+{
+#if PCIBUS_DUMP
+    dev.dump();
+#endif
+    record_device(dev.description());
+
+    if (dev.is_pci_to_pci_bridge())
+    {
+        // Firmware numbers buses depth first, anything else would be a loop in the topology.
+        uint8_t secondary = dev.secondary_bus();
+        if (secondary > dev.description().bus)
+            scan_bus(secondary);
+    }
+}
+
+static void scan_bus(uint8_t bus)
+{
+    for (uint8_t slot = 0; slot < 32; ++slot)
+    {
+        pci_device_t dev(bus, slot, 0);
+        if (!dev.is_present())
+            continue;
+
+        scan_function(dev);
+
+        if (!dev.is_multifunction_device())
+            continue;
+
+        for (uint8_t func = 1; func < 8; ++func)
+        {
+            pci_device_t f(bus, slot, func);
+            if (f.is_present())
+                scan_function(f);
+        }
+    }
+}
+
+static void enumerate()
+{
+    // Several host controllers show up as functions of the host bridge, function N is responsible for bus N.
+    pci_device_t host(0, 0, 0);
+    if (!host.is_multifunction_device())
+    {
+        scan_bus(0);
+        return;
+    }
+
+    for (uint8_t func = 0; func < 8; ++func)
+    {
+        pci_device_t f(0, 0, func);
+        if (f.is_present())
+            scan_bus(func);
+    }
+}
+
+//====
+// Driver matching
+//====
+
+static const pci_driver_t* const drivers[] = {
+    &graphics::bga_pci_driver,
+    &ne2k_pci_driver,
+    &virtio_net_pci_driver,
+};
+
+static void attach_drivers()
+{
+    for (size_t i = 0; i < n_devices; ++i)
+    {
+        for (const pci_driver_t* driver : drivers)
+        {
+            if (!driver->matches(devices[i]))
+                continue;
+
+            pci_device_t dev(devices[i]);
+            if (driver->probe(&dev))
+            {
+                dev.set_driver(driver);
+                devices[i] = dev.description();
+                kconsole << "PCI " << devices[i].bus << ":" << devices[i].slot << "." << devices[i].function << " driven by " << driver->name << endl;
+                break;
+            }
+        }
+    }
+}
+
+//====
+// pci_bus_v1 implementation
+//====
+
+static uint32_t
+count(pci_bus_v1::closure_t* self)
+{
+    return n_devices;
+}
+
+static pci_bus_v1::device
+get(pci_bus_v1::closure_t* self, uint32_t index)
+{
+    if (index >= n_devices)
+        OS_RAISE(pci_bus_v1::no_such_device_id, 0);
+    return devices[index];
+}
+
+static uint32_t
+find(pci_bus_v1::closure_t* self, uint16_t vendor, uint16_t device_id)
+{
+    size_t lo = 0, hi = n_devices;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (key_less(devices[mid], vendor, device_id, 0, 0))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == n_devices || devices[lo].vendor != vendor || devices[lo].device_id != device_id)
+        OS_RAISE(pci_bus_v1::no_such_device_id, 0);
+    return lo;
+}
+
+static uint32_t
+read_config(pci_bus_v1::closure_t* self, uint8_t bus, uint8_t slot, uint8_t function, uint16_t offset)
+{
+    return pci_bus_t::read_config_space(bus, slot, function, offset);
+}
+
+static void
+write_config(pci_bus_v1::closure_t* self, uint8_t bus, uint8_t slot, uint8_t function, uint16_t offset, uint32_t value)
+{
+    pci_bus_t::write_config_space(bus, slot, function, offset, value);
+}
+
+static const pci_bus_v1::ops_t pci_bus_v1_methods =
+{
+    count,
+    get,
+    find,
+    read_config,
+    write_config
+};
+
+static pci_bus_v1::closure_t pci_bus_closure =
+{
+    &pci_bus_v1_methods,
+    NULL
+};
+
 //====
 // implement interface closure
 //====
 
-// pci bus probing will merely record device and vendor ids present on pci bus and its topology
-// vendors and device ids are recorded into a pcibus lookup table
-// later when device drivers are probing they will use this table to look up if device they support is actually present
-// in this case they will attempt the device initialization and mark this device as driven in the pcibus table
-// pcibus_scan table of entries [vendor_id, device_id, has_driver, driver_id?]
+// PCI bus probing records the functions present on the buses and their topology in the device table, then drivers
+// are matched against it. The table is exported as System.PCIBus for later lookups.
 
 static void
 entry(closure::closure_t* self)
 {
-    for ( unsigned int bus=0; bus<256; bus++ ) {
-        for ( unsigned int slot=0; slot<32; slot++ ) {
-            for ( unsigned int func=0; func<7; func++ ) {
-				pci_device_t dev(bus, slot, func);
-
-				if (dev.is_present())
-				{
-					dev.dump();
-
-					if ((dev.vendor() == 0x1234) && (dev.device() == 0x1111))
-					{
-						graphics::bga bga;
-						bga.configure(&dev);
-						if (bga.is_available()) {
-							bga.init();
-						}
-						else {
-							kconsole << "BGA init failed!" << endl;
-						}
-					}
-
-					if ((dev.vendor() == 0x10ec) && (dev.device() == 0x8029))
-					{
-						ne2k ne;
-						ne.configure(&dev);
-						ne.init();
-
-						// Send a nice hello world to everyone
-						uint8_t hello[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-							               0xb0, 0xc4, 0x20, 0x00, 0x00, 0x00,
-							               0x00, 0x10,
-							               'H', 'e', 'l', 'l', 'o', ' ', 'n', 'e', 't', ' ', 'w', 'o', 'r', 'l', 'd', '!'};
-						ne.send_packet(hello, sizeof(hello));
-					}
-				}
-            }
-        }
+    if (!pci_bus_t::detect())
+    {
+        kconsole << "No PCI bus found." << endl;
+        return;
     }
+
+    pci_bus_t::init();
+    enumerate();
+    kconsole << "PCI enumeration found " << int32_t(n_devices) << " functions in " << int32_t(pci_bus_t::config_reads)
+             << " configuration reads" << (pci_bus_t::has_ecam() ? " (ECAM)." : " (port I/O).") << endl;
+
+    attach_drivers();
+
+    PVS(root)->add("System.PCIBus", closure_to_any(&pci_bus_closure, pci_bus_v1::type_code));
 };
 
 static const closure::ops_t methods =
@@ -22,6 +22,7 @@
 #include "domain.h"
 #include "algorithm"
 #include "logger.h"
+#include "trace.h"
 
 /**
  * Frame allocator client record.
@@ -169,12 +170,12 @@ static bool add_range(frame_allocator_v1::state_t* client_state, address_t start
     if (!client_state->heap || !client_state->region_list || !n_phys_frames)
         return true;
 
-    logger::trace() << __FUNCTION__ << ": " << n_phys_frames << " frames at " << start << " frame width " << frame_width;
+    TRACE_DEBUG("add_range: %u frames at %p frame width %u", n_phys_frames, start, frame_width);
     address_t end = start + (n_phys_frames << FRAME_WIDTH);
 
     if (client_state->region_list->is_empty())
     {
-        logger::trace() << __FUNCTION__ << ": region list is empty, allocating new entry";
+        TRACE_DEBUG("add_range: region list is empty, allocating new entry");
         return add_range_element(client_state, start, n_phys_frames, frame_width);
     }
     else
@@ -198,14 +199,14 @@ static bool add_range(frame_allocator_v1::state_t* client_state, address_t start
             // FIXME: doesn't check frame_width??
             if (end == next_start)
             {
-                logger::debug() << __FUNCTION__ << ": no prior elements, merging on rhs.";
+                TRACE_DEBUG("add_range: no prior elements, merging on rhs");
                 (*link->next())->n_phys_frames += n_phys_frames;
                 (*link->next())->start = start;
                 return true;
             }
             else
             {
-                logger::debug() << __FUNCTION__ << ": no prior elements, allocating new entry.";
+                TRACE_DEBUG("add_range: no prior elements, allocating new entry");
                 return add_range_element(client_state, start, n_phys_frames, frame_width);
             }
         }
@@ -244,7 +245,7 @@ static frames_module_v1::state_t* alloc_any(frame_allocator_v1::closure_t* self,
     frames_module_v1::state_t* state = client_state->module_state;
     frames_module_v1::state_t* cur_state = state;
 
-    logger::debug() << __FUNCTION__ << ": requested " << n_physical_frames << " frames.";
+    TRACE_DEBUG("alloc_any: requested %u frames", n_physical_frames);
 
     while (cur_state)
     {
@@ -307,7 +308,7 @@ static frames_module_v1::state_t* alloc_range(frame_allocator_v1::closure_t* sel
     }
 
     int bytes = int(*n_log_frames << cur_state->frame_width);
-    logger::debug() << "alloc_range: allocated " << bytes << " bytes at requested address " << start << "->" << start + bytes;
+    TRACE_DEBUG("alloc_range: allocated %u bytes at requested address %p", bytes, start);
     return cur_state;
 }
 
@@ -392,7 +393,7 @@ static memory_v1::address system_frame_allocator_v1_allocate_range(frame_allocat
         PANIC("Something's wrong.");
     }
 
-    logger::debug() << __FUNCTION__ << ": allocated " << start;
+    TRACE_DEBUG("allocate_range: allocated %p", start);
     return start;
 }
 
@@ -506,7 +507,7 @@ static void system_frame_allocator_v1_free(frame_allocator_v1::closure_t* self,
     for (i = end_log_frame; i >= start_log_frame; --i)
     {
         cur_state->frames[i].free = ++end_free;
-        logger::trace() << "1. Log frame " << i << " free set to " << cur_state->frames[i].free;
+        TRACE_DEBUG("1. Log frame %u free set to %u", i, cur_state->frames[i].free);
     }
 
     /*
@@ -518,7 +519,7 @@ static void system_frame_allocator_v1_free(frame_allocator_v1::closure_t* self,
     for (; /*wrap protect:*/(i < start_log_frame) && (cur_state->frames[i].free != 0); --i)
     {
         cur_state->frames[i].free = ++end_free;
-        logger::trace() << "2. Log frame " << i << " free set to " << cur_state->frames[i].free;
+        TRACE_DEBUG("2. Log frame %u free set to %u", i, cur_state->frames[i].free);
     }
 
     /* Now update the ramtab (if appropriate) */
@@ -571,7 +572,7 @@ static frame_allocator_v1::closure_t* system_frame_allocator_v1_create_client(sy
         extra_frames = granted_frames;
 
     // Invariant: extra_frames >= granted_frames >= init_alloc_frames
-    logger::debug() << __FUNCTION__ << ": allocating new client state";
+    TRACE_DEBUG("create_client: allocating new client state");
 
     frame_allocator_v1::state_t* new_client_state = reinterpret_cast<frame_allocator_v1::state_t*>(client_state->heap->allocate(sizeof(*new_client_state)));
     if (!new_client_state)
@@ -582,14 +583,14 @@ static frame_allocator_v1::closure_t* system_frame_allocator_v1_create_client(sy
 
     dcb_ro_t *domain = reinterpret_cast<dcb_ro_t*>(owner_dcb_virt);
 
-    logger::debug() << __FUNCTION__ << ": initialising domain record";
+    TRACE_DEBUG("create_client: initialising domain record");
 
     domain->min_phys_frame_count = 0;
     domain->max_phys_frame_count = state->ramtab->size();
     domain->ramtab = reinterpret_cast<ramtab_entry_t*>(state->ramtab->base());
     domain->memory_region_list.init(&domain->memory_region_list);
 
-    logger::debug() << __FUNCTION__ << ": initialising new client record";
+    TRACE_DEBUG("create_client: initialising new client record");
     new_client_state->domain = domain;
     new_client_state->region_list = &domain->memory_region_list;
     new_client_state->n_allocated_phys_frames = init_alloc_frames;
@@ -604,7 +605,7 @@ static frame_allocator_v1::closure_t* system_frame_allocator_v1_create_client(sy
     size_t n_frames;
     frames_module_v1::state_t* cur_state;
 
-    logger::debug() << __FUNCTION__ << ": allocating " << init_alloc_frames << " init frames";
+    TRACE_DEBUG("create_client: allocating %u init frames", init_alloc_frames);
 
     cur_state = alloc_any(self, init_alloc_frames, FRAME_WIDTH, &first_frame, &n_frames);
     if (cur_state == NULL)
@@ -618,7 +619,7 @@ static frame_allocator_v1::closure_t* system_frame_allocator_v1_create_client(sy
     }
 
     address_t start = frame_address(cur_state, first_frame);
-    logger::debug() << __FUNCTION__ << ": allocated " << init_alloc_frames << " physical frames at " << start;
+    TRACE_DEBUG("create_client: allocated %u physical frames at %p", init_alloc_frames, start);
 
     alloc_update_free_predecessors(cur_state, first_frame);
     mark_frames_used(new_client_state, cur_state, first_frame, n_frames);
@@ -1,6 +1,7 @@
 #include "gatekeeper_v1_interface.h"
 #include "gatekeeper_v1_impl.h"
 #include "gatekeeper_factory_v1_interface.h"
+#include "heap_v1_interface.h"
 #include "gatekeeper_factory_v1_impl.h"
 #include "heap_v1_impl.h"
 #include "default_console.h"
@@ -60,19 +61,19 @@ simple_get_heap(gatekeeper_v1::closure_t* self, protection_domain_v1::id pdid, s
     if (!cache)
     {
         // Cannot create a new heap; we only have the one. So die.
-        OS_RAISE((exception_support_v1::id)"gatekeeper_v1.failure", 0);
+        OS_RAISE(gatekeeper_v1::failure_id, 0);
     }
 
     if ((state->pdid != NULL_PDID) && (state->pdid != pdid))
     {
         // Cannot create a new heap for pdom "pdid". So die.
-        OS_RAISE((exception_support_v1::id)"gatekeeper_v1.failure", 0);
+        OS_RAISE(gatekeeper_v1::failure_id, 0);
     }
 
     if (rights != stretch_v1::rights(stretch_v1::right_read))
     {
         // Cannot chmod the heap either; its read only. So die. 
-        OS_RAISE((exception_support_v1::id)"gatekeeper_v1.failure", 0);
+        OS_RAISE(gatekeeper_v1::failure_id, 0);
     }
 
     return &state->heap_state.closure;
@@ -82,7 +83,7 @@ stretch_v1::closure_t*
 simple_get_stretch(gatekeeper_v1::closure_t*, protection_domain_v1::id, stretch_v1::size, stretch_v1::rights, uint32_t, uint32_t)
 {
     kconsole << "Attempt to call get_stretch() on a simple gatekeeper!" << endl;
-    OS_RAISE((exception_support_v1::id)"gatekeeper_v1.failure", 0);
+    OS_RAISE(gatekeeper_v1::failure_id, 0);
     return 0;
 }
 
@@ -143,7 +144,7 @@ create_simple(gatekeeper_factory_v1::closure_t* self, heap_v1::closure_t* heap)
     simple_gatekeeper_state_t* state = new(heap) simple_gatekeeper_state_t;
     if (!state)
     {
-        OS_RAISE((exception_support_v1::id)"heap_v1.no_memory", 0);
+        OS_RAISE(heap_v1::no_memory_id, 0);
     }
 
     state->heap = heap;
@@ -10,6 +10,7 @@
 #include "default_console.h"
 #include "bootinfo.h"
 #include "infopage.h"
+#include "trace.h"
 #include "mmu_module_v1_interface.h"
 #include "mmu_module_v1_impl.h"
 #include "mmu_v1_interface.h"
@@ -272,16 +273,16 @@ static size_t update_pages(mmu_v1::state_t* state, size_t page_width, address_t
 inline uint16_t alloc_pdidx(mmu_v1::state_t* state)
 {
     uint32_t i = state->next_pdidx;
-    logger::trace() << __FUNCTION__ << ": next_pdidx " << i;
+    TRACE_DEBUG("alloc_pdidx: next_pdidx %u", i);
     do {
         if (state->pdom_tbl[i] == NULL)
         {
             state->next_pdidx = (i + 1) % PDIDX_MAX;
-            logger::trace() << __FUNCTION__ << ": allocate next_pdidx " << i;
+            TRACE_DEBUG("alloc_pdidx: allocate next_pdidx %u", i);
             return i;
         }
         i = (i + 1) % PDIDX_MAX;
-        logger::trace() << __FUNCTION__ << ": next_pdidx " << i;
+        TRACE_DEBUG("alloc_pdidx: next_pdidx %u", i);
     } while(i != state->next_pdidx);
 
     logger::warning() << __FUNCTION__ << ": out of identifiers!" << endl;
@@ -597,8 +598,8 @@ static void mmu_v1_set_rights(mmu_v1::closure_t* self, protection_domain_v1::id
     pdom->rights[sid>>1] |= val;
 
     // Want to invalidate all non-global TB entries, but we can't
-    // do that on Intel so just blow away the whole thing.
-    // nucleus::flush_tlb();
+    // do that on Intel so just blow away the whole thing, on every CPU.
+    nucleus::flush_tlb();
 }
 
 static stretch_v1::rights mmu_v1_query_rights(mmu_v1::closure_t* self, protection_domain_v1::id dom_id, stretch_v1::closure_t* str)
@@ -646,21 +647,21 @@ static const mmu_v1::ops_t mmu_v1_methods =
 static memory_v1::size ramtab_v1_size(ramtab_v1::closure_t* self)
 {
     mmu_v1::state_t* st = reinterpret_cast<mmu_v1::state_t*>(self->d_state);
-    logger::trace() << __FUNCTION__ << ": ramtab state at " << st << ", returning size " << st->ramtab_size;
+    TRACE_DEBUG("ramtab_v1_size: ramtab state at %p, returning size %u", st, st->ramtab_size);
     return st->ramtab_size;
 }
 
 static memory_v1::address ramtab_v1_base(ramtab_v1::closure_t* self)
 {
     mmu_v1::state_t* st = reinterpret_cast<mmu_v1::state_t*>(self->d_state);
-    logger::trace() << __FUNCTION__ << ": ramtab state at " << st << ", returning base " << st->ramtab;
+    TRACE_DEBUG("ramtab_v1_base: ramtab state at %p, returning base %p", st, st->ramtab);
     return reinterpret_cast<memory_v1::address>(st->ramtab);
 }
 
 static void ramtab_v1_put(ramtab_v1::closure_t* self, uint32_t frame, uint32_t owner, uint32_t frame_width, ramtab_v1::state state)
 {
     mmu_v1::state_t* st = reinterpret_cast<mmu_v1::state_t*>(self->d_state);
-    logger::trace() << __FUNCTION__ << ": frame " << frame << " with owner " << owner << " and frame width " << int(frame_width) << " in state " << state;
+    TRACE_DEBUG("ramtab_v1_put: frame %u with owner %x and frame width %u in state %u", frame, owner, frame_width, state);
     if (frame >= st->ramtab_size)
     {
         logger::warning() << __FUNCTION__ << ": out of range frame " << frame << ", max is " << st->ramtab_size;
@@ -685,7 +686,7 @@ static uint32_t ramtab_v1_get(ramtab_v1::closure_t* self, uint32_t frame, uint32
 
     *frame_width = st->ramtab[frame].frame_width;
     *state = ramtab_v1::state(st->ramtab[frame].state);
-    logger::trace() << __FUNCTION__ << ": frame " << frame << " with owner " << st->ramtab[frame].owner << " and frame width " << int(*frame_width) << " in state " << *state;
+    TRACE_DEBUG("ramtab_v1_get: frame %u with owner %x and frame width %u in state %u", frame, st->ramtab[frame].owner, *frame_width, *state);
     return st->ramtab[frame].owner;
 }
 
@@ -823,7 +824,9 @@ static void enter_mappings(mmu_v1::state_t* state)
                 PANIC("enter_mappings failed!");
             }
 
-            state->ramtab_closure.put(phys_frame_number(phys), OWNER_SYSTEM, FRAME_WIDTH, ramtab_v1::state_mapped);
+            // Device memory (local APIC, PCI ECAM window) lies above RAM and has no ramtab entries.
+            if (phys_frame_number(phys) < state->ramtab_size)
+                state->ramtab_closure.put(phys_frame_number(phys), OWNER_SYSTEM, FRAME_WIDTH, ramtab_v1::state_mapped);
         }
     });
 
@@ -18,6 +18,8 @@
 #include "logger.h"
 #include "module_loader.h"
 #include "infopage.h"
+#include "trace_buffer.h"
+#include "fpu.h"
 #include "frames_module_v1_interface.h"
 #include "mmu_v1_interface.h"
 #include "mmu_module_v1_interface.h"
@@ -50,7 +52,7 @@
 #include "frames_module_v1_impl.h"
 #include "map_string_address_v1_interface.h"
 
-#include "config.h" // for PCIBUS_TEST
+#include "config.h" // for PCIBUS_TEST, IDC_BENCHMARK, CONSOLE_BENCHMARK, EXCEPTIONS_BENCHMARK
 
 /**
  * @class bootimage_t
@@ -129,13 +131,18 @@ create_address_space(system_frame_allocator_v1::closure_t* frames, mmu_v1::closu
 {
     auto pdom = mmu->create_domain();
 
-    memory_v1::physmem_desc null_pmem; /// @todo We pass pmems by value in the interface atm... it's not even used!
+    memory_v1::physmem_desc null_pmem = {}; // No frames: keep existing mappings or fault them in on demand.
 
-    // First we need to map the PIP globally read-only.
-    auto str = PVS(stretch_allocator)->create_over(PAGE_SIZE,
+    // First we need to map the PIPs of all CPUs globally read-only.
+    auto str = PVS(stretch_allocator)->create_over(information_page_t::MAX_CPUS * PAGE_SIZE,
             stretch_v1::rights(stretch_v1::right_read).add(stretch_v1::right_global),
             information_page_t::ADDRESS, memory_v1::attrs_regular, PAGE_WIDTH, null_pmem);
 
+    // Trace buffers are written by trace points in any domain.
+    PVS(stretch_allocator)->create_over(information_page_t::MAX_CPUS * trace_buffer_t::STRIDE,
+            stretch_v1::rights(stretch_v1::right_read).add(stretch_v1::right_write).add(stretch_v1::right_global),
+            trace_buffer_t::ADDRESS, memory_v1::attrs_regular, PAGE_WIDTH, null_pmem);
+
     /* Map stretches over the boot image */
 
 //
@@ -237,7 +244,7 @@ create_address_space(system_frame_allocator_v1::closure_t* frames, mmu_v1::closu
 static void map_initial_heap(heap_factory_v1::closure_t* heap_factory, heap_v1::closure_t* heap, size_t initial_heap_size, protection_domain_v1::id root_domain_pdid)
 {
     logger::debug() << "Mapping stretch over heap: " << int(initial_heap_size) << " bytes at " << heap;
-    memory_v1::physmem_desc null_pmem; /// @todo We pass pmems by value in the interface atm... it's not even used!
+    memory_v1::physmem_desc null_pmem = {}; // No frames: keep existing mappings or fault them in on demand.
 
     auto str = PVS(stretch_allocator)->create_over(initial_heap_size, stretch_v1::rights(stretch_v1::right_read), memory_v1::address(heap), memory_v1::attrs_regular, PAGE_WIDTH, null_pmem);
 
@@ -292,6 +299,12 @@ init(bootimage_t& bootimg)
     load_module<naming_context_factory_v1::closure_t>(bootimg, "context_factory", "exported_naming_context_factory_rootdom");
 #if PCIBUS_TEST
     load_module<closure::closure_t>(bootimg, "pcibus_mod", "exported_pcibus_rootdom");//test pci bus scanning
+#endif
+#if IDC_BENCHMARK
+    load_module<closure::closure_t>(bootimg, "idc_mod", "exported_idc_bench_rootdom");
+#endif
+#if THREADS_BENCHMARK
+    load_module<closure::closure_t>(bootimg, "threads_factory", "exported_threads_bench_rootdom");
 #endif
     load_module(bootimg, "interface_repository", nullptr);
     // === END WORKAROUND ===
@@ -393,7 +406,7 @@ init(bootimage_t& bootimg)
         auto res = PVS(heap)->allocate(1024*1024*1024);
         ASSERT(res); // Should not execute this!
     }
-    OS_CATCH("heap_v1.no_memory") {
+    OS_CATCH(heap_v1::no_memory_id) {
         logger::debug() << "__ Handled heap_v1.no_memory exception, yippie!";
     }
     OS_ENDTRY
@@ -420,15 +433,12 @@ init(bootimage_t& bootimg)
     PVS(types) = reinterpret_cast<type_system_v1::closure_t*>(ts);
     logger::debug() << "Done: typesystem is at " << ts;
 
-    /* Preload types in the interface repository */
+    /* Preload types in the interface repository, meddler puts all of them in one table */
     logger::debug() << "Registering interfaces";
-    // Idealized interface:
-    // symbols = module("interface_repository").find_symbols().ending_with("__intf_typeinfo");
-    auto symbols = symbols_in("interface_repository", "__intf_typeinfo").all_symbols();
-    logger::debug() << "   found " << int(symbols.size()) << " interfaces";
-    for (auto& symbol : symbols)
+    for (auto& symbol : symbols_in("interface_repository", "interface_registry").all_symbols())
     {
-        ts->register_interface(symbol.second->value);
+        if (memutils::is_string_equal(symbol.first, "interface_registry"))
+            ts->register_repository(symbol.second->value);
     }
 
     logger::debug() << "___ Testing the type system listing";
@@ -747,10 +757,102 @@ init(bootimage_t& bootimg)
 #define CONTEXT_FIND(name, type) \
 ({ \
     any v; \
-    if (!PVS(root)->get(name, &v)) OS_RAISE((exception_support_v1::id)"naming_context_v1.not_found", (exception_support_v1::args)name); \
+    if (!PVS(root)->get(name, &v)) OS_RAISE(naming_context_v1::not_found_id, (exception_support_v1::args)name); \
     reinterpret_cast<type::closure_t*>(PVS(types)->narrow(v, type::type_code)); \
 })
 
+#if CONSOLE_BENCHMARK
+#include "cpu.h"
+
+/**
+ * Measure console output throughput with lines typical of the boot log.
+ */
+static void console_benchmark()
+{
+    static const char line[] = "console benchmark: the quick brown fox jumps over the lazy dog ";
+    const int lines = 50;
+    int bytes = 0;
+
+    kconsole << endl;
+    uint64_t start = x86_cpu_t::read_tsc();
+    for (int i = 0; i < lines; ++i)
+    {
+        kconsole << line << i << endl;
+        bytes += sizeof(line) - 1 + (i < 10 ? 1 : 2) + 1;
+    }
+    // A 32-bit count keeps 64-bit division out of the kernel and is plenty for a few kilobytes.
+    uint32_t cycles = x86_cpu_t::read_tsc() - start;
+
+    kconsole << "Console throughput: " << bytes << " bytes in " << int(cycles / 1000) << " kcycles, "
+             << int(cycles / bytes) << " cycles per byte" << endl;
+}
+#endif
+
+#if EXCEPTIONS_BENCHMARK
+#include "cpu.h"
+
+// Raise an exception and catch it in the second of two CATCH clauses, as handlers for several exceptions do.
+static uint32_t raise_catch_cycles(exception_support_v1::id raised, exception_support_v1::id other, int rounds)
+{
+    uint64_t start = x86_cpu_t::read_tsc();
+    for (int i = 0; i < rounds; ++i)
+    {
+        OS_TRY {
+            OS_RAISE(raised, 0);
+        }
+        OS_CATCH(other) {
+            PANIC("Caught the wrong exception");
+        }
+        OS_CATCH(raised) {
+        }
+        OS_ENDTRY
+    }
+    return x86_cpu_t::read_tsc() - start;
+}
+
+// Enter and leave a TRY block without raising, the cost every guarded call pays. Compare with an unguarded loop.
+static uint32_t try_cycles(bool guarded, int rounds)
+{
+    volatile int work = 0;
+    uint64_t start = x86_cpu_t::read_tsc();
+    for (int i = 0; i < rounds; ++i)
+    {
+        if (!guarded)
+        {
+            work = work + 1;
+            continue;
+        }
+        OS_TRY {
+            work = work + 1;
+        }
+        OS_FINALLY {
+        }
+        OS_ENDTRY
+    }
+    return x86_cpu_t::read_tsc() - start;
+}
+
+/**
+ * Measure raise and catch round trips with exception ids against the same exceptions given by name,
+ * and the overhead of a TRY block with CONFIG_EXCEPTIONS_UNWIND either way.
+ */
+static void exceptions_benchmark()
+{
+    const int rounds = 1000;
+
+    uint32_t by_id = raise_catch_cycles(xcp_id(heap_v1::no_memory_id), xcp_id(naming_context_v1::not_found_id), rounds);
+    uint32_t by_name = raise_catch_cycles(xcp_id("heap_v1.no_memory"), xcp_id("naming_context_v1.not_found"), rounds);
+
+    kconsole << "Exception raise and catch: " << int(by_id / rounds) << " cycles by id, "
+             << int(by_name / rounds) << " cycles by name" << endl;
+
+    uint32_t plain = try_cycles(false, rounds);
+    uint32_t guarded = try_cycles(true, rounds);
+    kconsole << "TRY block overhead: " << (int(guarded) - int(plain)) / rounds << " cycles"
+             << (CONFIG_EXCEPTIONS_UNWIND ? " (unwind)" : " (setjmp)") << endl;
+}
+#endif
+
 /// @todo Must be a part of kickstarter (code that executes once on startup)?
 /// @todo Domain manager.
 /// @todo VCPU.
@@ -758,12 +860,33 @@ init(bootimage_t& bootimg)
 static NEVER_RETURNS void
 start_root_domain(bootimage_t& bootimg)
 {
+#if CONSOLE_BENCHMARK
+    console_benchmark();
+#endif
+
+#if EXCEPTIONS_BENCHMARK
+    exceptions_benchmark();
+#endif
+
 #if PCIBUS_TEST
     auto pciscan = load_module<closure::closure_t>(bootimg, "pcibus_mod", "exported_pcibus_rootdom");//test pci bus scanning
     ASSERT(pciscan);
     pciscan->apply();
 #endif
 
+#if IDC_BENCHMARK
+    auto idc_bench = load_module<closure::closure_t>(bootimg, "idc_mod", "exported_idc_bench_rootdom");
+    ASSERT(idc_bench);
+    idc_bench->apply();
+#endif
+
+#if THREADS_BENCHMARK
+    // Skips itself until the root domain runs on a vcpu with the threads package.
+    auto threads_bench = load_module<closure::closure_t>(bootimg, "threads_factory", "exported_threads_bench_rootdom");
+    ASSERT(threads_bench);
+    threads_bench->apply();
+#endif
+
 #if 0
     /* Find the Virtual Processor module */
     vp = CONTEXT_FIND("Modules.VCPU", vcpu_v1);
@@ -858,6 +981,9 @@ start_root_domain(bootimage_t& bootimg)
     bootinfo_t* bi = new(bootinfo_t::ADDRESS) bootinfo_t;
     bi->print_memory_map();
 
+    // FPU is switched lazily, state is only saved when another context traps on first FPU use.
+    logger::debug() << "FPU: " << INFO_PAGE.cpu.fpu_traps << " traps, " << INFO_PAGE.cpu.fpu_saves << " saves";
+
     PANIC("root_domain entry returned! IT'S OK STILL, NO WORRIES");
 }
 
@@ -887,7 +1013,8 @@ extern "C" void module_entry()
         PANIC("Bootimage not found! in image bootup");
     }
 
-    bi->use_memory(information_page_t::ADDRESS, PAGE_SIZE, multiboot_t::mmap_entry_t::info_page);
+    bi->use_memory(information_page_t::ADDRESS, information_page_t::MAX_CPUS * PAGE_SIZE, multiboot_t::mmap_entry_t::info_page);
+    bi->use_memory(trace_buffer_t::ADDRESS, information_page_t::MAX_CPUS * trace_buffer_t::STRIDE, multiboot_t::mmap_entry_t::info_page);
     bi->use_memory(bootinfo_t::ADDRESS, PAGE_SIZE, multiboot_t::mmap_entry_t::bootinfo);
     bi->use_memory(0xb8000, PAGE_SIZE, multiboot_t::mmap_entry_t::framebuffer);
 
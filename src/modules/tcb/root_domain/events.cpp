@@ -6,11 +6,14 @@
 #include "threads_manager_v1_interface.h"
 #include "thread_hooks_v1_interface.h"
 #include "time_notify_v1_interface.h"
+#include "time_notify_v1_impl.h"
 #include "channel_notify_v1_interface.h"
 #include "channel_notify_v1_impl.h"
 #include "events_v1_impl.h"
 #include "module_interface.h"
 #include "binder_v1_interface.h"
+#include "channel_v1_interface.h"
+#include "events_v1_interface.h"
 #include "exceptions.h"
 #include "time_macros.h"
 #include "heap_new.h"
@@ -160,6 +163,34 @@ channel_notify_v1::ops_t notify_methods =
     nullptr
 };
 
+//=====================================================================================================================
+// Timeouts.
+//=====================================================================================================================
+
+/**
+ * Called by the activation dispatcher when a thread blocked in block_event() with a deadline times out:
+ * take it off the event count wait queue and the time queue, and make it runnable again.
+ * Runs within the activation handler, activations are off.
+ */
+static void
+time_notify_v1_notify(time_notify_v1::closure_t* self, time_v1::time now, time_v1::time deadline, void* handle)
+{
+    instance_state_t* istate = reinterpret_cast<instance_state_t*>(self->d_state);
+    qlink_t* cur = reinterpret_cast<qlink_t*>(handle);
+
+    cur->waitq.remove();
+    cur->waitq.init(cur);
+    cur->timeq.remove();
+    cur->timeq.init(cur);
+
+    istate->thread_manager->unblock_thread(cur->thread, /*in_cs:*/false);
+}
+
+static const time_notify_v1::ops_t time_notify_methods =
+{
+    time_notify_v1_notify
+};
+
 //=====================================================================================================================
 // Events helper functions.
 //=====================================================================================================================
@@ -206,31 +237,26 @@ block_event(events_v1::state_t* state, event_count_t* event_count, thread_v1::cl
         wqp->add_to_tail(current->waitq);
     }
     else
-        current->waitq.init(); // use reset() or clear_links() maybe?
+        current->waitq.init(current);
 
     if (until != FOREVER)
     {
+        closure_init(&state->time_notify, &time_notify_methods, reinterpret_cast<time_notify_v1::state_t*>(istate));
+
         if (!istate->dispatcher->add_timeout(&state->time_notify, until, current))
         {
             // Timeout passed while we were adding it.
-            if (current->waitq.next())
-            {
-                current->waitq.remove();
-                current->waitq.init();
-                current->timeq.init();
-            }
+            current->waitq.remove();
+            current->waitq.init(current);
+            current->timeq.init(current);
             return alerted;
         }
 
-        dl_link_t<qlink_t>* tqp = istate->time_queue.next();
-
-        while (tqp != &istate->time_queue && (*tqp)->wait_time <= until)
-            tqp = tqp->next();
-
-        tqp->add_to_tail(current->timeq);
+        // The dispatcher keeps timeouts ordered, time_queue only tracks who is waiting.
+        istate->time_queue.add_to_tail(current->timeq);
     }
     else
-        current->timeq.init();
+        current->timeq.init(current);
 
     // Now we block the thread in the user-level scheduler, and yield.
     alerted = istate->thread_manager->block_yield(until);
@@ -247,8 +273,14 @@ unblock_event(instance_state_t* istate, event_count_t* event_count, bool alerted
         qlink_t *cur = *event_count->wait_queue.next();
 
         cur->waitq.remove();
+        cur->waitq.init(cur);
 
-        // @todo: remove from timeq too...
+        if (cur->wait_time != FOREVER)
+        {
+            istate->dispatcher->remove_timeout(cur->wait_time, cur);
+            cur->timeq.remove();
+            cur->timeq.init(cur);
+        }
 
         if (alerted)
             cur->thread->alert();
@@ -269,7 +301,7 @@ events_create(events_v1::closure_t* self)
 
     event_count_t* res = new(istate->heap) event_count_t(istate);
     if (!res)
-        OS_RAISE((exception_support_v1::id)"events_v1.no_resources", 0);
+        OS_RAISE(events_v1::no_resources_id, 0);
 
     istate->all_counts.ec_queue.add_to_tail(res->ec_queue);
 
@@ -435,7 +467,7 @@ events_await(events_v1::closure_t* self, event_v1::count ec, event_v1::value val
     istate->thread_manager->leave_critical_section();
 
     if (alerted)
-        OS_RAISE((exception_support_v1::id)"thread_v1.alerted", 0);
+        OS_RAISE(thread_v1::alerted_id, 0);
 
     return result;
 }
@@ -462,7 +494,7 @@ events_await_until(events_v1::closure_t* self, event_v1::count ec, event_v1::val
         }
 
         if (alerted)
-            OS_RAISE((exception_support_v1::id)"thread_v1.alerted", 0);
+            OS_RAISE(thread_v1::alerted_id, 0);
 
         return 0;
     }
@@ -532,7 +564,7 @@ events_await_until(events_v1::closure_t* self, event_v1::count ec, event_v1::val
     istate->thread_manager->leave_critical_section();
 
     if (alerted)
-        OS_RAISE((exception_support_v1::id)"thread_v1.alerted", 0);
+        OS_RAISE(thread_v1::alerted_id, 0);
 
     return result;
 }
@@ -549,7 +581,7 @@ events_create_sequencer(events_v1::closure_t* self)
 
     sequencer_t* res = new(istate->heap) sequencer_t(0);
     if (!res)
-        OS_RAISE((exception_support_v1::id)"events_v1.no_resources", 0);
+        OS_RAISE(events_v1::no_resources_id, 0);
 
     return res;
 }
@@ -600,14 +632,14 @@ events_attach(events_v1::closure_t* self, event_v1::count ec, channel_v1::endpoi
         if (state == channel_v1::state_connected)
         {
             if (ep_type != type)
-                OS_RAISE((exception_support_v1::id)"channel_v1.invalid", channel);
+                OS_RAISE(channel_v1::invalid_id, channel);
         }
         else
             if (state != channel_v1::state_local)
-                OS_RAISE((exception_support_v1::id)"channel_v1.bad_state", /*channel, state*/0);
+                OS_RAISE(channel_v1::bad_state_id, /*channel, state*/0);
 
         if (event_count->ep_type != channel_v1::endpoint_type_none)
-            OS_RAISE((exception_support_v1::id)"channel_v1.invalid", 0); //ec); // Already attached.
+            OS_RAISE(channel_v1::invalid_id, 0); //ec); // Already attached.
 
         event_count->ep = channel;
         event_count->ep_type = type;
@@ -662,28 +694,28 @@ events_attach_pair(events_v1::closure_t* self, event_v1::pair events, channel_v1
         if (tx_state == channel_v1::state_connected)
         {
             if (ep_type != channel_v1::endpoint_type_tx)
-                OS_RAISE((exception_support_v1::id)"channel_v1.invalid", channels.sender);
+                OS_RAISE(channel_v1::invalid_id, channels.sender);
         }
         else
             if (tx_state != channel_v1::state_local)
-                OS_RAISE((exception_support_v1::id)"channel_v1.bad_state", /*channel, state*/0);
+                OS_RAISE(channel_v1::bad_state_id, /*channel, state*/0);
 
         rx_state = istate->vcpu->query_channel(channels.receiver, &ep_type, &rx_val, &rx_ack);
 
         if (rx_state == channel_v1::state_connected)
         {
             if (ep_type != channel_v1::endpoint_type_rx)
-                OS_RAISE((exception_support_v1::id)"channel_v1.invalid", channels.receiver);
+                OS_RAISE(channel_v1::invalid_id, channels.receiver);
         }
         else
             if (rx_state != channel_v1::state_local)
-                OS_RAISE((exception_support_v1::id)"channel_v1.bad_state", /*channel, state*/0);
+                OS_RAISE(channel_v1::bad_state_id, /*channel, state*/0);
 
         if (tx->ep_type != channel_v1::endpoint_type_none)
-            OS_RAISE((exception_support_v1::id)"channel_v1.invalid", 0); //tx); // Already attached.
+            OS_RAISE(channel_v1::invalid_id, 0); //tx); // Already attached.
 
         if (rx->ep_type != channel_v1::endpoint_type_none)
-            OS_RAISE((exception_support_v1::id)"channel_v1.invalid", 0); //rx); // Already attached.
+            OS_RAISE(channel_v1::invalid_id, 0); //rx); // Already attached.
 
         tx->ep = channels.sender;
         tx->ep_type = channel_v1::endpoint_type_tx;
@@ -721,7 +753,7 @@ static channel_v1::endpoint
 events_query_endpoint(events_v1::closure_t* self, event_v1::count ec, channel_v1::endpoint_type* type)
 {
     if (ec == NULL_EVENT)
-        OS_RAISE((exception_support_v1::id)"events_v1.invalid", 0);//ec);
+        OS_RAISE(events_v1::invalid_id, 0);//ec);
 
     instance_state_t* istate  = self->d_state->inst_state;
     vcpu_lock_t lock(istate->vcpu);
@@ -547,6 +547,8 @@ system_stretch_allocator_v1_create_over(system_stretch_allocator_v1::closure_t*
 
     if (update)
         state->mmu->update_range(&s->closure, virtmem, global_rights);
+    else if (pmem.n_frames)
+        state->mmu->add_mapped_range(&s->closure, virtmem, pmem, global_rights); // e.g. device registers or DMA buffers
     else
         state->mmu->add_range(&s->closure, virtmem, global_rights);
 
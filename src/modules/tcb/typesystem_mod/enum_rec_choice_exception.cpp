@@ -96,14 +96,14 @@ info(exception_v1::closure_t* self, interface_v1::closure_t** i, uint32_t* n)
 static void
 shared_add(naming_context_v1::closure_t*, const char*, types::any)
 {
-    OS_RAISE((exception_support_v1::id)"naming_context_v1.denied", 0);
+    OS_RAISE(naming_context_v1::denied_id, 0);
     return;
 }
 
 static void
 shared_remove(naming_context_v1::closure_t*, const char*)
 { 
-    OS_RAISE((exception_support_v1::id)"naming_context_v1.denied", 0);
+    OS_RAISE(naming_context_v1::denied_id, 0);
     return; 
 }
 
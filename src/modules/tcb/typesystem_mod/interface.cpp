@@ -41,14 +41,14 @@ info(interface_v1::closure_t* self, interface_v1::needs* need_list, types::name*
 static void
 shared_add(naming_context_v1::closure_t*, const char*, types::any)
 {
-    OS_RAISE((exception_support_v1::id)"naming_context_v1.denied", 0);
+    OS_RAISE(naming_context_v1::denied_id, 0);
     return;
 }
 
 static void
 shared_remove(naming_context_v1::closure_t*, const char*)
 { 
-    OS_RAISE((exception_support_v1::id)"naming_context_v1.denied", 0);
+    OS_RAISE(naming_context_v1::denied_id, 0);
     return; 
 }
 
@@ -17,13 +17,16 @@
 #include "operation_v1_interface.h"
 #include "interface_v1_state.h"
 #include "interface_v1_impl.h"
+#include "interface_registry.h"
 #include "naming_context_v1_interface.h"
 #include "map_string_address_iterator_v1_interface.h"
 #include "map_card64_address_factory_v1_interface.h"
 #include "map_string_address_factory_v1_interface.h"
 #include "map_card64_address_v1_interface.h"
 #include "map_string_address_v1_interface.h"
+#include "heap_v1_interface.h"
 #include "heap_new.h"
+#include "lockable.h"
 #include "default_console.h"
 #include "exceptions.h"
 #include "debugger.h"
@@ -43,11 +46,79 @@
 // Type system internal data structures.
 //=====================================================================================================================
 
+struct type_hierarchy_t; // forward declaration
+
 struct type_system_f_v1::state_t
 {
     type_system_f_v1::closure_t        closure;
     map_card64_address_v1::closure_t*  interfaces_by_typecode;
     map_string_address_v1::closure_t*  interfaces_by_name;
+    const interface_registry_t*        repository;  // Interfaces of the interface repository, not in the maps.
+    heap_v1::closure_t*                heap;
+    size_t                             generation;  // Number of registered interfaces.
+    type_hierarchy_t* volatile         hierarchy;   // Built for some generation, rebuilt on demand.
+    type_hierarchy_t*                  retired;     // Superseded snapshots not freed yet, under hierarchy_lock.
+    volatile address_t                 readers;     // Queries using a snapshot at the moment.
+    lockable_t                         hierarchy_lock;
+};
+
+/**
+ * One registered interface in the hierarchy table.
+ *
+ * Interfaces are numbered in preorder of the inheritance tree, so an interface is a subtype of another exactly when
+ * its number lies in the [first, last] interval of the other's subtree.
+ */
+struct type_node_t
+{
+    enum : uint32_t { NIL = ~0u };
+
+    types::code             code;      // TCODE_NONE in a free slot.
+    interface_v1::state_t*  iface;
+    uint32_t                first;     // Preorder number of the interface.
+    uint32_t                last;      // Largest preorder number in its subtree.
+    types::code             orphan;    // Unregistered supertype up the chain, own code if the chain loops, or TCODE_NONE.
+    types::code*            unaliased; // Unaliased code of each type or TCODE_NONE if not known yet.
+    uint32_t                parent, child, sibling; // Slots of the tree links, used only while numbering.
+};
+
+/**
+ * Snapshot of the registered interfaces answering is_type and unalias without walking the chains.
+ *
+ * Open addressed table of type_node_t keyed by interface code. Never changed once published, a registration makes
+ * the next query build a new one. Another domain may still be reading the old one, so it is retired and freed
+ * later, by a rebuild that finds no other query running.
+ */
+struct type_hierarchy_t
+{
+    size_t            generation;
+    type_hierarchy_t* next_retired;
+    size_t            mask; // Number of slots minus one, a power of two.
+    type_node_t  nodes[];
+
+    static inline uint32_t hash(types::code code)
+    {
+        return uint32_t((code >> 16) ^ (code >> 32)) * 2654435761u;
+    }
+
+    inline type_node_t* find(types::code code)
+    {
+        for (size_t i = hash(code) & mask;; i = (i + 1) & mask)
+        {
+            if (nodes[i].code == code)
+                return &nodes[i];
+            if (nodes[i].code == TCODE_NONE)
+                return nullptr;
+        }
+    }
+
+    inline type_node_t* insert(types::code code)
+    {
+        size_t i = hash(code) & mask;
+        while (nodes[i].code != TCODE_NONE)
+            i = (i + 1) & mask;
+        nodes[i].code = code;
+        return &nodes[i];
+    }
 };
 
 extern interface_v1::closure_t meta_interface_closure; // forward declaration
@@ -60,14 +131,14 @@ extern interface_v1::state_t meta_interface; // forward declaration
 static void
 shared_add(naming_context_v1::closure_t*, const char*, types::any)
 {
-    OS_RAISE((exception_support_v1::id)"naming_context_v1.denied", 0);
+    OS_RAISE(naming_context_v1::denied_id, 0);
     return;
 }
 
 static void
 shared_remove(naming_context_v1::closure_t*, const char*)
 { 
-    OS_RAISE((exception_support_v1::id)"naming_context_v1.denied", 0);
+    OS_RAISE(naming_context_v1::denied_id, 0);
     return; 
 }
 
@@ -79,6 +150,314 @@ shared_destroy(naming_context_v1::closure_t*)
     return; 
 }
 
+//=====================================================================================================================
+// Interface lookup
+//=====================================================================================================================
+
+/**
+ * Find a registered interface by its type code.
+ */
+static interface_v1::state_t* find_interface(type_system_f_v1::state_t* state, types::code code)
+{
+    interface_v1::state_t* iface = nullptr;
+    if (state->repository && (iface = state->repository->find(code)))
+        return iface;
+    if (state->interfaces_by_typecode->get(code, (address_t*)&iface))
+        return iface;
+    return nullptr;
+}
+
+static const size_t MAX_INTERFACE_NAME = 127; // Longer names are found only by themselves, not as Interface.type.
+
+/**
+ * Find a registered interface by the first n characters of name.
+ */
+static interface_v1::state_t* find_interface(type_system_f_v1::state_t* state, const char* name, size_t n)
+{
+    interface_v1::state_t* iface = nullptr;
+    if (state->repository && (iface = state->repository->find(name, n)))
+        return iface;
+
+    // Interfaces registered one by one are kept by NUL terminated name.
+    if (name[n] == 0)
+    {
+        if (state->interfaces_by_name->get(name, (address_t*)&iface))
+            return iface;
+        return nullptr;
+    }
+
+    // Prefix of a qualified name, copy it out.
+    char key[MAX_INTERFACE_NAME + 1];
+    if (n > MAX_INTERFACE_NAME)
+        return nullptr;
+    memutils::copy_memory(key, name, n);
+    key[n] = 0;
+    if (state->interfaces_by_name->get(key, (address_t*)&iface))
+        return iface;
+    return nullptr;
+}
+
+//=====================================================================================================================
+// Type hierarchy
+//=====================================================================================================================
+
+/**
+ * Number the interfaces in preorder, walking the tree through the parent, child and sibling links.
+ */
+static void number_subtypes(type_hierarchy_t* h, uint32_t roots)
+{
+    uint32_t number = 0;
+    uint32_t n = roots;
+    while (n != type_node_t::NIL)
+    {
+        type_node_t& node = h->nodes[n];
+        node.first = number++;
+        node.orphan = node.parent != type_node_t::NIL ? h->nodes[node.parent].orphan
+                    : (node.iface->supertype ? node.iface->supertype : TCODE_NONE);
+        if (node.child != type_node_t::NIL)
+        {
+            n = node.child;
+            continue;
+        }
+        // Close the finished subtrees going up until there is a sibling to visit.
+        while (n != type_node_t::NIL)
+        {
+            h->nodes[n].last = number - 1;
+            if (h->nodes[n].sibling != type_node_t::NIL)
+            {
+                n = h->nodes[n].sibling;
+                break;
+            }
+            n = h->nodes[n].parent;
+        }
+    }
+}
+
+/**
+ * Follow the alias chain of every type, leaving TCODE_NONE where it leads out of the registered interfaces.
+ */
+static void unalias_types(type_hierarchy_t* h, size_t total_types)
+{
+    for (size_t slot = 0; slot <= h->mask; ++slot)
+    {
+        type_node_t& node = h->nodes[slot];
+        if (node.code == TCODE_NONE)
+            continue;
+
+        for (size_t i = 0; i < node.iface->num_types; ++i)
+        {
+            types::code tc = node.code | (i + 1);
+            type_node_t* owner = &node;
+            // An alias chain can't be longer than the number of types, unless it is a loop.
+            for (size_t steps = 0; tc != TCODE_NONE; ++steps)
+            {
+                if (TCODE_IS_INTERFACE(tc))
+                    break;
+                if (!owner || !TCODE_VALID_TYPE(tc, owner->iface) || steps > total_types)
+                    tc = TCODE_NONE;
+                else if (TCODE_WHICH_TYPE(tc, owner->iface)->any.type_ == type_system_v1::alias_type_code)
+                {
+                    tc = TCODE_WHICH_TYPE(tc, owner->iface)->any.value;
+                    owner = h->find(TCODE_INTF_CODE(tc));
+                }
+                else
+                    break;
+            }
+            node.unaliased[i] = tc;
+        }
+    }
+}
+
+static type_hierarchy_t* build_hierarchy(type_system_f_v1::state_t* state)
+{
+    size_t count = 0, total_types = 0;
+    const char* name;
+    interface_v1::state_t* iface;
+
+    const interface_registry_t* repo = state->repository;
+    for (size_t i = 0; repo && i < repo->count; ++i)
+    {
+        ++count;
+        total_types += repo->entries[i].rep->num_types;
+    }
+
+    auto it = state->interfaces_by_name->iterate();
+    while (it->next(&name, (memory_v1::address*)&iface))
+    {
+        ++count;
+        total_types += iface->num_types;
+    }
+    it->dispose();
+
+    size_t slots = 4;
+    while (slots < 2 * count)
+        slots *= 2;
+
+    type_hierarchy_t* h = reinterpret_cast<type_hierarchy_t*>(state->heap->allocate(
+        sizeof(type_hierarchy_t) + slots * sizeof(type_node_t) + total_types * sizeof(types::code)));
+    h->generation = state->generation;
+    h->mask = slots - 1;
+    types::code* unaliased = reinterpret_cast<types::code*>(&h->nodes[slots]);
+    for (size_t i = 0; i < slots; ++i)
+        h->nodes[i].code = TCODE_NONE;
+
+    auto add_node = [&](interface_v1::state_t* iface)
+    {
+        type_node_t* node = h->insert(iface->rep.code.value);
+        node->iface = iface;
+        node->first = type_node_t::NIL; // Outside of every interval until numbered, supertype loops never are.
+        node->last = 0;
+        node->orphan = TCODE_NONE;
+        node->unaliased = unaliased;
+        node->parent = node->child = node->sibling = type_node_t::NIL;
+        unaliased += iface->num_types;
+    };
+
+    for (size_t i = 0; repo && i < repo->count; ++i)
+        add_node(repo->entries[i].rep);
+
+    it = state->interfaces_by_name->iterate();
+    while (it->next(&name, (memory_v1::address*)&iface))
+        add_node(iface);
+    it->dispose();
+
+    // Link the tree, interfaces without a registered supertype are roots.
+    uint32_t roots = type_node_t::NIL;
+    for (uint32_t slot = 0; slot < slots; ++slot)
+    {
+        type_node_t& node = h->nodes[slot];
+        if (node.code == TCODE_NONE)
+            continue;
+        type_node_t* super = node.iface->supertype ? h->find(node.iface->supertype) : nullptr;
+        if (super)
+        {
+            node.parent = super - h->nodes;
+            node.sibling = super->child;
+            super->child = slot;
+        }
+        else
+        {
+            node.sibling = roots;
+            roots = slot;
+        }
+    }
+
+    number_subtypes(h, roots);
+
+    // Interfaces not reached from any root have a loop in their supertype chain.
+    for (uint32_t slot = 0; slot < slots; ++slot)
+    {
+        type_node_t& node = h->nodes[slot];
+        if (node.code == TCODE_NONE || node.first != type_node_t::NIL)
+            continue;
+        logger::warning() << "type_system: supertype chain of " << node.iface->rep.name << " loops";
+        node.orphan = node.code;
+    }
+
+    unalias_types(h, total_types);
+
+    logger::debug() << "type_system: numbered " << int(count) << " interfaces";
+    return h;
+}
+
+/**
+ * Free the retired snapshots if the calling query is the only one running. Queries that start later count
+ * themselves before they read state->hierarchy, so they can only get the current snapshot.
+ * Called with hierarchy_lock held.
+ */
+static void free_retired(type_system_f_v1::state_t* state)
+{
+    atomic_ops::membar();
+    if (state->readers != 1)
+        return;
+
+    while (state->retired)
+    {
+        type_hierarchy_t* h = state->retired;
+        state->retired = h->next_retired;
+        state->heap->free(reinterpret_cast<memory_v1::address>(h));
+    }
+}
+
+/**
+ * Get the hierarchy of the currently registered interfaces.
+ * It stays valid until put_hierarchy(), do not raise exceptions in between.
+ */
+static inline type_hierarchy_t* get_hierarchy(type_system_f_v1::state_t* state)
+{
+    atomic_ops::aaf(const_cast<address_t*>(&state->readers), 1);
+
+    type_hierarchy_t* h = state->hierarchy;
+    if (h && h->generation == state->generation)
+        return h;
+
+    scope_lock_t<lockable_t> lock(state->hierarchy_lock);
+    h = state->hierarchy;
+    if (!h || h->generation != state->generation)
+    {
+        type_hierarchy_t* old = h;
+        h = build_hierarchy(state);
+        atomic_ops::membar();
+        state->hierarchy = h;
+        if (old)
+        {
+            old->next_retired = state->retired;
+            state->retired = old;
+        }
+        free_retired(state);
+    }
+    return h;
+}
+
+static inline void put_hierarchy(type_system_f_v1::state_t* state)
+{
+    atomic_ops::saf(const_cast<address_t*>(&state->readers), 1);
+}
+
+/**
+ * Check if sub is the same type as super or an interface extending it.
+ */
+static inline bool is_subtype(type_system_f_v1::state_t* state, type_system_v1::alias sub, type_system_v1::alias super)
+{
+    type_hierarchy_t* h = get_hierarchy(state);
+    bool result = false, bad = false;
+    types::code bad_code = TCODE_NONE;
+
+    type_node_t* super_node = h->find(TCODE_INTF_CODE(super));
+    type_node_t* sub_node = h->find(TCODE_INTF_CODE(sub));
+
+    if (!super_node)
+    {
+        bad = true;
+        bad_code = super;
+    }
+    else if (sub == super)
+        result = true;
+    else if (!sub_node)
+    {
+        bad = true;
+        bad_code = sub;
+    }
+    /* A concrete type is compatible only with the same typecode. */
+    else if (!TCODE_IS_INTERFACE(sub) || !TCODE_IS_INTERFACE(super))
+        result = false;
+    else if (sub_node->first >= super_node->first && sub_node->first <= super_node->last)
+        result = true;
+    /* The chain of supertypes ends in an interface which is not registered, or loops. */
+    else if (sub_node->orphan != TCODE_NONE)
+    {
+        bad = true;
+        bad_code = sub_node->orphan;
+    }
+
+    put_hierarchy(state);
+
+    if (bad)
+        OS_RAISE(type_system_v1::bad_code_id, bad_code);
+
+    return result;
+}
+
 //=====================================================================================================================
 // Typesystem
 //=====================================================================================================================
@@ -93,13 +472,9 @@ static type_representation_t* internal_get(type_system_f_v1::state_t* state, con
     stringref_t name_sr(name);
     std::pair<stringref_t, stringref_t> refs = name_sr.split('.');
 
-    // @todo: move this allocation to stringref_t guts?
-    if (!refs.second.empty())
-        name = string_n_copy(refs.first.data(), refs.first.size(), PVS(heap)); // @todo MEMLEAK
+    /* now "first" is just the interface, and "second" is any extra qualifier */
 
-    /* now "name" is just the interface, and "extra" is any extra qualifier */
-
-    if (state->interfaces_by_name->get(name, (address_t*)&iface))
+    if ((iface = find_interface(state, refs.first.data(), refs.first.size())))
     {
         /* We've found the first component. */
         if (!refs.second.empty())
@@ -158,9 +533,7 @@ type_system_v1_list(naming_context_v1::closure_t* self)
         interface_v1::state_t* tb;
         type_representation_t* trep;
 
-        it = state->interfaces_by_name->iterate();
-
-        while (it->next(&name, (memory_v1::address*)&tb))
+        auto add_names = [&](interface_v1::state_t* tb)
         {
             add_name(tb->rep.name, PVS(heap), n);
             /* Run through all the types defined in the current interface */
@@ -169,13 +542,21 @@ type_system_v1_list(naming_context_v1::closure_t* self)
                 trep = tb->types[i];
                 add_qual_name(tb->rep.name, trep->name, PVS(heap), n);
             }
-        }
+        };
+
+        for (size_t i = 0; state->repository && i < state->repository->count; ++i)
+            add_names(state->repository->entries[i].rep);
+
+        it = state->interfaces_by_name->iterate();
+
+        while (it->next(&name, (memory_v1::address*)&tb))
+            add_names(tb);
         it->dispose();
     }
     OS_CATCH_ALL {
         if (it)
             it->dispose();
-        OS_RAISE((exception_support_v1::id)"heap_v1.no_memory", 0);
+        OS_RAISE(heap_v1::no_memory_id, 0);
     }
     OS_ENDTRY;
 
@@ -207,8 +588,8 @@ type_system_v1_info(type_system_v1::closure_t* self, type_system_v1::alias tc, t
     interface_v1::state_t* iface = nullptr;
 
     /* Check the type code refers to a valid interface */
-    if (!reinterpret_cast<type_system_f_v1::state_t*>(self->d_state)->interfaces_by_typecode->get(TCODE_INTF_CODE(tc), (address_t*)&iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+    if (!(iface = find_interface(reinterpret_cast<type_system_f_v1::state_t*>(self->d_state), TCODE_INTF_CODE(tc))))
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     /* Deal with the case where the type code refers to an interface type */
     if (TCODE_IS_INTERFACE(tc))
@@ -219,7 +600,7 @@ type_system_v1_info(type_system_v1::closure_t* self, type_system_v1::alias tc, t
   
     /* Check that within the given interface this is a valid type */
     if (!TCODE_VALID_TYPE(tc, iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     type_representation_t* trep = TCODE_WHICH_TYPE(tc, iface);
 
@@ -236,8 +617,8 @@ type_system_v1_size(type_system_v1::closure_t* self, type_system_v1::alias tc)
     interface_v1::state_t* iface = nullptr;
 
     /* Check the type code refers to a valid interface */
-    if (!reinterpret_cast<type_system_f_v1::state_t*>(self->d_state)->interfaces_by_typecode->get(TCODE_INTF_CODE(tc), (address_t*)&iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+    if (!(iface = find_interface(reinterpret_cast<type_system_f_v1::state_t*>(self->d_state), TCODE_INTF_CODE(tc))))
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     /* Deal with the case where the type code refers to an interface type */
     if (TCODE_IS_INTERFACE(tc))
@@ -245,7 +626,7 @@ type_system_v1_size(type_system_v1::closure_t* self, type_system_v1::alias tc)
   
     /* Check that within the given interface this is a valid type */
     if (!TCODE_VALID_TYPE (tc, iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     return TCODE_WHICH_TYPE(tc, iface)->size;
 }
@@ -257,8 +638,8 @@ type_system_v1_name(type_system_v1::closure_t* self, type_system_v1::alias tc)
     interface_v1::state_t* iface = nullptr;
 
     /* Check the type code refers to a valid interface */
-    if (!reinterpret_cast<type_system_f_v1::state_t*>(self->d_state)->interfaces_by_typecode->get(TCODE_INTF_CODE(tc), (address_t*)&iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+    if (!(iface = find_interface(reinterpret_cast<type_system_f_v1::state_t*>(self->d_state), TCODE_INTF_CODE(tc))))
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     /* Deal with the case where the type code refers to an interface type */
     if (TCODE_IS_INTERFACE(tc))
@@ -268,7 +649,7 @@ type_system_v1_name(type_system_v1::closure_t* self, type_system_v1::alias tc)
   
     /* Check that within the given interface this is a valid type */
     if (!TCODE_VALID_TYPE (tc, iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     type_representation_t* trep = TCODE_WHICH_TYPE(tc, iface);
     return string_copy(trep->name, PVS(heap));
@@ -281,8 +662,8 @@ type_system_v1_docstring(type_system_v1::closure_t* self, type_system_v1::alias
     interface_v1::state_t* iface = nullptr;
 
     /* Check the type code refers to a valid interface */
-    if (!reinterpret_cast<type_system_f_v1::state_t*>(self->d_state)->interfaces_by_typecode->get(TCODE_INTF_CODE(tc), (address_t*)&iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+    if (!(iface = find_interface(reinterpret_cast<type_system_f_v1::state_t*>(self->d_state), TCODE_INTF_CODE(tc))))
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     /* Deal with the case where the type code refers to an interface type */
     if (TCODE_IS_INTERFACE(tc))
@@ -292,7 +673,7 @@ type_system_v1_docstring(type_system_v1::closure_t* self, type_system_v1::alias
   
     /* Check that within the given interface this is a valid type */
     if (!TCODE_VALID_TYPE (tc, iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+        OS_RAISE(type_system_v1::bad_code_id, tc);
 
     type_representation_t* trep = TCODE_WHICH_TYPE(tc, iface);
     return string_copy(trep->autodoc, PVS(heap));
@@ -304,55 +685,7 @@ type_system_v1_docstring(type_system_v1::closure_t* self, type_system_v1::alias
 static bool
 type_system_v1_is_type(type_system_v1::closure_t* self, type_system_v1::alias sub, type_system_v1::alias super)
 {
-    logger::function_scope trace("type_system.is_type");
-    type_system_f_v1::state_t* state = reinterpret_cast<type_system_f_v1::state_t*>(self->d_state);
-    interface_v1::state_t* iface = nullptr;
-
-    /* Check the super type code refers to a valid interface */
-    if (!state->interfaces_by_typecode->get(TCODE_INTF_CODE(super), (address_t*)&iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", super);
-
-    logger::trace() << "type_system.is_type: " << super << " is valid supertype " << iface->rep.name;
-
-    /* Quick and dirty check for equality. */
-    if (sub == super)
-    {
-        logger::trace() << "subtype and supertype matched, returning true!";
-        return true;
-    }
-
-    /* Check the sub type code refers to a valid interface */
-    if (!state->interfaces_by_typecode->get(TCODE_INTF_CODE(sub), (address_t*)&iface))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", sub);
-
-    logger::trace() << "type_system.is_type: " << sub << " is valid subtype " << iface->rep.name;
-
-    /* Deal with the case where the type code refers to an interface type */
-    if (TCODE_IS_INTERFACE(sub))
-    {
-        logger::trace() << "type_system.is_type: " << iface->rep.code.value << " vs " << super;
-        while (iface->rep.code.value != super)
-        {
-            /* Look up the supertype */
-            if (!iface->supertype)
-            {
-                logger::trace() << "no supertype found, returning false!";
-                return false;
-            }
-
-            if (!state->interfaces_by_typecode->get(iface->supertype, (address_t*)&iface))
-                OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", iface->supertype);
-            logger::trace() << "type_system.is_type: found valid supertype " << iface->rep.name << endl
-                            << "type_system.is_type: " << iface->rep.code.value << " vs " << super;
-        }
-
-        logger::trace() << "valid supertype matched, returning true!";
-        return true;
-    }
-
-    /* We have a concrete type and it's not the same typecode, so fail. */
-    logger::trace() << "concrete type not equal, returning false!";
-    return false;
+    return is_subtype(reinterpret_cast<type_system_f_v1::state_t*>(self->d_state), sub, super);
 }
 
 /**
@@ -361,11 +694,9 @@ type_system_v1_is_type(type_system_v1::closure_t* self, type_system_v1::alias su
 static types::val
 type_system_v1_narrow(type_system_v1::closure_t* self, types::any a, type_system_v1::alias tc)
 {
-    logger::function_scope trace("type_system.narrow");
-    if (!type_system_v1_is_type(self, a.type_, tc))
-        OS_RAISE((exception_support_v1::id)"type_system_v1.incompatible", 0);
+    if (!is_subtype(reinterpret_cast<type_system_f_v1::state_t*>(self->d_state), a.type_, tc))
+        OS_RAISE(type_system_v1::incompatible_id, 0);
 
-    logger::trace() << a.value;
     return a.value;
 }
 
@@ -375,16 +706,31 @@ type_system_v1_narrow(type_system_v1::closure_t* self, types::any a, type_system
 static type_system_v1::alias
 type_system_v1_unalias(type_system_v1::closure_t* self, type_system_v1::alias tc)
 {
-    logger::function_scope trace("type_system.unalias");
     type_system_f_v1::state_t* state = reinterpret_cast<type_system_f_v1::state_t*>(self->d_state);
     interface_v1::state_t* iface = nullptr;
     type_representation_t* trep = nullptr;
 
+    /* Chains within the registered interfaces are followed in advance. */
+    types::code unaliased = TCODE_NONE;
+    type_node_t* node = get_hierarchy(state)->find(TCODE_INTF_CODE(tc));
+    if (node)
+    {
+        if (TCODE_IS_INTERFACE(tc))
+            unaliased = tc;
+        else if (TCODE_VALID_TYPE(tc, node->iface))
+            unaliased = node->unaliased[(tc & TCODE_MASK) - 1];
+    }
+    put_hierarchy(state);
+
+    if (unaliased != TCODE_NONE)
+        return unaliased;
+
+    /* Otherwise find where the chain breaks. */
     while (true)
     {
         /* Check the type code refers to a valid interface */
-        if (!state->interfaces_by_typecode->get(TCODE_INTF_CODE(tc), (address_t*)&iface))
-            OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+        if (!(iface = find_interface(state, TCODE_INTF_CODE(tc))))
+            OS_RAISE(type_system_v1::bad_code_id, tc);
 
         /* Deal with the case where the type code refers to an interface type */
         if (TCODE_IS_INTERFACE(tc))
@@ -392,7 +738,7 @@ type_system_v1_unalias(type_system_v1::closure_t* self, type_system_v1::alias tc
 
         /* Check that within the given interface this is a valid type */
         if (!TCODE_VALID_TYPE (tc, iface))
-            OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+            OS_RAISE(type_system_v1::bad_code_id, tc);
 
         /* Get the representation of this type */
         trep = TCODE_WHICH_TYPE(tc, iface);
@@ -405,7 +751,7 @@ type_system_v1_unalias(type_system_v1::closure_t* self, type_system_v1::alias tc
         tc = trep->any.value;
     }
 
-    OS_RAISE((exception_support_v1::id)"type_system_v1.bad_code", tc);
+    OS_RAISE(type_system_v1::bad_code_id, tc);
 }
 
 /*
@@ -418,59 +764,96 @@ extern record_v1::ops_t    record_ops;
 extern enum_v1::ops_t      enum_ops;
 extern choice_v1::ops_t    choice_ops;
 
+/**
+ * Point closures of the interface type information at the method suites of this module.
+ */
+static void
+patch_closures(interface_v1::state_t* iface)
+{
+    address_t clos_ptr;
+    size_t i;
+
+    /* Fill in operation tables of closures */
+    reinterpret_cast<interface_v1::closure_t*>(iface->rep.any.value)->d_methods = &interface_ops;
+
+    /* Types */
+    for (i = 0; i < iface->num_types; i++)
+    {
+        clos_ptr = iface->types[i]->any.value;
+        switch (iface->types[i]->any.type_)
+        {
+            case type_system_v1::choice_type_code:
+                reinterpret_cast<choice_v1::closure_t*>(clos_ptr)->d_methods = &choice_ops;
+                break;
+            case type_system_v1::enum__type_code:
+                reinterpret_cast<enum_v1::closure_t*>(clos_ptr)->d_methods = &enum_ops;
+                break;
+            case type_system_v1::record_type_code:
+                reinterpret_cast<record_v1::closure_t*>(clos_ptr)->d_methods = &record_ops;
+                break;
+        }
+    }
+
+    /* Operations */
+    for (i = 0; i < iface->num_methods; i++) {
+        iface->methods[i]->closure->d_methods = &operation_ops;
+    }
+
+    /* Exceptions */
+    for (i = 0; i < iface->num_exns; i++) {
+        iface->exns[i]->closure.d_methods = &exception_ops;
+    }
+}
+
 static void
 type_system_f_v1_register_interface(type_system_f_v1::closure_t* self, type_system_f_v1::interface_info intf)
 {
     interface_v1::state_t* iface = reinterpret_cast<interface_v1::state_t*>(intf); // @todo do we need to convert this back and forth?
-    address_t dummy;
 
     logger::debug() << "register_interface '" << iface->rep.name << "'";
 
-    if (self->d_state->interfaces_by_name->get(iface->rep.name, &dummy))
-        OS_RAISE((exception_support_v1::id)"type_system_f_v1.name_clash", 0);
+    if (find_interface(self->d_state, iface->rep.name, memutils::string_length(iface->rep.name)))
+        OS_RAISE(type_system_f_v1::name_clash_id, 0);
 
-    if (self->d_state->interfaces_by_typecode->get(iface->rep.code.value, &dummy))
-        OS_RAISE((exception_support_v1::id)"type_system_f_v1.type_code_clash", 0);
+    if (find_interface(self->d_state, iface->rep.code.value))
+        OS_RAISE(type_system_f_v1::type_code_clash_id, 0);
 
     if (iface != &meta_interface) // meta_interface needs no patching, it's all set up.
-    {
-        address_t clos_ptr;
-        size_t i;
+        patch_closures(iface);
 
-        /* Fill in operation tables of closures */
-        reinterpret_cast<interface_v1::closure_t*>(iface->rep.any.value)->d_methods = &interface_ops;
+    self->d_state->interfaces_by_name->put(iface->rep.name, intf);
+    self->d_state->interfaces_by_typecode->put(iface->rep.code.value, intf);
+    ++self->d_state->generation; // Queries renumber the hierarchy.
+}
 
-        /* Types */
-        for (i = 0; i < iface->num_types; i++)
-        {
-            clos_ptr = iface->types[i]->any.value;
-            switch (iface->types[i]->any.type_)
-            {
-                case type_system_v1::choice_type_code:
-                    reinterpret_cast<choice_v1::closure_t*>(clos_ptr)->d_methods = &choice_ops;
-                    break;
-                case type_system_v1::enum__type_code:
-                    reinterpret_cast<enum_v1::closure_t*>(clos_ptr)->d_methods = &enum_ops;
-                    break;
-                case type_system_v1::record_type_code:
-                    reinterpret_cast<record_v1::closure_t*>(clos_ptr)->d_methods = &record_ops;
-                    break;
-            }
-        }
+/**
+ * Take the table meddler generated for the interface repository instead of registering its interfaces one by one.
+ * There is only one repository.
+ */
+static void
+type_system_f_v1_register_repository(type_system_f_v1::closure_t* self, type_system_f_v1::repository_info repo)
+{
+    const interface_registry_t* registry = reinterpret_cast<const interface_registry_t*>(repo);
 
-        /* Operations */
-        for (i = 0; i < iface->num_methods; i++) {
-            iface->methods[i]->closure->d_methods = &operation_ops;
-        }
+    logger::debug() << "register_repository of " << int(registry->count) << " interfaces";
 
-        /* Exceptions */
-        for (i = 0; i < iface->num_exns; i++) {
-            iface->exns[i]->closure.d_methods = &exception_ops;
-        }
+    if (self->d_state->repository)
+        OS_RAISE(type_system_f_v1::name_clash_id, 0);
+
+    for (size_t i = 0; i < registry->count; ++i)
+    {
+        interface_v1::state_t* iface = registry->entries[i].rep;
+        if (find_interface(self->d_state, iface->rep.name, memutils::string_length(iface->rep.name)))
+            OS_RAISE(type_system_f_v1::name_clash_id, 0);
+        if (find_interface(self->d_state, iface->rep.code.value))
+            OS_RAISE(type_system_f_v1::type_code_clash_id, 0);
     }
 
-    self->d_state->interfaces_by_name->put(iface->rep.name, intf);
-    self->d_state->interfaces_by_typecode->put(iface->rep.code.value, intf);
+    for (size_t i = 0; i < registry->count; ++i)
+        patch_closures(registry->entries[i].rep);
+
+    self->d_state->repository = registry;
+    ++self->d_state->generation; // Queries renumber the hierarchy.
 }
 
 static type_system_f_v1::ops_t typesystem_ops = 
@@ -487,7 +870,8 @@ static type_system_f_v1::ops_t typesystem_ops =
     type_system_v1_is_type,
     type_system_v1_narrow,
     type_system_v1_unalias,
-    type_system_f_v1_register_interface
+    type_system_f_v1_register_interface,
+    type_system_f_v1_register_repository
 };
 
 //=====================================================================================================================
@@ -512,6 +896,9 @@ meta_interface_list(naming_context_v1::closure_t* self)
         }
 
         /* then all the others */
+        for (size_t i = 0; state->repository && i < state->repository->count; ++i)
+            add_name(state->repository->entries[i].rep->rep.name, PVS(heap), n);
+
         it = state->interfaces_by_name->iterate();
         while (it->next(&name, (memory_v1::address*)&tb))
         {
@@ -522,7 +909,7 @@ meta_interface_list(naming_context_v1::closure_t* self)
     OS_CATCH_ALL {
         if (it)
             it->dispose();
-        OS_RAISE((exception_support_v1::id)"heap_v1.no_memory", 0);
+        OS_RAISE(heap_v1::no_memory_id, 0);
     }
     OS_ENDTRY;
 
@@ -557,12 +944,9 @@ meta_interface_get(naming_context_v1::closure_t* self, const char* name, types::
     stringref_t name_sr(name);
     std::pair<stringref_t, stringref_t> refs = name_sr.split('.');
 
-    if (!refs.second.empty())
-        name = string_n_copy(refs.first.data(), refs.first.size(), PVS(heap)); // @todo MEMLEAK
-
-    /* now "name" is just the interface, and "extra" is any extra qualifier */
+    /* now "first" is just the interface, and "second" is any extra qualifier */
 
-    if (state->interfaces_by_name->get(name, (address_t*)&iface))
+    if ((iface = find_interface(state, refs.first.data(), refs.first.size())))
     {
         // We've found the first component. If there are no more components,
         // then simply return the types.any; otherwise, have to recurse a bit.
@@ -583,7 +967,6 @@ meta_interface_get(naming_context_v1::closure_t* self, const char* name, types::
             naming_context_v1::closure_t* context = reinterpret_cast<naming_context_v1::closure_t*>(v);
 
             exists = context->get(refs.second.data(), obj);
-            // @todo free (name) here
         }
     }
   
@@ -710,6 +1093,12 @@ create(type_system_factory_v1::closure_t* self, heap_v1::closure_t* h,
 
     state->interfaces_by_typecode = cardmap->create(h);
     state->interfaces_by_name = stringmap->create(h);
+    state->repository = nullptr;
+    state->heap = h;
+    state->generation = 0;
+    state->hierarchy = nullptr;
+    state->retired = nullptr;
+    state->readers = 0;
 
     state->closure.register_interface(reinterpret_cast<type_system_f_v1::interface_info>(&meta_interface));
     /*
@@ -0,0 +1,141 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include "threads_manager_v1_interface.h"
+#include "thread_v1_interface.h"
+#include "thread_hooks_v1_interface.h"
+#include "activation_v1_interface.h"
+#include "activation_dispatcher_v1_interface.h"
+#include "vcpu_v1_interface.h"
+#include "heap_v1_interface.h"
+#include "time_v1_interface.h"
+#include "pervasives_v1_interface.h"
+#include "doubly_linked_list.h"
+#include "lockable.h"
+#include "infopage.h"
+#include "setjmp.h"
+
+typedef thread_v1::state_t thread_t;
+struct vcpu_sched_t;
+
+/**
+ * Thread stack. The record sits at the top of the stack area it describes.
+ */
+struct stack_t
+{
+    dl_link_t<stack_t> link;
+    address_t          bottom;
+    address_t          top;     //!< Initial stack pointer, just below this record.
+    uint32_t           size_class;
+};
+
+/**
+ * Pool of thread stacks. Stacks are power of two sizes from MIN_STACK_SHIFT up, carved in batches out of stretches
+ * which are never given back, so after warm-up getting a stack is a list pop.
+ */
+class stack_pool_t
+{
+public:
+    enum {
+        MIN_STACK_SHIFT = 12,
+        CLASSES = 9,             //!< 4KiB .. 1MiB
+        CHUNK_SIZE = 64*KiB      //!< Stretch size used to refill small stack classes.
+    };
+
+    void init();
+    stack_t* allocate(size_t bytes);
+    void free(stack_t* stack);
+
+    static uint32_t size_class(size_t bytes);
+
+private:
+    bool refill(uint32_t size_class);
+
+    lockable_t         lock;
+    dl_link_t<stack_t> free_stacks[CLASSES];
+};
+
+/**
+ * Per-thread state. Threads are recycled through the free list of the vcpu they exited on, keeping their context
+ * slot and stack, so most forks do not touch the vcpu or the stack pool.
+ */
+struct thread_v1::state_t
+{
+    enum state_e {
+        runnable,   //!< On a run queue.
+        running,    //!< Current thread of some vcpu.
+        blocking,   //!< Going to sleep, context not saved yet.
+        woken,      //!< Unblocked while still blocking.
+        blocked,
+        exited
+    };
+
+    thread_v1::closure_t         closure;
+    dl_link_t<thread_t>          link;        //!< Run queue or free list.
+    threads_manager_v1::state_t* manager;
+    vcpu_sched_t*                sched;       //!< vcpu owning the context slot, and where the thread runs.
+    vcpu_v1::context_slot        slot;
+    stack_t*                     stack;
+    pervasives_v1::rec           pvs;
+    memory_v1::address           entry;
+    memory_v1::address           data;
+    lockable_t                   lock;        //!< Protects state against concurrent unblocking.
+    volatile state_e             state;
+    uint32_t                     cs_depth;    //!< Threads-level critical section nesting.
+    uint32_t                     mxcsr;       //!< Callee-saved FP control state, not kept in the jmp_buf.
+    uint16_t                     fpu_cw;
+    bool                         fp_custom;   //!< mxcsr and fpu_cw differ from the defaults.
+    bool                         fresh;       //!< Not started yet, or idle thread: start from the stack top.
+    bool                         preempted;   //!< Context saved by the kernel, resume with rfa_resume.
+    bool                         alerted;
+    bool                         daemon;
+};
+
+/**
+ * Per-vcpu scheduler. The run queue may be raided by idle vcpus, so it is spinlocked; locks are only taken with
+ * activations off on the calling vcpu.
+ */
+struct vcpu_sched_t
+{
+    threads_manager_v1::state_t*         manager;
+    uint32_t                             index;
+    vcpu_v1::closure_t*                  vcpu;
+    activation_dispatcher_v1::closure_t* dispatcher;
+    activation_v1::closure_t             activation;   //!< Chained after the dispatcher.
+    lockable_t                           lock;         //!< Run queue, free list and context slot allocation.
+    dl_link_t<thread_t>                  run_queue;
+    volatile uint32_t                    ready;        //!< Run queue length, read by thieves without the lock.
+    dl_link_t<thread_t>                  free_threads;
+    thread_t*                            current;
+    thread_t*                            idle;
+    thread_t*                            fp_words;     //!< Thread whose FP control words the FPU holds, nullptr for defaults.
+};
+
+struct hook_t
+{
+    dl_link_t<hook_t>          link;
+    thread_hooks_v1::closure_t* hooks;
+};
+
+struct threads_manager_v1::state_t
+{
+    enum { MAX_VCPUS = information_page_t::MAX_CPUS };
+
+    threads_manager_v1::closure_t closure;
+    heap_v1::closure_t*           heap;
+    pervasives_v1::rec            pvs_template;   //!< New threads start with a copy of their parent's pervasives.
+    size_t                        default_stack_bytes;
+    stack_pool_t                  stacks;
+    vcpu_sched_t*                 vcpus[MAX_VCPUS];
+    volatile uint32_t             num_vcpus;
+    lockable_t                    hooks_lock;
+    dl_link_t<hook_t>             hooks;
+    address_t                     live_threads;   //!< Non-daemon threads, the domain exits when it drops to zero.
+};
@@ -0,0 +1,124 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Threads fork-join benchmark: creation, exit and context switch cost of the user-level threads package.
+//
+// Has to be applied from a thread of a domain running the threads package, it skips itself otherwise.
+//
+#include "threads_v1_interface.h"
+#include "vcpu_v1_interface.h"
+#include "closure_interface.h"
+#include "closure_impl.h"
+#include "default_console.h"
+#include "infopage.h"
+#include "atomic.h"
+#include "cpu.h"
+
+static const uint32_t FORK_JOIN_THREADS = 1000000;
+static const uint32_t MAX_BATCH = 64;
+static const uint32_t YIELD_ROUNDS = 100000;
+
+static address_t outstanding;
+static volatile bool stop_yielding;
+
+static void child(memory_v1::address)
+{
+    atomic_ops::saf(&outstanding, 1);
+}
+
+static void yielder(memory_v1::address)
+{
+    while (!stop_yielding)
+        PVS(threads)->yield();
+    atomic_ops::saf(&outstanding, 1);
+}
+
+static void report(const char* what, uint32_t rounds, uint64_t cycles)
+{
+    kconsole << what << ": " << int32_t(rounds) << " rounds, " << int32_t(cycles / rounds) << " cycles per round" << endl;
+}
+
+/**
+ * Spawn threads in batches and wait for each batch to finish. Batches stay well below the number of context slots,
+ * so exited threads are recycled and this measures the warm fork path.
+ */
+static void fork_join(uint32_t batch)
+{
+    uint64_t start = x86_cpu_t::read_tsc();
+
+    for (uint32_t done = 0; done < FORK_JOIN_THREADS; done += batch)
+    {
+        if (batch > FORK_JOIN_THREADS - done)
+            batch = FORK_JOIN_THREADS - done;
+
+        outstanding = batch;
+        for (uint32_t i = 0; i < batch; ++i)
+            PVS(threads)->fork(reinterpret_cast<memory_v1::address>(child), 0, 0);
+        while (outstanding)
+            PVS(threads)->yield();
+    }
+
+    report("fork-join", FORK_JOIN_THREADS, x86_cpu_t::read_tsc() - start);
+}
+
+/**
+ * Two threads yielding to each other: every round is one thread switch.
+ */
+static void ping_pong()
+{
+    stop_yielding = false;
+    outstanding = 1;
+    PVS(threads)->fork(reinterpret_cast<memory_v1::address>(yielder), 0, 0);
+    PVS(threads)->yield(); // Let it start.
+
+    uint64_t start = x86_cpu_t::read_tsc();
+    for (uint32_t i = 0; i < YIELD_ROUNDS; ++i)
+        PVS(threads)->yield();
+    uint64_t cycles = x86_cpu_t::read_tsc() - start;
+
+    stop_yielding = true;
+    while (outstanding)
+        PVS(threads)->yield();
+
+    report("yield", YIELD_ROUNDS * 2, cycles);
+}
+
+static void entry(closure::closure_t* self)
+{
+    kconsole << "=================================" << endl
+             << "   Threads fork-join benchmark"    << endl
+             << "=================================" << endl;
+
+    if (!INFO_PAGE.pervasives || !PVS(threads) || !PVS(thread))
+    {
+        kconsole << "No threads package in this domain, skipped." << endl;
+        return;
+    }
+
+    uint32_t batch = PVS(vcpu)->num_contexts() / 2;
+    if (batch > MAX_BATCH)
+        batch = MAX_BATCH;
+    if (batch == 0)
+        batch = 1;
+
+    fork_join(batch);
+    ping_pong();
+}
+
+static const closure::ops_t methods =
+{
+    entry
+};
+
+static const closure::closure_t clos =
+{
+    &methods,
+    NULL
+};
+
+extern "C" const closure::closure_t* const exported_threads_bench_rootdom = &clos;
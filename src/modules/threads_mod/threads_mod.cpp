@@ -0,0 +1,1004 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// User-level threads package.
+//
+// Each vcpu of the domain has a run queue, an idle thread and a free list of exited threads. Threads save their
+// context into vcpu context slots: with setjmp when they give up the processor themselves, and by the kernel (via the
+// save slot) when the vcpu is preempted. A vcpu that runs out of work steals half of the queue of another vcpu;
+// only threads saved with setjmp can move, their jmp_buf is copied into a context slot of the thief.
+//
+// The switch away from a thread is finished on the idle thread's stack, so a thread is put on a queue only after
+// nothing runs on its stack any more, and another vcpu may pick it up straight away.
+//
+#include "threads.h"
+#include "threads_factory_v1_interface.h"
+#include "threads_factory_v1_impl.h"
+#include "threads_manager_v1_impl.h"
+#include "thread_v1_impl.h"
+#include "activation_v1_impl.h"
+#include "activation_dispatcher_factory_v1_interface.h"
+#include "system_stretch_allocator_v1_interface.h"
+#include "stretch_v1_interface.h"
+#include "heap_v1_interface.h"
+#include "threads_v1_interface.h"
+#include "exceptions.h"
+#include "time_macros.h"
+#include "heap_new.h"
+#include "memutils.h"
+#include "atomic.h"
+#include "cpu.h"
+
+static const size_t DEFAULT_STACK_BYTES = 16*KiB;
+static const size_t IDLE_STACK_BYTES = 8*KiB;
+static const uint32_t NUM_TIMEOUTS = 256;
+
+static bool have_sse; // MXCSR exists, the kernel enables SSE whenever the CPU has it.
+
+//======================================================================================================================
+// Stack pool.
+//======================================================================================================================
+
+void stack_pool_t::init()
+{
+    for (uint32_t c = 0; c < CLASSES; ++c)
+        free_stacks[c].init();
+}
+
+uint32_t stack_pool_t::size_class(size_t bytes)
+{
+    uint32_t c = 0;
+    while (c < CLASSES - 1 && (size_t(1) << (MIN_STACK_SHIFT + c)) < bytes)
+        ++c;
+    return c;
+}
+
+bool stack_pool_t::refill(uint32_t c)
+{
+    size_t stack_size = size_t(1) << (MIN_STACK_SHIFT + c);
+    size_t chunk = stack_size > CHUNK_SIZE ? stack_size : CHUNK_SIZE;
+    stretch_v1::closure_t* stretch = nullptr;
+
+    OS_TRY {
+        stretch = PVS(stretch_allocator)->create(chunk, stretch_v1::rights(stretch_v1::right_read).add(stretch_v1::right_write));
+    }
+    OS_CATCH_ALL {
+        stretch = nullptr;
+    }
+    OS_ENDTRY;
+
+    if (!stretch)
+        return false;
+
+    memory_v1::size size;
+    address_t base = stretch->info(&size);
+
+    for (size_t offset = 0; offset + stack_size <= size; offset += stack_size)
+    {
+        stack_t* s = reinterpret_cast<stack_t*>(base + offset + stack_size - sizeof(stack_t));
+        s->link.init(s);
+        s->bottom = base + offset;
+        s->top = reinterpret_cast<address_t>(s) & ~15;
+        s->size_class = c;
+        free_stacks[c].add_to_tail(s->link);
+    }
+    return true;
+}
+
+/**
+ * Callers keep activations off, the lock is shared between vcpus.
+ */
+stack_t* stack_pool_t::allocate(size_t bytes)
+{
+    uint32_t c = size_class(bytes);
+    lockable_scope_lock_t guard(lock);
+
+    if (free_stacks[c].is_empty() && !refill(c))
+        return nullptr;
+
+    dl_link_t<stack_t>* l = free_stacks[c].next();
+    l->remove();
+    return *l;
+}
+
+void stack_pool_t::free(stack_t* stack)
+{
+    lockable_scope_lock_t guard(lock);
+    free_stacks[stack->size_class].add_to_head(stack->link);
+}
+
+//======================================================================================================================
+// Scheduler helpers.
+//======================================================================================================================
+
+static inline threads_manager_v1::state_t* manager(threads_v1::closure_t* self)
+{
+    return reinterpret_cast<threads_manager_v1::state_t*>(self->d_state);
+}
+
+static inline thread_t* current_thread()
+{
+    return PVS(thread)->d_state;
+}
+
+static inline void* context(thread_t* t)
+{
+    return reinterpret_cast<void*>(t->sched->vcpu->context(t->slot));
+}
+
+/**
+ * @returns true if activations were on.
+ */
+static inline bool activations_off(vcpu_v1::closure_t* vcpu)
+{
+    bool on = vcpu->are_activations_enabled();
+    if (on)
+        vcpu->disable_activations();
+    return on;
+}
+
+static inline void activations_on(vcpu_v1::closure_t* vcpu)
+{
+    vcpu->enable_activations();
+    if (vcpu->are_events_pending())
+        vcpu->rfa();
+}
+
+/**
+ * The x87 control word and MXCSR are callee-saved in the i386 ABI, so they have to follow the thread across
+ * switches just like the registers in its jmp_buf.
+ *
+ * The kernel switches FPU state lazily: CR0.TS stays set until the domain touches the FPU, and any FPU instruction
+ * faults the whole state in. So the words are only read while the domain owns the FPU, otherwise the thread has not
+ * touched it since the vcpu was activated and what it saved last time still holds. Threads keeping the defaults
+ * share them, the FPU is written only when a thread with its own rounding or exception masks comes or goes.
+ */
+static const uint16_t DEFAULT_FPU_CW = 0x037f;
+static const uint32_t DEFAULT_MXCSR = 0x1f80;
+
+static inline bool fpu_owned()
+{
+    address_t msw;
+    asm volatile("smsw %0" : "=r"(msw));
+    return !(msw & IA32_CR0_TS);
+}
+
+static inline void save_fp_control(vcpu_sched_t* vs, thread_t* t)
+{
+    if (!fpu_owned())
+        return;
+
+    asm volatile("fnstcw %0" : "=m"(t->fpu_cw));
+    if (have_sse)
+        asm volatile("stmxcsr %0" : "=m"(t->mxcsr));
+
+    t->fp_custom = t->fpu_cw != DEFAULT_FPU_CW || (have_sse && t->mxcsr != DEFAULT_MXCSR);
+    vs->fp_words = t->fp_custom ? t : nullptr;
+}
+
+static inline void restore_fp_control(vcpu_sched_t* vs, thread_t* t)
+{
+    thread_t* want = t->fp_custom ? t : nullptr;
+    if (vs->fp_words == want)
+        return;
+
+    uint16_t cw = want ? t->fpu_cw : DEFAULT_FPU_CW;
+    uint32_t mxcsr = want ? t->mxcsr : DEFAULT_MXCSR;
+    asm volatile("fldcw %0" :: "m"(cw));
+    if (have_sse)
+        asm volatile("ldmxcsr %0" :: "m"(mxcsr));
+    vs->fp_words = want;
+}
+
+/**
+ * Switch to the stack ending at "top" and call fn(a, b) on it.
+ */
+static void call_on_stack(address_t top, void (*fn)(void*, void*), void* a, void* b) NEVER_RETURNS;
+static void call_on_stack(address_t top, void (*fn)(void*, void*), void* a, void* b)
+{
+    asm volatile("movl %0, %%esp\n\t"
+                 "subl $8, %%esp\n\t"
+                 "pushl %3\n\t"
+                 "pushl %2\n\t"
+                 "call *%1"
+                 :: "r"(top), "r"(fn), "r"(a), "r"(b) : "memory");
+    __builtin_unreachable();
+}
+
+// All functions below touching run queues, free lists or context slots expect activations off on the calling vcpu.
+
+static void enqueue(vcpu_sched_t* vs, thread_t* t)
+{
+    lockable_scope_lock_t guard(vs->lock);
+    t->state = thread_t::runnable;
+    vs->run_queue.add_to_tail(t->link);
+    ++vs->ready;
+}
+
+static thread_t* dequeue(vcpu_sched_t* vs)
+{
+    if (!vs->ready)
+        return nullptr;
+
+    lockable_scope_lock_t guard(vs->lock);
+    dl_link_t<thread_t>* l = vs->run_queue.next();
+    if (!l)
+        return nullptr;
+    l->remove();
+    --vs->ready;
+    return *l;
+}
+
+static bool allocate_slot(vcpu_sched_t* vs, vcpu_v1::context_slot* slot)
+{
+    bool ok = true;
+    lockable_scope_lock_t guard(vs->lock);
+    OS_TRY {
+        *slot = vs->vcpu->allocate_context();
+    }
+    OS_CATCH_ALL {
+        ok = false;
+    }
+    OS_ENDTRY;
+    return ok;
+}
+
+static void release_slot(vcpu_sched_t* vs, vcpu_v1::context_slot slot)
+{
+    lockable_scope_lock_t guard(vs->lock);
+    vs->vcpu->release_context(slot);
+}
+
+/**
+ * Move thread "t" saved with setjmp over to vcpu "vs": context slots belong to a vcpu, so take one there
+ * and copy the jmp_buf into it.
+ */
+static bool rehome(vcpu_sched_t* vs, thread_t* t)
+{
+    vcpu_sched_t* old = t->sched;
+    vcpu_v1::context_slot slot;
+
+    if (!allocate_slot(vs, &slot))
+        return false;
+
+    memutils::copy_memory(reinterpret_cast<void*>(vs->vcpu->context(slot)), context(t), sizeof(jmp_buf));
+    release_slot(old, t->slot);
+    t->slot = slot;
+    t->sched = vs;
+    return true;
+}
+
+/**
+ * Take up to half of the threads queued on another vcpu, starting with the ones queued last.
+ * Threads preempted by the kernel stay behind: they can only be resumed from their own vcpu's context slot.
+ * @returns one of the stolen threads, the rest are queued on "thief".
+ */
+static thread_t* steal(vcpu_sched_t* thief)
+{
+    threads_manager_v1::state_t* m = thief->manager;
+    uint32_t n = m->num_vcpus;
+
+    for (uint32_t i = 1; i < n; ++i)
+    {
+        vcpu_sched_t* victim = m->vcpus[(thief->index + i) % n];
+        if (!victim->ready)
+            continue;
+
+        dl_link_t<thread_t> loot;
+        {
+            lockable_scope_lock_t guard(victim->lock);
+            uint32_t want = (victim->ready + 1) / 2;
+            dl_link_t<thread_t>* l = victim->run_queue.prev();
+
+            while (want && l && l != &victim->run_queue)
+            {
+                dl_link_t<thread_t>* prev = l->prev();
+                if (!(*l)->preempted)
+                {
+                    l->remove();
+                    loot.add_to_head(*l);
+                    --victim->ready;
+                    --want;
+                }
+                l = prev;
+            }
+        }
+
+        thread_t* result = nullptr;
+        while (!loot.is_empty())
+        {
+            thread_t* t = *loot.next();
+            t->link.remove();
+
+            if (!rehome(thief, t))
+                enqueue(victim, t);
+            else if (!result)
+                result = t;
+            else
+                enqueue(thief, t);
+        }
+
+        if (result)
+            return result;
+    }
+
+    return nullptr;
+}
+
+static thread_t* pick(vcpu_sched_t* vs)
+{
+    thread_t* t = dequeue(vs);
+    if (!t)
+        t = steal(vs);
+    if (!t)
+    {
+        t = vs->idle;
+        t->fresh = true;
+    }
+    return t;
+}
+
+static void thread_main(void* thread, void*) NEVER_RETURNS;
+
+/**
+ * Give the vcpu to thread "t".
+ */
+static void run(vcpu_sched_t* vs, thread_t* t) NEVER_RETURNS;
+static void run(vcpu_sched_t* vs, thread_t* t)
+{
+    vs->current = t;
+    t->state = thread_t::running;
+    t->pvs.vcpu = vs->vcpu;
+    t->pvs.dispatcher = vs->dispatcher;
+    INFO_PAGE.pervasives = &t->pvs;
+    vs->vcpu->set_save_slot(t->slot);
+    restore_fp_control(vs, t);
+
+    if (t->preempted)
+    {
+        t->preempted = false;
+        vs->vcpu->rfa_resume(t->slot);
+    }
+
+    if (t->fresh)
+    {
+        t->fresh = false;
+        call_on_stack(t->stack->top, thread_main, t, nullptr);
+    }
+
+    __sjljeh_longjmp(reinterpret_cast<void**>(context(t)), 1);
+}
+
+/**
+ * Second half of switch_from(), running on the idle thread's stack: file the previous thread according to
+ * its new state and run the next one.
+ */
+static void schedule(void* thread, void* new_state) NEVER_RETURNS;
+static void schedule(void* thread, void* new_state)
+{
+    thread_t* prev = reinterpret_cast<thread_t*>(thread);
+    vcpu_sched_t* vs = prev->sched;
+    vs->current = nullptr;
+
+    switch (reinterpret_cast<address_t>(new_state))
+    {
+        case thread_t::runnable:
+            enqueue(vs, prev);
+            break;
+
+        case thread_t::blocking:
+        {
+            lockable_scope_lock_t guard(prev->lock);
+            if (prev->state == thread_t::woken)
+                enqueue(vs, prev);
+            else
+                prev->state = thread_t::blocked;
+            break;
+        }
+
+        case thread_t::exited:
+        {
+            lockable_scope_lock_t guard(vs->lock);
+            prev->state = thread_t::exited;
+            vs->free_threads.add_to_head(prev->link);
+            break;
+        }
+    }
+
+    run(vs, pick(vs));
+}
+
+/**
+ * Save the current thread and run another one. Called with activations off.
+ * Returns when "cur" runs again, possibly on another vcpu.
+ */
+static void switch_from(thread_t* cur, thread_t::state_e new_state)
+{
+    save_fp_control(cur->sched, cur);
+    if (__sjljeh_setjmp(reinterpret_cast<void**>(context(cur))) != 0)
+        return;
+
+    call_on_stack(cur->sched->idle->stack->top, schedule, cur, reinterpret_cast<void*>(new_state));
+}
+
+/**
+ * Make a blocked thread runnable on the calling vcpu. Called with t->lock held and activations off.
+ */
+static void wake(thread_t* t)
+{
+    if (t->state == thread_t::blocking)
+    {
+        t->state = thread_t::woken;
+        return;
+    }
+
+    if (t->state != thread_t::blocked)
+        return;
+
+    vcpu_sched_t* here = current_thread()->sched;
+    if (t->sched != here && !t->preempted)
+        rehome(here, t);
+    enqueue(t->sched, t);
+}
+
+/**
+ * Idle thread: restarted from its stack top whenever it is picked, it has no state worth keeping.
+ */
+static void idle_loop(vcpu_sched_t* vs) NEVER_RETURNS;
+static void idle_loop(vcpu_sched_t* vs)
+{
+    while (true)
+    {
+        vs->vcpu->disable_activations();
+
+        thread_t* t = dequeue(vs);
+        if (!t)
+            t = steal(vs);
+        if (t)
+            run(vs, t);
+
+        // Dispatch events and timeouts, returns if anything happened, otherwise blocks the vcpu until it does.
+        vs->dispatcher->reactivate();
+    }
+}
+
+//======================================================================================================================
+// thread_v1 implementation
+//======================================================================================================================
+
+static void
+thread_v1_alert(thread_v1::closure_t* self)
+{
+    thread_t* t = self->d_state;
+    bool on = activations_off(PVS(vcpu));
+    {
+        lockable_scope_lock_t guard(t->lock);
+        t->alerted = true;
+        wake(t);
+    }
+    if (on)
+        activations_on(PVS(vcpu));
+}
+
+static memory_v1::address
+thread_v1_get_stack_info(thread_v1::closure_t* self, memory_v1::address* stack_top, memory_v1::address* stack_bottom)
+{
+    thread_t* t = self->d_state;
+
+    *stack_top = t->stack->top;
+    *stack_bottom = t->stack->bottom;
+
+    if (t == current_thread())
+    {
+        address_t sp;
+        asm volatile("movl %%esp, %0" : "=r"(sp));
+        return sp;
+    }
+
+    return reinterpret_cast<memory_v1::address>(reinterpret_cast<void**>(context(t))[5]); // Saved ESP, see setjmp.nasm.
+}
+
+static void
+thread_v1_set_daemon(thread_v1::closure_t* self)
+{
+    thread_t* t = self->d_state;
+    if (t->daemon)
+        return;
+    t->daemon = true;
+    atomic_ops::saf(&t->manager->live_threads, 1);
+}
+
+static const thread_v1::ops_t thread_v1_methods =
+{
+    thread_v1_alert,
+    thread_v1_get_stack_info,
+    thread_v1_set_daemon
+};
+
+//======================================================================================================================
+// Thread creation.
+//======================================================================================================================
+
+static void run_hooks_forward(threads_manager_v1::state_t* m, void (*fn)(thread_hooks_v1::closure_t*, void*), void* arg)
+{
+    for (dl_link_t<hook_t>* l = m->hooks.next(); l && l != &m->hooks; l = l->next())
+        fn((*l)->hooks, arg);
+}
+
+static void run_hooks_backward(threads_manager_v1::state_t* m, void (*fn)(thread_hooks_v1::closure_t*, void*), void* arg)
+{
+    for (dl_link_t<hook_t>* l = m->hooks.prev(); l && l != &m->hooks; l = l->prev())
+        fn((*l)->hooks, arg);
+}
+
+static void hook_fork(thread_hooks_v1::closure_t* h, void* pvs)
+{
+    h->fork(reinterpret_cast<pervasives_v1::rec*>(pvs));
+}
+
+static void hook_forked(thread_hooks_v1::closure_t* h, void*)
+{
+    h->forked();
+}
+
+static void hook_exit_thread(thread_hooks_v1::closure_t* h, void*)
+{
+    h->exit_thread();
+}
+
+static void hook_exit_domain(thread_hooks_v1::closure_t* h, void*)
+{
+    h->exit_domain();
+}
+
+/**
+ * Get a thread with a context slot on "vs" and a stack of at least "stack_bytes", preferably one that has exited.
+ */
+static thread_t* create_thread(vcpu_sched_t* vs, size_t stack_bytes)
+{
+    threads_manager_v1::state_t* m = vs->manager;
+    uint32_t size_class = stack_pool_t::size_class(stack_bytes);
+    thread_t* t = nullptr;
+    bool on = activations_off(vs->vcpu);
+
+    {
+        lockable_scope_lock_t guard(vs->lock);
+        dl_link_t<thread_t>* l = vs->free_threads.next();
+        if (l)
+        {
+            l->remove();
+            t = *l;
+        }
+    }
+
+    if (!t)
+    {
+        t = new(m->heap) thread_t;
+        if (t)
+        {
+            t->manager = m;
+            t->sched = vs;
+            t->stack = nullptr;
+            t->link.init(t);
+            closure_init(&t->closure, &thread_v1_methods, t);
+            if (!allocate_slot(vs, &t->slot))
+            {
+                m->heap->free(reinterpret_cast<memory_v1::address>(t));
+                t = nullptr;
+            }
+        }
+    }
+
+    if (t && t->stack && t->stack->size_class != size_class)
+    {
+        m->stacks.free(t->stack);
+        t->stack = nullptr;
+    }
+
+    if (t && !t->stack && !(t->stack = m->stacks.allocate(stack_bytes)))
+    {
+        lockable_scope_lock_t guard(vs->lock);
+        vs->free_threads.add_to_head(t->link);
+        t = nullptr;
+    }
+
+    if (on)
+        activations_on(vs->vcpu);
+
+    if (!t)
+        return nullptr;
+
+    t->state = thread_t::runnable;
+    t->cs_depth = 0;
+    t->fp_custom = false; // Start with the default floating point environment.
+    t->fresh = true;
+    t->preempted = false;
+    t->alerted = false;
+    t->daemon = false;
+    return t;
+}
+
+static void thread_exit(thread_t* cur) NEVER_RETURNS;
+
+static void thread_main(void* thread, void*)
+{
+    thread_t* t = reinterpret_cast<thread_t*>(thread);
+    vcpu_sched_t* vs = t->sched;
+
+    if (t == vs->idle)
+        idle_loop(vs);
+
+    activations_on(vs->vcpu);
+    run_hooks_forward(t->manager, hook_forked, nullptr);
+
+    reinterpret_cast<void (*)(memory_v1::address)>(t->entry)(t->data);
+
+    thread_exit(t);
+}
+
+static void thread_exit(thread_t* cur)
+{
+    threads_manager_v1::state_t* m = cur->manager;
+
+    run_hooks_backward(m, hook_exit_thread, nullptr);
+    if (!cur->daemon && atomic_ops::saf(&m->live_threads, 1) == 0)
+        run_hooks_backward(m, hook_exit_domain, nullptr);
+
+    cur->sched->vcpu->disable_activations();
+    switch_from(cur, thread_t::exited);
+    PANIC("exited thread resumed");
+}
+
+//======================================================================================================================
+// threads_manager_v1 implementation
+//======================================================================================================================
+
+static thread_v1::closure_t*
+threads_v1_fork(threads_v1::closure_t* self, memory_v1::address entry, memory_v1::address data, memory_v1::size stack_bytes)
+{
+    threads_manager_v1::state_t* m = manager(self);
+    thread_t* cur = current_thread();
+    vcpu_sched_t* vs = cur->sched;
+
+    thread_t* t = create_thread(vs, stack_bytes ? stack_bytes : m->default_stack_bytes);
+    if (!t)
+        OS_RAISE(threads_v1::no_resources_id, 0);
+
+    t->entry = entry;
+    t->data = data;
+    t->pvs = cur->pvs;
+    t->pvs.thread = &t->closure;
+    run_hooks_forward(m, hook_fork, &t->pvs);
+    atomic_ops::aaf(&m->live_threads, 1);
+
+    bool on = activations_off(vs->vcpu);
+    enqueue(vs, t);
+    if (on)
+        activations_on(vs->vcpu);
+
+    return &t->closure;
+}
+
+/**
+ * All threads-level critical sections keep activations off, since activations are the only way a thread
+ * can lose the vcpu to another thread.
+ */
+static void
+threads_v1_enter_critical_section(threads_v1::closure_t* self, bool vcpu_cs)
+{
+    thread_t* cur = current_thread();
+    if (cur->cs_depth++ == 0)
+        cur->sched->vcpu->disable_activations();
+}
+
+static void
+threads_v1_leave_critical_section(threads_v1::closure_t* self)
+{
+    thread_t* cur = current_thread();
+    if (--cur->cs_depth == 0)
+        activations_on(cur->sched->vcpu);
+}
+
+static void
+threads_v1_yield(threads_v1::closure_t* self)
+{
+    thread_t* cur = current_thread();
+    bool on = activations_off(cur->sched->vcpu);
+
+    if (cur->sched->ready)
+        switch_from(cur, thread_t::runnable);
+
+    if (on)
+        activations_on(cur->sched->vcpu);
+}
+
+static void
+threads_v1_exit(threads_v1::closure_t* self)
+{
+    thread_exit(current_thread());
+}
+
+static thread_v1::closure_t*
+threads_manager_v1_current_thread(threads_manager_v1::closure_t* self)
+{
+    return PVS(thread);
+}
+
+/**
+ * Only the current thread can be blocked this way. It keeps running until block_yield() or the next activation
+ * switches it away, and stays off the run queue until unblocked.
+ */
+static bool
+threads_manager_v1_block_thread(threads_manager_v1::closure_t* self, thread_v1::closure_t* thread, time_v1::time maybe_until)
+{
+    thread_t* t = thread->d_state;
+    bool on = activations_off(PVS(vcpu));
+    {
+        lockable_scope_lock_t guard(t->lock);
+        if (t->state == thread_t::running)
+            t->state = thread_t::blocking;
+    }
+    if (on)
+        activations_on(PVS(vcpu));
+    return t->cs_depth > 0;
+}
+
+static void
+threads_manager_v1_unblock_thread(threads_manager_v1::closure_t* self, thread_v1::closure_t* thread, bool in_cs)
+{
+    thread_t* t = thread->d_state;
+    bool on = activations_off(PVS(vcpu));
+    {
+        lockable_scope_lock_t guard(t->lock);
+        wake(t);
+    }
+    if (on)
+        activations_on(PVS(vcpu));
+}
+
+static bool
+threads_manager_v1_block_yield(threads_manager_v1::closure_t* self, time_v1::time maybe_until)
+{
+    thread_t* cur = current_thread();
+    bool on = activations_off(cur->sched->vcpu);
+    bool alerted;
+
+    {
+        lockable_scope_lock_t guard(cur->lock);
+        // Woken already, possibly after block_thread().
+        alerted = cur->alerted || cur->state == thread_t::woken;
+        cur->state = alerted ? thread_t::running : thread_t::blocking;
+    }
+
+    if (!alerted)
+        switch_from(cur, thread_t::blocking);
+
+    {
+        lockable_scope_lock_t guard(cur->lock);
+        alerted = cur->alerted;
+        cur->alerted = false;
+    }
+
+    if (on)
+        activations_on(cur->sched->vcpu);
+    return alerted;
+}
+
+static bool
+threads_manager_v1_unblock_yield(threads_manager_v1::closure_t* self, thread_v1::closure_t* thread, bool in_cs)
+{
+    threads_manager_v1_unblock_thread(self, thread, in_cs);
+    threads_v1_yield(reinterpret_cast<threads_v1::closure_t*>(self));
+
+    thread_t* cur = current_thread();
+    bool on = activations_off(cur->sched->vcpu);
+    bool alerted;
+    {
+        lockable_scope_lock_t guard(cur->lock);
+        alerted = cur->alerted;
+        cur->alerted = false;
+    }
+    if (on)
+        activations_on(cur->sched->vcpu);
+    return alerted;
+}
+
+static void activation_v1_go(activation_v1::closure_t* self, vcpu_v1::closure_t* vcpu, activation_v1::reason reason);
+
+static const activation_v1::ops_t activation_v1_methods =
+{
+    activation_v1_go
+};
+
+static vcpu_sched_t*
+add_vcpu(threads_manager_v1::state_t* m, vcpu_v1::closure_t* vcpu, activation_dispatcher_v1::closure_t* dispatcher)
+{
+    if (m->num_vcpus >= threads_manager_v1::state_t::MAX_VCPUS)
+        OS_RAISE(threads_v1::no_resources_id, 0);
+
+    vcpu_sched_t* vs = new(m->heap) vcpu_sched_t;
+    if (!vs)
+        OS_RAISE(threads_v1::no_resources_id, 0);
+
+    vs->manager = m;
+    vs->vcpu = vcpu;
+    vs->dispatcher = dispatcher;
+    vs->run_queue.init();
+    vs->free_threads.init();
+    vs->ready = 0;
+    vs->current = nullptr;
+    vs->fp_words = nullptr;
+    closure_init(&vs->activation, &activation_v1_methods, reinterpret_cast<activation_v1::state_t*>(vs));
+
+    vs->idle = create_thread(vs, IDLE_STACK_BYTES);
+    if (!vs->idle)
+        OS_RAISE(threads_v1::no_resources_id, 0);
+    vs->idle->pvs = m->pvs_template;
+    vs->idle->pvs.thread = &vs->idle->closure;
+    vs->idle->daemon = true;
+
+    dispatcher->set_handler(&vs->activation);
+
+    vs->index = m->num_vcpus;
+    m->vcpus[vs->index] = vs;
+    atomic_ops::membar();
+    ++m->num_vcpus;
+
+    return vs;
+}
+
+static void
+threads_manager_v1_add_vcpu(threads_manager_v1::closure_t* self, vcpu_v1::closure_t* vcpu, activation_dispatcher_v1::closure_t* dispatcher)
+{
+    threads_manager_v1::state_t* m = self->d_state;
+    lockable_scope_lock_t guard(m->hooks_lock);
+    add_vcpu(m, vcpu, dispatcher);
+}
+
+static void
+threads_manager_v1_register_hooks(threads_manager_v1::closure_t* self, thread_hooks_v1::closure_t* hooks)
+{
+    threads_manager_v1::state_t* m = self->d_state;
+    hook_t* h = new(m->heap) hook_t;
+    if (!h)
+        OS_RAISE(heap_v1::no_memory_id, 0);
+
+    h->hooks = hooks;
+    h->link.init(h);
+
+    bool on = activations_off(PVS(vcpu));
+    {
+        lockable_scope_lock_t guard(m->hooks_lock);
+        m->hooks.add_to_tail(h->link);
+    }
+    if (on)
+        activations_on(PVS(vcpu));
+}
+
+static const threads_manager_v1::ops_t threads_manager_v1_methods =
+{
+    threads_v1_fork,
+    threads_v1_enter_critical_section,
+    threads_v1_leave_critical_section,
+    threads_v1_yield,
+    threads_v1_exit,
+    threads_manager_v1_current_thread,
+    threads_manager_v1_block_thread,
+    threads_manager_v1_unblock_thread,
+    threads_manager_v1_block_yield,
+    threads_manager_v1_unblock_yield,
+    threads_manager_v1_add_vcpu,
+    threads_manager_v1_register_hooks
+};
+
+//======================================================================================================================
+// activation_v1 implementation
+//======================================================================================================================
+
+/**
+ * Chained after the activation dispatcher, which has already delivered events and timeouts.
+ * A thread other than idle that was current had activations on, so the kernel saved it in its context slot.
+ */
+static void
+activation_v1_go(activation_v1::closure_t* self, vcpu_v1::closure_t* vcpu, activation_v1::reason reason)
+{
+    vcpu_sched_t* vs = reinterpret_cast<vcpu_sched_t*>(self->d_state);
+    thread_t* cur = vs->current;
+
+    if (cur && cur != vs->idle)
+    {
+        lockable_scope_lock_t guard(cur->lock);
+        save_fp_control(vs, cur);
+        cur->preempted = true;
+        if (cur->state == thread_t::blocking)
+            cur->state = thread_t::blocked;
+        else
+            enqueue(vs, cur);
+    }
+
+    vs->current = nullptr;
+    run(vs, pick(vs));
+}
+
+//======================================================================================================================
+// threads_factory_v1 implementation
+//======================================================================================================================
+
+/**
+ * The start-of-day stack and user stretch are not used: thread stacks come from the stack pool and the heap
+ * is taken from "pervasives_init".
+ */
+static threads_manager_v1::closure_t*
+threads_factory_v1_create(threads_factory_v1::closure_t* self, memory_v1::address entry, memory_v1::address data,
+                          threads_factory_v1::stack proto_stack, stretch_v1::closure_t* user_stretch,
+                          memory_v1::size default_stack_bytes, activation_dispatcher_factory_v1::closure_t* dispatcher_factory,
+                          pervasives_v1::init* pervasives_init, activation_dispatcher_v1::closure_t** dispatcher)
+{
+    vcpu_v1::closure_t* vcpu = pervasives_init->vcpu;
+    heap_v1::closure_t* heap = pervasives_init->heap;
+
+    uint32_t eax, ebx, ecx, edx;
+    x86_cpu_t::cpuid(1, &eax, &ebx, &ecx, &edx);
+    have_sse = (edx & X86_32_FEAT_FXSR) && (edx & X86_32_FEAT_XMM);
+
+    threads_manager_v1::state_t* m = new(heap) threads_manager_v1::state_t;
+    if (!m)
+        OS_RAISE(threads_v1::no_resources_id, 0);
+
+    m->heap = heap;
+    m->default_stack_bytes = default_stack_bytes ? default_stack_bytes : DEFAULT_STACK_BYTES;
+    m->stacks.init();
+    m->num_vcpus = 0;
+    m->hooks.init();
+    m->live_threads = 0;
+    closure_init(&m->closure, &threads_manager_v1_methods, m);
+
+    if (INFO_PAGE.pervasives)
+        m->pvs_template = *INFO_PAGE.pervasives;
+    else
+        memutils::fill_memory(&m->pvs_template, 0, sizeof(m->pvs_template));
+    m->pvs_template.vcpu = vcpu;
+    m->pvs_template.heap = heap;
+    m->pvs_template.types = pervasives_init->types;
+    m->pvs_template.root = pervasives_init->root;
+    m->pvs_template.threads = reinterpret_cast<threads_v1::closure_t*>(&m->closure);
+
+    activation_v1::closure_t* activation;
+    m->pvs_template.dispatcher = dispatcher_factory->create(vcpu, m->pvs_template.time, heap, NUM_TIMEOUTS, &activation);
+    vcpu->set_activation_vector(activation);
+
+    vcpu_sched_t* vs = add_vcpu(m, vcpu, m->pvs_template.dispatcher);
+
+    thread_t* main = create_thread(vs, m->default_stack_bytes);
+    if (!main)
+        OS_RAISE(threads_v1::no_resources_id, 0);
+    main->entry = entry;
+    main->data = data;
+    main->pvs = m->pvs_template;
+    main->pvs.thread = &main->closure;
+    m->live_threads = 1;
+    enqueue(vs, main);
+
+    vcpu->set_save_slot(vcpu->get_resume_slot());
+
+    *dispatcher = m->pvs_template.dispatcher;
+    return &m->closure;
+}
+
+static const threads_factory_v1::ops_t threads_factory_v1_methods =
+{
+    threads_factory_v1_create
+};
+
+static threads_factory_v1::closure_t clos =
+{
+    &threads_factory_v1_methods,
+    NULL
+};
+
+EXPORT_CLOSURE_TO_ROOTDOM(threads_factory, v1, clos);
@@ -13,6 +13,7 @@
 #include "debugger.h"
 #include "panic.h"
 #include "isr.h"
+#include "cpu_information.h"
 #include "protection_domain_v1_interface.h"
 #include "stretch_v1_interface.h"
 #include "default_console.h"
@@ -41,6 +42,22 @@ namespace nucleus
         return 0;
     }
 
+    /**
+     * Invalidate TLB entry for linear address on all CPUs, or the whole TLB if linear is 0.
+     */
+    inline void flush_tlb(address_t linear = 0)
+    {
+        asm volatile ("int $99" :: "a"(4), "b"(linear));
+    }
+
+    /**
+     * Put domain on the run queue of given CPU, sending it a wakeup IPI if it's not the current CPU.
+     */
+    inline void wakeup(dcb_ro_t* dcb, cpu_id_t cpu)
+    {
+        asm volatile ("int $99" :: "a"(5), "b"(dcb), "c"(cpu));
+    }
+
     inline void debug_stop()
     {
         debugger_t::breakpoint();
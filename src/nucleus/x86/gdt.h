@@ -12,6 +12,7 @@
 #include "segs.h"
 #include "tss.h"
 #include "macros.h"
+#include "ia32.h"
 
 class gdt_entry_t
 {
@@ -108,7 +109,10 @@ inline void gdt_entry_t::set_sys(uint32_t base, uint32_t limit, segtype_e type,
 class global_descriptor_table_t
 {
 public:
-    inline global_descriptor_table_t() // TODO: specify number of entries for per-CPU data segment (gs) descriptors
+    /**
+     * Each CPU gets its own table, so CPU_LOCAL_DS can point to a different information page on every CPU.
+     */
+    inline global_descriptor_table_t()
     {
         setup_standard_entries();
 
@@ -129,11 +133,18 @@ public:
         entries[idx(  USER_DS)].set_seg(0, ~0, gdt_entry_t::data, 3);
         entries[idx(  PRIV_CS)].set_seg(0, ~0, gdt_entry_t::code, 0);
         entries[idx(  PRIV_DS)].set_seg(0, ~0, gdt_entry_t::data, 0);
+        entries[idx(CPU_LOCAL_DS)].set_seg(0, ~0, gdt_entry_t::data, 3);
 
-        // TODO: Move this stack to a per-cpu structure.
         tss.ss0 = KERNEL_DS;
         tss.esp0 = intr_kernel_stack + 1024;
     }
+    /**
+     * Point the CPU-local segment of this table at given information page.
+     */
+    inline void set_cpu_local_base(address_t page)
+    {
+        entries[idx(CPU_LOCAL_DS)].set_seg(page, PAGE_SIZE - 1, gdt_entry_t::data, 3);
+    }
     inline void install()
     {
         asm volatile("lgdtl %0\n\t"
@@ -143,9 +154,9 @@ public:
         "movl %%ecx, %%ds\n\t"
         "movl %%ecx, %%es\n\t"
         "movl %%ecx, %%fs\n\t"
-        "movl %%ecx, %%gs\n\t"
+        "movl %%edx, %%gs\n\t"
         "movl %%ecx, %%ss"
-        :: "m"(*this), "i"(KERNEL_CS), "a"(KERNEL_TS), "c"(KERNEL_DS));
+        :: "m"(*this), "i"(KERNEL_CS), "a"(KERNEL_TS), "c"(KERNEL_DS), "d"(CPU_LOCAL_DS));
     }
 
 private:
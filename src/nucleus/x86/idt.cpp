@@ -65,6 +65,10 @@ extern "C"
     void irq13();
     void irq14();
     void irq15();
+
+    void ipi240();
+    void ipi241();
+    void apic_spurious();
 }
 
 interrupt_descriptor_table_t& interrupt_descriptor_table_t::instance()
@@ -79,6 +83,9 @@ interrupt_descriptor_table_t& interrupt_descriptor_table_t::instance()
 #define IRQ_ENTRY(n, m) \
     idt_entries[n].set(KERNEL_CS, irq##m, idt_entry_t::interrupt_gate, 0)
 
+#define IPI_ENTRY(n) \
+    idt_entries[n].set(KERNEL_CS, ipi##n, idt_entry_t::interrupt_gate, 0)
+
 // Start vectors offsets
 #define MASTER_VEC 0x20
 #define SLAVE_VEC  0x28
@@ -147,5 +154,18 @@ void interrupt_descriptor_table_t::install()
 
     IDT_ENTRY(99, interrupt_gate);
 
+    // Inter-processor interrupts, see local_apic.h
+    IPI_ENTRY(240);
+    IPI_ENTRY(241);
+    idt_entries[255].set(KERNEL_CS, apic_spurious, idt_entry_t::interrupt_gate, 0);
+
+    load();
+}
+
+/**
+ * Load the (already installed) table on current CPU. All CPUs share the same IDT.
+ */
+void interrupt_descriptor_table_t::load()
+{
     asm volatile("lidtl %0\n" :: "m"(*this));
 }
@@ -79,6 +79,7 @@ public:
     }
 
     void install();
+    void load();
 
     // Generic interrupt service routines.
     inline void set_isr_handler(int isr_num, interrupt_service_routine_t* isr)
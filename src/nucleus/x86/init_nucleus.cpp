@@ -18,6 +18,10 @@
 #include "c++ctors.h"
 #include "panic.h"
 #include "mmu.h"
+#include "atomic.h"
+#include "infopage.h"
+#include "local_apic.h"
+#include "fpu.h"
 
 static void dump_regs(registers_t* regs)
 {
@@ -42,6 +46,10 @@ static void dump_regs(registers_t* regs)
 
     kconsole << endl;
     debugger_t::print_backtrace(regs->ebp, regs->eip, 20);
+    // Without a privilege change the CPU does not push useresp and ss, the interrupted stack starts right there.
+    address_t esp = (regs->cs & 3) ? regs->useresp : reinterpret_cast<address_t>(&regs->useresp);
+    debugger_t::print_stack_snapshot(esp, regs->eip, regs->ebp);
+    debugger_t::print_trace(INFO_PAGE.cpu.id, 64);
 
     kconsole << "=================================================================================================" << endl;    
 }
@@ -76,6 +84,145 @@ public:
     }
 };
 
+address_t local_apic_t::base_address;
+static address_t online_cpus; // bitmask of CPUs that have passed nucleus_init()
+
+/**
+ * Cross-CPU TLB invalidation request.
+ * Initiators are serialised by the lock, each target clears its bit in pending once it has flushed.
+ */
+class tlb_shootdown_t
+{
+public:
+    void initiate(address_t linear)
+    {
+        // Another initiator may be waiting for us with interrupts disabled, keep servicing its request.
+        while (!lock.try_lock())
+        {
+            service();
+            x86_cpu_t::pause();
+        }
+
+        flush(linear);
+
+        address_t others = online_cpus & ~(1 << x86_cpu_t::id());
+        if (others)
+        {
+            address = linear;
+            pending = others;
+            atomic_ops::membar();
+            local_apic_t::broadcast_ipi(IPI_TLB_SHOOTDOWN);
+            while (*const_cast<volatile address_t*>(&pending))
+                x86_cpu_t::pause();
+        }
+
+        lock.unlock();
+    }
+
+    void service()
+    {
+        address_t self = 1 << x86_cpu_t::id();
+        if (*const_cast<volatile address_t*>(&pending) & self)
+        {
+            flush(address);
+            ++x86_cpu_t::current_cpu().tlb_shootdowns;
+            atomic_ops::fetch_and(&pending, ~self);
+        }
+    }
+
+private:
+    // Linear address 0 is never mapped, use it to request a full flush.
+    static void flush(address_t linear)
+    {
+        if (linear)
+            ia32_mmu_t::flush_page_directory_entry(linear);
+        else
+            ia32_mmu_t::flush_page_directory();
+    }
+
+    lockable_t lock;
+    volatile address_t address;
+    address_t pending;
+};
+
+static tlb_shootdown_t tlb_shootdown;
+
+/**
+ * Page directory and paging mode of the CPU that last wrote the PDBR. There is a single kernel address space,
+ * application processors follow it so that TLB shootdowns and shared mappings mean the same on every CPU.
+ */
+static volatile address_t kernel_pdbr;
+static volatile bool kernel_paging;
+
+static void share_pagetable(address_t pdbr)
+{
+    kernel_paging = ia32_mmu_t::paged_mode_enabled();
+    kernel_pdbr = pdbr;
+    atomic_ops::membar();
+    if (online_cpus & ~(1 << x86_cpu_t::id()))
+        local_apic_t::broadcast_ipi(IPI_WAKEUP);
+}
+
+/**
+ * Switch this CPU to the shared page directory and paging mode if they changed.
+ */
+static void adopt_pagetable()
+{
+    address_t pdbr = kernel_pdbr;
+    if (!pdbr)
+        return;
+    if (ia32_mmu_t::get_active_pagetable() != pdbr)
+        ia32_mmu_t::set_active_pagetable(pdbr);
+    if (kernel_paging && !ia32_mmu_t::paged_mode_enabled())
+        x86_cpu_t::cr0_set_flag(IA32_CR0_PG);
+}
+
+class fpu_trap_handler_t : public interrupt_service_routine_t
+{
+public:
+    virtual void run(registers_t*)
+    {
+        x86_fpu_t::handle_trap();
+    }
+};
+
+class wakeup_ipi_handler_t : public interrupt_service_routine_t
+{
+public:
+    virtual void run(registers_t*)
+    {
+        // The run queue has been filled by the sender, here we only need to get out of hlt.
+        ++x86_cpu_t::current_cpu().wakeups;
+        local_apic_t::eoi();
+    }
+};
+
+class tlb_shootdown_handler_t : public interrupt_service_routine_t
+{
+public:
+    virtual void run(registers_t*)
+    {
+        tlb_shootdown.service();
+        local_apic_t::eoi();
+    }
+};
+
+/**
+ * Put domain on the run queue of given CPU and kick that CPU if it is not us.
+ */
+static void wakeup_domain(dcb_ro_t* dcb, cpu_id_t cpu)
+{
+    if ((cpu >= information_page_t::MAX_CPUS) || !(online_cpus & (1 << cpu)))
+    {
+        kconsole << "wakeup: cpu " << cpu << " is not online" << endl;
+        return;
+    }
+
+    information_page_t::for_cpu(cpu)->cpu.run_queue.enqueue(dcb);
+    if (cpu != x86_cpu_t::id())
+        local_apic_t::send_ipi(information_page_t::for_cpu(cpu)->cpu.apic_id, IPI_WAKEUP);
+}
+
 class first_syscall_handler_t : public interrupt_service_routine_t
 {
 public:
@@ -85,6 +232,7 @@ public:
         {
             kconsole << "syscall(0x01): write_pdbr" << endl;
             ia32_mmu_t::set_active_pagetable(regs->ebx);
+            share_pagetable(regs->ebx);
         }
         else
         if (regs->eax == 2)
@@ -98,6 +246,16 @@ public:
             interrupt_descriptor_table().set_irq_handler(regs->ebx, reinterpret_cast<interrupt_service_routine_t*>(regs->ecx));
         }
         else
+        if (regs->eax == 4)
+        {
+            tlb_shootdown.initiate(regs->ebx);
+        }
+        else
+        if (regs->eax == 5)
+        {
+            wakeup_domain(reinterpret_cast<dcb_ro_t*>(regs->ebx), regs->ecx);
+        }
+        else
         {
             kconsole << "unknown syscall " << regs->eax << endl;            
         }
@@ -108,19 +266,77 @@ general_fault_handler_t gpf_handler;
 invalid_opcode_handler_t iop_handler;
 dummy_handler_t all_exceptions_handler;
 first_syscall_handler_t syscall_handler;
+fpu_trap_handler_t fpu_handler;
+wakeup_ipi_handler_t wakeup_handler;
+tlb_shootdown_handler_t tlb_shootdown_handler;
+
+/**
+ * Per-CPU descriptor tables, constructed on first use by the bootstrap processor like the shared IDT.
+ */
+static global_descriptor_table_t& global_descriptor_table(cpu_id_t cpu)
+{
+    static global_descriptor_table_t tables[information_page_t::MAX_CPUS];
+    return tables[cpu];
+}
 
-static global_descriptor_table_t gdt; // FIXME: use a singleton accessor like for interrupt_descriptor_table?
+static uint32_t ap_idle_stacks[information_page_t::MAX_CPUS][1024] ALIGNED(16);
 
 /**
- * Initialize single core system tables, interrupt handler stubs and syscall interface.
- * TODO: this goes into nucleus .init.code - as this code runs once and then can be dumped.
+ * Application processors wait here for IPIs, following page directory changes of the BSP.
+ * @todo Activate domains from the run queue once the scheduler can run them on APs.
  */
-extern "C" INIT_ONLY void nucleus_init()
+static void NEVER_RETURNS ap_idle()
 {
+    adopt_pagetable();
+    x86_cpu_t::current_cpu().online = true;
+    for (;;)
+    {
+        x86_cpu_t::enable_interrupts();
+        x86_cpu_t::halt();
+        x86_cpu_t::disable_interrupts();
+        adopt_pagetable();
+    }
+}
+
+/**
+ * Load per-CPU descriptor table with %gs based at this CPU's information page.
+ */
+static void install_cpu_tables(cpu_id_t cpu)
+{
+    information_page_t* info = information_page_t::for_cpu(cpu);
+    info->self = info;
+    global_descriptor_table(cpu).set_cpu_local_base(reinterpret_cast<address_t>(info));
+    global_descriptor_table(cpu).install();
+}
+
+/**
+ * Initialize system tables, interrupt handler stubs and syscall interface for given CPU.
+ * The bootstrap processor (cpu 0) comes first and sets up the shared IDT, application processors
+ * only install their own GDT and TSS and load the IDT.
+ * Lives in .text.init, which the nucleus keeps loaded: application processors come through here after boot.
+ */
+extern "C" INIT_ONLY void nucleus_init(cpu_id_t cpu)
+{
+    if (cpu != 0)
+    {
+        install_cpu_tables(cpu);
+        interrupt_descriptor_table().load();
+        local_apic_t::enable();
+        atomic_ops::fetch_or(&online_cpus, 1 << cpu);
+        kconsole << "CPU " << cpu << " entered nucleus." << endl;
+
+        // Leave the launcher boot stack, it is shared by all APs and goes away with the launcher.
+        asm volatile ("movl %0, %%esp\n"
+                      "xorl %%ebp, %%ebp\n"
+                      "jmp *%1"
+                      :: "r"(ap_idle_stacks[cpu] + 1024), "r"(ap_idle));
+    }
+
     // No dynamic memory allocation here yet, global objects not constructed either.
     run_global_ctors();
 
-    gdt.install();
+    install_cpu_tables(0);
+    online_cpus = 1;
     kconsole << "Created GDT." << endl;
 
     interrupt_descriptor_table().install();
@@ -131,7 +347,7 @@ extern "C" INIT_ONLY void nucleus_init()
     interrupt_descriptor_table().set_isr_handler(0x4, &all_exceptions_handler);
     interrupt_descriptor_table().set_isr_handler(0x5, &all_exceptions_handler);
     interrupt_descriptor_table().set_isr_handler(0x6, &iop_handler);
-    interrupt_descriptor_table().set_isr_handler(0x7, &all_exceptions_handler);
+    interrupt_descriptor_table().set_isr_handler(0x7, &fpu_handler);
     interrupt_descriptor_table().set_isr_handler(0x8, &all_exceptions_handler);
     interrupt_descriptor_table().set_isr_handler(0x9, &all_exceptions_handler);
     interrupt_descriptor_table().set_isr_handler(0xa, &all_exceptions_handler);
@@ -158,5 +374,12 @@ extern "C" INIT_ONLY void nucleus_init()
     interrupt_descriptor_table().set_isr_handler(0x1f, &all_exceptions_handler);
 
     interrupt_descriptor_table().set_isr_handler(99, &syscall_handler);
+    interrupt_descriptor_table().set_isr_handler(IPI_WAKEUP, &wakeup_handler);
+    interrupt_descriptor_table().set_isr_handler(IPI_TLB_SHOOTDOWN, &tlb_shootdown_handler);
     kconsole << "Created IDT." << endl;
+
+#if CONFIG_SMP
+    if (INFO_PAGE.cpu_features & X86_32_FEAT_APIC)
+        local_apic_t::enable();
+#endif
 }
@@ -17,5 +17,6 @@
 #define USER_DS   0x2b
 #define PRIV_CS   0x32
 #define PRIV_DS   0x3a
+#define CPU_LOCAL_DS 0x43 // Based at this CPU's information page, loaded into %gs.
 
-#define GDT_ENTRIES 7
+#define GDT_ENTRIES 8
@@ -51,3 +51,65 @@ extern "C" void __bad_alloc_handler()
 {
     //TODO: panic() here
 }
+
+#include "config.h"
+
+#if CONFIG_EXCEPTIONS_UNWIND
+#include "exceptions_unwind.h"
+#include "panic.h"
+
+// Exception handling entry points for the unwinding exception system, called by landing pads and catch clauses.
+// Every component has its own copy, the calls are forwarded to exceptions_mod through the exception ops.
+
+extern "C" _Unwind_Reason_Code
+__gxx_personality_v0(int version, _Unwind_Action actions, uint64_t exception_class,
+                     _Unwind_Exception* exception, _Unwind_Context* context)
+{
+    if (exception_class != xcp_unwind_exception_t::CLASS)
+        return _URC_FATAL_PHASE1_ERROR;
+    return xcp_unwind_exception_t::from(exception)->ops->personality(version, actions, exception_class, exception, context);
+}
+
+// Weak, exceptions_mod links the real one from libunwind.
+extern "C" __attribute__((weak)) void _Unwind_Resume(_Unwind_Exception* exception)
+{
+    xcp_unwind_exception_t::from(exception)->ops->resume(exception);
+    __builtin_unreachable();
+}
+
+extern "C" void* __cxa_begin_catch(void* exception)
+{
+    return xcp_unwind_exception_t::from(reinterpret_cast<_Unwind_Exception*>(exception))->thrown;
+}
+
+// OS_ENDTRY copies the record out and marks it popped, the exception object is freed by a later raise.
+extern "C" void __cxa_end_catch()
+{
+}
+
+extern "C" void __cxa_call_unexpected(void*)
+{
+    PANIC("unexpected exception");
+}
+
+namespace std
+{
+    void terminate() noexcept
+    {
+        PANIC("std::terminate called");
+    }
+}
+
+// Type info of the thrown xcp_context_t refers to this vtable. Handlers are matched by exception id, not by type,
+// so nothing else of it is needed.
+namespace __cxxabiv1
+{
+    class __class_type_info
+    {
+    public:
+        virtual ~__class_type_info();
+    };
+
+    __class_type_info::~__class_type_info() {}
+}
+#endif
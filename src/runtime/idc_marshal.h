@@ -0,0 +1,183 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// IDC wire format helpers used by meddler-generated marshalling stubs.
+//
+// Values are packed into idc_v1::buffer_rec at 4-byte alignment. Builtin types, enums, records and
+// closure pointers are copied as is: all domains share one address space, so a pointer is valid on
+// both sides, subject to protection. Strings and sequences are sent as a length followed by elements.
+//
+#pragma once
+
+#include "types.h"
+#include "memutils.h"
+#include "idc_v1_interface.h"
+#include <vector>
+
+namespace marshal {
+
+/**
+ * Result codes of a call, transported in the reply header and returned by receive_reply().
+ */
+enum result_e
+{
+    ok             = 0, //!< Reply holds results.
+    raised         = 1, //!< Server raised an exception, reply holds its name.
+    unknown_method = 2, //!< Server does not implement this method number.
+    bad_arguments  = 3, //!< Request could not be unmarshalled.
+    reply_overflow = 4  //!< Results did not fit into the reply buffer.
+};
+
+/**
+ * Signature of generated <interface>::idc::dispatch() functions.
+ */
+typedef uint32_t (*dispatch_t)(void* server, uint32_t method, idc_v1::buffer_desc request, idc_v1::buffer_desc reply);
+
+const size_t ALIGNMENT = sizeof(uint32_t);
+
+inline size_t padded(size_t size)
+{
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+/**
+ * Reset buffer to hold up to "size" bytes starting at "base".
+ */
+inline void reset(idc_v1::buffer_desc b, address_t base, size_t size)
+{
+    b->base = base;
+    b->ptr = base;
+    b->space = size;
+}
+
+inline size_t used(idc_v1::buffer_desc b)
+{
+    return b->ptr - b->base;
+}
+
+/**
+ * Reserve "size" bytes in the buffer.
+ * @returns Address of reserved area or nullptr if buffer is exhausted.
+ */
+inline void* advance(idc_v1::buffer_desc b, size_t size)
+{
+    // Sizes may come from the peer, check before padding can wrap them around.
+    if (size > b->space || padded(size) > b->space)
+        return nullptr;
+    size = padded(size);
+    void* p = reinterpret_cast<void*>(b->ptr);
+    b->ptr += size;
+    b->space -= size;
+    return p;
+}
+
+inline bool put_bytes(idc_v1::buffer_desc b, const void* data, size_t size)
+{
+    void* p = advance(b, size);
+    if (!p)
+        return false;
+    memutils::copy_memory(p, data, size);
+    return true;
+}
+
+inline bool get_bytes(idc_v1::buffer_desc b, void* data, size_t size)
+{
+    void* p = advance(b, size);
+    if (!p)
+        return false;
+    memutils::copy_memory(data, p, size);
+    return true;
+}
+
+template <typename T>
+inline bool put(idc_v1::buffer_desc b, const T& value)
+{
+    return put_bytes(b, &value, sizeof(T));
+}
+
+template <typename T>
+inline bool get(idc_v1::buffer_desc b, T& value)
+{
+    return get_bytes(b, &value, sizeof(T));
+}
+
+/**
+ * Strings include the terminating zero, so the receiver can use them directly from the buffer.
+ */
+inline bool put(idc_v1::buffer_desc b, const char* const& value)
+{
+    uint32_t length = value ? memutils::string_length(value) + 1 : 0;
+    return put(b, length) && put_bytes(b, value, length);
+}
+
+/**
+ * Unmarshalled string points into the buffer and stays valid until the buffer is reused.
+ */
+inline bool get(idc_v1::buffer_desc b, const char*& value)
+{
+    uint32_t length;
+    if (!get(b, length))
+        return false;
+    if (length == 0)
+    {
+        value = nullptr;
+        return true;
+    }
+    if (length > b->space)
+        return false;
+    value = reinterpret_cast<const char*>(advance(b, length));
+    return value && (value[length - 1] == 0);
+}
+
+template <typename T, typename A>
+inline bool put(idc_v1::buffer_desc b, const std::vector<T, A>& seq)
+{
+    uint32_t count = seq.size();
+    if (!put(b, count))
+        return false;
+    for (auto& item : seq)
+        if (!put(b, item))
+            return false;
+    return true;
+}
+
+template <typename T, typename A>
+inline bool get(idc_v1::buffer_desc b, std::vector<T, A>& seq)
+{
+    uint32_t count;
+    // Every element takes at least a byte, a longer count can't be genuine.
+    if (!get(b, count) || (count > b->space))
+        return false;
+    seq.resize(count);
+    for (auto& item : seq)
+        if (!get(b, item))
+            return false;
+    return true;
+}
+
+/**
+ * Octet sequences are copied in one go, elements are not padded.
+ */
+template <typename A>
+inline bool put(idc_v1::buffer_desc b, const std::vector<uint8_t, A>& seq)
+{
+    uint32_t count = seq.size();
+    return put(b, count) && put_bytes(b, seq.data(), count);
+}
+
+template <typename A>
+inline bool get(idc_v1::buffer_desc b, std::vector<uint8_t, A>& seq)
+{
+    uint32_t count;
+    if (!get(b, count) || (count > b->space) || (padded(count) > b->space))
+        return false;
+    seq.resize(count);
+    return get_bytes(b, seq.data(), count);
+}
+
+} // namespace marshal
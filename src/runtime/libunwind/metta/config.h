@@ -0,0 +1,14 @@
+/* libunwind configuration for Metta, stands in for the one generated by configure. */
+#ifndef metta_libunwind_config_h
+#define metta_libunwind_config_h
+
+#define HAVE_ENDIAN_H 1
+#define HAVE_ELF_H 1
+#define HAVE_LINK_H 1
+/* Use the __sync builtins for atomic updates, see ia64intrin.h. */
+#define HAVE_IA64INTRIN_H 1
+
+#define PACKAGE_STRING "libunwind 1.0 (Metta)"
+#define PACKAGE_BUGREPORT "berkus@atta-metta.net"
+
+#endif
@@ -0,0 +1,9 @@
+/* Byte order of the Metta targets. */
+#ifndef metta_endian_h
+#define metta_endian_h
+
+#define __LITTLE_ENDIAN 1234
+#define __BIG_ENDIAN    4321
+#define __BYTE_ORDER    __LITTLE_ENDIAN
+
+#endif
@@ -0,0 +1,9 @@
+/* There are no files to open in Metta, declared for the unused ELF image helpers of libunwind. */
+#ifndef metta_fcntl_h
+#define metta_fcntl_h
+
+#define O_RDONLY 0
+
+int open(const char* path, int flags, ...);
+
+#endif
@@ -0,0 +1,4 @@
+/* Stands in for the header that brings the __sync builtins to libunwind, gcc and clang have them built in. */
+#ifndef metta_ia64intrin_h
+#define metta_ia64intrin_h
+#endif
@@ -0,0 +1,7 @@
+/* Minimal inttypes.h for building libunwind for Metta. */
+#ifndef metta_inttypes_h
+#define metta_inttypes_h
+
+#include <stdint.h>
+
+#endif
@@ -0,0 +1,21 @@
+/* Loaded objects for libunwind. Components have no program headers, their unwind tables are registered with
+   _U_dyn_register() by the exception system instead, so dl_iterate_phdr() reports nothing, see os-metta.c. */
+#ifndef metta_link_h
+#define metta_link_h
+
+#include <stddef.h>
+#include <elf.h>
+
+#define ElfW(type) Elf32_##type
+
+struct dl_phdr_info
+{
+    Elf32_Addr        dlpi_addr;
+    const char*       dlpi_name;
+    const Elf32_Phdr* dlpi_phdr;
+    Elf32_Half        dlpi_phnum;
+};
+
+int dl_iterate_phdr(int (*callback)(struct dl_phdr_info* info, size_t size, void* data), void* data);
+
+#endif
@@ -0,0 +1,7 @@
+/* Old name of string.h used by libunwind. */
+#ifndef metta_memory_h
+#define metta_memory_h
+
+#include <string.h>
+
+#endif
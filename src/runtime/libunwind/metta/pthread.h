@@ -0,0 +1,14 @@
+/* Locks protecting libunwind caches and the list of registered unwind tables, see os-metta.c. */
+#ifndef metta_pthread_h
+#define metta_pthread_h
+
+typedef struct { volatile int locked; } pthread_mutex_t;
+typedef struct { int unused; } pthread_mutexattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+
+int pthread_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr);
+int pthread_mutex_lock(pthread_mutex_t* mutex);
+int pthread_mutex_unlock(pthread_mutex_t* mutex);
+
+#endif
@@ -0,0 +1,15 @@
+/* There are no signals in Metta, libunwind only needs the mask type. */
+#ifndef metta_signal_h
+#define metta_signal_h
+
+typedef unsigned long sigset_t;
+
+#define SIG_SETMASK 2
+
+static inline int sigfillset(sigset_t* set)
+{
+    *set = ~0UL;
+    return 0;
+}
+
+#endif
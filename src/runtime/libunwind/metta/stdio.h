@@ -0,0 +1,7 @@
+/* libunwind only prints in debug builds, which are not supported for Metta. */
+#ifndef metta_stdio_h
+#define metta_stdio_h
+
+#include <stddef.h>
+
+#endif
@@ -0,0 +1,11 @@
+/* Minimal stdlib.h for building libunwind for Metta, see os-metta.c. */
+#ifndef metta_stdlib_h
+#define metta_stdlib_h
+
+#include <stddef.h>
+
+void abort(void) __attribute__((noreturn));
+void free(void* ptr);
+char* getenv(const char* name);
+
+#endif
@@ -0,0 +1,15 @@
+/* String functions used by libunwind, provided by the Metta runtime. */
+#ifndef metta_string_h
+#define metta_string_h
+
+#include <stddef.h>
+
+void* memcpy(void* dest, const void* src, size_t count);
+void* memmove(void* dest, const void* src, size_t count);
+void* memset(void* dest, int value, size_t count);
+int memcmp(const void* left, const void* right, size_t count);
+size_t strlen(const char* str);
+int strcmp(const char* left, const char* right);
+char* strncpy(char* dest, const char* src, size_t count);
+
+#endif
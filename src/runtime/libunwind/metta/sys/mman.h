@@ -0,0 +1,18 @@
+/* Anonymous mappings for libunwind memory pools, see os-metta.c. */
+#ifndef metta_sys_mman_h
+#define metta_sys_mman_h
+
+#include <sys/types.h>
+
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED    ((void*)-1)
+#define MS_ASYNC      1
+
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
+int munmap(void* addr, size_t length);
+int msync(void* addr, size_t length, int flags);
+
+#endif
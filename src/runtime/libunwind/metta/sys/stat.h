@@ -0,0 +1,14 @@
+/* There are no files to stat in Metta, declared for the unused ELF image helpers of libunwind. */
+#ifndef metta_sys_stat_h
+#define metta_sys_stat_h
+
+#include <sys/types.h>
+
+struct stat
+{
+    off_t st_size;
+};
+
+int fstat(int fd, struct stat* buf);
+
+#endif
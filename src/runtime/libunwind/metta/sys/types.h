@@ -0,0 +1,12 @@
+/* Minimal sys/types.h for building libunwind for Metta. */
+#ifndef metta_sys_types_h
+#define metta_sys_types_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int32_t ssize_t;
+typedef int32_t off_t;
+typedef int32_t pid_t;
+
+#endif
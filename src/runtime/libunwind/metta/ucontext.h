@@ -0,0 +1,43 @@
+/* Machine context saved by unw_getcontext(), laid out like the Linux i386 one as libunwind's offsets.h expects. */
+#ifndef metta_ucontext_h
+#define metta_ucontext_h
+
+#include <stddef.h>
+#include <signal.h>
+
+enum
+{
+    REG_GS = 0, REG_FS, REG_ES, REG_DS, REG_EDI, REG_ESI, REG_EBP, REG_ESP, REG_EBX, REG_EDX,
+    REG_ECX, REG_EAX, REG_TRAPNO, REG_ERR, REG_EIP, REG_CS, REG_EFL, REG_UESP, REG_SS,
+    NGREG
+};
+
+typedef int greg_t;
+typedef greg_t gregset_t[NGREG];
+
+typedef struct
+{
+    void*  ss_sp;
+    int    ss_flags;
+    size_t ss_size;
+} stack_t;
+
+typedef struct
+{
+    gregset_t     gregs;
+    void*         fpregs;
+    unsigned long oldmask;
+    unsigned long cr2;
+} mcontext_t;
+
+typedef struct ucontext
+{
+    unsigned long    uc_flags;
+    struct ucontext* uc_link;
+    stack_t          uc_stack;
+    mcontext_t       uc_mcontext;
+    unsigned long    uc_sigmask[32];
+    char             uc_fpregs_mem[112];
+} ucontext_t;
+
+#endif
@@ -0,0 +1,12 @@
+/* Minimal unistd.h for building libunwind for Metta, see os-metta.c. */
+#ifndef metta_unistd_h
+#define metta_unistd_h
+
+#include <sys/types.h>
+
+int close(int fd);
+int getpagesize(void);
+pid_t getpid(void);
+ssize_t write(int fd, const void* buf, size_t count);
+
+#endif
@@ -463,7 +463,9 @@ put_unwind_info (struct dwarf_cursor *c, unw_proc_info_t *pi)
   if (!c->pi_valid)
     return;
 
-  if (c->pi_is_dynamic)
+  /* Registered tables are parsed like .eh_frame, their CIE info is
+     allocated from the pool as well (Metta registers all unwind tables).  */
+  if (c->pi_is_dynamic && pi->format == UNW_INFO_FORMAT_DYNAMIC)
     unwi_put_dynamic_unwind_info (c->as, pi, c->as_arg);
   else if (pi->unwind_info)
     {
@@ -0,0 +1,207 @@
+/* libunwind - a platform-independent unwind library
+   Copyright (C) 2017 Stanislav Karchebnyy <berkus@atta-metta.net>
+
+This file is part of libunwind.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
+
+/* Metta has no processes, files or signals.  Unwinding is only done in
+   the local address space, with unwind tables of loaded components
+   registered through _U_dyn_register(), so this file provides just
+   enough of the C library for that.  */
+
+#include "libunwind_i.h"
+
+/* Memory for libunwind pools.  Pools never give memory back and only
+   grow with the number of unwind tables and concurrent unwinds, so a
+   static arena is enough.  */
+
+#define ARENA_SIZE	(16 * 4096)
+
+static char arena[ARENA_SIZE] __attribute__ ((aligned (4096)));
+static size_t arena_used;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *
+mmap (void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  void *mem = MAP_FAILED;
+
+  length = (length + getpagesize () - 1) & -getpagesize ();
+  pthread_mutex_lock (&arena_lock);
+  if (length <= ARENA_SIZE - arena_used)
+    {
+      mem = arena + arena_used;
+      arena_used += length;
+    }
+  pthread_mutex_unlock (&arena_lock);
+  return mem;
+}
+
+int
+munmap (void *addr, size_t length)
+{
+  return -1;
+}
+
+int
+msync (void *addr, size_t length, int flags)
+{
+  return 0;
+}
+
+int
+getpagesize (void)
+{
+  return 4096;
+}
+
+pid_t
+getpid (void)
+{
+  return 0;
+}
+
+ssize_t
+write (int fd, const void *buf, size_t count)
+{
+  return count;
+}
+
+char *
+getenv (const char *name)
+{
+  return NULL;
+}
+
+/* Only .debug_frame tables are freed, these are never loaded here.  */
+void
+free (void *ptr)
+{
+}
+
+void
+abort (void)
+{
+  __builtin_trap ();
+}
+
+int
+pthread_mutex_init (pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+  mutex->locked = 0;
+  return 0;
+}
+
+int
+pthread_mutex_lock (pthread_mutex_t *mutex)
+{
+  while (__sync_lock_test_and_set (&mutex->locked, 1))
+    while (mutex->locked)
+      __builtin_ia32_pause ();
+  return 0;
+}
+
+int
+pthread_mutex_unlock (pthread_mutex_t *mutex)
+{
+  __sync_lock_release (&mutex->locked);
+  return 0;
+}
+
+int
+dl_iterate_phdr (int (*callback) (struct dl_phdr_info *info, size_t size,
+				  void *data), void *data)
+{
+  return 0;
+}
+
+HIDDEN int
+tdep_get_elf_image (struct elf_image *ei, pid_t pid, unw_word_t ip,
+		    unsigned long *segbase, unsigned long *mapoff,
+		    char *path, size_t pathlen)
+{
+  return -UNW_ENOINFO;
+}
+
+int
+elf_w (get_proc_name) (unw_addr_space_t as, pid_t pid, unw_word_t ip,
+		       char *buf, size_t buf_len, unw_word_t *offp)
+{
+  return -UNW_ENOINFO;
+}
+
+/* The Metta runtime only has memcpy() and memset().  */
+
+void *
+memmove (void *dest, const void *src, size_t count)
+{
+  char *d = dest;
+  const char *s = src;
+
+  if (d < s)
+    while (count--)
+      *d++ = *s++;
+  else
+    while (count--)
+      d[count] = s[count];
+  return dest;
+}
+
+int
+memcmp (const void *left, const void *right, size_t count)
+{
+  const unsigned char *l = left, *r = right;
+
+  for (; count; --count, ++l, ++r)
+    if (*l != *r)
+      return *l - *r;
+  return 0;
+}
+
+size_t
+strlen (const char *str)
+{
+  size_t len = 0;
+
+  while (str[len])
+    ++len;
+  return len;
+}
+
+int
+strcmp (const char *left, const char *right)
+{
+  while (*left && *left == *right)
+    ++left, ++right;
+  return (unsigned char) *left - (unsigned char) *right;
+}
+
+char *
+strncpy (char *dest, const char *src, size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < count && src[i]; ++i)
+    dest[i] = src[i];
+  for (; i < count; ++i)
+    dest[i] = 0;
+  return dest;
+}
@@ -0,0 +1,133 @@
+/* libunwind - a platform-independent unwind library
+   Copyright (C) 2017 Stanislav Karchebnyy <berkus@atta-metta.net>
+
+This file is part of libunwind.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
+
+#include "unwind_i.h"
+
+/* Metta delivers no signals to user code, so there are no signal
+   frames to recognize.  */
+
+PROTECTED int
+unw_is_signal_frame (unw_cursor_t *cursor)
+{
+  return 0;
+}
+
+PROTECTED int
+unw_handle_signal_frame (unw_cursor_t *cursor)
+{
+  return -UNW_EUNSPEC;
+}
+
+HIDDEN dwarf_loc_t
+x86_get_scratch_loc (struct cursor *c, unw_regnum_t reg)
+{
+  return DWARF_REG_LOC (&c->dwarf, reg);
+}
+
+#ifndef UNW_REMOTE_ONLY
+HIDDEN void *
+x86_r_uc_addr (ucontext_t *uc, int reg)
+{
+  void *addr;
+
+  switch (reg)
+    {
+    case UNW_X86_GS:  addr = &uc->uc_mcontext.gregs[REG_GS]; break;
+    case UNW_X86_FS:  addr = &uc->uc_mcontext.gregs[REG_FS]; break;
+    case UNW_X86_ES:  addr = &uc->uc_mcontext.gregs[REG_ES]; break;
+    case UNW_X86_DS:  addr = &uc->uc_mcontext.gregs[REG_DS]; break;
+    case UNW_X86_EAX: addr = &uc->uc_mcontext.gregs[REG_EAX]; break;
+    case UNW_X86_EBX: addr = &uc->uc_mcontext.gregs[REG_EBX]; break;
+    case UNW_X86_ECX: addr = &uc->uc_mcontext.gregs[REG_ECX]; break;
+    case UNW_X86_EDX: addr = &uc->uc_mcontext.gregs[REG_EDX]; break;
+    case UNW_X86_ESI: addr = &uc->uc_mcontext.gregs[REG_ESI]; break;
+    case UNW_X86_EDI: addr = &uc->uc_mcontext.gregs[REG_EDI]; break;
+    case UNW_X86_EBP: addr = &uc->uc_mcontext.gregs[REG_EBP]; break;
+    case UNW_X86_EIP: addr = &uc->uc_mcontext.gregs[REG_EIP]; break;
+    case UNW_X86_ESP: addr = &uc->uc_mcontext.gregs[REG_ESP]; break;
+    case UNW_X86_TRAPNO:  addr = &uc->uc_mcontext.gregs[REG_TRAPNO]; break;
+    case UNW_X86_CS:  addr = &uc->uc_mcontext.gregs[REG_CS]; break;
+    case UNW_X86_EFLAGS:  addr = &uc->uc_mcontext.gregs[REG_EFL]; break;
+    case UNW_X86_SS:  addr = &uc->uc_mcontext.gregs[REG_SS]; break;
+
+    default:
+      addr = NULL;
+    }
+  return addr;
+}
+
+/* Load the general registers saved in UC and continue at its EIP on
+   its stack.  Segment registers and flags are left as they are, they
+   do not change between frames of a thread.  EAX, ECX and EIP go
+   through the target stack just below its top, as there are no spare
+   registers left to hold them; that area belongs to frames being
+   unwound, never to this one, but all of UC is read before it is
+   written all the same.  */
+static void NORETURN
+x86_setcontext (ucontext_t *uc)
+{
+  asm volatile ("movl %c[esp](%0), %%ecx\n\t"
+		"subl $12, %%ecx\n\t"
+		"pushl %c[eip](%0)\n\t"
+		"pushl %c[ecx](%0)\n\t"
+		"pushl %c[eax](%0)\n\t"
+		"movl %c[ebx](%0), %%ebx\n\t"
+		"movl %c[esi](%0), %%esi\n\t"
+		"movl %c[edi](%0), %%edi\n\t"
+		"movl %c[ebp](%0), %%ebp\n\t"
+		"movl %c[edx](%0), %%edx\n\t"
+		"popl 0(%%ecx)\n\t"
+		"popl 4(%%ecx)\n\t"
+		"popl 8(%%ecx)\n\t"
+		"movl %%ecx, %%esp\n\t"
+		"popl %%eax\n\t"
+		"popl %%ecx\n\t"
+		"ret"
+		:
+		: "a" (uc->uc_mcontext.gregs),
+		  [eax] "i" (REG_EAX * 4), [ebx] "i" (REG_EBX * 4),
+		  [ecx] "i" (REG_ECX * 4), [edx] "i" (REG_EDX * 4),
+		  [esi] "i" (REG_ESI * 4), [edi] "i" (REG_EDI * 4),
+		  [ebp] "i" (REG_EBP * 4), [esp] "i" (REG_ESP * 4),
+		  [eip] "i" (REG_EIP * 4)
+		: "memory");
+  __builtin_unreachable ();
+}
+
+HIDDEN int
+x86_local_resume (unw_addr_space_t as, unw_cursor_t *cursor, void *arg)
+{
+  struct cursor *c = (struct cursor *) cursor;
+  ucontext_t *uc = c->uc;
+
+  /* Ensure c->pi is up-to-date.  On x86, it's relatively common to be
+     missing DWARF unwind info.  We don't want to fail in that case,
+     because the frame-chain still would let us do a backtrace at
+     least.  */
+  dwarf_make_proc_info (&c->dwarf);
+
+  Debug (8, "resuming at ip=%x via x86_setcontext()\n", c->dwarf.ip);
+  x86_setcontext (uc);
+}
+#endif
@@ -0,0 +1,63 @@
+/* libunwind - a platform-independent unwind library
+   Copyright (C) 2017 Stanislav Karchebnyy <berkus@atta-metta.net>
+
+This file is part of libunwind.
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.  */
+
+#include "offsets.h"
+
+/*  int _Ux86_getcontext (ucontext_t *ucp)
+
+  Saves the machine context in UCP necessary for libunwind, like
+  getcontext-linux.S does.  Metta builds have no GNU assembler
+  sources, hence the top-level asm.  FPU state is not saved, touching
+  it could fault in a thread that has not used the FPU yet.
+
+*/
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+#define MCONTEXT(reg) STR(LINUX_UC_MCONTEXT_OFF + LINUX_SC_ ## reg ## _OFF)
+
+asm (".text\n\t"
+     ".global _Ux86_getcontext\n\t"
+     ".type _Ux86_getcontext, @function\n"
+     "_Ux86_getcontext:\n\t"
+     ".cfi_startproc\n\t"
+     "mov 4(%esp), %eax\n\t"
+     /* EAX is not preserved. */
+     "movl $0, " MCONTEXT(EAX) "(%eax)\n\t"
+     "movl %ebx, " MCONTEXT(EBX) "(%eax)\n\t"
+     "movl %ecx, " MCONTEXT(ECX) "(%eax)\n\t"
+     "movl %edx, " MCONTEXT(EDX) "(%eax)\n\t"
+     "movl %edi, " MCONTEXT(EDI) "(%eax)\n\t"
+     "movl %esi, " MCONTEXT(ESI) "(%eax)\n\t"
+     "movl %ebp, " MCONTEXT(EBP) "(%eax)\n\t"
+     "movl (%esp), %ecx\n\t"
+     "movl %ecx, " MCONTEXT(EIP) "(%eax)\n\t"
+     /* Exclude the return address. */
+     "leal 4(%esp), %ecx\n\t"
+     "movl %ecx, " MCONTEXT(ESP) "(%eax)\n\t"
+     "movl $0, " MCONTEXT(FPSTATE) "(%eax)\n\t"
+     "xor %eax, %eax\n\t"
+     "ret\n\t"
+     ".cfi_endproc\n\t"
+     ".size _Ux86_getcontext, . - _Ux86_getcontext");
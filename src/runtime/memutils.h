@@ -29,7 +29,8 @@ namespace memutils {
 inline void*
 fill_memory(void* dest, int value, size_t count)
 {
-    asm volatile ("cld; rep stosb" :: "c"(count), "a"(value), "D"(dest) : "memory");
+    void* d = dest;
+    asm volatile ("cld; rep stosb" : "+c"(count), "+D"(d) : "a"(value) : "memory");
     return dest;
 }
 
@@ -61,7 +62,8 @@ clear_memory(void* dest, size_t count)
 inline void*
 copy_memory(void* dest, const void* src, size_t count)
 {
-    asm volatile ("cld; rep movsb" :: "c"(count), "S"(src), "D"(dest) : "memory");
+    void* d = dest;
+    asm volatile ("cld; rep movsb" : "+c"(count), "+S"(src), "+D"(d) :: "memory");
     return dest;
 }
 
@@ -89,9 +91,9 @@ move_memory(void* dest, const void* src, size_t count)
     if (dest <= src) {
         copy_memory(dest, src, count);
     } else {
-        tmp = reinterpret_cast<char*>(dest) + count;
-        s = reinterpret_cast<const char*>(src) + count;
-        asm volatile ("std; rep movsb" :: "c"(count), "S"(s), "D"(tmp) : "memory");
+        tmp = reinterpret_cast<char*>(dest) + count - 1;
+        s = reinterpret_cast<const char*>(src) + count - 1;
+        asm volatile ("std; rep movsb; cld" : "+c"(count), "+S"(s), "+D"(tmp) :: "memory");
     }
     return dest;
 }
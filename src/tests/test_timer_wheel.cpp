@@ -0,0 +1,163 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief Test timer_wheel_t and timed waits expiring through it.
+ */
+
+/*============================================================================*/
+
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "timer_wheel.h"
+#include "time_notify_v1_impl.h"
+
+static const time_v1::time MS = 1000000;
+
+/**
+ * A thread blocked on an event count with a deadline, as events.cpp keeps it.
+ */
+struct waiter_t
+{
+    dl_link_t<waiter_t> waitq;
+    bool                running;
+
+    waiter_t() : waitq(this), running(false) {}
+};
+
+struct expiry_t
+{
+    time_notify_v1::closure_t closure;
+    int                       fired;
+    time_v1::time             last_now, last_deadline;
+};
+
+// Same as the events time_notify handler: take the waiter off its wait queue and let it run.
+static void
+expire(time_notify_v1::closure_t* self, time_v1::time now, time_v1::time deadline, void* handle)
+{
+    expiry_t* e = reinterpret_cast<expiry_t*>(self->d_state);
+    waiter_t* w = reinterpret_cast<waiter_t*>(handle);
+
+    w->waitq.remove();
+    w->waitq.init(w);
+    w->running = true;
+
+    ++e->fired;
+    e->last_now = now;
+    e->last_deadline = deadline;
+}
+
+static const time_notify_v1::ops_t expire_methods = { expire };
+
+struct fixture_t
+{
+    timer_wheel_t       wheel;
+    expiry_t            expiry;
+    dl_link_t<waiter_t> wait_queue;
+
+    fixture_t()
+    {
+        wheel.init(0);
+        expiry.closure.d_methods = &expire_methods;
+        expiry.closure.d_state = reinterpret_cast<time_notify_v1::state_t*>(&expiry);
+        expiry.fired = 0;
+    }
+
+    void block(timeout_t& t, waiter_t& w, time_v1::time until)
+    {
+        wait_queue.add_to_tail(w.waitq);
+        t.link.init(&t);
+        t.deadline = until;
+        t.notify = &expiry.closure;
+        t.handle = &w;
+        wheel.insert(&t);
+    }
+
+    // What the activation dispatcher does on each activation.
+    int dispatch(time_v1::time now)
+    {
+        int n = 0;
+        while (timeout_t* t = wheel.next_expired(now))
+        {
+            t->notify->d_methods->notify(t->notify, now, t->deadline, t->handle);
+            ++n;
+        }
+        return n;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE( test_suite, fixture_t )
+
+BOOST_AUTO_TEST_CASE(timed_wait_expires)
+{
+    timeout_t t;
+    waiter_t w;
+    block(t, w, 5*MS);
+
+    BOOST_CHECK_EQUAL(wheel.earliest(), &t);
+    BOOST_CHECK_EQUAL(dispatch(1*MS), 0);
+    BOOST_CHECK_EQUAL(dispatch(5*MS - 1), 0);
+    BOOST_CHECK(!w.running);
+    BOOST_CHECK(!wait_queue.is_empty());
+
+    BOOST_CHECK_EQUAL(dispatch(6*MS), 1);
+    BOOST_CHECK(w.running);
+    BOOST_CHECK(wait_queue.is_empty());
+    BOOST_CHECK(w.waitq.is_empty());
+    BOOST_CHECK_EQUAL(expiry.last_now, 6*MS);
+    BOOST_CHECK_EQUAL(expiry.last_deadline, 5*MS);
+
+    BOOST_CHECK(wheel.earliest() == nullptr);
+    BOOST_CHECK_EQUAL(dispatch(100*MS), 0);
+    BOOST_CHECK_EQUAL(expiry.fired, 1);
+}
+
+BOOST_AUTO_TEST_CASE(cancelled_wait_does_not_expire)
+{
+    timeout_t t;
+    waiter_t w;
+    block(t, w, 5*MS);
+
+    // Woken by the event before the deadline.
+    wheel.remove(&t);
+    w.waitq.remove();
+    w.waitq.init(&w);
+
+    BOOST_CHECK_EQUAL(dispatch(10*MS), 0);
+    BOOST_CHECK(!w.running);
+    BOOST_CHECK_EQUAL(expiry.fired, 0);
+}
+
+BOOST_AUTO_TEST_CASE(waits_expire_in_deadline_order)
+{
+    // One per wheel level, and one on the overflow list.
+    const time_v1::time deadlines[] = { 3*MS, 200*MS, 20000*MS, 3000000*MS, (time_v1::time(1) << 46) };
+    const int count = sizeof(deadlines) / sizeof(deadlines[0]);
+    timeout_t t[count];
+    waiter_t w[count];
+
+    for (int i = count - 1; i >= 0; --i)
+        block(t[i], w[i], deadlines[i]);
+
+    for (int i = 0; i < count; ++i)
+    {
+        BOOST_CHECK_EQUAL(wheel.earliest(), &t[i]);
+        BOOST_CHECK_EQUAL(dispatch(deadlines[i] - 1), 0);
+        BOOST_CHECK(!w[i].running);
+
+        BOOST_CHECK_EQUAL(dispatch(deadlines[i]), 1);
+        BOOST_CHECK(w[i].running);
+        BOOST_CHECK_EQUAL(expiry.last_deadline, deadlines[i]);
+    }
+
+    BOOST_CHECK(wait_queue.is_empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -45,6 +45,7 @@ bool interface_t::add_exception(exception_t* exc)
 {
     //std::cout << "interface_t::add_exception()" << std::endl;
     exceptions.push_back(exc);
+    exc->exception_number = exceptions.size();
     return true;
 }
 
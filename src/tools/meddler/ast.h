@@ -10,6 +10,7 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
 #include "token.h"
 
 namespace AST
@@ -243,7 +244,7 @@ public:
 class exception_t : public node_t
 {
 public:
-    exception_t(node_t* parent, std::string nm) : node_t(parent, nm) {}
+    exception_t(node_t* parent, std::string nm) : node_t(parent, nm), exception_number(0) {}
     virtual bool add_field(alias_t* field);
     virtual void dump(std::string indent_prefix);
     virtual void emit_impl_h(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
@@ -252,6 +253,7 @@ public:
     virtual void emit_typedef_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
 
     std::vector<alias_t*> fields;
+    int exception_number; // 1-based index in the declaring interface, set by add_exception()
 };
 
 class method_t : public node_t
@@ -275,9 +277,17 @@ public:
     virtual void emit_interface_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
 
     virtual void typecode_representation(std::ostringstream& s);
+    /**
+     * Fingerprint of typecode_representation(), the type code of this interface.
+     */
+    uint64_t type_code();
 
     virtual void emit_typedef_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
 
+    void emit_marshal_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
+    void emit_dispatch_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
+    bool has_results(); // reply carries any values back to the caller
+
     std::vector<parameter_t*> params;
     std::vector<parameter_t*> returns;
     std::vector<exception_t*> raises;
@@ -314,6 +324,10 @@ public:
     virtual void emit_interface_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
 
     virtual void typecode_representation(std::ostringstream& s);
+    /**
+     * Fingerprint of typecode_representation(), the type code of this interface.
+     */
+    uint64_t type_code();
 
     virtual void emit_typedef_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
 
@@ -321,6 +335,15 @@ public:
     void emit_methods_interface_h(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
     void emit_methods_interface_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
 
+    /**
+     * Generate IDC client stubs and server dispatcher for non-local interfaces.
+     * Call after renumber_methods(), method numbers are used as operation codes on the wire.
+     */
+    void emit_marshal_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
+    void emit_methods_marshal_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
+    void emit_methods_surrogate_ops(std::ostringstream& s, std::string indent_prefix);
+    void emit_methods_dispatch_cpp(std::ostringstream& s, std::string indent_prefix, bool fully_qualify_types = false);
+
     /**
      * Call before generating typedefs cpp to renumber methods through all inheritance chain.
      * @returns index for the next subsequent method (after the last method in this interface).
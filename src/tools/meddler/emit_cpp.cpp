@@ -402,6 +402,13 @@ void interface_t::emit_interface_h(ostringstream& s, string indent_prefix, bool)
         }
     }
 
+    // Marshalling stubs declarations refer to IDC types.
+    if (!local && (methods.size() > 0))
+    {
+        s << indent_prefix << "namespace idc_v1 { struct buffer_rec; }" << endl
+          << indent_prefix << "namespace idc_client_binding_v1 { struct closure_t; }" << endl;
+    }
+
     s << endl;
 
     // Closure.
@@ -436,8 +443,19 @@ void interface_t::emit_interface_h(ostringstream& s, string indent_prefix, bool)
 
     s << endl;
 
+    if (!local && (methods.size() > 0))
+    {
+        s << indent_prefix << "    // IDC stubs, defined in " << name() << "_marshal.cpp" << endl
+          << indent_prefix << "    namespace idc" << endl
+          << indent_prefix << "    {" << endl
+          << indent_prefix << "        void init_surrogate(closure_t* surrogate, idc_client_binding_v1::closure_t* binding);" << endl
+          << indent_prefix << "        uint32_t dispatch(void* server, uint32_t method, idc_v1::buffer_rec* request, idc_v1::buffer_rec* reply);" << endl
+          << indent_prefix << "    }" << endl
+          << endl;
+    }
+
     // Type codes.
-    uint64_t fp = generate_fingerprint(this);
+    uint64_t fp = type_code();
     s << indent_prefix << "    const uint64_t type_code = 0x" << hex << fp << "ull;" << endl;
 
     int index = 0;
@@ -452,6 +470,12 @@ void interface_t::emit_interface_h(ostringstream& s, string indent_prefix, bool)
         s << indent_prefix << "    const uint64_t " << t->name() << "_type_code = 0x" << hex << fp + index << "ull;" << endl;
     }
 
+    // Exception ids, defined in _interface.cpp.
+    if (exceptions.size() > 0)
+        s << endl;
+    for (auto e : exceptions)
+        e->emit_interface_h(s, indent_prefix + "    ");
+
     s << indent_prefix << "}" << endl;
 
 }
@@ -472,7 +496,7 @@ void interface_t::emit_methods_interface_cpp(ostringstream& s, string indent_pre
 // Currently no need to generate interface.cpp if there are no methods.
 void interface_t::emit_interface_cpp(ostringstream& s, string indent_prefix, bool)
 {
-    if (methods.size() > 0)
+    if ((methods.size() > 0) || (exceptions.size() > 0))
     {
         s << indent_prefix << "#include \"" << name() << "_interface.h\"" << endl
           << indent_prefix << "#include \"" << name() << "_impl.h\"" << endl << endl;
@@ -480,12 +504,105 @@ void interface_t::emit_interface_cpp(ostringstream& s, string indent_prefix, boo
         s << indent_prefix << "namespace " << name() << endl
           << indent_prefix << "{" << endl << endl;
 
+        for (auto e : exceptions)
+            e->emit_interface_cpp(s, indent_prefix);
+        if (exceptions.size() > 0)
+            s << endl;
+
         emit_methods_interface_cpp(s, indent_prefix);
 
         s << indent_prefix << "}" << endl;
     }
 }
 
+void interface_t::emit_methods_marshal_cpp(ostringstream& s, string indent_prefix, bool fully_qualify_types)
+{
+    if (parent)
+        parent->emit_methods_marshal_cpp(s, indent_prefix, true);
+
+    for (auto m : methods)
+    {
+        m->emit_marshal_cpp(s, indent_prefix, fully_qualify_types);
+    }
+}
+
+// Order must match the ops_t structure emitted by emit_methods_impl_h().
+void interface_t::emit_methods_surrogate_ops(ostringstream& s, string indent_prefix)
+{
+    if (parent)
+        parent->emit_methods_surrogate_ops(s, indent_prefix);
+
+    for (auto m : methods)
+    {
+        s << indent_prefix << "    " << m->name() << "_stub," << endl;
+    }
+}
+
+void interface_t::emit_methods_dispatch_cpp(ostringstream& s, string indent_prefix, bool fully_qualify_types)
+{
+    if (parent)
+        parent->emit_methods_dispatch_cpp(s, indent_prefix, true);
+
+    for (auto m : methods)
+    {
+        m->emit_dispatch_cpp(s, indent_prefix, fully_qualify_types);
+    }
+}
+
+/**
+ * Client side is a surrogate closure with d_state pointing to an idc_client_binding_v1 closure of the transport.
+ * Server side is a dispatch function decoding the request and invoking the server closure.
+ * Wire format is defined by idc_marshal.h.
+ */
+void interface_t::emit_marshal_cpp(ostringstream& s, string indent_prefix, bool)
+{
+    if (local || (methods.size() == 0))
+    {
+        s << indent_prefix << "// " << name() << " has no IDC stubs, interface is local or has no methods." << endl;
+        return;
+    }
+
+    s << indent_prefix << "#include \"" << name() << "_interface.h\"" << endl
+      << indent_prefix << "#include \"" << name() << "_impl.h\"" << endl
+      << indent_prefix << "#include \"idc_v1_interface.h\"" << endl
+      << indent_prefix << "#include \"idc_client_binding_v1_interface.h\"" << endl
+      << indent_prefix << "#include \"idc_marshal.h\"" << endl
+      << indent_prefix << "#include \"exceptions.h\"" << endl << endl;
+
+    s << indent_prefix << "namespace " << name() << endl
+      << indent_prefix << "{" << endl
+      << indent_prefix << "namespace idc" << endl
+      << indent_prefix << "{" << endl << endl;
+
+    // Client stubs.
+    emit_methods_marshal_cpp(s, indent_prefix);
+
+    s << indent_prefix << "static const ops_t surrogate_ops =" << endl
+      << indent_prefix << "{" << endl;
+    emit_methods_surrogate_ops(s, indent_prefix);
+    s << indent_prefix << "};" << endl << endl;
+
+    s << indent_prefix << "void init_surrogate(closure_t* surrogate, idc_client_binding_v1::closure_t* binding)" << endl
+      << indent_prefix << "{" << endl
+      << indent_prefix << "    surrogate->d_methods = &surrogate_ops;" << endl
+      << indent_prefix << "    surrogate->d_state = reinterpret_cast<state_t*>(binding);" << endl
+      << indent_prefix << "}" << endl << endl;
+
+    // Server dispatcher.
+    s << indent_prefix << "uint32_t dispatch(void* server, uint32_t method, idc_v1::buffer_rec* _request, idc_v1::buffer_rec* _reply)" << endl
+      << indent_prefix << "{" << endl
+      << indent_prefix << "    closure_t* _server = reinterpret_cast<closure_t*>(server);" << endl
+      << indent_prefix << "    switch (method)" << endl
+      << indent_prefix << "    {" << endl;
+    emit_methods_dispatch_cpp(s, indent_prefix + "        ");
+    s << indent_prefix << "    }" << endl
+      << indent_prefix << "    return marshal::unknown_method;" << endl
+      << indent_prefix << "}" << endl << endl;
+
+    s << indent_prefix << "}" << endl
+      << indent_prefix << "}" << endl;
+}
+
 void interface_t::typecode_representation(ostringstream& s)
 {
     s << name() << "{";
@@ -505,6 +622,11 @@ void interface_t::typecode_representation(ostringstream& s)
     s << "}";
 }
 
+uint64_t interface_t::type_code()
+{
+    return generate_fingerprint(this);
+}
+
 int interface_t::renumber_methods()
 {
     int last_method = 0;
@@ -761,6 +883,200 @@ void method_t::emit_interface_cpp(ostringstream& s, string indent_prefix, bool f
       << indent_prefix << "}" << endl << endl;
 }
 
+bool method_t::has_results()
+{
+    if (never_returns)
+        return false;
+    if (returns.size() > 0)
+        return true;
+    for (auto param : params)
+    {
+        if (param->direction != parameter_t::in)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Client stub: marshal in and inout arguments into the request, wait for the reply and unmarshal results.
+ * Reply carries the return value, other results, then out and inout arguments.
+ */
+void method_t::emit_marshal_cpp(ostringstream& s, string indent_prefix, bool fully_qualify_types)
+{
+    string return_value_type;
+    if (never_returns || (returns.size() == 0))
+        return_value_type = "void";
+    else
+        return_value_type = emit_type(*returns.front(), fully_qualify_types);
+
+    s << indent_prefix << "static " << return_value_type << " " << name() << "_stub(" << parent_interface << "::closure_t* self";
+
+    for (auto param : params)
+    {
+        s << ", ";
+        param->emit_impl_h(s, "", fully_qualify_types);
+    }
+
+    if (returns.size() > 1)
+    {
+        for_each(returns.begin()+1, returns.end(), [&s, fully_qualify_types](parameter_t* param)
+        {
+            s << ", ";
+            param->emit_impl_h(s, "", fully_qualify_types);
+        });
+    }
+
+    s << ")" << endl
+      << indent_prefix << "{" << endl
+      << indent_prefix << "    auto _binding = reinterpret_cast<idc_client_binding_v1::closure_t*>(self->d_state);" << endl
+      << indent_prefix << "    idc_v1::buffer_desc _b = _binding->" << (never_returns ? "init_cast" : "init_call")
+      << "(" << method_number << ", \"" << name() << "\");" << endl;
+
+    for (auto param : params)
+    {
+        if (param->direction == parameter_t::out)
+            continue;
+        s << indent_prefix << "    if (!marshal::put(_b, " << (param->direction == parameter_t::in ? "" : "*") << param->name() << "))" << endl
+          << indent_prefix << "        OS_RAISE(idc_v1::failure_id, 0);" << endl;
+    }
+
+    s << indent_prefix << "    _binding->send_call(_b);" << endl;
+
+    if (never_returns)
+    {
+        s << indent_prefix << "}" << endl << endl;
+        return;
+    }
+
+    s << indent_prefix << "    const char* _xcp = nullptr;" << endl
+      << indent_prefix << "    if (_binding->receive_reply(&_b, &_xcp) != marshal::ok)" << endl
+      << indent_prefix << "    {" << endl
+      << indent_prefix << "        _binding->ack_receive(_b);" << endl
+      << indent_prefix << "        if (_xcp)" << endl
+      << indent_prefix << "            OS_RAISE(_xcp, 0);" << endl
+      << indent_prefix << "        OS_RAISE(idc_v1::failure_id, 0);" << endl
+      << indent_prefix << "    }" << endl;
+
+    if (!has_results())
+    {
+        s << indent_prefix << "    _binding->ack_receive(_b);" << endl
+          << indent_prefix << "}" << endl << endl;
+        return;
+    }
+
+    if (return_value_type != "void")
+        s << indent_prefix << "    " << return_value_type << " _result;" << endl;
+
+    s << indent_prefix << "    bool _ok = true;" << endl;
+    if (return_value_type != "void")
+        s << indent_prefix << "    _ok = _ok && marshal::get(_b, _result);" << endl;
+    if (returns.size() > 1)
+    {
+        for_each(returns.begin()+1, returns.end(), [&s, indent_prefix](parameter_t* param)
+        {
+            s << indent_prefix << "    _ok = _ok && marshal::get(_b, *" << param->name() << ");" << endl;
+        });
+    }
+    for (auto param : params)
+    {
+        if (param->direction == parameter_t::in)
+            continue;
+        s << indent_prefix << "    _ok = _ok && marshal::get(_b, *" << param->name() << ");" << endl;
+    }
+
+    s << indent_prefix << "    _binding->ack_receive(_b);" << endl
+      << indent_prefix << "    if (!_ok)" << endl
+      << indent_prefix << "        OS_RAISE(idc_v1::failure_id, 0);" << endl;
+    if (return_value_type != "void")
+        s << indent_prefix << "    return _result;" << endl;
+    s << indent_prefix << "}" << endl << endl;
+}
+
+/**
+ * Server side of the method: a case in the dispatch() switch, mirroring emit_marshal_cpp() wire order.
+ */
+void method_t::emit_dispatch_cpp(ostringstream& s, string indent_prefix, bool fully_qualify_types)
+{
+    string return_value_type;
+    if (never_returns || (returns.size() == 0))
+        return_value_type = "void";
+    else
+        return_value_type = emit_type(*returns.front(), fully_qualify_types);
+
+    s << indent_prefix << "case " << method_number << ": // " << name() << endl
+      << indent_prefix << "{" << endl;
+
+    for (auto param : params)
+        s << indent_prefix << "    " << emit_type(*param, fully_qualify_types) << " " << param->name() << ";" << endl;
+    if (returns.size() > 1)
+    {
+        for_each(returns.begin()+1, returns.end(), [&s, indent_prefix, fully_qualify_types](parameter_t* param)
+        {
+            s << indent_prefix << "    " << emit_type(*param, fully_qualify_types) << " " << param->name() << ";" << endl;
+        });
+    }
+
+    for (auto param : params)
+    {
+        if (param->direction == parameter_t::out)
+            continue;
+        s << indent_prefix << "    if (!marshal::get(_request, " << param->name() << "))" << endl
+          << indent_prefix << "        return marshal::bad_arguments;" << endl;
+    }
+
+    s << indent_prefix << "    ";
+    if (return_value_type != "void")
+        s << return_value_type << " _result = ";
+    s << "_server->" << name() << "(";
+
+    bool first = true;
+    for (auto param : params)
+    {
+        if (!first)
+            s << ", ";
+        else
+            first = false;
+        s << (param->direction == parameter_t::in ? "" : "&") << param->name();
+    }
+    if (returns.size() > 1)
+    {
+        for_each(returns.begin()+1, returns.end(), [&s, &first](parameter_t* param)
+        {
+            if (!first)
+                s << ", ";
+            else
+                first = false;
+            s << "&" << param->name();
+        });
+    }
+    s << ");" << endl;
+
+    if (has_results())
+    {
+        s << indent_prefix << "    bool _ok = true;" << endl;
+        if (return_value_type != "void")
+            s << indent_prefix << "    _ok = _ok && marshal::put(_reply, _result);" << endl;
+        if (returns.size() > 1)
+        {
+            for_each(returns.begin()+1, returns.end(), [&s, indent_prefix](parameter_t* param)
+            {
+                s << indent_prefix << "    _ok = _ok && marshal::put(_reply, " << param->name() << ");" << endl;
+            });
+        }
+        for (auto param : params)
+        {
+            if (param->direction == parameter_t::in)
+                continue;
+            s << indent_prefix << "    _ok = _ok && marshal::put(_reply, " << param->name() << ");" << endl;
+        }
+        s << indent_prefix << "    return _ok ? marshal::ok : marshal::reply_overflow;" << endl;
+    }
+    else
+        s << indent_prefix << "    return marshal::ok;" << endl;
+
+    s << indent_prefix << "}" << endl;
+}
+
 void method_t::typecode_representation(ostringstream& s)
 {
     s << name() << "(";
@@ -861,11 +1177,18 @@ void exception_t::emit_impl_h(ostringstream& s, string indent_prefix, bool)
 
 void exception_t::emit_interface_h(ostringstream& s, string indent_prefix, bool)
 {
-    s << indent_prefix << "typedef int xcp_" << replace_dots(name()) << ";" << endl; //TEMP hack
+    s << indent_prefix << "extern const exception_id_t " << name() << "_id;" << endl;
 }
 
+/**
+ * Exception codes follow the interface type code like type codes of the interface types do, but exceptions are
+ * never used as types, so the two may overlap.
+ */
 void exception_t::emit_interface_cpp(ostringstream& s, string indent_prefix, bool)
 {
+    string iface = get_root()->name();
+    s << indent_prefix << "const exception_id_t " << name() << "_id = { exception_id_t::MARKER, type_code + "
+      << exception_number << ", \"" << iface << "." << name() << "\" };" << endl;
 }
 
 void exception_t::emit_typedef_cpp(ostringstream& s, string indent_prefix, bool fully_qualify_types)
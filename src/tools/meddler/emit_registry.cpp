@@ -0,0 +1,157 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "emit_registry.h"
+#include "logger.h"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+
+/**
+ * Same as interface_name_hash() in interfaces/interface_registry.h.
+ */
+static uint32_t name_hash(const string& name, uint32_t seed = 0)
+{
+    uint32_t hash = 2166136261u ^ (seed * 2654435761u);
+    for (unsigned char c : name)
+        hash = (hash ^ c) * 16777619u;
+    return hash;
+}
+
+/**
+ * Hash and displace: find for every bucket a seed which puts its names into free slots, biggest buckets first.
+ * @returns false if some bucket has no such seed, try again with more buckets then.
+ */
+static bool find_seeds(const vector<registry_entry_t>& entries, size_t n_buckets,
+                       vector<uint16_t>& seeds, vector<uint16_t>& slots)
+{
+    const size_t count = entries.size();
+    vector<vector<size_t>> buckets(n_buckets);
+    for (size_t i = 0; i < count; ++i)
+        buckets[name_hash(entries[i].name) % n_buckets].push_back(i);
+
+    vector<size_t> order(n_buckets);
+    for (size_t b = 0; b < n_buckets; ++b)
+        order[b] = b;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    seeds.assign(n_buckets, 0);
+    slots.assign(count, 0);
+    vector<bool> taken(count, false);
+
+    for (size_t b : order)
+    {
+        if (buckets[b].empty())
+            break;
+
+        bool placed = false;
+        for (uint32_t seed = 0; seed <= 0xffff && !placed; ++seed)
+        {
+            vector<size_t> chosen;
+            for (size_t i : buckets[b])
+            {
+                size_t slot = name_hash(entries[i].name, seed) % count;
+                if (taken[slot] || find(chosen.begin(), chosen.end(), slot) != chosen.end())
+                    break;
+                chosen.push_back(slot);
+            }
+            if (chosen.size() != buckets[b].size())
+                continue;
+
+            for (size_t k = 0; k < chosen.size(); ++k)
+            {
+                taken[chosen[k]] = true;
+                slots[chosen[k]] = buckets[b][k];
+            }
+            seeds[b] = seed;
+            placed = true;
+        }
+        if (!placed)
+            return false;
+    }
+    return true;
+}
+
+static void emit_array(ostringstream& s, const char* name, const vector<uint16_t>& values)
+{
+    s << "constexpr uint16_t " << name << "[] = {";
+    for (size_t i = 0; i < values.size(); ++i)
+        s << (i % 16 ? " " : "\n    ") << dec << values[i] << ",";
+    s << endl << "};" << endl << endl;
+}
+
+bool emit_registry(vector<registry_entry_t> entries, ostringstream& s)
+{
+    sort(entries.begin(), entries.end(),
+         [](const registry_entry_t& a, const registry_entry_t& b) { return a.type_code < b.type_code; });
+
+    bool ok = true;
+    for (size_t i = 1; i < entries.size(); ++i)
+    {
+        if (entries[i].type_code == entries[i - 1].type_code)
+        {
+            cerr << "*** Interfaces " << entries[i - 1].name << " and " << entries[i].name
+                 << " have the same type code 0x" << hex << entries[i].type_code << dec << endl;
+            ok = false;
+        }
+        for (size_t j = 0; j < i; ++j)
+            if (entries[i].name == entries[j].name)
+            {
+                cerr << "*** Interface " << entries[i].name << " is given twice" << endl;
+                ok = false;
+            }
+    }
+    if (!ok || entries.empty())
+    {
+        cerr << "*** Cannot generate the interface registry" << endl;
+        return false;
+    }
+
+    // About two names per bucket, each bucket finds a seed quickly.
+    size_t n_buckets = entries.size() / 2 + 1;
+    vector<uint16_t> seeds, slots;
+    while (!find_seeds(entries, n_buckets, seeds, slots))
+        n_buckets *= 2;
+    L(cout << "### Registry of " << entries.size() << " interfaces uses " << n_buckets << " buckets" << endl);
+
+    s << "#include \"interface_registry.h\"" << endl
+      << endl;
+
+    for (auto& e : entries)
+        s << "extern interface_v1::state_t " << e.name << "__intf_typeinfo;" << endl;
+    s << endl;
+
+    s << "namespace { // start anon namespace" << endl
+      << endl
+      << "constexpr interface_registry_t::entry_t entries[] = {" << endl;
+    for (auto& e : entries)
+        s << "    { 0x" << hex << setw(16) << setfill('0') << e.type_code << "ull, 0x" << setw(8) << name_hash(e.name)
+          << "u, &" << e.name << "__intf_typeinfo }," << endl;
+    s << setfill(' ') << dec << "};" << endl
+      << endl;
+
+    emit_array(s, "seeds", seeds);
+    emit_array(s, "slots", slots);
+
+    s << "} // end anon namespace" << endl
+      << endl
+      << "constexpr interface_registry_t interface_registry = {" << endl
+      << "    " << entries.size() << ", entries, " << n_buckets << ", seeds, slots" << endl
+      << "};" << endl
+      << endl
+      << "static_assert(interface_registry_t::sorted(entries, " << entries.size() << "), \"Registry must be sorted by type code\");" << endl;
+
+    // Check that interface_name_hash() hashes the names the same way as meddler.
+    for (size_t i = 0; i < entries.size(); ++i)
+        s << "static_assert(interface_registry.slot(\"" << entries[i].name << "\", " << entries[i].name.size() << ") == " << i
+          << ", \"" << entries[i].name << " is not found by name\");" << endl;
+
+    return true;
+}
@@ -0,0 +1,27 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct registry_entry_t
+{
+    std::string name;
+    uint64_t type_code;
+};
+
+/**
+ * Emit interface_registry.cpp: the table of all interfaces sorted by type code and the perfect hash of their names,
+ * see interfaces/interface_registry.h.
+ * @returns false if two interfaces have the same name or type code.
+ */
+bool emit_registry(std::vector<registry_entry_t> entries, std::ostringstream& s);
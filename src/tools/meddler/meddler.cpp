@@ -7,6 +7,7 @@
 // (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 #include "parser.h"
+#include "emit_registry.h"
 #include "logger.h"
 #include <iostream>
 #include <sstream>
@@ -18,8 +19,8 @@
 using namespace llvm;
 using namespace std;
 
-static cl::opt<string>
-inputFilename(cl::Positional, cl::desc("<input .if file>"), cl::init("-"));
+static cl::list<string>
+inputFilenames(cl::Positional, cl::desc("<input .if files>"), cl::OneOrMore);
 
 static cl::list<string>
 includeDirectories("I", cl::Prefix, cl::desc("Include path"), cl::value_desc("directory"), cl::ZeroOrMore);
@@ -30,6 +31,34 @@ verbose("v", cl::desc("Increase verbosity level."), cl::ZeroOrMore);
 static cl::opt<string>
 outputDirectory("o", cl::Prefix, cl::desc("Output path"), cl::value_desc("directory"), cl::init("."));
 
+static cl::opt<string>
+registryFile("registry", cl::desc("Instead of stubs, generate the registry of all input interfaces"), cl::value_desc("file"));
+
+static string boilerplate_header(const string& name)
+{
+    ostringstream boilerplate_header;
+
+    char* user_name = getenv("USER");
+    char* host_name = getenv("HOSTNAME");
+    time_t now;
+    time(&now);
+    struct tm *current;
+    current = localtime(&now);
+
+    boilerplate_header << "/*" << endl
+                       << " * " << name << " generated";
+    if (user_name)
+        boilerplate_header << " by " << user_name;
+    if (host_name)
+        boilerplate_header << " at " << host_name;
+    boilerplate_header << " on " << (1900 + current->tm_year) << "." << (1 + current->tm_mon) << "." << current->tm_mday
+                       << "T" << current->tm_hour << ":" << current->tm_min << ":" << current->tm_sec << endl;
+    boilerplate_header << " * AUTOMATICALLY GENERATED FILE, DO NOT EDIT!" << endl
+                       << " */" << endl
+                       << endl;
+    return boilerplate_header.str();
+}
+
 class Meddler
 {
     llvm::SourceMgr sm;
@@ -95,29 +124,11 @@ public:
 
     bool emit(const string& output_dir)
     {
-        ostringstream boilerplate_header;
-        ostringstream impl_h, interface_h, interface_cpp, typedefs_cpp, filename;
+        ostringstream impl_h, interface_h, interface_cpp, typedefs_cpp, marshal_cpp, filename;
         parser_t& parser = *parser_stack[0];
 
-        char* user_name = getenv("USER");
-        char* host_name = getenv("HOSTNAME");
-        time_t now;
-        time(&now);
-        struct tm *current;
-        current = localtime(&now);
-
         L(cout << "### Generating boilerplate header" << endl);
-        boilerplate_header << "/*" << endl
-                           << " * " << parser.parse_tree->name() << " generated";
-        if (user_name)
-            boilerplate_header << " by " << user_name;
-        if (host_name)
-            boilerplate_header << " at " << host_name;
-        boilerplate_header << " on " << (1900 + current->tm_year) << "." << (1 + current->tm_mon) << "." << current->tm_mday
-                           << "T" << current->tm_hour << ":" << current->tm_min << ":" << current->tm_sec << endl;
-        boilerplate_header << " * AUTOMATICALLY GENERATED FILE, DO NOT EDIT!" << endl
-                           << " */" << endl
-                           << endl;
+        string header = boilerplate_header(parser.parse_tree->name());
 
         L(cout << "### Emitting impl_h" << endl);
         parser.parse_tree->emit_impl_h(impl_h, "");
@@ -128,55 +139,100 @@ public:
         L(cout << "### Emitting type definitions cpp" << endl);
         parser.parse_tree->renumber_methods();
         parser.parse_tree->emit_typedef_cpp(typedefs_cpp, "");
+        L(cout << "### Emitting marshalling stubs cpp" << endl);
+        parser.parse_tree->emit_marshal_cpp(marshal_cpp, "");
 
         // todo: boost.filesystem for paths
 
         filename << output_dir << "/" << parser.parse_tree->name() << "_impl.h";
         ofstream of(filename.str().c_str(), ios::out|ios::trunc);
-        of << boilerplate_header.str() << impl_h.str();
+        of << header << impl_h.str();
         of.close();
 
         filename.str("");
         filename << output_dir << "/" << parser.parse_tree->name() << "_interface.h";
         of.open(filename.str().c_str(), ios::out|ios::trunc);
-        of << boilerplate_header.str() << interface_h.str();
+        of << header << interface_h.str();
         of.close();
 
         filename.str("");
         filename << output_dir << "/" << parser.parse_tree->name() << "_interface.cpp";
         of.open(filename.str().c_str(), ios::out|ios::trunc);
-        of << boilerplate_header.str() << interface_cpp.str();
+        of << header << interface_cpp.str();
         of.close();
 
         filename.str("");
         filename << output_dir << "/" << parser.parse_tree->name() << "_typedefs.cpp";
         of.open(filename.str().c_str(), ios::out|ios::trunc);
-        of << boilerplate_header.str() << typedefs_cpp.str();
+        of << header << typedefs_cpp.str();
+        of.close();
+
+        filename.str("");
+        filename << output_dir << "/" << parser.parse_tree->name() << "_marshal.cpp";
+        of.open(filename.str().c_str(), ios::out|ios::trunc);
+        of << header << marshal_cpp.str();
         of.close();
 
         return true;
     }
+
+    registry_entry_t registry_entry()
+    {
+        parser_t& parser = *parser_stack[0];
+        return registry_entry_t{parser.parse_tree->name(), parser.parse_tree->type_code()};
+    }
 };
 
+static bool write_registry(const string& file)
+{
+    vector<registry_entry_t> entries;
+    for (auto& input : inputFilenames)
+    {
+        Meddler m(verbose);
+        m.set_include_dirs(includeDirectories);
+        if (!m.add_source(input) || !m.parse())
+        {
+            cerr << "Could not parse input file " << input << endl;
+            return false;
+        }
+        entries.push_back(m.registry_entry());
+    }
+
+    ostringstream registry_cpp;
+    if (!emit_registry(entries, registry_cpp))
+        return false;
+
+    ofstream of(file.c_str(), ios::out|ios::trunc);
+    of << boilerplate_header("interface_registry") << registry_cpp.str();
+    return true;
+}
+
 int main(int argc, char** argv)
 {
     cl::ParseCommandLineOptions(argc, argv, "Meddler - Metta IDL parser.\n");
-    Meddler m(verbose);
 
-    m.set_include_dirs(includeDirectories);
+    if (!registryFile.empty())
+        return write_registry(registryFile) ? 0 : -1;
 
-    if (!m.add_source(inputFilename))
+    for (auto& input : inputFilenames)
     {
-        cerr << "Could not open input file " << inputFilename << endl;
-        return -1;
-    }
+        Meddler m(verbose);
 
-    if (m.parse())
-    {
-        m.emit(outputDirectory);
+        m.set_include_dirs(includeDirectories);
+
+        if (!m.add_source(input))
+        {
+            cerr << "Could not open input file " << input << endl;
+            return -1;
+        }
+
+        if (m.parse())
+        {
+            m.emit(outputDirectory);
+        }
+        else
+            return -1;
     }
-    else
-        return -1;
 
     return 0;
 }
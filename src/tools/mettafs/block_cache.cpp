@@ -10,6 +10,9 @@
 #include "block_device_mapper.h"
 #include "memutils.h"
 #include <cstdio>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
 #include <cassert>
 #include <iostream> // debug
 
@@ -24,34 +27,40 @@ void block_cache_t::set_device_mapper(block_device_mapper_t& mapper)
 
 size_t block_cache_t::read_blocks(deviceno_t device, block_device_t::blockno_t block_n, char* data, size_t nblocks, size_t block_size)
 {
-    return device_mapper->read(device, block_n, data, nblocks * block_size);
+    return device_mapper->read(device, block_n, data, nblocks * block_size) / block_size;
 }
 
 size_t block_cache_t::write_blocks(deviceno_t device, block_device_t::blockno_t block_n, const char* data, size_t nblocks, size_t block_size)
 {
-    return device_mapper->write(device, block_n, data, nblocks * block_size);
+    return device_mapper->write(device, block_n, data, nblocks * block_size) / block_size;
+}
+
+size_t block_cache_t::read_blocks(deviceno_t device, block_device_t::blockno_t block_n, const std::vector<struct iovec>& iov, size_t block_size)
+{
+    return device_mapper->read(device, block_n, iov.data(), iov.size()) / block_size;
+}
+
+size_t block_cache_t::write_blocks(deviceno_t device, block_device_t::blockno_t block_n, const std::vector<struct iovec>& iov, size_t block_size)
+{
+    return device_mapper->write(device, block_n, iov.data(), iov.size()) / block_size;
 }
 
 //=====================================================================================================================
 // cache_block_t
 //=====================================================================================================================
 
-cache_block_t::cache_block_t(deviceno_t dev, block_device_t::blockno_t block_n, size_t size)
-    : device(dev)
-    , block_num(block_n)
+cache_block_t::cache_block_t(size_t size, char* buffer)
+    : device(-1)
+    , block_num(-1)
     , block_size(size)
+    , data(buffer)
     , dirty(false)
     , busy(false)
+    , reading(false)
+    , locks(0)
     , next_mru(0)
     , prev_lru(0)
 {
-    data = new char [size];
-    assert(data);
-}
-
-cache_block_t::~cache_block_t()
-{
-    delete data;
 }
 
 // Double-linked list helper functions.
@@ -74,10 +83,10 @@ void cache_block_t::link_at_mru(cache_block_list_t* parent)
         parent->mru->next_mru = this;
     }
     parent->mru = this;
-        if (!parent->lru)
-        {
-            parent->lru = this;
-        }
+    if (!parent->lru)
+    {
+        parent->lru = this;
+    }
 }
 
 // Link at LRU side.
@@ -98,10 +107,10 @@ void cache_block_t::link_at_lru(cache_block_list_t* parent)
         parent->lru->prev_lru = this;
     }
     parent->lru = this;
-        if (!parent->mru)
-        {
-            parent->mru = this;
-        }
+    if (!parent->mru)
+    {
+        parent->mru = this;
+    }
 }
 
 void cache_block_t::unlink_from(cache_block_list_t* parent)
@@ -120,123 +129,453 @@ void cache_block_t::unlink_from(cache_block_list_t* parent)
 }
 
 //=====================================================================================================================
-// Portable block cache implementation.
+// block_ref_t
 //=====================================================================================================================
 
-block_cache_t::~block_cache_t()
+block_ref_t::block_ref_t(block_cache_t* c, cache_block_t* b)
+    : cache(c)
+    , blk(b)
+    , mapping(nullptr)
+    , ptr(b->data)
+    , bytes(b->block_size)
 {
 }
 
-/**
- * Find the block in the cache.
- * Assumes all necessary locks are held (acts as internal worker function).
- * If block is busy doing I/O will wait a certain amount of time (not implemented for single-threaded test).
- */
-cache_block_t* block_cache_t::block_lookup(deviceno_t device, block_device_t::blockno_t block_n)
+block_ref_t::block_ref_t(mapped_block_device_t* m, const char* data, size_t size)
+    : cache(nullptr)
+    , blk(nullptr)
+    , mapping(m)
+    , ptr(data)
+    , bytes(size)
+{
+    mapping->pin();
+}
+
+block_ref_t::block_ref_t(block_ref_t&& other)
+    : cache(other.cache)
+    , blk(other.blk)
+    , mapping(other.mapping)
+    , ptr(other.ptr)
+    , bytes(other.bytes)
 {
-    block_id_t id = std::make_pair(device, block_n);
-    cache_map_t::iterator it;
+    other.blk = nullptr;
+    other.mapping = nullptr;
+    other.ptr = nullptr;
+}
 
-    if ((it = cache.find(id)) != cache.end())
+block_ref_t& block_ref_t::operator =(block_ref_t&& other)
+{
+    if (this != &other)
     {
-        //TODO: check for busy block, and wait if it is busy (shouldn't happen in single threaded test).
-        return (*it).second;
+        release();
+        cache = other.cache;
+        blk = other.blk;
+        mapping = other.mapping;
+        ptr = other.ptr;
+        bytes = other.bytes;
+        other.blk = nullptr;
+        other.mapping = nullptr;
+        other.ptr = nullptr;
     }
-    return NULL;
+    return *this;
+}
+
+void block_ref_t::release()
+{
+    if (blk)
+        cache->release_ref(blk);
+    if (mapping)
+        mapping->unpin();
+    blk = nullptr;
+    mapping = nullptr;
+    ptr = nullptr;
+    bytes = 0;
+}
+
+//=====================================================================================================================
+// block_slab_t
+//=====================================================================================================================
+
+block_slab_t::block_slab_t(size_t size)
+    : block_size(size)
+    , blocks_per_chunk(size < CHUNK_BYTES ? CHUNK_BYTES / size : 1)
+    , free_blocks(0)
+{
+}
+
+block_slab_t::~block_slab_t()
+{
+    for (auto chunk : chunks)
+        ::free(chunk);
 }
 
 /**
- * Write out all cached blocks for device dev.
+ * A chunk holds blocks_per_chunk buffers followed by their block records.
  */
-bool block_cache_t::flush(deviceno_t dev)
+cache_block_t* block_slab_t::allocate()
 {
-    cache_block_t* blk = blocks.lru;
-    cache_block_t* prev_blk = 0;
-    while (blk) {
-        if (blk->is_busy() || (blk->device != dev)) {
-            std::cerr << "NOT flushing block " << blk->block_num << " because busy? " << blk->is_busy() << ", or wrong dev? " << (blk->device != dev) << std::endl;
-            blk = blk->next_mru;
-            continue;
+    if (!free_blocks)
+    {
+        size_t buffers = blocks_per_chunk * block_size;
+        void* chunk;
+        if (posix_memalign(&chunk, block_device_t::DIRECT_IO_ALIGN, buffers + blocks_per_chunk * sizeof(cache_block_t)) != 0)
+            throw std::bad_alloc();
+        chunks.push_back(static_cast<char*>(chunk));
+
+        cache_block_t* records = reinterpret_cast<cache_block_t*>(static_cast<char*>(chunk) + buffers);
+        for (size_t i = blocks_per_chunk; i > 0; --i)
+        {
+            cache_block_t* blk = new(&records[i - 1]) cache_block_t(block_size, static_cast<char*>(chunk) + (i - 1) * block_size);
+            blk->next_mru = free_blocks;
+            free_blocks = blk;
         }
+    }
 
-        std::cerr << "Flushing block " << blk->block_num << " of device " << dev << std::endl;
+    cache_block_t* blk = free_blocks;
+    free_blocks = blk->next_mru;
+    blk->next_mru = 0;
+    return blk;
+}
 
-        if (write_blocks(dev, blk->block_num, blk->data, 1, blk->block_size) != blk->block_size)
-            return false;
+void block_slab_t::free(cache_block_t* blk)
+{
+    assert(blk->block_size == block_size);
+    assert(blk->prev_lru == 0 && blk->next_mru == 0);
+    assert(blk->locks == 0);
+    blk->dirty = blk->busy = blk->reading = false;
+    blk->next_mru = free_blocks;
+    free_blocks = blk;
+}
+
+//=====================================================================================================================
+// block_index_t
+//=====================================================================================================================
 
-        prev_blk = blk;
-        blk = blk->next_mru;
-        prev_blk->unlink_from(&blocks);
-        cache[std::make_pair(dev, prev_blk->block_num)] = 0;
-        delete prev_blk;
+block_index_t::block_index_t(size_t max_entries)
+{
+    // Keep the load factor at or below 1/2.
+    size_t capacity = 16;
+    shift = 64 - 4;
+    while (capacity < 2 * max_entries)
+    {
+        capacity <<= 1;
+        --shift;
     }
-    return true;
+    slots.assign(capacity, nullptr);
+    mask = capacity - 1;
 }
 
-size_t block_cache_t::unwritten_blocks()
+/**
+ * Fibonacci hashing of the combined key, sequential block numbers spread over the whole table.
+ */
+size_t block_index_t::home_slot(deviceno_t device, block_device_t::blockno_t block_n) const
 {
-    size_t n = 0;
-    cache_block_t* blk = blocks.lru;
-    while (blk) {
-        ++n;
-        blk = blk->next_mru;
+    uint64_t key = (uint64_t(device) << 48) ^ block_n;
+    return (key * 0x9e3779b97f4a7c15ull) >> shift;
+}
+
+cache_block_t* block_index_t::find(deviceno_t device, block_device_t::blockno_t block_n) const
+{
+    for (size_t i = home_slot(device, block_n); slots[i]; i = (i + 1) & mask)
+    {
+        if (slots[i]->device == device && slots[i]->block_num == block_n)
+            return slots[i];
     }
-    return n;
+    return nullptr;
+}
+
+void block_index_t::insert(cache_block_t* blk)
+{
+    size_t i = home_slot(blk->device, blk->block_num);
+    while (slots[i])
+    {
+        assert(slots[i] != blk);
+        i = (i + 1) & mask;
+    }
+    slots[i] = blk;
 }
 
 /**
- * Blocks we are trying to get may be either busy, locked or dirty. In either case, we cannot discard them and reuse for anything.
- * We also need to keep track that the blocks we've taken are of correct size, and if not - reallocate them.
+ * Remove the entry and shift back following entries of the same probe run that would become unreachable.
  */
-std::vector<cache_block_t*> block_cache_t::get_blocks(size_t nblocks, size_t block_size)
+void block_index_t::erase(cache_block_t* blk)
+{
+    size_t i = home_slot(blk->device, blk->block_num);
+    while (slots[i] != blk)
+    {
+        assert(slots[i]);
+        i = (i + 1) & mask;
+    }
+    slots[i] = nullptr;
+
+    for (size_t j = (i + 1) & mask; slots[j]; j = (j + 1) & mask)
+    {
+        size_t home = home_slot(slots[j]->device, slots[j]->block_num);
+        // Entry at j may move into the hole at i unless its home slot lies cyclically in (i, j].
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            slots[i] = slots[j];
+            slots[j] = nullptr;
+            i = j;
+        }
+    }
+}
+
+//=====================================================================================================================
+// Portable block cache implementation.
+//=====================================================================================================================
+
+block_cache_t::shard_t::shard_t(size_t n_blocks)
+    : index(n_blocks)
+    , max_blocks(n_blocks)
+    , allocated_blocks(0)
+    , dirty_blocks(0)
+{
+    clean.lru = clean.mru = NULL;
+    dirty.lru = dirty.mru = NULL;
+    busy.lru = busy.mru = NULL;
+}
+
+block_cache_t::shard_t::~shard_t()
+{
+    for (auto& slab : slabs)
+        delete slab.second;
+}
+
+block_cache_t::block_cache_t(size_t n_blocks)
+    : mapped_count(0)
+    , max_blocks(n_blocks)
+    , device_mapper(NULL)
+    , io_thread_stop(false)
+    , write_back_running(false)
+{
+    size_t n_shards = 1;
+    while (n_shards < MAX_SHARDS && n_shards * 2 * MIN_SHARD_BLOCKS <= n_blocks)
+        n_shards *= 2;
+
+    for (size_t i = 0; i < n_shards; ++i)
+        shards.emplace_back(new shard_t(n_blocks / n_shards + (i < n_blocks % n_shards ? 1 : 0)));
+}
+
+block_cache_t::~block_cache_t()
 {
-    if (nblocks > max_blocks)
-        throw std::runtime_error("Cannot allocate more blocks than allowed in the cache in total!");
+    stop_write_back();
+}
+
+block_cache_t::shard_t& block_cache_t::shard_for(deviceno_t device, block_device_t::blockno_t block_n)
+{
+    return *shards[(block_n + device * 0x9e3779b9ull) & (shards.size() - 1)];
+}
+
+cache_block_list_t* block_cache_t::list_for(shard_t& shard, cache_block_t* blk)
+{
+    if (blk->is_busy())
+        return &shard.busy;
+    if (blk->dirty)
+        return &shard.dirty;
+    return &shard.clean;
+}
+
+void block_cache_t::lock_block(shard_t& shard, cache_block_t* blk)
+{
+    blk->unlink_from(list_for(shard, blk));
+    ++blk->locks;
+    blk->link_at_mru(&shard.busy);
+}
+
+void block_cache_t::unlock_block(shard_t& shard, cache_block_t* blk)
+{
+    assert(blk->locks);
+    blk->unlink_from(&shard.busy);
+    --blk->locks;
+    blk->link_at_mru(list_for(shard, blk));
+    if (!blk->locks)
+        shard.io_done.notify_all();
+}
+
+void block_cache_t::start_reading(shard_t& shard, cache_block_t* blk, deviceno_t device, block_device_t::blockno_t block_n)
+{
+    blk->device = device;
+    blk->block_num = block_n;
+    blk->reading = true;
+    shard.index.insert(blk);
+    blk->link_at_mru(&shard.busy);
+}
+
+void block_cache_t::finish_reading(shard_t& shard, cache_block_t* blk, bool valid)
+{
+    assert(blk->reading && !blk->dirty);
+    blk->unlink_from(&shard.busy);
+    blk->reading = false;
+    if (valid)
+        blk->link_at_mru(&shard.clean);
+    else
+        release_block(shard, blk);
+    shard.io_done.notify_all();
+}
+
+void block_cache_t::release_block(shard_t& shard, cache_block_t* blk)
+{
+    shard.index.erase(blk);
+    unget_block(shard, blk);
+}
+
+void block_cache_t::unget_block(shard_t& shard, cache_block_t* blk)
+{
+    slab_for(shard, blk->block_size).free(blk);
+    --shard.allocated_blocks;
+}
 
-    std::vector<cache_block_t*> ret;
+block_slab_t& block_cache_t::slab_for(shard_t& shard, size_t block_size)
+{
+    block_slab_t*& slab = shard.slabs[block_size];
+    if (!slab)
+        slab = new block_slab_t(block_size);
+    return *slab;
+}
 
-    // If cache is not filled, just allocate new blocks.
-    size_t nfree = max_blocks - cache.size();
-    while (nfree && nblocks)
+/**
+ * Write out all cached blocks for device dev and drop them from the cache.
+ */
+bool block_cache_t::flush(deviceno_t dev)
+{
     {
-        cache_block_t* blk = new cache_block_t(-1, -1, block_size);
-        assert(blk); // FIXME: do a real check.
-        ret.push_back(blk);
-        --nblocks;
-        --nfree;
+        // Forget read-ahead for the device and let prefetches already in flight finish.
+        std::unique_lock<std::mutex> guard(lock);
+        readahead.erase(dev);
+        prefetches.erase(std::remove_if(prefetches.begin(), prefetches.end(),
+            [dev](const prefetch_t& p) { return p.device == dev; }), prefetches.end());
+        prefetch_done.wait(guard, [this, dev] { return !prefetches_in_flight[dev]; });
     }
 
-    // We've exhausted the cache free space, now take old entries off the cache and reuse.
-    while (nblocks)
+    std::vector<std::vector<cache_block_t*>> marked(shards.size());
+    for (size_t i = 0; i < shards.size(); ++i)
     {
-        cache_block_t* blk = blocks.lru;
+        shard_t& shard = *shards[i];
+        std::unique_lock<std::mutex> guard(shard.lock);
+
+        // Let background writes and readers of the device's blocks finish.
+        shard.io_done.wait(guard, [&shard, dev] {
+            for (cache_block_t* blk = shard.busy.lru; blk; blk = blk->next_mru)
+                if (blk->device == dev)
+                    return false;
+            return true;
+        });
+
+        for (cache_block_t* blk = shard.dirty.lru; blk; blk = blk->next_mru)
+        {
+            if (blk->device == dev)
+                marked[i].push_back(blk);
+        }
+        mark_busy(shard, marked[i]);
+    }
+
+    if (!write_marked(marked))
+        return false;
+
+    for (auto& shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        cache_block_t* blk = shard->clean.lru;
         while (blk)
         {
-            if (!blk->is_usable() || (blk->size() != block_size))
+            cache_block_t* next = blk->next_mru;
+            if (blk->device == dev)
             {
-                blk = blk->next_mru;
-                continue;
+                blk->unlink_from(&shard->clean);
+                release_block(*shard, blk);
             }
-            blk->unlink_from(&blocks);
-            ret.push_back(blk);
-            --nblocks;
-            break;
+            blk = next;
         }
     }
+    return true;
+}
 
-    return ret;
+/**
+ * Blocks come from the slab until the shard is full, then clean blocks are evicted from the LRU end of the clean list.
+ * When there are no clean blocks the least recently used dirty block is written back first, and when all blocks are
+ * busy this waits for them to become free, dropping the lock meanwhile. Evicted blocks of another size go back to
+ * their slab and are replaced by a block of the right size.
+ */
+cache_block_t* block_cache_t::get_block(shard_t& shard, std::unique_lock<std::mutex>& guard, size_t block_size, bool wait)
+{
+    while (true)
+    {
+        // If the shard is not filled, just allocate a new block.
+        if (shard.allocated_blocks < shard.max_blocks)
+        {
+            ++shard.allocated_blocks;
+            return slab_for(shard, block_size).allocate();
+        }
+
+        // We've exhausted the shard free space, now take old entries off the cache and reuse.
+        if (cache_block_t* blk = shard.clean.lru)
+        {
+            blk->unlink_from(&shard.clean);
+            shard.index.erase(blk);
+
+            if (blk->block_size != block_size)
+            {
+                slab_for(shard, blk->block_size).free(blk);
+                blk = slab_for(shard, block_size).allocate();
+            }
+            return blk;
+        }
+
+        if (!wait)
+            return nullptr;
+
+        if (shard.dirty.lru)
+        {
+            std::vector<cache_block_t*> blks(1, shard.dirty.lru);
+            mark_busy(shard, blks);
+            guard.unlock();
+            bool written = write_blocks(blks[0]->device, blks[0]->block_num, blks[0]->data, 1, blks[0]->block_size) == 1;
+            guard.lock();
+            unmark_busy(shard, blks, written);
+            if (!written)
+                throw std::runtime_error("Writing back dirty block failed.");
+            continue;
+        }
+
+        if (!shard.busy.lru)
+            throw std::runtime_error("No block cache entries can be evicted.");
+
+        shard.io_done.wait(guard);
+    }
 }
 
 void block_cache_t::set_device_block_size(deviceno_t dev, size_t block_size)
 {
+    std::lock_guard<std::mutex> guard(lock);
     device_block_sizes[dev] = block_size;
 }
 
 size_t block_cache_t::get_block_size(deviceno_t dev)
 {
+    std::lock_guard<std::mutex> guard(lock);
     return device_block_sizes[dev];
 }
 
+void block_cache_t::set_device_mapping(deviceno_t dev, mapped_block_device_t* mapping)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (mapping)
+        mapped_devices[dev] = mapping;
+    else
+        mapped_devices.erase(dev);
+    mapped_count = mapped_devices.size();
+}
+
+mapped_block_device_t* block_cache_t::get_mapping(deviceno_t dev)
+{
+    if (!mapped_count)
+        return nullptr;
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = mapped_devices.find(dev);
+    return it == mapped_devices.end() ? nullptr : it->second;
+}
+
 size_t block_cache_t::byte_read(deviceno_t device, off_t byte_offset, char* data, size_t nbytes)
 {
     return -1;
@@ -263,132 +602,574 @@ size_t block_cache_t::cached_read(deviceno_t device, block_device_t::blockno_t b
     char* buffer = static_cast<char*>(data);
     size_t actually_read;
 
+    // Mapped devices are read-only, the mapping is always up to date.
+    if (mapped_block_device_t* mapping = get_mapping(device))
+    {
+        size_t available = mapping->mapped_size() / block_size;
+        actually_read = block_n < available ? std::min<size_t>(nblocks, available - block_n) : 0;
+        if (actually_read)
+            memutils::copy_memory(buffer, mapping->data(block_n, actually_read * block_size), actually_read * block_size);
+        return actually_read;
+    }
+
+    size_t window = note_read(device, block_n, nblocks, block_size);
+
     if (nblocks * block_size > 64*1024)
     {
         // Large read: do directly!
-        actually_read = read_blocks(device, block_n, buffer, nblocks, block_size);
-        // Update read data with contents of dirty blocks in cache if necessary.
-        while (nblocks)
+        // Lock cached blocks first, so they cannot be modified or evicted before they are copied over the data read
+        // from the device. Cached blocks are never older than the device, even if they are clean by the time the
+        // device read finishes. Placeholders hold what is on the device already.
+        std::vector<cache_block_t*> locked(nblocks);
+        for (size_t i = 0; i < nblocks; ++i)
         {
-            entry = block_lookup(device, block_n);
-            if (entry)
+            shard_t& shard = shard_for(device, block_n + i);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            entry = shard.index.find(device, block_n + i);
+            if (entry && !entry->reading)
             {
                 assert(entry->block_size == block_size);
-                if (entry->dirty)
-                    memutils::copy_memory(entry->data, buffer, block_size); // Update read data with cache data (e.g. dirty blocks).
+                lock_block(shard, entry);
+                locked[i] = entry;
             }
-            block_n++;
-            nblocks--;
-            buffer += block_size;
         }
+
+        actually_read = read_blocks(device, block_n, buffer, nblocks, block_size);
+
+        // Update read data with contents of blocks in cache.
+        for (size_t i = 0; i < nblocks; ++i)
+        {
+            if (!locked[i])
+                continue;
+            shard_t& shard = shard_for(locked[i]);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            memutils::copy_memory(buffer + i * block_size, locked[i]->data, block_size);
+            unlock_block(shard, locked[i]);
+        }
+
+        // Blocks written but not yet flushed may lie past the end of the device.
+        while (actually_read < nblocks && locked[actually_read])
+            ++actually_read;
         return actually_read;
     }
 
     // Small reads, do slower block-by-block for now.
+    actually_read = 0;
+    block_device_t::blockno_t prefetched_until = 0;
     while (nblocks)
     {
-        entry = block_lookup(device, block_n);
+        shard_t& shard = shard_for(device, block_n);
+        std::unique_lock<std::mutex> guard(shard.lock);
+
+        entry = shard.index.find(device, block_n);
+        if (entry && entry->reading)
+        {
+            // Somebody is reading the block in already.
+            shard.io_done.wait(guard);
+            continue;
+        }
+
         if (entry)
         {
             assert(entry->block_size == block_size);
             // Block is found in cache.
-            entry->unlink_from(&blocks); // Remove it from the list it is in, because it's going to be modified.
             memutils::copy_memory(buffer, entry->data, block_size); // FIXME: replace this with a visitor pattern?
-            // Add block back at the start of the MRU list.
-            entry->link_at_mru(&blocks);
+            // Move block to the MRU end of its list.
+            cache_block_list_t* list = list_for(shard, entry);
+            entry->unlink_from(list);
+            entry->link_at_mru(list);
 
             block_n++;
             nblocks--;
             buffer += block_size;
+            actually_read++;
+            continue;
         }
-        else
-        {
-            // Block is not found in the cache, need to perform a read (preferably with a readahead, for at least number of blocks requested)
-            // Check if some blocks in that range are already in the cache anyway?
-            // FIXME: Would it be simpler to read entire stripes regardless and then just discard blocks already in the cache?
 
-            // find how many adjacent blocks from the request are not in the cache, to read them all at once
-            block_device_t::blockno_t block_stripe;
-            for (block_stripe = 1; block_stripe < nblocks; ++block_stripe) // start from 1, since block 0 definitely not found (above).
+        // Sequential stream outran the prefetches, read ahead synchronously.
+        if (window && block_n >= prefetched_until)
+        {
+            guard.unlock();
+            prefetch_t request{device, block_n, std::max(nblocks, window), block_size};
             {
-                if (block_lookup(device, block_n + block_stripe))
-                    break;
+                std::lock_guard<std::mutex> engine_guard(lock);
+                ++prefetches_in_flight[device];
             }
+            prefetch(request);
+            prefetched_until = block_n + request.nblocks;
+            continue;
+        }
 
-            actually_read = read_blocks(device, block_n, buffer, block_stripe, block_size);
+        // Block is not found in the cache, need to perform a read (preferably with a readahead, for at least number of blocks requested)
+        // Index placeholders for the blocks first, so other readers wait for this read instead of repeating it.
+        entry = get_block(shard, guard, block_size, true);
+        if (shard.index.find(device, block_n))
+        {
+            // Got in while get_block() waited.
+            unget_block(shard, entry);
+            continue;
+        }
+        start_reading(shard, entry, device, block_n);
+        guard.unlock();
 
-            if (actually_read < block_stripe)
-                throw std::runtime_error("Read blocks from physical media failed! [make it nonfatal]");
+        // find how many adjacent blocks from the request are not in the cache, to read them all at once
+        // Do not wait for blocks of other shards while holding a placeholder, stop the stripe instead.
+        std::vector<cache_block_t*> stripe(1, entry);
+        while (stripe.size() < nblocks)
+        {
+            shard_t& next_shard = shard_for(device, block_n + stripe.size());
+            std::unique_lock<std::mutex> next_guard(next_shard.lock);
+            if (next_shard.index.find(device, block_n + stripe.size()))
+                break;
+            cache_block_t* blk = get_block(next_shard, next_guard, block_size, false);
+            if (!blk)
+                break;
+            start_reading(next_shard, blk, device, block_n + stripe.size());
+            stripe.push_back(blk);
+        }
 
-            // create new blocks for just read data
-            // add new block to the cache, evicting LRU entries as needed
-            auto ents = get_blocks(block_stripe, block_size);
+        size_t got = read_blocks(device, block_n, buffer, stripe.size(), block_size);
 
-            if (ents.size() < block_stripe)
-                throw std::runtime_error("Couldn't get enough block cache entries.");
+        // Fill the placeholders with just read data, or drop those the device did not return.
+        for (size_t i = 0; i < stripe.size(); ++i)
+        {
+            if (i < got)
+                memutils::copy_memory(stripe[i]->data, buffer + i * block_size, block_size);
+            shard_t& blk_shard = shard_for(stripe[i]);
+            std::lock_guard<std::mutex> blk_guard(blk_shard.lock);
+            finish_reading(blk_shard, stripe[i], i < got);
+        }
 
-            // cache the blocks
-            // for (size_t b = 0; b < block_stripe; ++b)
+        if (got < stripe.size())
+            throw std::runtime_error("Read blocks from physical media failed! [make it nonfatal]");
 
-            // keep looping
-        }
+        block_n += got;
+        nblocks -= got;
+        buffer += got * block_size;
+        actually_read += got;
     }
-    return 0;
+    return actually_read;
 }
 
 size_t block_cache_t::cached_write(deviceno_t device, block_device_t::blockno_t block_n, const void* data, size_t nblocks, size_t block_size)
 {
     cache_block_t* entry(0);
-    char* buffer = static_cast<char*>(const_cast<void*>(data));
+    const char* buffer = static_cast<const char*>(data);
     size_t written = 0;
+    bool wake_flusher = false;
 
-    std::cerr << "cached_write(dev " << device << ", block " << block_n << ", nblocks " << nblocks << ", block_size " << block_size << ")" << std::endl;
+    if (get_mapping(device))
+        throw std::runtime_error("Writing to a read-only mapped device.");
 
     while (nblocks)
     {
-        entry = block_lookup(device, block_n);
+        shard_t& shard = shard_for(device, block_n);
+        std::unique_lock<std::mutex> guard(shard.lock);
+
+        entry = shard.index.find(device, block_n);
+        if (entry && entry->is_busy())
+        {
+            // Block is being read in, written out or read from, wait until it can be modified.
+            shard.io_done.wait(guard);
+            continue;
+        }
+
         if (entry)
         {
             assert(entry->block_size == block_size);
-            std::cerr << "Block is found in the cache." << std::endl;
-            entry->unlink_from(&blocks); // Remove it from the list it is in, because it's going to be modified.
-            memutils::copy_memory(entry->data, buffer, block_size); // FIXME: replace this with a visitor pattern?
-
-            entry->set_dirty();
-            entry->device = device;
-            entry->block_num = block_n;
-
-            // Add block back at the start of the MRU list.
-            entry->link_at_mru(&blocks);
-            cache[std::make_pair(device, block_n)] = entry;
+            entry->unlink_from(list_for(shard, entry)); // Remove it from the list it is in, because it's going to be modified.
         }
         else
         {
             // Block is not found in the cache, create a new one (potentially pushing older blocks out of cache).
-            auto ents = get_blocks(1, block_size);
-
-            if (ents.size() < 1)
-                throw std::runtime_error("get_blocks failed");
-
-            std::cerr << "New blocks allocated: " << ents.size() << std::endl;
-
-            entry = ents[0];
-            memutils::copy_memory(entry->data, buffer, block_size);
-
-            entry->set_dirty();
+            entry = get_block(shard, guard, block_size, true);
+            if (shard.index.find(device, block_n))
+            {
+                unget_block(shard, entry);
+                continue;
+            }
             entry->device = device;
             entry->block_num = block_n;
+            shard.index.insert(entry);
+        }
 
-            // Add block back at the start of the MRU list.
-            entry->link_at_mru(&blocks);
-            cache[std::make_pair(device, block_n)] = entry;
+        memutils::copy_memory(entry->data, buffer, block_size); // FIXME: replace this with a visitor pattern?
+        if (!entry->dirty)
+        {
+            entry->dirty = true;
+            entry->dirtied = cache_clock_t::now();
+            ++shard.dirty_blocks;
         }
 
+        // Add block back at the start of the MRU list.
+        entry->link_at_mru(list_for(shard, entry));
+
+        if (shard.dirty_blocks > shard.max_blocks * policy.dirty_ratio)
+            wake_flusher = true;
+
         block_n++;
         nblocks--;
         buffer += block_size;
         written += block_size;
     }
 
+    if (wake_flusher && write_back_running)
+        work.notify_one();
+
+    return written;
+}
+
+block_ref_t block_cache_t::cached_ref(deviceno_t device, block_device_t::blockno_t block_n, size_t block_size)
+{
+    if (mapped_block_device_t* mapping = get_mapping(device))
+    {
+        const char* data = mapping->data(block_n, block_size);
+        return data ? block_ref_t(mapping, data, block_size) : block_ref_t();
+    }
+
+    note_read(device, block_n, 1, block_size);
+
+    shard_t& shard = shard_for(device, block_n);
+    std::unique_lock<std::mutex> guard(shard.lock);
+    while (true)
+    {
+        cache_block_t* entry = shard.index.find(device, block_n);
+        if (entry && entry->reading)
+        {
+            shard.io_done.wait(guard);
+            continue;
+        }
+
+        if (entry)
+        {
+            assert(entry->block_size == block_size);
+            lock_block(shard, entry);
+            return block_ref_t(this, entry);
+        }
+
+        // Read the block in place and keep it locked from the start.
+        entry = get_block(shard, guard, block_size, true);
+        if (shard.index.find(device, block_n))
+        {
+            unget_block(shard, entry);
+            continue;
+        }
+        start_reading(shard, entry, device, block_n);
+        guard.unlock();
+        bool valid = read_blocks(device, block_n, entry->data, 1, block_size) == 1;
+        guard.lock();
+        finish_reading(shard, entry, valid);
+        if (!valid)
+            return block_ref_t();
+        lock_block(shard, entry);
+        return block_ref_t(this, entry);
+    }
+}
+
+void block_cache_t::release_ref(cache_block_t* blk)
+{
+    shard_t& shard = shard_for(blk);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    unlock_block(shard, blk);
+}
+
+size_t block_cache_t::unwritten_blocks() const
+{
+    size_t n = 0;
+    for (auto& shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        n += shard->dirty_blocks;
+    }
+    return n;
+}
+
+size_t block_cache_t::allocated_size() const
+{
+    size_t n = 0;
+    for (auto& shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        n += shard->allocated_blocks;
+    }
+    return n;
+}
+
+//=====================================================================================================================
+// Write-back engine.
+//=====================================================================================================================
+
+void block_cache_t::start_write_back(const write_back_policy_t& p)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (io_thread.joinable())
+        return;
+    policy = p;
+    io_thread_stop = false;
+    io_thread = std::thread(&block_cache_t::io_thread_main, this);
+    write_back_running = true;
+}
+
+void block_cache_t::stop_write_back()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!io_thread.joinable())
+            return;
+        io_thread_stop = true;
+        write_back_running = false;
+    }
+    work.notify_all();
+    io_thread.join();
+
+    std::lock_guard<std::mutex> guard(lock);
+    prefetches.clear();
+    readahead.clear();
+}
+
+void block_cache_t::mark_busy(shard_t& shard, const std::vector<cache_block_t*>& blks)
+{
+    for (auto blk : blks)
+    {
+        assert(blk->dirty && !blk->is_busy());
+        blk->unlink_from(&shard.dirty);
+        blk->busy = true;
+        blk->link_at_mru(&shard.busy);
+    }
+}
+
+void block_cache_t::unmark_busy(shard_t& shard, const std::vector<cache_block_t*>& blks, bool written)
+{
+    for (auto blk : blks)
+    {
+        blk->unlink_from(&shard.busy);
+        blk->busy = false;
+        if (written)
+        {
+            blk->dirty = false;
+            --shard.dirty_blocks;
+        }
+        blk->link_at_mru(list_for(shard, blk));
+    }
+    shard.io_done.notify_all();
+}
+
+bool block_cache_t::write_sorted(std::vector<cache_block_t*>& blks)
+{
+    std::sort(blks.begin(), blks.end(), [](const cache_block_t* a, const cache_block_t* b) {
+        return a->device < b->device || (a->device == b->device && a->block_num < b->block_num);
+    });
+
+    std::vector<struct iovec> iov;
+    bool written = true;
+
+    for (size_t i = 0; i < blks.size(); )
+    {
+        cache_block_t* first = blks[i];
+        size_t block_size = first->block_size;
+        size_t n = 1;
+
+        while (i + n < blks.size() && n < policy.max_write_blocks
+            && blks[i + n]->device == first->device
+            && blks[i + n]->block_size == block_size
+            && blks[i + n]->block_num == first->block_num + n)
+        {
+            ++n;
+        }
+
+        iov.resize(n);
+        for (size_t k = 0; k < n; ++k)
+            iov[k] = { blks[i + k]->data, block_size };
+        written &= write_blocks(first->device, first->block_num, iov, block_size) == n;
+
+        i += n;
+    }
+
+    return written;
+}
+
+bool block_cache_t::write_marked(std::vector<std::vector<cache_block_t*>>& marked)
+{
+    std::vector<cache_block_t*> blks;
+    for (auto& shard_blks : marked)
+        blks.insert(blks.end(), shard_blks.begin(), shard_blks.end());
+    if (blks.empty())
+        return true;
+
+    bool written = write_sorted(blks);
+
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        if (marked[i].empty())
+            continue;
+        std::lock_guard<std::mutex> guard(shards[i]->lock);
+        unmark_busy(*shards[i], marked[i], written);
+    }
     return written;
 }
+
+std::vector<cache_block_t*> block_cache_t::select_write_back(shard_t& shard, cache_clock_t::time_point now)
+{
+    std::vector<cache_block_t*> blks;
+    size_t high = shard.max_blocks * policy.dirty_ratio;
+    size_t low = shard.max_blocks * policy.dirty_background_ratio;
+    size_t excess = shard.dirty_blocks > high ? shard.dirty_blocks - low : 0;
+
+    for (cache_block_t* blk = shard.dirty.lru; blk; blk = blk->next_mru)
+    {
+        if (excess)
+        {
+            blks.push_back(blk);
+            --excess;
+        }
+        else if (now - blk->dirtied >= policy.max_age)
+            blks.push_back(blk);
+    }
+
+    return blks;
+}
+
+/**
+ * A read continuing where the previous read of the device ended doubles the read-ahead window, any other read
+ * resets it. Prefetches are issued in batches of at least half a window.
+ */
+size_t block_cache_t::note_read(deviceno_t device, block_device_t::blockno_t block_n, size_t nblocks, size_t block_size)
+{
+    if (!write_back_running)
+        return 0;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (!policy.readahead_max)
+        return 0;
+
+    readahead_t& ra = readahead[device];
+
+    if (block_n == ra.next_block)
+        ra.window = ra.window ? std::min(ra.window * 2, policy.readahead_max) : policy.readahead_min;
+    else
+    {
+        ra.window = 0;
+        ra.prefetched_until = 0;
+    }
+    ra.next_block = block_n + nblocks;
+
+    if (!ra.window)
+        return 0;
+
+    block_device_t::blockno_t start = std::max(ra.prefetched_until, ra.next_block);
+    block_device_t::blockno_t end = ra.next_block + ra.window;
+    if (start >= end || end - start < ra.window / 2)
+        return ra.window;
+
+    prefetches.push_back(prefetch_t{device, start, size_t(end - start), block_size});
+    ra.prefetched_until = end;
+    work.notify_one();
+    return ra.window;
+}
+
+/**
+ * Missing blocks are indexed as placeholders before the device is read, blocks cached at that point may be dirty and
+ * are left alone. Blocks for which the shard has no room right away are skipped.
+ */
+void block_cache_t::prefetch(const prefetch_t& request)
+{
+    block_device_t::blockno_t block_n = request.block_n;
+    size_t nblocks = std::min(request.nblocks, max_blocks / 2);
+    size_t block_size = request.block_size;
+
+    std::vector<cache_block_t*> placeholders(nblocks);
+    size_t first = nblocks, last = 0;
+    for (size_t i = 0; i < nblocks; ++i)
+    {
+        shard_t& shard = shard_for(request.device, block_n + i);
+        std::unique_lock<std::mutex> guard(shard.lock);
+        if (shard.index.find(request.device, block_n + i))
+            continue;
+        cache_block_t* blk = get_block(shard, guard, block_size, false);
+        if (!blk)
+            continue;
+        start_reading(shard, blk, request.device, block_n + i);
+        placeholders[i] = blk;
+        first = std::min(first, i);
+        last = i + 1;
+    }
+
+    if (first < last)
+    {
+        // Read straight into the placeholders, device data for blocks in between goes to a scratch block.
+        std::vector<char> scratch;
+        std::vector<struct iovec> iov(last - first);
+        for (size_t i = first; i < last; ++i)
+        {
+            if (placeholders[i])
+                iov[i - first] = { placeholders[i]->data, block_size };
+            else
+            {
+                scratch.resize(block_size);
+                iov[i - first] = { scratch.data(), block_size };
+            }
+        }
+
+        size_t got = read_blocks(request.device, block_n + first, iov, block_size);
+
+        for (size_t i = first; i < last; ++i)
+        {
+            if (!placeholders[i])
+                continue;
+            shard_t& shard = shard_for(placeholders[i]);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            finish_reading(shard, placeholders[i], i - first < got);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    --prefetches_in_flight[request.device];
+    prefetch_done.notify_all();
+}
+
+/**
+ * Background thread: serves prefetch requests and writes back dirty blocks when there are too many or they get too old.
+ * Blocks being written are kept on the busy lists, so no locks are held during writes.
+ */
+void block_cache_t::io_thread_main()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (!io_thread_stop)
+    {
+        bool idle = true;
+
+        if (!prefetches.empty())
+        {
+            prefetch_t request = prefetches.front();
+            prefetches.pop_front();
+            ++prefetches_in_flight[request.device];
+            guard.unlock();
+            prefetch(request);
+            guard.lock();
+            idle = false;
+        }
+        guard.unlock();
+
+        std::vector<std::vector<cache_block_t*>> marked(shards.size());
+        cache_clock_t::time_point now = cache_clock_t::now();
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            std::lock_guard<std::mutex> shard_guard(shards[i]->lock);
+            marked[i] = select_write_back(*shards[i], now);
+            mark_busy(*shards[i], marked[i]);
+            if (!marked[i].empty())
+                idle = false;
+        }
+
+        if (!write_marked(marked))
+        {
+            std::cerr << "Block cache write-back failed, will retry." << std::endl;
+            idle = true;
+        }
+
+        guard.lock();
+        if (idle && !io_thread_stop && prefetches.empty())
+            work.wait_for(guard, policy.interval);
+    }
+}
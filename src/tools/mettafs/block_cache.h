@@ -10,113 +10,406 @@
  * Filesystem block cache.
  *
  * Block cache handles device reads and writes and adds faster access for reading and delayed buffer management for writing.
- * It is very simple - blocks are entered into a map based on block number and origin device, blocks are also entered into a LRU/MRU list,
- * for easy eviction if memory pressure increases.
+ * Blocks are found through an open addressing hash index on origin device and block number. Every block is also on
+ * exactly one of three LRU/MRU lists - clean, dirty or busy - so eviction takes the LRU end of the clean list without
+ * skipping over blocks that cannot be dropped. Block records and buffers come from a slab per block size.
+ *
+ * The cache is safe to use from many threads. Blocks are spread over shards by device and block number, each shard has
+ * its own lock, index, lists and slabs, so threads working on different blocks rarely meet. A block being read in is
+ * indexed as a placeholder, and threads that want it wait for the read to finish instead of reading it again.
+ *
+ * Once the write-back engine is started, a background thread writes dirty blocks out in device and block order,
+ * merging adjacent blocks into single multi-block writes, and prefetches the next extent of sequentially read streams.
  */
 #pragma once
 
 #include "block_device.h"
 #include <map>
 #include <vector>
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <condition_variable>
 
 class cache_block_t;
 
 typedef uint32_t deviceno_t;
+typedef std::chrono::steady_clock cache_clock_t;
 
 struct cache_block_list_t
 {
-	cache_block_t* mru;
-	cache_block_t* lru;
+    cache_block_t* mru;
+    cache_block_t* lru;
 };
 
 class cache_block_t
 {
-	deviceno_t device;
-	block_device_t::blockno_t block_num;
+    deviceno_t device;
+    block_device_t::blockno_t block_num;
+
+    size_t block_size;
+    char* data;
+
+    bool dirty; //!< Block is dirty (written to but not flushed yet).
+    bool busy; //!< Block is busy (I/O operation in progress).
+    bool reading; //!< Placeholder for a block being read in, contents not valid yet.
+    unsigned locks; //!< Number of readers holding the block in the cache, it cannot be modified or evicted meanwhile.
+    cache_clock_t::time_point dirtied; //!< When the block last went from clean to dirty.
+
+    cache_block_t* next_mru; //!< Points towards MRU end of the list, or next free block in the slab.
+    cache_block_t* prev_lru; //!< Points towards LRU end of the list.
+
+    friend class block_cache_t;
+    friend class block_slab_t;
+    friend class block_index_t;
+    friend class block_ref_t;
+
+public:
+    cache_block_t(size_t size, char* buffer);
+
+    bool is_usable() { return !dirty && !busy && !reading && !locks; }
+    bool is_busy() const { return busy || reading || locks; }
+    size_t size() { return block_size; }
 
-	size_t block_size;
-	char* data;
+    void link_at_mru(cache_block_list_t* parent);
+    void link_at_lru(cache_block_list_t* parent);
+    void unlink_from(cache_block_list_t* parent);
+};
+
+/**
+ * Slab of cache blocks of one size. Block records and their buffers are carved out of large chunks and recycled
+ * through a free list; chunks are returned to the system only when the slab is destroyed. Buffers are aligned for
+ * direct device I/O.
+ */
+class block_slab_t
+{
+    static const size_t CHUNK_BYTES = 256*1024;
+
+    size_t block_size;
+    size_t blocks_per_chunk;
+    std::vector<char*> chunks;
+    cache_block_t* free_blocks;
+
+public:
+    block_slab_t(size_t size);
+    ~block_slab_t();
 
-	bool dirty; //!< Block is dirty (written to but not flushed yet).
-	bool busy; //!< Block is busy (I/O operation in progress).
+    cache_block_t* allocate();
+    void free(cache_block_t* blk);
+};
 
-	cache_block_t* next_mru; //!< Points towards MRU end of the list.
-	cache_block_t* prev_lru; //!< Points towards LRU end of the list.
+/**
+ * Open addressing hash index of cached blocks, keyed by device and block number.
+ * Linear probing with backward shift deletion, so there are no tombstones and probe sequences stay short
+ * however many blocks pass through the cache. The table is sized for the cache capacity and never grows.
+ */
+class block_index_t
+{
+    std::vector<cache_block_t*> slots;
+    size_t mask;
+    unsigned shift;
 
-	friend class block_cache_t;
+    size_t home_slot(deviceno_t device, block_device_t::blockno_t block_n) const;
 
 public:
-	cache_block_t(deviceno_t device, block_device_t::blockno_t block_n, size_t size);
-	~cache_block_t();
+    block_index_t(size_t max_entries);
 
-	void set_dirty() { dirty = true; }
-	bool is_usable() { return !dirty && !busy/* && !locked*/; }
-        bool is_busy() const { return busy; }
-	size_t size() { return block_size; }
+    cache_block_t* find(deviceno_t device, block_device_t::blockno_t block_n) const;
+    void insert(cache_block_t* blk);
+    void erase(cache_block_t* blk);
+};
+
+/**
+ * Write-back engine tuning.
+ */
+struct write_back_policy_t
+{
+    double dirty_ratio; //!< Start writing back when this fraction of the cache is dirty...
+    double dirty_background_ratio; //!< ...and continue until dirty blocks drop to this fraction.
+    std::chrono::milliseconds max_age; //!< Blocks dirty for longer than this are written back regardless.
+    std::chrono::milliseconds interval; //!< How often the flusher looks for old blocks.
+    size_t max_write_blocks; //!< Longest merged write.
+    size_t readahead_min; //!< Initial read-ahead window in blocks, doubled on every sequential read up to...
+    size_t readahead_max; //!< ...this many blocks. 0 disables read-ahead.
 
-	void link_at_mru(cache_block_list_t* parent);
-	void link_at_lru(cache_block_list_t* parent);
-	void unlink_from(cache_block_list_t* parent);
+    write_back_policy_t()
+        : dirty_ratio(0.5), dirty_background_ratio(0.25)
+        , max_age(std::chrono::milliseconds(3000)), interval(std::chrono::milliseconds(500))
+        , max_write_blocks(256), readahead_min(8), readahead_max(128)
+    {}
 };
 
 class block_device_mapper_t;
+class block_cache_t;
+
+/**
+ * Reference to block data used in place, without copying it out of the cache or device mapping.
+ * While the reference is held the block stays put: a cache block is locked, so it is neither modified nor evicted,
+ * and a device mapping is pinned. References are movable, not copyable, and release the block when destroyed.
+ */
+class block_ref_t
+{
+    block_cache_t* cache;
+    cache_block_t* blk; //!< Locked cache block, or null if data points into a device mapping.
+    mapped_block_device_t* mapping; //!< Pinned device mapping, or null.
+    const char* ptr;
+    size_t bytes;
+
+    friend class block_cache_t;
+
+    block_ref_t(block_cache_t* c, cache_block_t* b);
+    block_ref_t(mapped_block_device_t* m, const char* data, size_t size);
+
+public:
+    block_ref_t() : cache(nullptr), blk(nullptr), mapping(nullptr), ptr(nullptr), bytes(0) {}
+    block_ref_t(block_ref_t&& other);
+    block_ref_t& operator =(block_ref_t&& other);
+    block_ref_t(const block_ref_t&) = delete;
+    block_ref_t& operator =(const block_ref_t&) = delete;
+    ~block_ref_t() { release(); }
+
+    void release();
+
+    const char* data() const { return ptr; }
+    size_t size() const { return bytes; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    /**
+     * View the block as an on-disk structure, e.g. a tree node.
+     */
+    template <typename T>
+    const T* as() const { return reinterpret_cast<const T*>(ptr); }
+};
 
 class block_cache_t
 {
-	typedef std::pair<deviceno_t, block_device_t::blockno_t> block_id_t; //!< Pairs device number with block number.
-	typedef std::map<block_id_t, cache_block_t*> cache_map_t;
-	cache_map_t cache; //!< Map for quickly finding blocks given device and block number pair.
-	std::map<deviceno_t, size_t> max_device_blocks; //!< Maximum number of blocks in each opened device (for error checking).
-	std::map<deviceno_t, size_t> device_block_sizes; //!< Block sizes for registered devices.
-	size_t max_blocks; //!< Maximum number of blocks stored in this cache.
-	cache_block_list_t blocks; //!< LRU list of blocks.
-	block_device_mapper_t* device_mapper;
-
-	/**
-	 * Perform actual read on physical blocks.
-	 * @return number of blocks successfully read or 0 on failure.
-	 */
-	size_t read_blocks(deviceno_t device, block_device_t::blockno_t block_n, char* data, size_t nblocks, size_t block_size);
-	/**
-	 * Perform actual write on physical blocks.
-	 * @return number of blocks successfully written or 0 on failure.
-	 */
-	size_t write_blocks(deviceno_t device, block_device_t::blockno_t block_n, const char* data, size_t nblocks, size_t block_size);
-
-	cache_block_t* block_lookup(deviceno_t device, block_device_t::blockno_t block_n);
-
-	/**
-	 * Obtain a number of blocks by evicting oldest blocks from the cache.
-	 */
-	std::vector<cache_block_t*> get_blocks(size_t nblocks, size_t block_size);
-
-	/**
-	 * Get block size for a given device.
-	 */
-	size_t get_block_size(deviceno_t device);
+    static const size_t MAX_SHARDS = 16;
+    static const size_t MIN_SHARD_BLOCKS = 256; //!< Smaller caches use fewer shards.
+
+    /**
+     * Part of the cache holding the blocks that hash to it. Blocks are only examined or modified with the shard lock
+     * held, apart from the data of busy and locked blocks, which does not change while they are in that state.
+     */
+    struct shard_t
+    {
+        std::mutex lock;
+        std::condition_variable io_done; //!< Signalled when blocks stop being busy, locked or read in.
+        block_index_t index; //!< Hash index for quickly finding blocks given device and block number pair.
+        std::map<size_t, block_slab_t*> slabs; //!< Block allocators, one per block size.
+        size_t max_blocks; //!< Maximum number of blocks stored in this shard.
+        size_t allocated_blocks; //!< Number of blocks taken from the slabs.
+        size_t dirty_blocks; //!< Number of dirty blocks, including those being written back.
+        cache_block_list_t clean; //!< LRU list of blocks that can be evicted right away.
+        cache_block_list_t dirty; //!< LRU list of blocks waiting to be written back.
+        cache_block_list_t busy; //!< Blocks with I/O in progress, locked blocks and placeholders.
+
+        shard_t(size_t n_blocks);
+        ~shard_t();
+    };
+
+    std::vector<std::unique_ptr<shard_t>> shards;
+    std::map<deviceno_t, size_t> max_device_blocks; //!< Maximum number of blocks in each opened device (for error checking).
+    std::map<deviceno_t, size_t> device_block_sizes; //!< Block sizes for registered devices.
+    std::map<deviceno_t, mapped_block_device_t*> mapped_devices; //!< Read-only devices served from their mapping.
+    std::atomic<size_t> mapped_count; //!< Size of mapped_devices, to skip the lookup when nothing is mapped.
+    size_t max_blocks; //!< Maximum number of blocks stored in this cache.
+    block_device_mapper_t* device_mapper;
+
+    /**
+     * Sequential access detection state, per device.
+     */
+    struct readahead_t
+    {
+        block_device_t::blockno_t next_block; //!< Where the next read continues a sequential stream.
+        block_device_t::blockno_t prefetched_until; //!< End of the last prefetch issued for the stream.
+        size_t window; //!< Current read-ahead size, 0 when the stream is not sequential.
+    };
+
+    struct prefetch_t
+    {
+        deviceno_t device;
+        block_device_t::blockno_t block_n;
+        size_t nblocks;
+        size_t block_size;
+    };
+
+    // Write-back engine.
+    mutable std::mutex lock; //!< Protects device maps and engine state, never held together with a shard lock.
+    std::condition_variable work; //!< Wakes up the background thread.
+    std::condition_variable prefetch_done; //!< Signalled when a prefetch finishes.
+    std::thread io_thread;
+    bool io_thread_stop;
+    std::atomic<bool> write_back_running;
+    write_back_policy_t policy;
+    std::map<deviceno_t, readahead_t> readahead;
+    std::deque<prefetch_t> prefetches;
+    std::map<deviceno_t, size_t> prefetches_in_flight;
+
+    /**
+     * Perform actual read on physical blocks.
+     * @return number of blocks successfully read or 0 on failure.
+     */
+    size_t read_blocks(deviceno_t device, block_device_t::blockno_t block_n, char* data, size_t nblocks, size_t block_size);
+    /**
+     * Perform actual write on physical blocks.
+     * @return number of blocks successfully written or 0 on failure.
+     */
+    size_t write_blocks(deviceno_t device, block_device_t::blockno_t block_n, const char* data, size_t nblocks, size_t block_size);
+    /**
+     * Perform actual scatter/gather read or write of consecutive physical blocks, one buffer per block, as one request.
+     * @return number of blocks successfully transferred or 0 on failure.
+     */
+    size_t read_blocks(deviceno_t device, block_device_t::blockno_t block_n, const std::vector<struct iovec>& iov, size_t block_size);
+    size_t write_blocks(deviceno_t device, block_device_t::blockno_t block_n, const std::vector<struct iovec>& iov, size_t block_size);
+
+    /**
+     * Shard a block belongs to. Consecutive blocks go to different shards, so sequential streams spread over all of them.
+     */
+    shard_t& shard_for(deviceno_t device, block_device_t::blockno_t block_n);
+    shard_t& shard_for(cache_block_t* blk) { return shard_for(blk->device, blk->block_num); }
+
+    /**
+     * List a block belongs on according to its state.
+     */
+    static cache_block_list_t* list_for(shard_t& shard, cache_block_t* blk);
+
+    /**
+     * Lock a block in the cache: it stays indexed and unmodified until unlocked.
+     */
+    void lock_block(shard_t& shard, cache_block_t* blk);
+    void unlock_block(shard_t& shard, cache_block_t* blk);
+
+    /**
+     * Index a new block as a placeholder for data being read in.
+     */
+    void start_reading(shard_t& shard, cache_block_t* blk, deviceno_t device, block_device_t::blockno_t block_n);
+
+    /**
+     * Make a placeholder, whose data has been read in by now, a clean block. Drop it if reading failed.
+     */
+    void finish_reading(shard_t& shard, cache_block_t* blk, bool valid);
+
+    /**
+     * Write out busy blocks, sorting them and merging adjacent blocks of a device into single writes.
+     * Does not touch cache lists or the index, so it can run without shard locks.
+     * @return false if any write failed.
+     */
+    bool write_sorted(std::vector<cache_block_t*>& blks);
+
+    /**
+     * Move dirty blocks to the busy list for write_sorted().
+     */
+    void mark_busy(shard_t& shard, const std::vector<cache_block_t*>& blks);
+
+    /**
+     * Finish write_sorted() of busy blocks: move them to the clean list, or back to the dirty list if writing failed.
+     */
+    void unmark_busy(shard_t& shard, const std::vector<cache_block_t*>& blks, bool written);
+
+    /**
+     * Write out blocks marked busy in each shard as one sorted batch, so adjacent blocks merge across shards,
+     * then unmark them.
+     */
+    bool write_marked(std::vector<std::vector<cache_block_t*>>& marked);
+
+    /**
+     * Pick dirty blocks of a shard that are too old, or the oldest ones if too much of the shard is dirty.
+     */
+    std::vector<cache_block_t*> select_write_back(shard_t& shard, cache_clock_t::time_point now);
+
+    /**
+     * Update sequential access state after a read and queue a prefetch when a stream runs ahead of read-ahead.
+     * @return current read-ahead window of the stream, 0 if it is not sequential.
+     */
+    size_t note_read(deviceno_t device, block_device_t::blockno_t block_n, size_t nblocks, size_t block_size);
+
+    /**
+     * Read blocks that are not cached yet into the cache. The request must be counted in prefetches_in_flight,
+     * it is uncounted when done. Called without locks.
+     */
+    void prefetch(const prefetch_t& request);
+
+    void io_thread_main();
+
+    /**
+     * Drop a block that is not on any list from the index and give it back to its slab.
+     */
+    void release_block(shard_t& shard, cache_block_t* blk);
+
+    /**
+     * Give a block obtained from get_block() back to its slab.
+     */
+    void unget_block(shard_t& shard, cache_block_t* blk);
+
+    block_slab_t& slab_for(shard_t& shard, size_t block_size);
+
+    /**
+     * Obtain a block for the shard, evicting the oldest clean block if the shard is full.
+     * The returned block is neither indexed nor on any list. Called with the shard lock held. Unless "wait" is false,
+     * may drop the lock to write back a dirty block or wait for I/O; without it returns nullptr instead.
+     */
+    cache_block_t* get_block(shard_t& shard, std::unique_lock<std::mutex>& guard, size_t block_size, bool wait);
+
+    /**
+     * Get block size for a given device.
+     */
+    size_t get_block_size(deviceno_t device);
+
+    /**
+     * Mapping serving reads of a device, if any.
+     */
+    mapped_block_device_t* get_mapping(deviceno_t device);
+
+    friend class block_ref_t;
+    void release_ref(cache_block_t* blk);
 
 public:
-	/**
-	 * Create a cache that can store maximum of n_blocks data blocks.
-	 */
-	block_cache_t(size_t n_blocks) : max_blocks(n_blocks), device_mapper(NULL) { blocks.lru = blocks.mru = NULL; }
-	~block_cache_t();
+    /**
+     * Create a cache that can store maximum of n_blocks data blocks.
+     */
+    block_cache_t(size_t n_blocks);
+    ~block_cache_t();
+
+    /**
+     * Start the background write-back and read-ahead thread. Without it writes stay in the cache until they are
+     * evicted or flushed.
+     */
+    void start_write_back(const write_back_policy_t& p = write_back_policy_t());
+    void stop_write_back();
+
+    void set_device_block_size(deviceno_t dev, size_t block_size);
+    void set_device_mapper(block_device_mapper_t& mapper);
+
+    /**
+     * Serve reads of a read-only device straight from its memory mapping, bypassing cache blocks. Null stops that.
+     */
+    void set_device_mapping(deviceno_t dev, mapped_block_device_t* mapping);
 
-	void set_device_block_size(deviceno_t dev, size_t block_size);
-	void set_device_mapper(block_device_mapper_t& mapper);
+    /**
+     * Finish all remaining operations on cache for device dev.
+     * Waits for block references to the device's blocks to be released.
+     */
+    bool flush(deviceno_t dev);
 
-	/**
-	 * Finish all remaining operations on cache for device dev.
-	 */
-	bool flush(deviceno_t dev);
+    size_t cached_read(deviceno_t device, block_device_t::blockno_t block_n, void* data, size_t nblocks, size_t block_size);
+    size_t cached_write(deviceno_t device, block_device_t::blockno_t block_n, const void* data, size_t nblocks, size_t block_size);
 
-	size_t cached_read(deviceno_t device, block_device_t::blockno_t block_n, void* data, size_t nblocks, size_t block_size);
-	size_t cached_write(deviceno_t device, block_device_t::blockno_t block_n, const void* data, size_t nblocks, size_t block_size);
+    /**
+     * Get a block for use in place. Mapped devices return a pointer into the mapping, other devices a locked cache block,
+     * reading it in first if necessary. Writers of the block wait until the reference is released.
+     * @return empty reference if the block could not be read.
+     */
+    block_ref_t cached_ref(deviceno_t device, block_device_t::blockno_t block_n, size_t block_size);
 
-	// helper functions for the vfs layer, they will figure out the block size themselves
-	size_t byte_read(deviceno_t device, off_t byte_offset, char* data, size_t nbytes);
-	size_t byte_write(deviceno_t device, off_t byte_offset, const char* data, size_t nbytes);
+    // helper functions for the vfs layer, they will figure out the block size themselves
+    size_t byte_read(deviceno_t device, off_t byte_offset, char* data, size_t nbytes);
+    size_t byte_write(deviceno_t device, off_t byte_offset, const char* data, size_t nbytes);
 
-        // debug stuff
-        size_t unwritten_blocks();
+    // debug stuff
+    size_t unwritten_blocks() const;
+    size_t allocated_size() const;
+    size_t shard_count() const { return shards.size(); }
 };
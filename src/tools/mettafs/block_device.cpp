@@ -7,55 +7,113 @@
 // (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 #include "block_device.h"
-#include "macros.h"
-#include <fstream>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
 #include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 using namespace std;
 
-block_device_t::block_device_t(const std::string& name, bool create, blocksize_t bs, blockno_t numBlocks)
-    : storageFileName(name)
+block_device_t::block_device_t(const std::string& name, bool create, blocksize_t bs, blockno_t numBlocks, unsigned options)
+    : fd(-1)
+    , storageFileName(name)
+    , direct(false)
     , blockSize(bs)
     , numBlocks(numBlocks)
+    , reads(0)
+    , writes(0)
+    , seeking(false)
+    , head(0)
 {
-    storageFile = new fstream(storageFileName.c_str(), create ? ios::out|ios::trunc|ios::binary : ios::out|/*ios::nocreate|*/ios::binary);
+    int flags = (options & READ_ONLY) ? O_RDONLY : O_RDWR | (create ? O_CREAT|O_TRUNC : 0);
+
+#ifdef O_DIRECT
+    if (options & DIRECT_IO)
+    {
+        fd = ::open(storageFileName.c_str(), flags | O_DIRECT, 0644);
+        direct = fd >= 0;
+    }
+#endif
+    if (fd < 0)
+        fd = ::open(storageFileName.c_str(), flags, 0644);
+    if (fd < 0)
+    {
+        cerr << "Cannot open " << storageFileName << ": " << strerror(errno) << endl;
+        return;
+    }
+#ifdef F_NOCACHE
+    if ((options & DIRECT_IO) && !direct)
+        direct = fcntl(fd, F_NOCACHE, 1) == 0;
+#endif
 }
 
 block_device_t::~block_device_t()
 {
-    if (storageFile)
+    if (fd >= 0)
         close();
 }
 
 void block_device_t::close()
 {
-    assert(storageFile);
-    assert(storageFile->good());
-    storageFile->close();
-    delete storageFile; // TODO: no matching open()
-    storageFile = 0;
+    assert(fd >= 0);
+    ::close(fd);
+    fd = -1;
+}
+
+void block_device_t::simulate_seeks(const seek_model_t& model)
+{
+    std::lock_guard<std::mutex> guard(ioLock);
+    seekModel = model;
+    seeking = true;
+
+    // Size the model after the backing file if the device size was not given.
+    struct stat st;
+    if (!numBlocks && blockSize && fstat(fd, &st) == 0)
+        numBlocks = st.st_size / blockSize;
 }
 
 /**
  * Return time in nanoseconds it would take to seek from current block position to seekTo.
+ * Seek time grows with the square root of the distance, as the arm accelerates over the first half of the way.
  */
 int block_device_t::seek_time(blockno_t seekTo)
 {
-    UNUSED(seekTo);
-    return 0;
+    if (!seeking || seekTo == head)
+        return 0;
+
+    blockno_t distance = seekTo > head ? seekTo - head : head - seekTo;
+    double span = numBlocks ? std::min(1.0, double(distance) / numBlocks) : 1.0;
+    return seekModel.track_to_track_ns + (seekModel.full_stroke_ns - seekModel.track_to_track_ns) * std::sqrt(span)
+        + seekModel.rotation_ns;
 }
 
 // hey, seek doesn't really seek, it just emulates the delay it would take the device to seek from current position to block
-// with presence of seek_time it's probably not needed.
 void block_device_t::seek(blockno_t block)
 {
-    UNUSED(block);
+    int ns = seek_time(block);
+    if (ns)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+    head = block;
 }
 
 block_device_t::blockno_t block_device_t::pos()
 {
-    return 0;
+    return head;
 }
 
 /**
@@ -63,23 +121,181 @@ block_device_t::blockno_t block_device_t::pos()
  */
 block_device_t::blocksize_t block_device_t::read_block(block_device_t::blockno_t block, char* buffer, block_device_t::blocksize_t bytes)
 {
-    if (bytes % blockSize)
+    struct iovec iov = { buffer, bytes };
+    return transfer(false, block, &iov, 1);
+}
+
+block_device_t::blocksize_t block_device_t::write_block(block_device_t::blockno_t block, const char* buffer, block_device_t::blocksize_t bytes)
+{
+    struct iovec iov = { const_cast<char*>(buffer), bytes };
+    return transfer(true, block, &iov, 1);
+}
+
+block_device_t::blocksize_t block_device_t::read_blocks(blockno_t block, const struct iovec* iov, int iovcnt)
+{
+    return transfer(false, block, iov, iovcnt);
+}
+
+block_device_t::blocksize_t block_device_t::write_blocks(blockno_t block, const struct iovec* iov, int iovcnt)
+{
+    return transfer(true, block, iov, iovcnt);
+}
+
+/**
+ * Issue positional vectored calls until everything is transferred, the device ends or an error occurs.
+ * Reading past the end of the device is a short read, not an error.
+ */
+block_device_t::blocksize_t block_device_t::transfer(bool write, blockno_t block, const struct iovec* iov, int iovcnt)
+{
+    size_t bytes = 0;
+    bool aligned = true;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (iov[i].iov_len % blockSize)
+        {
+            cerr << "block " << (write ? "write" : "read") << " of non-block size buffer" << endl;
+            return 0;
+        }
+        bytes += iov[i].iov_len;
+        aligned &= uintptr_t(iov[i].iov_base) % DIRECT_IO_ALIGN == 0;
+    }
+
+    if (direct && !aligned)
+        return transfer_aligned(write, block, iov, iovcnt, bytes);
+
+    std::unique_lock<std::mutex> guard(ioLock, std::defer_lock);
+    if (seeking)
+    {
+        guard.lock();
+        seek(block);
+    }
+
+    std::vector<struct iovec> rest(iov, iov + iovcnt);
+    struct iovec* v = rest.data();
+    off_t offset = block * blockSize;
+    size_t done = 0;
+
+    while (iovcnt > 0)
     {
-        std::cerr << "block read of non-block size buffer" << std::endl;
+        int n = std::min(iovcnt, IOV_MAX);
+        ssize_t r = write ? pwritev(fd, v, n, offset) : preadv(fd, v, n, offset);
+        ++(write ? writes : reads);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            cerr << "block " << (write ? "write" : "read") << " failed: " << strerror(errno) << endl;
+            break;
+        }
+        if (r == 0)
+            break;
+
+        done += r;
+        offset += r;
+        while (r > 0)
+        {
+            if (size_t(r) >= v->iov_len)
+            {
+                r -= v->iov_len;
+                ++v;
+                --iovcnt;
+            }
+            else
+            {
+                v->iov_base = static_cast<char*>(v->iov_base) + r;
+                v->iov_len -= r;
+                r = 0;
+            }
+        }
+    }
+
+    if (seeking)
+        head = block + done / blockSize;
+
+    return done - done % blockSize;
+}
+
+/**
+ * Direct I/O needs aligned buffers, go through an aligned bounce buffer.
+ */
+block_device_t::blocksize_t block_device_t::transfer_aligned(bool write, blockno_t block, const struct iovec* iov, int iovcnt, size_t bytes)
+{
+    void* bounce;
+    if (posix_memalign(&bounce, DIRECT_IO_ALIGN, bytes) != 0)
         return 0;
+
+    char* p = static_cast<char*>(bounce);
+    if (write)
+    {
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+    }
+
+    struct iovec whole = { bounce, bytes };
+    size_t done = transfer(write, block, &whole, 1);
+
+    if (!write)
+    {
+        size_t left = done;
+        for (int i = 0; i < iovcnt && left; ++i)
+        {
+            size_t n = std::min(left, iov[i].iov_len);
+            memcpy(iov[i].iov_base, p, n);
+            p += n;
+            left -= n;
+        }
     }
-    storageFile->seekg(block * blockSize);
-    storageFile->read(buffer, bytes);
-    return bytes;
+
+    free(bounce);
+    return done;
 }
 
-void block_device_t::write_block(block_device_t::blockno_t block, const char* buffer, block_device_t::blocksize_t bytes)
+//=====================================================================================================================
+// mapped_block_device_t
+//=====================================================================================================================
+
+mapped_block_device_t::mapped_block_device_t(const std::string& name, blocksize_t bs)
+    : block_device_t(name, false, bs, 0, READ_ONLY)
+    , mapping(nullptr)
+    , mappingSize(0)
+    , pins(0)
 {
-    if (bytes % blockSize)
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+        return;
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
     {
-        std::cerr << "block write of non-block size buffer" << std::endl;
+        cerr << "Cannot map " << name << ": " << strerror(errno) << endl;
         return;
     }
-    storageFile->seekp(block * blockSize);
-    storageFile->write(buffer, bytes);
+    mapping = static_cast<const char*>(addr);
+    mappingSize = st.st_size;
+}
+
+mapped_block_device_t::~mapped_block_device_t()
+{
+    if (mapping)
+        close();
+}
+
+void mapped_block_device_t::close()
+{
+    assert(pins == 0);
+    if (mapping)
+        munmap(const_cast<char*>(mapping), mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    block_device_t::close();
+}
+
+const char* mapped_block_device_t::data(blockno_t block, size_t bytes) const
+{
+    if (!mapping || block > mappingSize / block_size() || bytes > mappingSize - block * block_size())
+        return nullptr;
+    return mapping + block * block_size();
 }
@@ -9,11 +9,19 @@
 #pragma once
 
 #include <string>
-#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <sys/uio.h>
+
+class mapped_block_device_t;
 
 /**
  * The block device emulates a disk block device with configured block size and access times. It uses a regular file in
  * a filesystem to store data.
+ *
+ * Requests go straight to the file descriptor with positional and vectored system calls, so a multi-block request is
+ * a single call regardless of how its buffers are scattered in memory. The device can optionally bypass the host page
+ * cache and simulate seek delays of a rotating disk.
  */
 class block_device_t
 {
@@ -24,10 +32,40 @@ public:
     typedef unsigned long long blockno_t;
     typedef size_t blocksize_t;
 
-    block_device_t(const std::string& storageFile, bool create = false, blocksize_t blockSize = 0, blockno_t numBlocks = 0);
+    enum options_e {
+        DIRECT_IO = 1, //!< Bypass the host page cache. Falls back to buffered I/O if the host filesystem refuses.
+        READ_ONLY = 2  //!< Open the storage file for reading only, writes fail.
+    };
+
+    /**
+     * Buffer alignment needed for direct I/O. Requests with unaligned buffers go through a bounce buffer.
+     */
+    static const size_t DIRECT_IO_ALIGN = 4096;
+
+    /**
+     * Mechanical disk timing for seek simulation.
+     */
+    struct seek_model_t
+    {
+        unsigned track_to_track_ns; //!< Seek to a neighbouring position.
+        unsigned full_stroke_ns;    //!< Seek across the whole device.
+        unsigned rotation_ns;       //!< Average rotational latency, added to every seek.
+    };
+
+    block_device_t(const std::string& storageFile, bool create = false, blocksize_t blockSize = 0, blockno_t numBlocks = 0, unsigned options = 0);
     virtual ~block_device_t();
 
-    void close();
+    virtual void close();
+
+    /**
+     * @return this device if it is memory mapped, nullptr otherwise. Tools are built without RTTI.
+     */
+    virtual mapped_block_device_t* as_mapped() { return nullptr; }
+
+    /**
+     * Make every request wait for the time the modelled disk would need to seek to it. Off by default.
+     */
+    void simulate_seeks(const seek_model_t& model);
 
     /**
      * Return time in nanoseconds it would take to seek from current block position to seekTo.
@@ -37,18 +75,78 @@ public:
     void seek(blockno_t block);
     blockno_t pos();
 
-    blocksize_t block_size() { return blockSize; }
+    blocksize_t block_size() const { return blockSize; }
+    bool direct_io() const { return direct; }
 
     /**
      * Read and write functions operate on whole blocks of specific size.
+     * They may be called from several threads. Requests only queue up on the device when seeks are simulated.
+     * @return number of bytes transferred, a multiple of block size.
      */
     blocksize_t read_block(blockno_t block, char* buffer, blocksize_t bufSize);
-    void write_block(blockno_t block, const char* buffer, blocksize_t bytes);
+    blocksize_t write_block(blockno_t block, const char* buffer, blocksize_t bytes);
+
+    /**
+     * Scatter/gather versions: transfer consecutive blocks starting at "block" from or to a list of buffers.
+     * Every buffer must be a multiple of block size long.
+     * @return number of bytes transferred, a multiple of block size.
+     */
+    blocksize_t read_blocks(blockno_t block, const struct iovec* iov, int iovcnt);
+    blocksize_t write_blocks(blockno_t block, const struct iovec* iov, int iovcnt);
+
+    /**
+     * Number of read and write requests issued so far, for benchmarking.
+     */
+    size_t read_requests() const { return reads; }
+    size_t write_requests() const { return writes; }
+
+protected:
+    int fd;
 
 private:
+    blocksize_t transfer(bool write, blockno_t block, const struct iovec* iov, int iovcnt);
+    blocksize_t transfer_aligned(bool write, blockno_t block, const struct iovec* iov, int iovcnt, size_t bytes);
+
     std::string storageFileName;
-    std::fstream* storageFile;
+    bool direct;
     blocksize_t blockSize;
     blockno_t numBlocks;
+    std::atomic<size_t> reads;
+    std::atomic<size_t> writes;
+    std::mutex ioLock; //!< Serializes requests while seeks are simulated, like a single disk head would.
+    bool seeking; //!< Seek simulation is on.
+    seek_model_t seekModel;
+    blockno_t head; //!< Block after the last transferred one.
 };
 
+/**
+ * Read-only block device with the whole storage file mapped into memory. Besides the regular read calls, it hands out
+ * pointers to block data inside the mapping, so readers can use blocks in place without copying them.
+ */
+class mapped_block_device_t : public block_device_t
+{
+public:
+    mapped_block_device_t(const std::string& storageFile, blocksize_t blockSize);
+    ~mapped_block_device_t();
+
+    void close() override;
+    mapped_block_device_t* as_mapped() override { return this; }
+
+    /**
+     * Address of "bytes" bytes of data starting at block in the mapping.
+     * @return nullptr if the range is outside of the device.
+     */
+    const char* data(blockno_t block, size_t bytes) const;
+    size_t mapped_size() const { return mappingSize; }
+
+    /**
+     * Keep the mapping alive while pointers into it are in use. The device must not be closed while pinned.
+     */
+    void pin() { ++pins; }
+    void unpin() { --pins; }
+
+private:
+    const char* mapping;
+    size_t mappingSize;
+    std::atomic<size_t> pins;
+};
@@ -9,11 +9,13 @@
 #pragma once
 
 #include <map>
+#include <mutex>
 #include <cassert>
 #include "block_cache.h"
 
 /**
  * Device mapper can convert between abstract device numbers and actual devices performing I/O.
+ * Mapping and lookups may happen from any thread.
  */
 class block_device_mapper_t
 {
@@ -21,25 +23,44 @@ class block_device_mapper_t
     static int next_device;
     std::map<const char*, deviceno_t> device_ids;
     std::map<deviceno_t, block_device_t*> devices;
+    std::mutex lock; //!< Protects device maps.
+
+    block_device_t* find_device(deviceno_t dev)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        block_device_t* device = devices[dev];
+        assert(device);
+        return device;
+    }
 
 public:
     block_device_mapper_t() {}
     void map_device(block_device_t& dev, const char* name)
     {
-        deviceno_t d = ++next_device;
-        device_ids[name] = d;
-        devices[d] = &dev;
+        deviceno_t d;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            d = ++next_device;
+            device_ids[name] = d;
+            devices[d] = &dev;
+        }
         cache->set_device_block_size(d, dev.block_size());
+        if (mapped_block_device_t* mapped = dev.as_mapped())
+            cache->set_device_mapping(d, mapped);
     }
     bool unmap_device(deviceno_t dev)
     {
-        block_device_t* device = devices[dev];
-        assert(device);
+        block_device_t* device = find_device(dev);
         cache->flush(dev);
+        cache->set_device_mapping(dev, nullptr);
         device->close();
         return true;
     }
-    deviceno_t resolve_device(const char* name) /*const*/ { return device_ids[name]; }
+    deviceno_t resolve_device(const char* name) /*const*/
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return device_ids[name];
+    }
     void set_cache(block_cache_t& c) { cache = &c; }
     block_cache_t& get_cache() const { return *cache; }
 
@@ -48,20 +69,27 @@ public:
      */
     size_t read(deviceno_t dev, off_t block_no, char* buffer, size_t size)
     {
-        // LOCK
-        block_device_t* device = devices[dev];
-        assert(device);
-        return device->read_block(block_no, buffer, size);
+        return find_device(dev)->read_block(block_no, buffer, size);
     }
     /**
      * Perform block write on actual device.
      */
     size_t write(deviceno_t dev, off_t block_no, const char* buffer, size_t size)
     {
-        // LOCK
-        block_device_t* device = devices[dev];
-        assert(device);
-        /*return*/ device->write_block(block_no, buffer, size);
-        return size;
+        return find_device(dev)->write_block(block_no, buffer, size);
+    }
+    /**
+     * Perform scatter/gather read of consecutive blocks on actual device, as a single request.
+     */
+    size_t read(deviceno_t dev, off_t block_no, const struct iovec* iov, int iovcnt)
+    {
+        return find_device(dev)->read_blocks(block_no, iov, iovcnt);
+    }
+    /**
+     * Perform scatter/gather write of consecutive blocks on actual device, as a single request.
+     */
+    size_t write(deviceno_t dev, off_t block_no, const struct iovec* iov, int iovcnt)
+    {
+        return find_device(dev)->write_blocks(block_no, iov, iovcnt);
     }
 };
@@ -0,0 +1,99 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * Queue between two pipeline stages. Producers block while it is full, so a slow stage holds back the ones before
+ * it instead of letting their output pile up in memory.
+ *
+ * Closing the queue ends the stream: consumers get the items still queued and then nothing, producers can't push
+ * any more. A stage failing closes its queues to stop the stages on both sides.
+ */
+template <typename T>
+class bounded_queue_t
+{
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    size_t producers; //!< Open producer handles, the queue closes when the last one is done.
+    bool closed;
+
+public:
+    explicit bounded_queue_t(size_t capacity, size_t producers = 1)
+        : capacity(capacity)
+        , producers(producers)
+        , closed(false)
+    {
+    }
+
+    /**
+     * @return false if the queue was closed and item was not queued.
+     */
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * @return false if the queue is closed and empty.
+     */
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * One of the producers is done, the last one closes the queue.
+     */
+    void producer_done()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (producers && --producers == 0)
+            close_locked();
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        close_locked();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.size();
+    }
+
+private:
+    void close_locked()
+    {
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
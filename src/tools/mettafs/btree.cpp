@@ -6,299 +6,893 @@
 // Distributed under the Boost Software License, Version 1.0.
 // (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
 //
-//B-trees C++ implement by Zhu Xinquan@2006-3-26
- 
-#include <iostream>
-#include <ctime>
-#include <vector>
-#define ___DEBUG
-using namespace std;
- 
- 
-//the class definition of the element stored in each node;
-template<typename T>
-class Element
-{
-public:
-    T data;
-    bool operator < (Element& e) const { return data < e.data;}
-    bool operator <= (Element& e) const { return data <= e.data;}
-    bool operator > (Element& e) const { return data > e.data;}
-    bool operator >= (Element& e) const { return data >= e.data;}
-    bool operator == (Element& e) const { return data == e.data;}
-    Element& operator = (const Element& e)
+#include "btree.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cassert>
+
+static_assert(sizeof(fs_key_t) == sizeof(fs_ondisk_key_t), "In-memory and on-disk keys must match");
+
+static const uint32_t BTREE_BLOCK_VERSION = 1;
+
+static fs_ondisk_key_t to_disk(const fs_key_t& key)
+{
+    fs_ondisk_key_t k;
+    k.objectid = key.objectid;
+    k.type = key.type;
+    k.offset = key.offset;
+    return k;
+}
+
+static fs_key_t from_disk(const fs_ondisk_key_t& key)
+{
+    fs_key_t k;
+    k.objectid = key.objectid;
+    k.type = key.type;
+    k.offset = key.offset;
+    return k;
+}
+
+static btree_block_header_t* header(char* block) { return reinterpret_cast<btree_block_header_t*>(block); }
+static fs_leaf_t* as_leaf(char* block) { return reinterpret_cast<fs_leaf_t*>(block); }
+static fs_node_t* as_node(char* block) { return reinterpret_cast<fs_node_t*>(block); }
+
+/**
+ * Item data offsets are relative to the end of the block header, where the item array starts.
+ */
+static char* leaf_area(fs_leaf_t* leaf) { return reinterpret_cast<char*>(leaf->items); }
+static const char* leaf_area(const fs_leaf_t* leaf) { return reinterpret_cast<const char*>(leaf->items); }
+
+/**
+ * Binary search for key in a leaf.
+ * @return slot of the key if found, otherwise slot where it would be inserted.
+ */
+static uint32_t search_items(const fs_leaf_t* leaf, const fs_ondisk_key_t& key, bool& found)
+{
+    uint32_t lo = 0, hi = leaf->numItems;
+    found = false;
+    while (lo < hi)
     {
-       data=e.data;
-       return *this;
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = compare_keys(leaf->items[mid].key, key);
+        if (c < 0)
+            lo = mid + 1;
+        else if (c > 0)
+            hi = mid;
+        else
+        {
+            found = true;
+            return mid;
+        }
     }
-    Element(T& d) : data(d){}
-};
- 
-//An integer element.
-typedef Element<int> Elem;
- 
-class BTreeNode
-{
-public:
- 
-    vector<Elem> m_data;
-    //m_child[i] is the child whose keys are smaller than that of m_data[i];
-    //and the size of m_child is always one more than m_data
-    vector<BTreeNode*> m_child;
-//Here is my B-tree strcture representation
-//
-//                     m_data[0]  m_data[1] ... m_data[i] ...
-//      m_child[0]--> /         |          |             \ <--m_child[i+1]
-//                   /          |          |              \    
-//
-    BTreeNode* m_parent; // pointer to the parent BTreeNode
-    BTreeNode(BTreeNode* mp=NULL) : m_parent(mp){}
-};
- 
-class BTree
-{
-    typedef void (*v_func)(Elem &data);//visit function    
-protected:
-    int m_order; //maximum number of the elements stored a node
-    BTreeNode* m_root;//the root of the tree
-    v_func m_visit;
-    //return true if the insertion does not need split the current node
-    bool Normal_insert(Elem &);
-    //When the number of current node's element is overflow, perform split insertion.
-    bool Split_insert(Elem &);
-    //store the result of every search
-    BTreeNode* search_result;
- 
- 
-public:
-    BTree(v_func f, int n, BTreeNode* r=NULL):m_visit(f),m_order(n),m_root(r)
+    return lo;
+}
+
+/**
+ * Binary search for the child that may contain key: the last one with a lower or equal key, or the first one.
+ */
+static uint32_t search_ptrs(const fs_node_t* node, const fs_ondisk_key_t& key)
+{
+    uint32_t lo = 0, hi = node->numItems;
+    while (lo < hi)
     {
-       search_result = NULL;
-    };
-    ~BTree();
-    bool Insertion(Elem&);//Insert a element to the B-tree.
-    bool Deletion(Elem&);
-    BTreeNode* Search(Elem&);//Search an Element in B-tree.
-    void travel(BTreeNode*) const; // travel the Btree
-    void print() const { travel(m_root); } // print the elements in a sorted order
-};
- 
-BTree::~BTree()
-{
-    //something to be added
-   
-}
-void BTree::travel(BTreeNode* p) const
-{
-    if(p==NULL)
-       return;
-    int i;
-    for(i=0;i < p->m_child.size()-1; i++)
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (compare_keys(node->ptrs[mid].key, key) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? lo - 1 : 0;
+}
+
+//=====================================================================================================================
+// btree_allocator_t
+//=====================================================================================================================
+
+btree_allocator_t::btree_allocator_t(fs_location_t start, fs_location_t end, size_t block_size)
+    : next(start)
+    , end(end)
+    , block_size(block_size)
+{
+}
+
+fs_location_t btree_allocator_t::allocate()
+{
+    if (!free_blocks.empty())
     {
-       travel(p->m_child[i]);
-       m_visit(p->m_data[i]);
+        fs_location_t loc = free_blocks.back();
+        free_blocks.pop_back();
+        return loc;
     }
-    travel(p->m_child[i]);
-   
+    if (next + block_size > end)
+        throw std::runtime_error("No free space for tree blocks.");
+    fs_location_t loc = next;
+    next += block_size;
+    return loc;
 }
-//Search an Element in B-tree. Return the node pointer which contain the
-//desired element or return NULL if the element isn't found.
-BTreeNode* BTree::Search(Elem& t)
+
+void btree_allocator_t::free(fs_location_t block, bool committed)
 {
-    BTreeNode* p = m_root;
-    while (p)
+    (committed ? pending : free_blocks).push_back(block);
+}
+
+fs_location_t btree_allocator_t::allocate_run(size_t blocks)
+{
+    if (blocks == 1)
+        return allocate();
+    if (next + blocks * block_size > end)
+        throw std::runtime_error("No free space for data extents.");
+    fs_location_t loc = next;
+    next += blocks * block_size;
+    return loc;
+}
+
+void btree_allocator_t::free_run(fs_location_t start, size_t blocks, bool committed)
+{
+    for (size_t i = 0; i < blocks; ++i)
+        free(start + i * block_size, committed);
+}
+
+void btree_allocator_t::commit()
+{
+    free_blocks.insert(free_blocks.end(), pending.begin(), pending.end());
+    pending.clear();
+    // Hand out lower blocks first, keeping the tree packed towards the start of the area.
+    std::sort(free_blocks.begin(), free_blocks.end(), std::greater<fs_location_t>());
+}
+
+//=====================================================================================================================
+// btree_t block layout helpers
+//=====================================================================================================================
+
+btree_t::btree_t(block_cache_t& cache, deviceno_t device, btree_allocator_t& allocator, size_t node_size,
+                 uint64_t owner, uint64_t generation)
+    : cache(cache)
+    , device(device)
+    , allocator(allocator)
+    , block_size(node_size)
+    , owner(owner)
+    , transid(generation)
+    , root_loc(0)
+    , root_gen(0)
+    , root_lvl(0)
+    , checksum(nullptr)
+{
+    memset(fsid, 0, sizeof(fsid));
+}
+
+void btree_t::open(fs_location_t root, uint64_t generation)
+{
+    transid = generation + 1;
+    root_loc = root;
+    root_gen = 0;
+    root_lvl = 0;
+    if (root_loc)
     {
-       //store the current search result.
-       search_result = p;
-       //perform binary search of the node
-       int first=0, last=p->m_data.size()-1, mid = (first+last)/2;
-       while (first<=last)
-       {
-           mid=(first+last)/2;
-           if (p->m_data[mid]==t) {
-              return p;
-           }
-           if (p->m_data[mid]>t) {
-              last=mid-1;
-           }
-           if (p->m_data[mid]<t) {
-              first=mid+1;
-           }
-       }
-       //continue search in the child.
-       if(p->m_data[mid]>t)
-           p = p->m_child[mid];
-       else
-           p = p->m_child[mid+1];
+        block_ref_t ref = get(root_loc, 0);
+        root_gen = ref.as<btree_block_header_t>()->generation;
+        root_lvl = ref.as<btree_block_header_t>()->level;
     }
-    return p;
 }
- 
-bool BTree::Insertion(Elem& t)
+
+void btree_t::set_fsid(const uint8_t* id)
+{
+    memcpy(fsid, id, sizeof(fsid));
+}
+
+size_t btree_t::area_size() const
+{
+    return block_size - sizeof(btree_block_header_t);
+}
+
+size_t btree_t::node_capacity() const
+{
+    return area_size() / sizeof(fs_key_ptr_t);
+}
+
+size_t btree_t::max_item_size() const
+{
+    return area_size() / 2 - sizeof(fs_item_t);
+}
+
+/**
+ * Item data is packed at the end of the block in reverse item order, so the last item has the lowest data offset.
+ */
+size_t btree_t::leaf_free_space(const fs_leaf_t* leaf) const
+{
+    size_t data_start = leaf->numItems ? leaf->items[leaf->numItems - 1].offset : area_size();
+    return data_start - leaf->numItems * sizeof(fs_item_t);
+}
+
+size_t btree_t::leaf_used(const fs_leaf_t* leaf) const
+{
+    return area_size() - leaf_free_space(leaf);
+}
+
+void btree_t::leaf_insert(fs_leaf_t* leaf, uint32_t slot, const fs_ondisk_key_t& key, const void* data, uint32_t size)
+{
+    uint32_t n = leaf->numItems;
+    char* area = leaf_area(leaf);
+    size_t data_start = n ? leaf->items[n - 1].offset : area_size();
+    size_t top = slot ? leaf->items[slot - 1].offset : area_size();
+
+    assert(leaf_free_space(leaf) >= sizeof(fs_item_t) + size);
+
+    // Data of the items after slot moves down to make room, their headers move up by one.
+    memmove(area + data_start - size, area + data_start, top - data_start);
+    for (uint32_t i = slot; i < n; ++i)
+        leaf->items[i].offset -= size;
+    memmove(&leaf->items[slot + 1], &leaf->items[slot], (n - slot) * sizeof(fs_item_t));
+
+    leaf->items[slot].key = key;
+    leaf->items[slot].offset = top - size;
+    leaf->items[slot].size = size;
+    if (size)
+        memcpy(area + top - size, data, size);
+    leaf->numItems = n + 1;
+}
+
+void btree_t::leaf_delete(fs_leaf_t* leaf, uint32_t slot)
+{
+    uint32_t n = leaf->numItems;
+    char* area = leaf_area(leaf);
+    size_t data_start = leaf->items[n - 1].offset;
+    uint32_t size = leaf->items[slot].size;
+
+    memmove(area + data_start + size, area + data_start, leaf->items[slot].offset - data_start);
+    for (uint32_t i = slot + 1; i < n; ++i)
+        leaf->items[i].offset += size;
+    memmove(&leaf->items[slot], &leaf->items[slot + 1], (n - slot - 1) * sizeof(fs_item_t));
+
+    // Keep unused space zeroed, blocks are checksummed whole.
+    memset(area + data_start, 0, size);
+    memset(&leaf->items[n - 1], 0, sizeof(fs_item_t));
+    leaf->numItems = n - 1;
+}
+
+void btree_t::node_insert(fs_node_t* node, uint32_t slot, const fs_ondisk_key_t& key, fs_location_t child, uint64_t gen)
+{
+    uint32_t n = node->numItems;
+    assert(n < node_capacity());
+    memmove(&node->ptrs[slot + 1], &node->ptrs[slot], (n - slot) * sizeof(fs_key_ptr_t));
+    node->ptrs[slot].key = key;
+    node->ptrs[slot].blockptr = child;
+    node->ptrs[slot].generation = gen;
+    node->numItems = n + 1;
+}
+
+void btree_t::node_delete(fs_node_t* node, uint32_t slot)
+{
+    uint32_t n = node->numItems;
+    memmove(&node->ptrs[slot], &node->ptrs[slot + 1], (n - slot - 1) * sizeof(fs_key_ptr_t));
+    memset(&node->ptrs[n - 1], 0, sizeof(fs_key_ptr_t));
+    node->numItems = n - 1;
+}
+
+void btree_t::init_block(char* block, uint8_t level)
 {
-    if(Search(t))//The element already exits in the tree
-       return false;
-    if(m_root==NULL)//The tree is empty
+    memset(block, 0, block_size);
+    btree_block_header_t* hdr = header(block);
+    hdr->version = BTREE_BLOCK_VERSION;
+    memcpy(hdr->fsid, fsid, sizeof(fsid));
+    hdr->level = level;
+    hdr->generation = transid;
+    hdr->owner = owner;
+}
+
+//=====================================================================================================================
+// btree_t block I/O
+//=====================================================================================================================
+
+/**
+ * Get a block for use in place. Generation 0 accepts any generation.
+ */
+block_ref_t btree_t::get(fs_location_t loc, uint64_t gen)
+{
+    block_ref_t ref = cache.cached_ref(device, loc / block_size, block_size);
+    if (!ref)
+        throw std::runtime_error("Reading tree block failed.");
+    const btree_block_header_t* hdr = ref.as<btree_block_header_t>();
+    if (hdr->block_offset != loc || (gen && hdr->generation != gen))
+        throw std::runtime_error("Tree block is misplaced or from a wrong generation.");
+    return ref;
+}
+
+/**
+ * Get a copy of the block to modify.
+ */
+void btree_t::load(fs_location_t loc, uint64_t gen, std::vector<char>& block)
+{
+    block.resize(block_size);
+    if (cache.cached_read(device, loc / block_size, block.data(), 1, block_size) != 1)
+        throw std::runtime_error("Reading tree block failed.");
+    btree_block_header_t* hdr = header(block.data());
+    if (hdr->block_offset != loc || (gen && hdr->generation != gen))
+        throw std::runtime_error("Tree block is misplaced or from a wrong generation.");
+}
+
+void btree_t::store(char* block, fs_location_t loc)
+{
+    btree_block_header_t* hdr = header(block);
+    hdr->block_offset = loc;
+    hdr->generation = transid;
+    if (checksum)
+        checksum(hdr, block_size);
+    if (cache.cached_write(device, loc / block_size, block, 1, block_size) != block_size)
+        throw std::runtime_error("Writing tree block failed.");
+}
+
+/**
+ * Prepare a loaded block for modification. A block from a committed generation gets a new location, the old one
+ * is released once the change commits.
+ * @return true if the block moved.
+ */
+bool btree_t::cow(char* block, fs_location_t& loc)
+{
+    btree_block_header_t* hdr = header(block);
+    if (hdr->generation == transid)
+        return false;
+    fs_location_t copy = allocator.allocate();
+    allocator.free(loc, true);
+    loc = copy;
+    hdr->generation = transid;
+    return true;
+}
+
+/**
+ * Free a block no longer used by the tree.
+ */
+void btree_t::release(fs_location_t loc, uint64_t gen)
+{
+    allocator.free(loc, gen != transid);
+}
+
+uint64_t btree_t::commit()
+{
+    allocator.commit();
+    return transid++;
+}
+
+//=====================================================================================================================
+// btree_t lookups
+//=====================================================================================================================
+
+bool btree_t::find(const fs_key_t& key, std::vector<char>* value)
+{
+    fs_ondisk_key_t k = to_disk(key);
+    fs_location_t loc = root_loc;
+    uint64_t gen = root_gen;
+
+    while (loc)
     {
-       m_root = new BTreeNode;
-       m_root->m_data.push_back(t);
-       m_root->m_child.push_back(NULL);
-       m_root->m_child.push_back(NULL);
-       m_root->m_parent = NULL;
-       return true;
+        block_ref_t ref = get(loc, gen);
+        if (ref.as<btree_block_header_t>()->level == 0)
+        {
+            const fs_leaf_t* leaf = ref.as<fs_leaf_t>();
+            bool found;
+            uint32_t slot = search_items(leaf, k, found);
+            if (found && value)
+            {
+                const char* data = leaf_area(leaf) + leaf->items[slot].offset;
+                value->assign(data, data + leaf->items[slot].size);
+            }
+            return found;
+        }
+
+        const fs_node_t* node = ref.as<fs_node_t>();
+        uint32_t slot = search_ptrs(node, k);
+        loc = node->ptrs[slot].blockptr;
+        gen = node->ptrs[slot].generation;
+    }
+    return false;
+}
+
+bool btree_t::find_floor(const fs_key_t& key, fs_key_t* found, std::vector<char>* value)
+{
+    return root_loc && floor_rec(root_loc, root_gen, to_disk(key), found, value);
+}
+
+/**
+ * A subtree may hold only keys above the searched one when its separator is a loose lower bound, the floor is then
+ * in a subtree to the left.
+ */
+bool btree_t::floor_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& key, fs_key_t* found,
+                        std::vector<char>* value)
+{
+    block_ref_t ref = get(loc, gen);
+
+    if (ref.as<btree_block_header_t>()->level == 0)
+    {
+        const fs_leaf_t* leaf = ref.as<fs_leaf_t>();
+        bool exact;
+        uint32_t slot = search_items(leaf, key, exact);
+        if (!exact)
+        {
+            if (slot == 0)
+                return false;
+            --slot;
+        }
+        if (found)
+            *found = from_disk(leaf->items[slot].key);
+        if (value)
+        {
+            const char* data = leaf_area(leaf) + leaf->items[slot].offset;
+            value->assign(data, data + leaf->items[slot].size);
+        }
+        return true;
+    }
+
+    const fs_node_t* node = ref.as<fs_node_t>();
+    for (uint32_t i = search_ptrs(node, key) + 1; i > 0; --i)
+        if (floor_rec(node->ptrs[i - 1].blockptr, node->ptrs[i - 1].generation, key, found, value))
+            return true;
+    return false;
+}
+
+size_t btree_t::scan(const fs_key_t& from, const fs_key_t& to, const visitor_t& visit)
+{
+    size_t count = 0;
+    if (root_loc)
+        scan_rec(root_loc, root_gen, to_disk(from), to_disk(to), visit, count);
+    return count;
+}
+
+/**
+ * Blocks on the path to the current leaf stay referenced while the scan is in their subtree.
+ * @return false once the scan is over.
+ */
+bool btree_t::scan_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& from, const fs_ondisk_key_t& to,
+                       const visitor_t& visit, size_t& count)
+{
+    block_ref_t ref = get(loc, gen);
+
+    if (ref.as<btree_block_header_t>()->level == 0)
+    {
+        const fs_leaf_t* leaf = ref.as<fs_leaf_t>();
+        bool found;
+        for (uint32_t i = search_items(leaf, from, found); i < leaf->numItems; ++i)
+        {
+            const fs_item_t& item = leaf->items[i];
+            if (compare_keys(item.key, to) > 0)
+                return false;
+            ++count;
+            if (!visit(from_disk(item.key), leaf_area(leaf) + item.offset, item.size))
+                return false;
+        }
+        return true;
+    }
+
+    const fs_node_t* node = ref.as<fs_node_t>();
+    uint32_t first = search_ptrs(node, from);
+    for (uint32_t i = first; i < node->numItems; ++i)
+    {
+        if (i > first && compare_keys(node->ptrs[i].key, to) > 0)
+            return false;
+        if (!scan_rec(node->ptrs[i].blockptr, node->ptrs[i].generation, from, to, visit, count))
+            return false;
+    }
+    return true;
+}
+
+//=====================================================================================================================
+// btree_t updates
+//=====================================================================================================================
+
+bool btree_t::insert(const fs_key_t& key, const void* data, size_t size)
+{
+    if (size > max_item_size())
+        throw std::length_error("Tree item is too large.");
+
+    fs_ondisk_key_t k = to_disk(key);
+    if (!root_loc)
+    {
+        std::vector<char> block(block_size);
+        init_block(block.data(), 0);
+        leaf_insert(as_leaf(block.data()), 0, k, data, size);
+        root_loc = allocator.allocate();
+        root_gen = transid;
+        root_lvl = 0;
+        store(block.data(), root_loc);
+        return true;
+    }
+
+    change_t ch;
+    if (!insert_rec(root_loc, root_gen, k, data, size, false, ch))
+        return false;
+    grow(ch);
+    return true;
+}
+
+void btree_t::update(const fs_key_t& key, const void* data, size_t size)
+{
+    if (size > max_item_size())
+        throw std::length_error("Tree item is too large.");
+    if (!root_loc)
+    {
+        insert(key, data, size);
+        return;
+    }
+
+    change_t ch;
+    insert_rec(root_loc, root_gen, to_disk(key), data, size, true, ch);
+    grow(ch);
+}
+
+/**
+ * Follow the change of the root after an insert, adding a level above a split root.
+ */
+void btree_t::grow(const change_t& ch)
+{
+    root_loc = ch.loc;
+    root_gen = transid;
+    if (!ch.split)
+        return;
+
+    std::vector<char> block(block_size);
+    init_block(block.data(), root_lvl + 1);
+    fs_node_t* node = as_node(block.data());
+    fs_ondisk_key_t lowest;
+    memset(&lowest, 0, sizeof(lowest));
+    node_insert(node, 0, lowest, ch.loc, transid);
+    node_insert(node, 1, ch.split_key, ch.split_loc, transid);
+
+    root_loc = allocator.allocate();
+    ++root_lvl;
+    store(block.data(), root_loc);
+}
+
+/**
+ * The first key pointer of a node is only a lower bound, searches that fall before the second key go to the first child
+ * anyway. Other keys are exact separators: no lower key in their subtree, no equal or higher key to their left.
+ */
+bool btree_t::insert_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& key, const void* data, uint32_t size,
+                         bool replace, change_t& ch)
+{
+    std::vector<char> block;
+    load(loc, gen, block);
+    ch.loc = loc;
+    ch.moved = false;
+    ch.split = false;
+    ch.underflow = false;
+
+    if (header(block.data())->level == 0)
+    {
+        fs_leaf_t* leaf = as_leaf(block.data());
+        bool found;
+        uint32_t slot = search_items(leaf, key, found);
+        if (found && !replace)
+            return false;
+
+        ch.moved = cow(block.data(), ch.loc);
+        if (found)
+            leaf_delete(leaf, slot);
+        if (leaf_free_space(leaf) >= sizeof(fs_item_t) + size)
+        {
+            leaf_insert(leaf, slot, key, data, size);
+            store(block.data(), ch.loc);
+        }
+        else
+            split_leaf(block, slot, key, data, size, ch);
+        return true;
+    }
+
+    fs_node_t* node = as_node(block.data());
+    uint32_t slot = search_ptrs(node, key);
+    change_t sub;
+    if (!insert_rec(node->ptrs[slot].blockptr, node->ptrs[slot].generation, key, data, size, replace, sub))
+        return false;
+    if (!sub.moved && !sub.split)
+        return true; // Child changed in place.
+
+    ch.moved = cow(block.data(), ch.loc);
+    node->ptrs[slot].blockptr = sub.loc;
+    node->ptrs[slot].generation = transid;
+    if (sub.split)
+    {
+        if (node->numItems == node_capacity())
+        {
+            split_node(block, slot + 1, sub.split_key, sub.split_loc, ch);
+            return true;
+        }
+        node_insert(node, slot + 1, sub.split_key, sub.split_loc, transid);
+    }
+    store(block.data(), ch.loc);
+    return true;
+}
+
+/**
+ * Split a full leaf in two around the middle byte, adding the new item. An item appended after the last one
+ * goes alone to the new leaf, so ascending inserts leave full leaves behind.
+ */
+void btree_t::split_leaf(std::vector<char>& block, uint32_t slot, const fs_ondisk_key_t& key, const void* data,
+                         uint32_t size, change_t& ch)
+{
+    fs_leaf_t* leaf = as_leaf(block.data());
+    uint32_t n = leaf->numItems;
+    std::vector<entry_t> entries;
+    entries.reserve(n + 1);
+    for (uint32_t i = 0; i < n; ++i)
+        entries.push_back({ leaf->items[i].key, leaf_area(leaf) + leaf->items[i].offset, leaf->items[i].size });
+    entries.insert(entries.begin() + slot, { key, static_cast<const char*>(data), size });
+
+    size_t split = n;
+    if (slot < n)
+    {
+        size_t total = 0, left = 0;
+        for (auto& e : entries)
+            total += sizeof(fs_item_t) + e.size;
+        for (split = 0; left < total / 2; ++split)
+            left += sizeof(fs_item_t) + entries[split].size;
+        // Items are at most half a leaf, so if the left half overflows it fits with one item less.
+        if (left > area_size())
+            --split;
+        split = std::max<size_t>(1, std::min(split, entries.size() - 1));
+    }
+
+    std::vector<char> left(block_size), right(block_size);
+    init_block(left.data(), 0);
+    init_block(right.data(), 0);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        fs_leaf_t* half = as_leaf(i < split ? left.data() : right.data());
+        leaf_insert(half, half->numItems, entries[i].key, entries[i].data, entries[i].size);
+    }
+
+    ch.split = true;
+    ch.split_key = entries[split].key;
+    ch.split_loc = allocator.allocate();
+    store(left.data(), ch.loc);
+    store(right.data(), ch.split_loc);
+}
+
+/**
+ * Split a full node in two, adding a pointer to child at slot.
+ */
+void btree_t::split_node(std::vector<char>& block, uint32_t slot, const fs_ondisk_key_t& key, fs_location_t child,
+                         change_t& ch)
+{
+    fs_node_t* node = as_node(block.data());
+    uint8_t level = node->level;
+    uint32_t n = node->numItems;
+    std::vector<fs_key_ptr_t> ptrs(node->ptrs, node->ptrs + n);
+    fs_key_ptr_t ptr;
+    ptr.key = key;
+    ptr.blockptr = child;
+    ptr.generation = transid;
+    ptrs.insert(ptrs.begin() + slot, ptr);
+
+    size_t split = slot < n ? ptrs.size() / 2 : n;
+
+    std::vector<char> right(block_size);
+    init_block(block.data(), level);
+    init_block(right.data(), level);
+    for (size_t i = 0; i < ptrs.size(); ++i)
+    {
+        fs_node_t* half = as_node(i < split ? block.data() : right.data());
+        node_insert(half, half->numItems, ptrs[i].key, ptrs[i].blockptr, ptrs[i].generation);
+    }
+
+    ch.split = true;
+    ch.split_key = ptrs[split].key;
+    ch.split_loc = allocator.allocate();
+    store(block.data(), ch.loc);
+    store(right.data(), ch.split_loc);
+}
+
+bool btree_t::remove(const fs_key_t& key)
+{
+    if (!root_loc)
+        return false;
+
+    change_t ch;
+    if (!remove_rec(root_loc, root_gen, to_disk(key), ch))
+        return false;
+    root_loc = ch.loc;
+    root_gen = transid;
+
+    // A root node left with a single child is dropped and the tree gets lower.
+    while (root_lvl > 0)
+    {
+        block_ref_t ref = get(root_loc, root_gen);
+        const fs_node_t* node = ref.as<fs_node_t>();
+        if (node->numItems != 1)
+            break;
+        fs_location_t child = node->ptrs[0].blockptr;
+        uint64_t child_gen = node->ptrs[0].generation;
+        ref.release();
+
+        release(root_loc, root_gen);
+        root_loc = child;
+        root_gen = child_gen;
+        --root_lvl;
+    }
+    return true;
+}
+
+bool btree_t::remove_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& key, change_t& ch)
+{
+    std::vector<char> block;
+    load(loc, gen, block);
+    ch.loc = loc;
+    ch.moved = false;
+    ch.split = false;
+    ch.underflow = false;
+
+    if (header(block.data())->level == 0)
+    {
+        fs_leaf_t* leaf = as_leaf(block.data());
+        bool found;
+        uint32_t slot = search_items(leaf, key, found);
+        if (!found)
+            return false;
+
+        ch.moved = cow(block.data(), ch.loc);
+        leaf_delete(leaf, slot);
+        store(block.data(), ch.loc);
+        ch.underflow = leaf_used(leaf) < area_size() / 4;
+        return true;
+    }
+
+    fs_node_t* node = as_node(block.data());
+    uint32_t slot = search_ptrs(node, key);
+    change_t sub;
+    if (!remove_rec(node->ptrs[slot].blockptr, node->ptrs[slot].generation, key, sub))
+        return false;
+
+    bool merge = sub.underflow && node->numItems > 1;
+    if (!sub.moved && !merge)
+        return true;
+
+    ch.moved = cow(block.data(), ch.loc);
+    node->ptrs[slot].blockptr = sub.loc;
+    node->ptrs[slot].generation = transid;
+    if (merge)
+        merge_children(node, slot);
+    store(block.data(), ch.loc);
+    ch.underflow = node->numItems * sizeof(fs_key_ptr_t) < area_size() / 4;
+    return true;
+}
+
+/**
+ * Merge an underfull child at slot with its right neighbour, or the left one for the last child, if both fit
+ * one block. The node must be writable.
+ */
+void btree_t::merge_children(fs_node_t* node, uint32_t slot)
+{
+    uint32_t l = slot + 1 < node->numItems ? slot : slot - 1;
+    fs_key_ptr_t lp = node->ptrs[l];
+    fs_key_ptr_t rp = node->ptrs[l + 1];
+
+    fs_location_t loc = lp.blockptr;
+    std::vector<char> left, right;
+    load(lp.blockptr, lp.generation, left);
+    load(rp.blockptr, rp.generation, right);
+
+    if (header(left.data())->level == 0)
+    {
+        fs_leaf_t* ll = as_leaf(left.data());
+        fs_leaf_t* rl = as_leaf(right.data());
+        if (leaf_used(ll) + leaf_used(rl) > area_size())
+            return;
+        cow(left.data(), loc);
+        for (uint32_t i = 0; i < rl->numItems; ++i)
+            leaf_insert(ll, ll->numItems, rl->items[i].key, leaf_area(rl) + rl->items[i].offset, rl->items[i].size);
     }
     else
     {
-       if(search_result)
-       {
-           //If the element can fit into vector m_data, slide all the elements
-           //greater than the arguement forward one position and insert the newly
-           //vacated slot, then return true. Otherwise performan split.
-           vector<Elem> *p = &search_result->m_data;
-           vector<BTreeNode*> *pc = &search_result->m_child;
-           int i;
-           //locate the right position to insert
-           for(i=0;i<p->size() && (*p)[i]<t;i++);
-           p->insert(p->begin()+i,t);//insert the new Element
-           pc->insert(pc->begin()+i,NULL);//insert the new child.
-           if(p->size() < m_order)//dosen't need to split this node
-           {
-#ifdef ___DEBUG
-              cout<<"Needn't to split! "<<endl;
-              cout<<"Now the tree is ################  ";
-              print();
-              cout<<"\n\n\n";
-#endif
-              return true;
-           }
-           else
-              return Split_insert(t);
-       }
-       else
-           return false;
+        fs_node_t* ln = as_node(left.data());
+        fs_node_t* rn = as_node(right.data());
+        if (ln->numItems + rn->numItems > node_capacity())
+            return;
+        cow(left.data(), loc);
+        // The right node's first key may be a loose lower bound, the parent separator is exact.
+        for (uint32_t i = 0; i < rn->numItems; ++i)
+            node_insert(ln, ln->numItems, i ? rn->ptrs[i].key : rp.key, rn->ptrs[i].blockptr, rn->ptrs[i].generation);
     }
- 
+
+    store(left.data(), loc);
+    release(rp.blockptr, rp.generation);
+    node->ptrs[l].blockptr = loc;
+    node->ptrs[l].generation = transid;
+    node_delete(node, l + 1);
 }
- 
- 
-bool BTree::Split_insert(Elem &t)
+
+//=====================================================================================================================
+// btree_bulk_loader_t
+//=====================================================================================================================
+
+btree_bulk_loader_t::btree_bulk_loader_t(btree_t& t, unsigned fill_percent)
+    : tree(t)
+    , leaf_fill(t.area_size() * fill_percent / 100)
+    , node_fill(std::max<size_t>(2, t.node_capacity() * fill_percent / 100))
+    , empty(true)
+{
+    if (tree.root_loc)
+        throw std::logic_error("Bulk loading needs an empty tree.");
+    node_fill = std::min(node_fill, tree.node_capacity());
+    levels.emplace_back(tree.block_size);
+    tree.init_block(levels[0].data(), 0);
+}
+
+void btree_bulk_loader_t::add(const fs_key_t& key, const void* data, size_t size)
 {
-    BTreeNode* sr = search_result;
-    if(sr)
+    if (size > tree.max_item_size())
+        throw std::length_error("Tree item is too large.");
+
+    fs_ondisk_key_t k = to_disk(key);
+    if (!empty && compare_keys(k, last) <= 0)
+        throw std::invalid_argument("Bulk loaded keys must be ascending.");
+
+    fs_leaf_t* leaf = as_leaf(levels[0].data());
+    if (leaf->numItems && tree.leaf_used(leaf) + sizeof(fs_item_t) + size > leaf_fill)
     {
-       BTreeNode* sr = search_result;
-       vector<Elem> *p = &sr->m_data;
-       vector<BTreeNode*> *pc = &sr->m_child;
-       //begin to insert and split
-       while(p->size() >= m_order)
-       {     
-           int split_point = p->size()/2;
-           BTreeNode* new_node = new BTreeNode(sr->m_parent);
-           //new node recieve rightmost half of current node. And after copying
-           //data to new node, delete the righmost half of the current node
-           int i,total= p->size();
-           for(i=split_point+1;i<total;i++)
-           {
-              new_node->m_data.push_back((*p)[split_point+1]);
-              new_node->m_child.push_back((*pc)[split_point+1]);
-              //make the new node be the parent of the righmost half's children
-              if((*pc)[split_point+1])
-                  (*pc)[split_point+1]->m_parent = new_node;
-              p->erase(p->begin()+split_point+1);
-              pc->erase(pc->begin()+split_point+1);
-           }
-           //deal with the one more child
-           new_node->m_child.push_back((*pc)[split_point+1]);
-           //make the new node be the parent of the righmost half's children
-           if((*pc)[split_point+1])
-              (*pc)[split_point+1]->m_parent = new_node;
-           pc->erase(pc->begin()+split_point+1);
-           //delete the split_point
-           Elem upward = (*p)[split_point];
-           p->erase(p->begin()+split_point);
-           //make the current's parent to be new_node's parent
-           new_node->m_parent = sr->m_parent;
-           if(sr == m_root)  //reach the root
-           {
-              //make a new node to be root.
-              BTreeNode* new_node2 = new BTreeNode(NULL);
-              m_root = new_node2;
-              new_node2->m_data.push_back(upward);
-              //the new root's two children are the splited two from current node
-              new_node2->m_child.push_back(sr);
-               new_node2->m_child.push_back(new_node);
-              sr->m_parent = new_node2;
-              new_node->m_parent = new_node2;
-#ifdef ___DEBUG
-              cout<<"\nNeed to make a new node to be root.";
-              cout<<"The new node is "<<new_node2->m_data[0].data;
-              cout<<"\nNow the tree is ################  ";
-              print();
-              cout<<"\n\n\n";
-#endif
-              return true;
-           }
-          
-#ifdef ___DEBUG
-           cout<<"\n^^^^^^^^^^^^\n"<<upward.data;
-           cout<<" need to upward. The split node become the two:\n";
-           for(i=0;i<p->size();i++)
-              cout<<(*p)[i].data<<" ";
-           cout<<"===";
-           for(i=0;i<new_node->m_data.size();i++)
-              cout<<new_node->m_data[i].data<<" ";
-#endif
-           //add the upward element to the parent of current node            
-           p = &sr->m_parent->m_data;
-           pc = &sr->m_parent->m_child;
-           //locate the right position to insert
-           for(i=0;i<p->size() && (*p)[i]<upward;i++);
-           p->insert(p->begin()+i,upward);
-           //adjust the parent's child
-           pc->insert(pc->begin()+i+1,new_node);
-#ifdef ___DEBUG
-           cout<<"The new parent is: ";
-           for(i=0;i<p->size();i++)
-              cout<<(*p)[i].data<<" ";
-           cout<<"\n^^^^^^^^^^^^^^\n";
-#endif
- 
-           sr=sr->m_parent;    
-       }
-#ifdef ___DEBUG
-       cout<<"\nNow the tree is ################  ";
-       print();
-       cout<<"\n\n\n";
-#endif
-       return true;
+        fs_ondisk_key_t first = leaf->items[0].key;
+        push(1, first, write(0));
     }
-    return false;
+    tree.leaf_insert(leaf, leaf->numItems, k, data, size);
+    last = k;
+    empty = false;
 }
-static void dump(Elem& e)
+
+/**
+ * Write out the block filled at level and start a new one there.
+ */
+fs_location_t btree_bulk_loader_t::write(size_t level)
 {
-    cout<<e.data<<" ";
+    fs_location_t loc = tree.allocator.allocate();
+    tree.store(levels[level].data(), loc);
+    tree.init_block(levels[level].data(), level);
+    return loc;
 }
 
-int main(int argc, char* argv[])
+/**
+ * Add a pointer to a written out block at the level below.
+ */
+void btree_bulk_loader_t::push(size_t level, const fs_ondisk_key_t& key, fs_location_t child)
 {
-    BTree b(&dump,5);
-    srand( (unsigned) time(NULL));
-    int i,j;
-    for(i=0;i<=1000;i++)
+    if (levels.size() == level)
+    {
+        levels.emplace_back(tree.block_size);
+        tree.init_block(levels[level].data(), level);
+    }
+
+    fs_node_t* node = as_node(levels[level].data());
+    if (node->numItems >= node_fill)
     {
-       int num = rand()%100;
-       Elem e1(num);
-       cout<<"Insert "<<e1.data<<" ";
-       b.Insertion(e1);
-       BTreeNode* temp;
-       if(temp = b.Search(e1))
-       {
-           cout<<"\nOK! find in the memory: 0x"<<temp;
-           for(j=0;j<temp->m_data.size();j++)
-              cout<<" "<<temp->m_data[j].data<<" ";
-           cout<<endl;
-       }
+        fs_ondisk_key_t first = node->ptrs[0].key;
+        push(level + 1, first, write(level));
+    }
+    node = as_node(levels[level].data());
+    tree.node_insert(node, node->numItems, key, child, tree.transid);
+}
+
+void btree_bulk_loader_t::finish()
+{
+    for (size_t level = 0; ; ++level)
+    {
+        btree_block_header_t* hdr = header(levels[level].data());
+        if (level + 1 == levels.size())
+        {
+            // Topmost block becomes the root, unless it is a node with one child which can be the root itself.
+            if (level > 0 && hdr->numItems == 1)
+            {
+                tree.root_loc = as_node(levels[level].data())->ptrs[0].blockptr;
+                tree.root_lvl = level - 1;
+            }
+            else
+            {
+                tree.root_loc = write(level);
+                tree.root_lvl = level;
+            }
+            break;
+        }
+
+        // Lower blocks are never left empty, they get their first entry right after being started.
+        fs_ondisk_key_t first = level ? as_node(levels[level].data())->ptrs[0].key
+                                      : as_leaf(levels[level].data())->items[0].key;
+        push(level + 1, first, write(level));
     }
-   
-    return 0;
+    tree.root_gen = tree.transid;
+    levels.clear();
 }
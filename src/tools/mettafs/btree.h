@@ -6,69 +6,248 @@
 // Distributed under the Boost Software License, Version 1.0.
 // (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
 //
+/**
+ * Persistent copy-on-write B+tree.
+ *
+ * Tree blocks use the on-disk node and leaf formats from superblock.h and live on a device accessed through the block
+ * cache. Leaves keep sorted item headers growing from the block start and item data growing from the block end,
+ * nodes keep sorted key pointers to their children. Lookups binary search each block in place, without copying it
+ * out of the cache.
+ *
+ * Every block records the generation (transaction) that wrote it. Changing a block of an already committed
+ * generation writes a copy to a new location and updates the parent, up to a new root, so the last committed tree
+ * stays intact on disk until the next commit. Blocks written in the running transaction are changed in place.
+ *
+ * Leaves and nodes are split when full and merged with a neighbour when they fall under a quarter full.
+ * A bulk loader builds a whole tree bottom-up from keys in sorted order, writing blocks sequentially.
+ */
 #pragma once
 
-template<typename T>
-class Element
-{
-public:
-    T data;
-    bool operator < (Element& e) const { return data < e.data;}
-    bool operator <= (Element& e) const { return data <= e.data;}
-    bool operator > (Element& e) const { return data > e.data;}
-    bool operator >= (Element& e) const { return data >= e.data;}
-    bool operator == (Element& e) const { return data == e.data;}
-    Element& operator = (const Element& e)
-    {
-        data=e.data;
-        return *this;
-    }
-    Element(T& d) : data(d){}
-};
+#include "superblock.h"
+#include "block_cache.h"
+#include <functional>
+#include <vector>
 
-//An integer element.
-typedef Element<int> Elem;
+/**
+ * Key order: object id, then item type, then offset.
+ */
+template <typename A, typename B>
+inline int compare_keys(const A& a, const B& b)
+{
+    if (a.objectid != b.objectid)
+        return a.objectid < b.objectid ? -1 : 1;
+    if (a.type != b.type)
+        return a.type < b.type ? -1 : 1;
+    if (a.offset != b.offset)
+        return a.offset < b.offset ? -1 : 1;
+    return 0;
+}
 
-class BTreeNode
+/**
+ * Hands out tree blocks and runs of blocks for data extents. New blocks are taken from the end of the used area unless
+ * freed ones are available. Blocks freed by copy-on-write still belong to the last committed tree, so they are only
+ * reused after the next commit.
+ */
+class btree_allocator_t
 {
+    fs_location_t next; //!< Start of the never used area.
+    fs_location_t end;
+    size_t block_size;
+    std::vector<fs_location_t> free_blocks;
+    std::vector<fs_location_t> pending; //!< Freed in the running transaction, still used by the committed tree.
+
 public:
-    vector<Elem> m_data;
-    //m_child[i] is the child whose keys are smaller than that of m_data[i];
-    //and the size of m_child is always one more than m_data
-    vector<BTreeNode*> m_child;
-    //Here is my B-tree strcture representation
-    //
-    //                     m_data[0]  m_data[1] ... m_data[i] ...
-    //      m_child[0]--> /         |          |             \ <--m_child[i+1]
-    //                   /          |          |              \     
-    //
-    BTreeNode* m_parent; // pointer to the parent BTreeNode
-    BTreeNode(BTreeNode* mp=NULL) : m_parent(mp){}
+    btree_allocator_t(fs_location_t start, fs_location_t end, size_t block_size);
+
+    /**
+     * @return location of a free block, throws if the device is full.
+     */
+    fs_location_t allocate();
+
+    /**
+     * Give a block back. Blocks that are part of the committed tree stay reserved until commit().
+     */
+    void free(fs_location_t block, bool committed);
+
+    /**
+     * Contiguous blocks for a data extent. Runs are cut from the end of the used area, freed runs come back as
+     * single blocks.
+     */
+    fs_location_t allocate_run(size_t blocks);
+    void free_run(fs_location_t start, size_t blocks, bool committed);
+
+    void commit();
+    size_t block_bytes() const { return block_size; }
+
+    /**
+     * Bytes between the start of the area and the highest block ever allocated.
+     */
+    fs_location_t high_water() const { return next; }
 };
 
-class BTree
+class btree_t
 {
-    typedef void (*v_func)(Elem &data);//visit function     
-protected:
-    int m_order; //maximum number of the elements stored a node
-    BTreeNode* m_root;//the root of the tree
-    v_func m_visit;
-    //return true if the insertion does not need split the current node
-    bool Normal_insert(Elem &);
-    //When the number of current node's element is overflow, perform split insertion
-    bool Split_insert(Elem &);
-    //store the result of every search
-    BTreeNode* search_result;
 public:
-    BTree(v_func f, int n, BTreeNode* r=NULL):m_visit(f),m_order(n),m_root(r)
+    typedef void (*checksum_fn)(btree_header_common_t* block, size_t bytes);
+
+    /**
+     * Called for every item in a range scan, return false to stop the scan.
+     */
+    typedef std::function<bool (const fs_key_t& key, const char* data, size_t size)> visitor_t;
+
+    /**
+     * Tree in blocks of node_size bytes on device. The tree starts out empty, its first leaf is written on
+     * the first insert, unless an existing tree is opened.
+     */
+    btree_t(block_cache_t& cache, deviceno_t device, btree_allocator_t& allocator, size_t node_size, uint64_t owner,
+            uint64_t generation = 1);
+
+    /**
+     * Use the tree rooted at root, which was committed at the given generation.
+     */
+    void open(fs_location_t root, uint64_t generation);
+
+    void set_fsid(const uint8_t* fsid);
+    void set_checksum(checksum_fn fn) { checksum = fn; }
+
+    fs_location_t root() const { return root_loc; }
+    uint8_t root_level() const { return root_lvl; }
+    uint64_t generation() const { return transid; }
+    size_t node_size() const { return block_size; }
+
+    /**
+     * Largest item data that fits a leaf, so that a split always makes room.
+     */
+    size_t max_item_size() const;
+
+    /**
+     * Look key up, copying its data out to value if given.
+     */
+    bool find(const fs_key_t& key, std::vector<char>* value = nullptr);
+
+    /**
+     * Find the item with the greatest key not above key, copying its key to found and data to value if given.
+     */
+    bool find_floor(const fs_key_t& key, fs_key_t* found, std::vector<char>* value = nullptr);
+
+    /**
+     * Visit items with keys from "from" to "to" inclusive, in key order.
+     * @return number of items visited.
+     */
+    size_t scan(const fs_key_t& from, const fs_key_t& to, const visitor_t& visit);
+
+    /**
+     * Add an item. Returns false and changes nothing if the key is already in the tree.
+     */
+    bool insert(const fs_key_t& key, const void* data, size_t size);
+
+    /**
+     * Add an item or replace data of an existing one.
+     */
+    void update(const fs_key_t& key, const void* data, size_t size);
+
+    bool remove(const fs_key_t& key);
+
+    /**
+     * End the running transaction, blocks of the current tree are copied before any further change.
+     * The tree becomes durable once the device is flushed and the root and committed generation are recorded in
+     * the superblock.
+     * @return the committed generation.
+     */
+    uint64_t commit();
+
+private:
+    friend class btree_bulk_loader_t;
+
+    /**
+     * How a subtree changed after an insert or remove, for its parent to follow.
+     */
+    struct change_t
     {
-        search_result = NULL;
+        fs_location_t loc;   //!< Subtree root location, differs from the old one after copy-on-write.
+        bool moved;
+        bool split;          //!< Subtree root was split, right half is at split_loc.
+        fs_ondisk_key_t split_key;
+        fs_location_t split_loc;
+        bool underflow;      //!< Subtree root is under a quarter full after a remove.
     };
-    ~BTree();
-    bool Insertion(Elem&);//Insert a element to the B-tree.
-    bool Deletion(Elem&);
-    BTreeNode* Search(Elem&);//Search an Element in B-tree.
-    void travel(BTreeNode*) const; // travel the Btree
-    void print() const { travel(m_root); } // print the elements in a sorted order
+
+    struct entry_t
+    {
+        fs_ondisk_key_t key;
+        const char* data;
+        uint32_t size;
+    };
+
+    block_cache_t& cache;
+    deviceno_t device;
+    btree_allocator_t& allocator;
+    size_t block_size;
+    uint64_t owner;
+    uint64_t transid; //!< Generation of the running transaction.
+    fs_location_t root_loc; //!< 0 while the tree is empty.
+    uint64_t root_gen;
+    uint8_t root_lvl;
+    uint8_t fsid[btree_header_common_t::FS_UUID_SIZE];
+    checksum_fn checksum;
+
+    size_t area_size() const;
+    size_t node_capacity() const;
+    size_t leaf_free_space(const fs_leaf_t* leaf) const;
+    size_t leaf_used(const fs_leaf_t* leaf) const;
+    void leaf_insert(fs_leaf_t* leaf, uint32_t slot, const fs_ondisk_key_t& key, const void* data, uint32_t size);
+    void leaf_delete(fs_leaf_t* leaf, uint32_t slot);
+    void node_insert(fs_node_t* node, uint32_t slot, const fs_ondisk_key_t& key, fs_location_t child, uint64_t gen);
+    void node_delete(fs_node_t* node, uint32_t slot);
+    void init_block(char* block, uint8_t level);
+
+    block_ref_t get(fs_location_t loc, uint64_t gen);
+    void load(fs_location_t loc, uint64_t gen, std::vector<char>& block);
+    void store(char* block, fs_location_t loc);
+    bool cow(char* block, fs_location_t& loc);
+    void release(fs_location_t loc, uint64_t gen);
+    void grow(const change_t& ch);
+
+    bool insert_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& key, const void* data, uint32_t size,
+                    bool replace, change_t& ch);
+    void split_leaf(std::vector<char>& block, uint32_t slot, const fs_ondisk_key_t& key, const void* data,
+                    uint32_t size, change_t& ch);
+    void split_node(std::vector<char>& block, uint32_t slot, const fs_ondisk_key_t& key, fs_location_t child,
+                    change_t& ch);
+    bool remove_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& key, change_t& ch);
+    void merge_children(fs_node_t* node, uint32_t slot);
+    bool floor_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& key, fs_key_t* found,
+                   std::vector<char>* value);
+    bool scan_rec(fs_location_t loc, uint64_t gen, const fs_ondisk_key_t& from, const fs_ondisk_key_t& to,
+                  const visitor_t& visit, size_t& count);
 };
 
+/**
+ * Build a tree from items given in ascending key order. Leaves and nodes are filled up to fill_percent and written
+ * out as they fill, so a large tree is written front to back with little memory. The tree must be empty.
+ */
+class btree_bulk_loader_t
+{
+    btree_t& tree;
+    size_t leaf_fill;
+    size_t node_fill;
+    std::vector<std::vector<char>> levels; //!< Block being filled at every level.
+    fs_ondisk_key_t last;
+    bool empty;
+
+    void push(size_t level, const fs_ondisk_key_t& key, fs_location_t child);
+    fs_location_t write(size_t level);
+
+public:
+    btree_bulk_loader_t(btree_t& tree, unsigned fill_percent = 90);
+
+    /**
+     * Append an item, keys must be strictly ascending.
+     */
+    void add(const fs_key_t& key, const void* data, size_t size);
+
+    /**
+     * Write out the partially filled blocks and make the result the tree root.
+     */
+    void finish();
+};
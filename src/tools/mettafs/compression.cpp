@@ -0,0 +1,309 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "compression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <lz4frame.h>
+#include <zstd.h>
+
+// Byte entropy above this means compressed, encrypted or otherwise random data, which would not shrink anyway.
+static const double ENTROPY_LIMIT = 7.5;
+static const size_t SAMPLE_SLICES = 16;
+static const size_t SAMPLE_SLICE = 1024;
+
+// Level at which LZ4 switches to its high compression mode.
+static const int LZ4_HC_LEVEL = 3;
+
+codec_t codec_t::parse(const std::string& spec)
+{
+    std::string name = spec.substr(0, spec.find(':'));
+    int level = 0;
+    if (name.size() < spec.size())
+        level = std::stoi(spec.substr(name.size() + 1));
+
+    if (name == "none")
+        return codec_t(COMPRESS_NONE);
+    if (name == "lz4")
+        return codec_t(COMPRESS_LZ4, level);
+    if (name == "zstd")
+        return codec_t(COMPRESS_ZSTD, level);
+    throw std::runtime_error("Unknown compression " + spec);
+}
+
+/**
+ * Slices spread over the data make a sample representative enough for an extent while costing a fraction of
+ * compressing it.
+ */
+double sampled_entropy(const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t histogram[256] = {0};
+    size_t sampled = 0;
+
+    if (size <= SAMPLE_SLICES * SAMPLE_SLICE)
+    {
+        for (size_t i = 0; i < size; ++i)
+            ++histogram[bytes[i]];
+        sampled = size;
+    }
+    else
+    {
+        size_t stride = (size - SAMPLE_SLICE) / (SAMPLE_SLICES - 1);
+        for (size_t s = 0; s < SAMPLE_SLICES; ++s)
+        {
+            const uint8_t* slice = bytes + s * stride;
+            for (size_t i = 0; i < SAMPLE_SLICE; ++i)
+                ++histogram[slice[i]];
+        }
+        sampled = SAMPLE_SLICES * SAMPLE_SLICE;
+    }
+
+    if (!sampled)
+        return 0.0;
+
+    double entropy = 0.0;
+    for (uint32_t count : histogram)
+    {
+        if (count)
+        {
+            double p = double(count) / sampled;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+namespace {
+
+/**
+ * Compression contexts are expensive to set up, keep one per compressing thread.
+ */
+struct zstd_context_t
+{
+    ZSTD_CCtx* ctx;
+    zstd_context_t() : ctx(ZSTD_createCCtx()) {}
+    ~zstd_context_t() { ZSTD_freeCCtx(ctx); }
+};
+
+size_t compress_zstd(int level, const void* data, size_t size, std::vector<char>& out)
+{
+    thread_local zstd_context_t context;
+    if (!context.ctx)
+        throw std::runtime_error("Cannot create zstd context");
+
+    level = std::min(level, ZSTD_maxCLevel());
+    out.resize(ZSTD_compressBound(size));
+    size_t result = ZSTD_compressCCtx(context.ctx, &out[0], out.size(), data, size, level);
+    if (ZSTD_isError(result))
+        throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(result));
+    return result;
+}
+
+size_t compress_lz4(int level, const void* data, size_t size, std::vector<char>& out)
+{
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    prefs.frameInfo.contentSize = size;
+    prefs.compressionLevel = level >= LZ4_HC_LEVEL ? level : 0;
+
+    out.resize(LZ4F_compressFrameBound(size, &prefs));
+    size_t result = LZ4F_compressFrame(&out[0], out.size(), data, size, &prefs);
+    if (LZ4F_isError(result))
+        throw std::runtime_error(std::string("lz4 compression failed: ") + LZ4F_getErrorName(result));
+    return result;
+}
+
+} // anonymous namespace
+
+void compress_extent(codec_t codec, const void* data, size_t size, size_t block_size, packed_extent_t& out)
+{
+    out.compression = COMPRESS_NONE;
+    out.incompressible = false;
+    out.bytes.clear();
+
+    // A single block can't shrink on disk.
+    if (codec.method == COMPRESS_NONE || size <= block_size)
+        return;
+
+    if (sampled_entropy(data, size) > ENTROPY_LIMIT)
+    {
+        out.incompressible = true;
+        return;
+    }
+
+    size_t packed;
+    switch (codec.method)
+    {
+        case COMPRESS_LZ4:
+            packed = compress_lz4(codec.level, data, size, out.bytes);
+            break;
+        case COMPRESS_ZSTD:
+            packed = compress_zstd(codec.level, data, size, out.bytes);
+            break;
+        default:
+            throw std::runtime_error("Unknown compression method");
+    }
+
+    size_t blocks = (size + block_size - 1) / block_size;
+    if (packed > (blocks - 1) * block_size)
+    {
+        out.bytes.clear();
+        return;
+    }
+
+    out.bytes.resize(packed);
+    out.compression = codec.method;
+}
+
+//=====================================================================================================================
+// decompressor_t
+//=====================================================================================================================
+
+static const size_t OUTPUT_CHUNK = 64 * 1024;
+
+decompressor_t::decompressor_t()
+    : zstd(nullptr)
+    , lz4(nullptr)
+    , method(COMPRESS_NONE)
+    , buffer(OUTPUT_CHUNK)
+    , produced(0)
+    , complete(false)
+{
+}
+
+decompressor_t::~decompressor_t()
+{
+    if (zstd)
+        ZSTD_freeDStream(zstd);
+    if (lz4)
+        LZ4F_freeDecompressionContext(lz4);
+}
+
+void decompressor_t::start(uint8_t m, const sink_t& s)
+{
+    method = m;
+    sink = s;
+    produced = 0;
+    complete = method == COMPRESS_NONE;
+
+    switch (method)
+    {
+        case COMPRESS_NONE:
+            break;
+        case COMPRESS_ZSTD:
+            if (!zstd && !(zstd = ZSTD_createDStream()))
+                throw std::runtime_error("Cannot create zstd context");
+            if (ZSTD_isError(ZSTD_initDStream(zstd)))
+                throw std::runtime_error("Cannot initialize zstd context");
+            break;
+        case COMPRESS_LZ4:
+            if (!lz4 && LZ4F_isError(LZ4F_createDecompressionContext(&lz4, LZ4F_VERSION)))
+                throw std::runtime_error("Cannot create lz4 context");
+            LZ4F_resetDecompressionContext(lz4);
+            break;
+        default:
+            throw std::runtime_error("Unknown compression method");
+    }
+}
+
+void decompressor_t::feed(const void* data, size_t size)
+{
+    if (method == COMPRESS_NONE)
+    {
+        sink(static_cast<const char*>(data), size);
+        produced += size;
+        return;
+    }
+
+    if (complete && size)
+        throw std::runtime_error("Data past the end of compressed extent");
+
+    if (method == COMPRESS_ZSTD)
+    {
+        ZSTD_inBuffer in = { data, size, 0 };
+        ZSTD_outBuffer out;
+        // A full output buffer may leave more data buffered inside the context even with all input consumed.
+        do {
+            out = { &buffer[0], buffer.size(), 0 };
+            size_t result = ZSTD_decompressStream(zstd, &out, &in);
+            if (ZSTD_isError(result))
+                throw std::runtime_error(std::string("zstd decompression failed: ") + ZSTD_getErrorName(result));
+            if (out.pos)
+                sink(&buffer[0], out.pos);
+            produced += out.pos;
+            if (result == 0)
+            {
+                complete = true;
+                if (in.pos != in.size)
+                    throw std::runtime_error("Data past the end of compressed extent");
+                break;
+            }
+        } while (in.pos < in.size || out.pos == out.size);
+        return;
+    }
+
+    const char* src = static_cast<const char*>(data);
+    size_t left = size;
+    size_t dst_size;
+    do {
+        size_t src_size = left;
+        dst_size = buffer.size();
+        size_t result = LZ4F_decompress(lz4, &buffer[0], &dst_size, src, &src_size, nullptr);
+        if (LZ4F_isError(result))
+            throw std::runtime_error(std::string("lz4 decompression failed: ") + LZ4F_getErrorName(result));
+        src += src_size;
+        left -= src_size;
+        if (dst_size)
+            sink(&buffer[0], dst_size);
+        produced += dst_size;
+        if (result == 0)
+        {
+            complete = true;
+            if (left)
+                throw std::runtime_error("Data past the end of compressed extent");
+            break;
+        }
+    } while (left || dst_size == buffer.size());
+}
+
+size_t decompressor_t::finish()
+{
+    if (!complete)
+        throw std::runtime_error("Compressed extent is truncated");
+    return produced;
+}
+
+//=====================================================================================================================
+// compression_policy_t
+//=====================================================================================================================
+
+codec_t compression_policy_t::codec_for(const std::vector<std::string>& tags) const
+{
+    codec_t codec = fallback;
+    size_t longest = 0;
+
+    for (auto& tag : tags)
+    {
+        for (auto& entry : by_tag)
+        {
+            const std::string& prefix = entry.first;
+            bool matches = tag.compare(0, prefix.size(), prefix) == 0
+                && (tag.size() == prefix.size() || tag[prefix.size()] == '.');
+            if (matches && prefix.size() > longest)
+            {
+                longest = prefix.size();
+                codec = entry.second;
+            }
+        }
+    }
+    return codec;
+}
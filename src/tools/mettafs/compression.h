@@ -0,0 +1,117 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Extent compression.
+ *
+ * Extents are compressed one by one, as LZ4 or zstd frames, so any extent can be decompressed on its own and as
+ * a stream, block by block while it is read from disk. Compressed data is only kept if it saves at least one block,
+ * extents are stored in whole blocks anyway. Data that looks random by its byte entropy is not even tried, so media
+ * files cost almost nothing extra to import.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Compression of an extent, as recorded in its extent item.
+static const uint8_t COMPRESS_NONE = 0;
+static const uint8_t COMPRESS_LZ4 = 1;
+static const uint8_t COMPRESS_ZSTD = 2;
+
+struct codec_t
+{
+    uint8_t method;
+    int level;  //!< Method specific, 0 for its default.
+
+    codec_t(uint8_t m = COMPRESS_NONE, int l = 0) : method(m), level(l) {}
+
+    /**
+     * Parse "none", "lz4", "lz4:9", "zstd" or "zstd:19".
+     */
+    static codec_t parse(const std::string& spec);
+};
+
+/**
+ * Estimated information content of data in bits per byte, from a sample of it.
+ */
+double sampled_entropy(const void* data, size_t size);
+
+/**
+ * Extent data as it goes to disk.
+ */
+struct packed_extent_t
+{
+    uint8_t compression;  //!< COMPRESS_NONE if the data should be stored as is.
+    bool incompressible;  //!< Compression was skipped on the data's entropy.
+    std::vector<char> bytes;
+
+    packed_extent_t() : compression(COMPRESS_NONE), incompressible(false) {}
+};
+
+/**
+ * Compress an extent to out. Nothing is compressed if the data looks incompressible or the result would not save
+ * at least one block of block_size bytes.
+ */
+void compress_extent(codec_t codec, const void* data, size_t size, size_t block_size, packed_extent_t& out);
+
+/**
+ * Streaming decompression of one extent at a time. Input can be fed in pieces of any size, decompressed data is
+ * handed to the sink as it comes out.
+ */
+class decompressor_t
+{
+public:
+    typedef std::function<void (const char* data, size_t size)> sink_t;
+
+    decompressor_t();
+    ~decompressor_t();
+
+    void start(uint8_t method, const sink_t& sink);
+    void feed(const void* data, size_t size);
+
+    /**
+     * Check that the whole extent was decompressed.
+     * @return number of bytes decompressed.
+     */
+    size_t finish();
+
+private:
+    struct ZSTD_DCtx_s* zstd;
+    struct LZ4F_dctx_s* lz4;
+    uint8_t method;
+    sink_t sink;
+    std::vector<char> buffer;
+    size_t produced;
+    bool complete;
+
+    decompressor_t(const decompressor_t&) = delete;
+    decompressor_t& operator =(const decompressor_t&) = delete;
+};
+
+/**
+ * Codec choice for imported files: a default, overridden by codecs for tag subtrees. The longest matching tag prefix
+ * wins, so "media" can be stored as is while "media.subtitles" is compressed.
+ */
+class compression_policy_t
+{
+    codec_t fallback;
+    std::map<std::string, codec_t> by_tag;
+
+public:
+    explicit compression_policy_t(codec_t default_codec = codec_t(COMPRESS_LZ4)) : fallback(default_codec) {}
+
+    void set_default(codec_t codec) { fallback = codec; }
+    void set_for_tag(const std::string& tag, codec_t codec) { by_tag[tag] = codec; }
+
+    codec_t codec_for(const std::vector<std::string>& tags) const;
+};
@@ -0,0 +1,117 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "content_hash.h"
+#include <cstring>
+#include <stdexcept>
+#include <openssl/evp.h>
+
+//=====================================================================================================================
+// XXH64
+//=====================================================================================================================
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t PRIME3 = 0x165667b19e3779f9ull;
+static const uint64_t PRIME4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t PRIME5 = 0x27d4eb2f165667c5ull;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t mix(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t v)
+{
+    acc ^= mix(0, v);
+    return acc * PRIME1 + PRIME4;
+}
+
+uint64_t fast_hash64(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        // Four independent lanes keep the multipliers busy.
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = mix(v1, read64(p));
+            v2 = mix(v2, read64(p + 8));
+            v3 = mix(v3, read64(p + 16));
+            v4 = mix(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    }
+    else
+        h = seed + PRIME5;
+
+    h += size;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= mix(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= uint64_t(read32(p)) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_SIZE])
+{
+    unsigned int len = SHA256_SIZE;
+    if (!EVP_Digest(data, size, digest, &len, EVP_sha256(), nullptr))
+        throw std::runtime_error("SHA-256 failed");
+}
@@ -0,0 +1,23 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Content hashes for data extents.
+ *
+ * Every extent gets a fast 64-bit hash (the XXH64 algorithm), which finds possible duplicates. A SHA-256 digest
+ * confirms a duplicate before its extent is shared, it is computed only for extents whose fast hash matched.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+static const size_t SHA256_SIZE = 32;
+
+uint64_t fast_hash64(const void* data, size_t size, uint64_t seed = 0);
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_SIZE]);
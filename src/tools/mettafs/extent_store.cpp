@@ -0,0 +1,296 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "extent_store.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static fs_key_t extent_key(fs_location_t location, uint64_t disk_bytes)
+{
+    fs_key_t key;
+    key.objectid = location;
+    key.type = EXTENT_ITEM;
+    key.offset = disk_bytes;
+    return key;
+}
+
+static fs_key_t hash_key(uint64_t hash, fs_location_t location)
+{
+    fs_key_t key;
+    key.objectid = hash;
+    key.type = EXTENT_HASH_ITEM;
+    key.offset = location;
+    return key;
+}
+
+const size_t extent_store_t::MAX_EXTENT;
+
+extent_store_t::extent_store_t(btree_t& tree, btree_allocator_t& allocator, block_cache_t& cache, deviceno_t device)
+    : tree(tree)
+    , allocator(allocator)
+    , cache(cache)
+    , device(device)
+    , block_size(allocator.block_bytes())
+    , counters()
+{
+}
+
+bool extent_store_t::find_extent(fs_location_t location, fs_key_t& key, extent_item_t& item)
+{
+    std::vector<char> data;
+    if (!tree.find_floor(extent_key(location, ~0ull), &key, &data) || key.objectid != location || key.type != EXTENT_ITEM)
+        return false;
+    if (data.size() != sizeof(item))
+        throw std::runtime_error("Corrupt extent item");
+    memcpy(&item, &data[0], sizeof(item));
+    return true;
+}
+
+void extent_store_t::write_data(fs_location_t location, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    size_t whole = size / block_size;
+    block_device_t::blockno_t block = location / block_size;
+
+    if (whole && cache.cached_write(device, block, bytes, whole, block_size) != whole * block_size)
+        throw std::runtime_error("Writing extent failed");
+
+    // The last block is padded with zeroes.
+    if (size % block_size)
+    {
+        std::vector<char> tail(block_size, 0);
+        memcpy(&tail[0], bytes + whole * block_size, size % block_size);
+        if (cache.cached_write(device, block + whole, &tail[0], 1, block_size) != block_size)
+            throw std::runtime_error("Writing extent failed");
+    }
+}
+
+void extent_store_t::read_data(fs_location_t location, size_t size, std::vector<char>& data)
+{
+    size_t blocks = blocks_for(size);
+    data.resize(blocks * block_size);
+    if (cache.cached_read(device, location / block_size, &data[0], blocks, block_size) != blocks)
+        throw std::runtime_error("Reading extent failed");
+    data.resize(size);
+}
+
+void extent_store_t::stream_data(const extent_item_t& item, fs_location_t location, const decompressor_t::sink_t& sink)
+{
+    block_device_t::blockno_t block = location / block_size;
+    size_t left = item.disk_bytes;
+
+    decompressor.start(item.compression, sink);
+    for (; left; ++block)
+    {
+        block_ref_t ref = cache.cached_ref(device, block, block_size);
+        if (!ref)
+            throw std::runtime_error("Reading extent failed");
+        size_t bytes = std::min(left, block_size);
+        decompressor.feed(ref.data(), bytes);
+        left -= bytes;
+    }
+    if (decompressor.finish() != item.ram_bytes)
+        throw std::runtime_error("Extent decompressed to wrong size");
+}
+
+void extent_store_t::load(const extent_item_t& item, fs_location_t location, std::vector<char>& data)
+{
+    if (item.compression == COMPRESS_NONE)
+    {
+        read_data(location, item.ram_bytes, data);
+        return;
+    }
+
+    data.clear();
+    data.reserve(item.ram_bytes);
+    stream_data(item, location, [&data](const char* bytes, size_t size) {
+        data.insert(data.end(), bytes, bytes + size);
+    });
+}
+
+bool extent_store_t::find_duplicate(const void* data, size_t size, uint64_t hash, extent_t& extent,
+    uint8_t digest[SHA256_SIZE], bool& have_digest)
+{
+    if (size == 0 || size > MAX_EXTENT)
+        throw std::runtime_error("Bad extent size");
+
+    ++counters.extents_in;
+    counters.bytes_in += size;
+
+    std::vector<fs_location_t> candidates;
+    tree.scan(hash_key(hash, 0), hash_key(hash, ~0ull), [&candidates](const fs_key_t& key, const char*, size_t) {
+        candidates.push_back(key.offset);
+        return true;
+    });
+
+    have_digest = false;
+    std::vector<char> other;
+
+    for (fs_location_t loc : candidates)
+    {
+        fs_key_t key;
+        extent_item_t item;
+        if (!find_extent(loc, key, item))
+            throw std::runtime_error("Dedup entry without extent");
+        if (item.ram_bytes != size)
+        {
+            ++counters.collisions;
+            continue;
+        }
+
+        if (!have_digest)
+        {
+            sha256(data, size, digest);
+            ++counters.sha_checks;
+            have_digest = true;
+        }
+        if (!(item.flags & EXTENT_FLAG_SHA256))
+        {
+            load(item, loc, other);
+            sha256(&other[0], other.size(), item.sha256);
+            ++counters.sha_checks;
+            item.flags |= EXTENT_FLAG_SHA256;
+        }
+        if (memcmp(digest, item.sha256, SHA256_SIZE) != 0)
+        {
+            ++counters.collisions;
+            tree.update(key, &item, sizeof(item)); // Keep the digest for the next match.
+            continue;
+        }
+
+        ++item.refs;
+        tree.update(key, &item, sizeof(item));
+        extent = extent_t{ loc, size, true };
+        return true;
+    }
+    return false;
+}
+
+extent_store_t::extent_t extent_store_t::write_extent(const void* data, size_t size, uint64_t hash,
+    const packed_extent_t& packed, const uint8_t digest[SHA256_SIZE], bool have_digest)
+{
+    bool compressed = packed.compression != COMPRESS_NONE;
+    size_t disk_bytes = compressed ? packed.bytes.size() : size;
+    size_t blocks = blocks_for(disk_bytes);
+    fs_location_t loc = allocator.allocate_run(blocks);
+    write_data(loc, compressed ? &packed.bytes[0] : data, disk_bytes);
+
+    extent_item_t item;
+    memset(&item, 0, sizeof(item));
+    item.refs = 1;
+    item.generation = tree.generation();
+    item.ram_bytes = size;
+    item.hash = hash;
+    if (have_digest)
+    {
+        memcpy(item.sha256, digest, SHA256_SIZE);
+        item.flags |= EXTENT_FLAG_SHA256;
+    }
+    item.disk_bytes = disk_bytes;
+    item.compression = packed.compression;
+    tree.insert(extent_key(loc, blocks * block_size), &item, sizeof(item));
+    tree.insert(hash_key(hash, loc), nullptr, 0);
+
+    ++counters.extents_stored;
+    counters.bytes_stored += size;
+    counters.bytes_written += disk_bytes;
+    counters.compressed += compressed;
+    counters.entropy_skips += packed.incompressible;
+    return extent_t{ loc, size, false };
+}
+
+extent_store_t::extent_t extent_store_t::store(const void* data, size_t size, uint64_t hash, codec_t codec)
+{
+    extent_t extent;
+    uint8_t digest[SHA256_SIZE];
+    bool have_digest;
+    if (find_duplicate(data, size, hash, extent, digest, have_digest))
+        return extent;
+
+    packed_extent_t packed;
+    compress_extent(codec, data, size, block_size, packed);
+    return write_extent(data, size, hash, packed, digest, have_digest);
+}
+
+extent_store_t::extent_t extent_store_t::store_packed(const void* data, size_t size, uint64_t hash,
+    const packed_extent_t& packed)
+{
+    extent_t extent;
+    uint8_t digest[SHA256_SIZE];
+    bool have_digest;
+    if (find_duplicate(data, size, hash, extent, digest, have_digest))
+        return extent;
+    return write_extent(data, size, hash, packed, digest, have_digest);
+}
+
+bool extent_store_t::known_hash(uint64_t hash)
+{
+    return tree.scan(hash_key(hash, 0), hash_key(hash, ~0ull), [](const fs_key_t&, const char*, size_t) {
+        return false;
+    }) > 0;
+}
+
+void extent_store_t::add_ref(fs_location_t location)
+{
+    fs_key_t key;
+    extent_item_t item;
+    if (!find_extent(location, key, item))
+        throw std::runtime_error("No extent to reference");
+    ++item.refs;
+    tree.update(key, &item, sizeof(item));
+}
+
+bool extent_store_t::release(fs_location_t location)
+{
+    fs_key_t key;
+    extent_item_t item;
+    if (!find_extent(location, key, item))
+        throw std::runtime_error("No extent to release");
+
+    if (--item.refs)
+    {
+        tree.update(key, &item, sizeof(item));
+        return false;
+    }
+
+    tree.remove(key);
+    tree.remove(hash_key(item.hash, location));
+    // An extent written before the running transaction is still part of the committed file system.
+    allocator.free_run(location, key.offset / block_size, item.generation != tree.generation());
+    return true;
+}
+
+void extent_store_t::read(fs_location_t location, std::vector<char>& data)
+{
+    fs_key_t key;
+    extent_item_t item;
+    if (!find_extent(location, key, item))
+        throw std::runtime_error("No extent to read");
+    load(item, location, data);
+}
+
+size_t extent_store_t::read(fs_location_t location, const decompressor_t::sink_t& sink)
+{
+    fs_key_t key;
+    extent_item_t item;
+    if (!find_extent(location, key, item))
+        throw std::runtime_error("No extent to read");
+    stream_data(item, location, sink);
+    return item.ram_bytes;
+}
+
+double extent_store_t::dedup_ratio() const
+{
+    return counters.bytes_stored ? double(counters.bytes_in) / counters.bytes_stored : 1.0;
+}
+
+double extent_store_t::compression_ratio() const
+{
+    return counters.bytes_written ? double(counters.bytes_stored) / counters.bytes_written : 1.0;
+}
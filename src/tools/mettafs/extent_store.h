@@ -0,0 +1,151 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Content addressed storage of file data.
+ *
+ * File data is kept in extents of whole blocks, up to MAX_EXTENT bytes each. Extents are found by their content:
+ * storing bytes that are already on disk adds a reference to the existing extent instead of writing them again,
+ * and an extent's space is freed when its last reference is released.
+ *
+ * The extent tree doubles as the dedup table. A fast hash of every extent points to the extents having it; when
+ * a new extent's hash matches, SHA-256 digests of both decide whether they are the same. Digests are computed
+ * only then and recorded in the extent item, so unique data is never hashed with SHA-256 at all.
+ *
+ * Extents are compressed when that saves space (see compression.h). Hashes, digests and duplicate checks are all
+ * of the uncompressed data, so the same contents are shared whatever codec each copy was stored with. Compressed
+ * extents are decompressed as a stream straight from cache blocks when read.
+ *
+ * Extent tree keys:
+ *   (disk location, EXTENT_ITEM, disk bytes)      -> extent_item_t
+ *   (fast hash, EXTENT_HASH_ITEM, disk location)  -> no data
+ */
+#pragma once
+
+#include "btree.h"
+#include "content_hash.h"
+#include "compression.h"
+#include <vector>
+
+static const uint8_t EXTENT_ITEM = 1;
+static const uint8_t EXTENT_HASH_ITEM = 2;
+
+static const uint8_t EXTENT_FLAG_SHA256 = 1; //!< sha256 of the extent item is filled in.
+
+struct extent_item_t
+{
+    uint64_t refs;           // [  0]
+    uint64_t generation;     // [  8] generation the extent was written in
+    uint64_t ram_bytes;      // [ 16] bytes of data, the rest of the last block is zero
+    uint64_t hash;           // [ 24] fast_hash64() of the data
+    uint8_t flags;           // [ 32]
+    uint8_t sha256[SHA256_SIZE]; // [ 33]
+    uint64_t disk_bytes;     // [ 65] bytes of stored data, compressed or not
+    uint8_t compression;     // [ 73] COMPRESS_* method of the stored data
+} PACKED; // 74 bytes
+
+class extent_store_t
+{
+public:
+    static const size_t MAX_EXTENT = 128 * 1024;
+
+    struct extent_t
+    {
+        fs_location_t location;
+        uint64_t ram_bytes;
+        bool shared; //!< Data was already stored, a reference was added.
+    };
+
+    struct stats_t
+    {
+        uint64_t extents_in;     //!< Extents given to store().
+        uint64_t bytes_in;
+        uint64_t extents_stored; //!< Extents actually written.
+        uint64_t bytes_stored;
+        uint64_t bytes_written;  //!< Bytes of extents written, after compression.
+        uint64_t compressed;     //!< Extents written compressed.
+        uint64_t entropy_skips;  //!< Extents not compressed because they looked random.
+        uint64_t sha_checks;     //!< Digests computed to confirm a fast hash match.
+        uint64_t collisions;     //!< Fast hash matches with different data.
+    };
+
+    /**
+     * Store extents on device, allocating their blocks from allocator and recording them in tree.
+     */
+    extent_store_t(btree_t& tree, btree_allocator_t& allocator, block_cache_t& cache, deviceno_t device);
+
+    /**
+     * Store data, or reference an extent with the same data. Hash must be fast_hash64() of the data, it is taken
+     * as a parameter so that hashing can be done in parallel beforehand. New extents are compressed with codec.
+     */
+    extent_t store(const void* data, size_t size, uint64_t hash, codec_t codec = codec_t());
+    extent_t store(const void* data, size_t size) { return store(data, size, fast_hash64(data, size)); }
+
+    /**
+     * Like store(), with the data already run through compress_extent(), in parallel by the caller. Packed is only
+     * written if no extent with the same data exists.
+     */
+    extent_t store_packed(const void* data, size_t size, uint64_t hash, const packed_extent_t& packed);
+
+    /**
+     * Whether some extent has this hash, i.e. data with it is likely a duplicate and not worth compressing.
+     */
+    bool known_hash(uint64_t hash);
+
+    void add_ref(fs_location_t location);
+
+    /**
+     * Drop a reference.
+     * @return true if it was the last one and the extent was freed.
+     */
+    bool release(fs_location_t location);
+
+    /**
+     * Read data of the extent at location into data.
+     */
+    void read(fs_location_t location, std::vector<char>& data);
+
+    /**
+     * Read data of the extent at location, handing it to sink piece by piece as it is decompressed.
+     * @return extent data size.
+     */
+    size_t read(fs_location_t location, const decompressor_t::sink_t& sink);
+
+    const stats_t& stats() const { return counters; }
+    size_t block_bytes() const { return block_size; }
+
+    /**
+     * Bytes given to store() per byte written.
+     */
+    double dedup_ratio() const;
+
+    /**
+     * Bytes of stored extents per byte written, i.e. the saving from compression alone.
+     */
+    double compression_ratio() const;
+
+private:
+    btree_t& tree;
+    btree_allocator_t& allocator;
+    block_cache_t& cache;
+    deviceno_t device;
+    size_t block_size;
+    stats_t counters;
+    decompressor_t decompressor;
+
+    size_t blocks_for(size_t bytes) const { return (bytes + block_size - 1) / block_size; }
+    bool find_extent(fs_location_t location, fs_key_t& key, extent_item_t& item);
+    void write_data(fs_location_t location, const void* data, size_t size);
+    void read_data(fs_location_t location, size_t size, std::vector<char>& data);
+    bool find_duplicate(const void* data, size_t size, uint64_t hash, extent_t& extent, uint8_t digest[SHA256_SIZE],
+        bool& have_digest);
+    extent_t write_extent(const void* data, size_t size, uint64_t hash, const packed_extent_t& packed,
+        const uint8_t digest[SHA256_SIZE], bool have_digest);
+    void load(const extent_item_t& item, fs_location_t location, std::vector<char>& data);
+    void stream_data(const extent_item_t& item, fs_location_t location, const decompressor_t::sink_t& sink);
+};
@@ -0,0 +1,430 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "import.h"
+#include "bounded_queue.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Queue lengths, per thread of a stage.
+static const size_t FILES_QUEUED = 256;
+static const size_t EXTENTS_QUEUED = 4;
+
+struct file_t
+{
+    uint64_t objid;
+    std::string name;
+    object_inode_item_t inode;
+};
+
+struct read_job_t
+{
+    uint64_t objid;
+    std::string path;
+    codec_t codec;
+};
+
+/**
+ * Extent of a file on its way through the pipeline. The end of every file is marked by a chunk without data at
+ * the offset where reading stopped.
+ */
+struct chunk_t
+{
+    uint64_t objid;
+    uint64_t offset;
+    bool end;
+    codec_t codec;
+    std::vector<char> data;
+    uint64_t hash;
+    packed_extent_t packed;
+};
+
+struct extent_record_t
+{
+    uint64_t objid;
+    uint64_t offset;
+    object_extent_item_t item;
+
+    bool operator <(const extent_record_t& other) const
+    {
+        return objid < other.objid || (objid == other.objid && offset < other.offset);
+    }
+};
+
+/**
+ * Path components become tag name components, so dots inside them would start new ones.
+ */
+std::string tag_component(const std::string& name)
+{
+    std::string tag = name;
+    std::replace(tag.begin(), tag.end(), '.', '_');
+    return tag;
+}
+
+std::vector<std::string> tags_for(const std::string& directory_tag, const std::string& file_name)
+{
+    std::vector<std::string> result;
+    if (!directory_tag.empty())
+        result.push_back(directory_tag);
+
+    size_t dot = file_name.rfind('.');
+    if (dot != std::string::npos && dot != 0 && dot + 1 < file_name.size())
+    {
+        std::string ext = file_name.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        result.push_back("type." + ext);
+    }
+    return result;
+}
+
+/**
+ * Walk stage state, only touched by the walking thread until it is joined.
+ */
+struct walker_t
+{
+    const std::string root;
+    const compression_policy_t& policy;
+    size_t max_name;
+    importer_t::stats_t& counters;
+    bounded_queue_t<read_job_t>& out;
+    uint64_t next_objid;
+    std::vector<file_t> files;
+    std::map<std::string, std::vector<uint64_t>> tagged;
+
+    walker_t(const std::string& root, const compression_policy_t& policy, size_t max_name,
+        importer_t::stats_t& counters, bounded_queue_t<read_job_t>& out)
+        : root(root)
+        , policy(policy)
+        , max_name(max_name)
+        , counters(counters)
+        , out(out)
+        , next_objid(FIRST_OBJECTID)
+    {
+    }
+
+    /**
+     * @return false if the pipeline was stopped.
+     */
+    bool walk(const std::string& relative, const std::string& directory_tag)
+    {
+        std::string dir_path = relative.empty() ? root : root + "/" + relative;
+        DIR* dir = opendir(dir_path.c_str());
+        if (!dir)
+        {
+            std::cerr << "Cannot open " << dir_path << ": " << strerror(errno) << std::endl;
+            ++counters.skipped;
+            return true;
+        }
+
+        // Entries are taken in name order, so the same tree always gets the same object ids.
+        std::vector<std::string> names;
+        while (dirent* entry = readdir(dir))
+        {
+            if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+                names.push_back(entry->d_name);
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+
+        for (auto& name : names)
+        {
+            std::string rel = relative.empty() ? name : relative + "/" + name;
+            std::string path = root + "/" + rel;
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0)
+            {
+                std::cerr << "Cannot stat " << path << ": " << strerror(errno) << std::endl;
+                ++counters.skipped;
+                continue;
+            }
+
+            if (S_ISDIR(st.st_mode))
+            {
+                std::string tag = directory_tag.empty() ? tag_component(name)
+                                                        : directory_tag + "." + tag_component(name);
+                if (!walk(rel, tag))
+                    return false;
+                continue;
+            }
+
+            if (!S_ISREG(st.st_mode) || rel.size() > max_name)
+            {
+                ++counters.skipped;
+                continue;
+            }
+
+            file_t file;
+            file.objid = next_objid++;
+            file.name = rel;
+            file.inode.size = st.st_size;
+            file.inode.mtime = uint64_t(st.st_mtime) * 1000000000ull;
+            file.inode.mode = st.st_mode & 07777;
+
+            std::vector<std::string> file_tags = tags_for(directory_tag, name);
+            for (auto& tag : file_tags)
+                tagged[tag].push_back(file.objid);
+
+            read_job_t job{ file.objid, path, policy.codec_for(file_tags) };
+            files.push_back(std::move(file));
+            ++counters.files;
+            if (!out.push(std::move(job)))
+                return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * Read stage work for one file.
+ * @return false if the pipeline was stopped.
+ */
+bool read_file(const read_job_t& job, bounded_queue_t<chunk_t>& out, importer_t::stats_t& counters)
+{
+    int fd = open(job.path.c_str(), O_RDONLY);
+    if (fd < 0)
+        std::cerr << "Cannot open " << job.path << ": " << strerror(errno) << std::endl;
+
+    uint64_t offset = 0;
+    bool ok = fd >= 0;
+    bool running = true;
+    while (ok && running)
+    {
+        chunk_t chunk{ job.objid, offset, false, job.codec, {}, 0, {} };
+        chunk.data.resize(extent_store_t::MAX_EXTENT);
+        size_t got = 0;
+        while (got < chunk.data.size())
+        {
+            ssize_t n = ::read(fd, &chunk.data[got], chunk.data.size() - got);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                std::cerr << "Cannot read " << job.path << ": " << strerror(errno) << std::endl;
+                ok = false;
+            }
+            if (n <= 0)
+                break;
+            got += n;
+        }
+        if (!got)
+            break;
+        chunk.data.resize(got);
+        offset += got;
+        counters.bytes_read += got;
+        running = out.push(std::move(chunk));
+    }
+    if (fd >= 0)
+        close(fd);
+
+    // A file that could not be read keeps the data read so far.
+    if (ok)
+        ++counters.files_read;
+    else
+        ++counters.skipped;
+    return running && out.push(chunk_t{ job.objid, offset, true, job.codec, {}, 0, {} });
+}
+
+} // anonymous namespace
+
+importer_t::importer_t(extent_store_t& extents, btree_t& objects, tag_index_t& tags,
+    const compression_policy_t& policy, unsigned threads)
+    : extents(extents)
+    , objects(objects)
+    , tags(tags)
+    , policy(policy)
+    , threads(std::max(threads, 1u))
+    , counters()
+{
+}
+
+void importer_t::run(const std::string& directory, unsigned progress_seconds)
+{
+    bounded_queue_t<read_job_t> to_read(FILES_QUEUED * threads);
+    bounded_queue_t<chunk_t> to_pack(EXTENTS_QUEUED * threads, threads);
+    bounded_queue_t<chunk_t> to_store(EXTENTS_QUEUED * threads, threads);
+
+    std::mutex failure_lock;
+    std::exception_ptr failure;
+    // A failing stage stops the whole pipeline, the first error is reported.
+    auto fail = [&]() {
+        {
+            std::lock_guard<std::mutex> guard(failure_lock);
+            if (!failure)
+                failure = std::current_exception();
+        }
+        to_read.close();
+        to_pack.close();
+        to_store.close();
+    };
+
+    walker_t walker(directory, policy, objects.max_item_size(), counters, to_read);
+    std::thread walk_thread([&]() {
+        try
+        {
+            walker.walk("", "");
+        }
+        catch (...)
+        {
+            fail();
+        }
+        to_read.close();
+    });
+
+    std::vector<std::thread> readers;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        readers.emplace_back([&]() {
+            try
+            {
+                read_job_t job;
+                while (to_read.pop(job) && read_file(job, to_pack, counters)) {}
+            }
+            catch (...)
+            {
+                fail();
+            }
+            to_pack.producer_done();
+        });
+    }
+
+    // Only the first extent with a hash is compressed, later ones are most likely stored as references to it.
+    std::mutex seen_lock;
+    std::unordered_set<uint64_t> seen;
+    size_t block_size = extents.block_bytes();
+
+    std::vector<std::thread> packers;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        packers.emplace_back([&]() {
+            try
+            {
+                chunk_t chunk;
+                while (to_pack.pop(chunk))
+                {
+                    if (!chunk.end)
+                    {
+                        chunk.hash = fast_hash64(&chunk.data[0], chunk.data.size());
+                        bool first;
+                        {
+                            std::lock_guard<std::mutex> guard(seen_lock);
+                            first = seen.insert(chunk.hash).second;
+                        }
+                        if (first)
+                            compress_extent(chunk.codec, &chunk.data[0], chunk.data.size(), block_size, chunk.packed);
+                        else
+                            ++counters.likely_duplicates;
+                        ++counters.packed;
+                    }
+                    if (!to_store.push(std::move(chunk)))
+                        return;
+                }
+            }
+            catch (...)
+            {
+                fail();
+            }
+            to_store.producer_done();
+        });
+    }
+
+    // Store stage, the only one touching the trees.
+    std::vector<extent_record_t> records;
+    std::vector<uint64_t> sizes;
+    auto started = std::chrono::steady_clock::now();
+    auto next_report = started + std::chrono::seconds(progress_seconds);
+
+    auto report = [&](const char* what) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        double mb = double(counters.bytes_read) / (1 << 20);
+        std::cerr << what << ": " << counters.files_read << "/" << counters.files << " files, " << mb << " MB read, "
+                  << (elapsed > 0 ? mb / elapsed : 0) << " MB/s, " << extents.stats().extents_stored
+                  << " extents stored, queued " << to_read.size() << " files, " << to_pack.size() << " to pack, "
+                  << to_store.size() << " to store" << std::endl;
+    };
+
+    try
+    {
+        chunk_t chunk;
+        while (to_store.pop(chunk))
+        {
+            size_t index = chunk.objid - FIRST_OBJECTID;
+            if (index >= sizes.size())
+                sizes.resize(index + 1);
+
+            if (chunk.end)
+                sizes[index] = chunk.offset;
+            else
+            {
+                extent_store_t::extent_t extent = extents.store_packed(&chunk.data[0], chunk.data.size(), chunk.hash,
+                                                                       chunk.packed);
+                records.push_back(extent_record_t{ chunk.objid, chunk.offset, { extent.location, extent.ram_bytes } });
+            }
+
+            if (progress_seconds && std::chrono::steady_clock::now() >= next_report)
+            {
+                report("import");
+                next_report += std::chrono::seconds(progress_seconds);
+            }
+        }
+    }
+    catch (...)
+    {
+        fail();
+    }
+
+    walk_thread.join();
+    for (auto& t : readers)
+        t.join();
+    for (auto& t : packers)
+        t.join();
+    if (failure)
+        std::rethrow_exception(failure);
+
+    // All keys are known now, load the trees in key order.
+    std::sort(records.begin(), records.end());
+    btree_bulk_loader_t loader(objects);
+    auto record = records.begin();
+    for (auto& file : walker.files)
+    {
+        size_t index = file.objid - FIRST_OBJECTID;
+        file.inode.size = index < sizes.size() ? sizes[index] : 0; // What was read, in case the file changed.
+
+        fs_key_t key;
+        key.objectid = file.objid;
+        key.type = OBJECT_INODE_ITEM;
+        key.offset = 0;
+        loader.add(key, &file.inode, sizeof(file.inode));
+        key.type = OBJECT_NAME_ITEM;
+        loader.add(key, file.name.data(), file.name.size());
+        key.type = OBJECT_EXTENT_ITEM;
+        for (; record != records.end() && record->objid == file.objid; ++record)
+        {
+            key.offset = record->offset;
+            loader.add(key, &record->item, sizeof(record->item));
+        }
+    }
+    loader.finish();
+    tags.build(walker.tagged);
+
+    if (progress_seconds)
+        report("imported");
+}
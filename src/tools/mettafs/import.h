@@ -0,0 +1,63 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Import of a host directory tree.
+ *
+ * Files are loaded by a pipeline of stages connected by bounded queues:
+ *   walk     - one thread lists the tree in name order, assigning object ids and tags,
+ *   read     - threads read files in extents,
+ *   pack     - threads hash and compress extents,
+ *   store    - the calling thread dedups and allocates extents in the extent tree,
+ * and once everything is in, the object and tag trees are bulk loaded from sorted items.
+ *
+ * Every regular file becomes an object tagged with its directory, dots separating path components, and with
+ * "type.<extension>". Other kinds of files are skipped.
+ */
+#pragma once
+
+#include "extent_store.h"
+#include "tag_index.h"
+#include <atomic>
+#include <string>
+
+class importer_t
+{
+public:
+    struct stats_t
+    {
+        std::atomic<uint64_t> files;      //!< Files found.
+        std::atomic<uint64_t> files_read; //!< Files read completely.
+        std::atomic<uint64_t> skipped;    //!< Entries that are not regular files or could not be read.
+        std::atomic<uint64_t> bytes_read;
+        std::atomic<uint64_t> packed;     //!< Extents through the pack stage.
+        std::atomic<uint64_t> likely_duplicates; //!< Extents not compressed because their hash was seen before.
+    };
+
+    /**
+     * Import into extents, and into the empty object and tag trees. Threads is the number of threads in each of
+     * the read and pack stages.
+     */
+    importer_t(extent_store_t& extents, btree_t& objects, tag_index_t& tags, const compression_policy_t& policy,
+        unsigned threads);
+
+    /**
+     * Import all files under directory. Progress is reported on stderr every progress_seconds, 0 for none.
+     */
+    void run(const std::string& directory, unsigned progress_seconds = 1);
+
+    const stats_t& stats() const { return counters; }
+
+private:
+    extent_store_t& extents;
+    btree_t& objects;
+    tag_index_t& tags;
+    const compression_policy_t& policy;
+    unsigned threads;
+    stats_t counters;
+};
@@ -9,17 +9,19 @@
 #include "block_device.h"
 #include "block_device_mapper.h"
 #include "block_cache.h"
+#include "btree.h"
+#include "content_hash.h"
+#include "import.h"
 #include <uuid/uuid.h> // @todo Use boost::uuid and remove libossp-uuid dependency
 #include "superblock.h"
 #include "memutils.h"
 #include "fourcc.h"
 #include "macros.h"
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <cassert>
 
-// SHA256 from openssl
-#include <openssl/sha.h>
-
 //raiser/btrfs style blocks:
 
 // use 4096 kb block size (or even 64kb?)
@@ -46,6 +48,7 @@ public:
     {
         cache.set_device_mapper(device_mapper);
         device_mapper.set_cache(cache);
+        cache.start_write_back();
     }
 
     deviceno_t mount(block_device_t& dev, const char* name)
@@ -64,15 +67,18 @@ public:
         return device_mapper.resolve_device(name);
     }
 
+    block_cache_t& cache()
+    {
+        return device_mapper.get_cache();
+    }
+
     size_t read(deviceno_t device, off_t byte_offset, char* buffer, size_t size)
     {
-        // LOCK
         block_cache_t& cache = device_mapper.get_cache();
         return cache.byte_read(device, byte_offset, buffer, size);
     }
     size_t write(deviceno_t device, off_t byte_offset, const char* buffer, size_t size)
     {
-        // LOCK
         block_cache_t& cache = device_mapper.get_cache();
         return cache.byte_write(device, byte_offset, buffer, size);
     }
@@ -108,11 +114,8 @@ static const int BLOCK_SIZE = 4096; // logical sector size
 
 void calc_checksum(btree_header_common_t* node, size_t bytes)
 {
-    SHA256_CTX ctx;
     memutils::fill_memory(node->checksum, 0, sizeof(node->checksum));
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, node, bytes);
-    SHA256_Final(node->checksum, &ctx);
+    sha256(node, bytes, node->checksum);
 }
 
 extern "C" void panic(const char* message, const char* file, uint32_t line)
@@ -121,7 +124,40 @@ extern "C" void panic(const char* message, const char* file, uint32_t line)
     exit(-1);
 }
 
-int create_fs(deviceno_t device, size_t num_bytes, const char* label)
+/**
+ * Compression spec is a comma separated list of a default codec and codecs for tags, e.g. "zstd:3,type.jpg=none".
+ */
+static compression_policy_t parse_policy(const std::string& spec)
+{
+    compression_policy_t policy;
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            policy.set_default(codec_t::parse(item));
+        else
+            policy.set_for_tag(item.substr(0, eq), codec_t::parse(item.substr(eq + 1)));
+    }
+    return policy;
+}
+
+static void add_root_item(btree_bulk_loader_t& loader, uint64_t objectid, btree_t& tree, uint64_t generation)
+{
+    fs_key_t key;
+    fs_root_item_t root_item;
+    key.objectid = objectid;
+    key.type = ROOT_ITEM;
+    key.offset = 0;
+    root_item.root = tree.root();
+    root_item.generation = generation;
+    root_item.level = tree.root_level();
+    loader.add(key, &root_item, sizeof(root_item));
+}
+
+int create_fs(deviceno_t device, size_t num_bytes, const char* label, const char* import_dir = nullptr,
+    const compression_policy_t& policy = compression_policy_t(), unsigned threads = 1)
 {
     char buffer[BLOCK_SIZE];
     uint8_t fsid[btree_header_common_t::FS_UUID_SIZE];
@@ -130,6 +166,47 @@ int create_fs(deviceno_t device, size_t num_bytes, const char* label)
 
     uuid_generate(fsid);
 
+    // Lay out the root of roots tree right after the superblock. Trees are built with the bulk loader, so whatever
+    // items are known at format time go in sorted, packed into full leaves and written front to back.
+    btree_allocator_t allocator(sectorsize, num_bytes, nodesize);
+    btree_t root_tree(vfs.cache(), device, allocator, nodesize, 0);
+    root_tree.set_fsid(fsid);
+    root_tree.set_checksum(calc_checksum);
+
+    // Data is added to the extent tree through extent_store_t, the object and tag trees are bulk loaded with
+    // the imported files. Without an import all of them start out empty.
+    btree_t extent_tree(vfs.cache(), device, allocator, nodesize, EXTENT_TREE_OBJECTID);
+    btree_t object_tree(vfs.cache(), device, allocator, nodesize, OBJECT_TREE_OBJECTID);
+    btree_t tag_tree(vfs.cache(), device, allocator, nodesize, TAG_TREE_OBJECTID);
+    for (btree_t* tree : { &extent_tree, &object_tree, &tag_tree })
+    {
+        tree->set_fsid(fsid);
+        tree->set_checksum(calc_checksum);
+    }
+
+    if (import_dir)
+    {
+        extent_store_t extents(extent_tree, allocator, vfs.cache(), device);
+        tag_index_t tags(tag_tree);
+        importer_t importer(extents, object_tree, tags, policy, threads);
+        importer.run(import_dir);
+
+        const extent_store_t::stats_t& stats = extents.stats();
+        std::cerr << importer.stats().files << " files imported, " << importer.stats().skipped << " skipped, "
+                  << stats.extents_stored << " of " << stats.extents_in << " extents stored, dedup ratio "
+                  << extents.dedup_ratio() << ", compression ratio " << extents.compression_ratio() << ", "
+                  << stats.entropy_skips << " extents skipped as incompressible" << std::endl;
+    }
+
+    btree_bulk_loader_t loader(root_tree);
+    add_root_item(loader, EXTENT_TREE_OBJECTID, extent_tree, extent_tree.commit());
+    add_root_item(loader, OBJECT_TREE_OBJECTID, object_tree, object_tree.commit());
+    add_root_item(loader, TAG_TREE_OBJECTID, tag_tree, tag_tree.commit());
+    loader.finish();
+    uint64_t generation = root_tree.commit();
+    vfs.cache().flush(device);
+
+    // Superblock goes last, it makes the trees written above current.
     fs_superblock_t* super = reinterpret_cast<fs_superblock_t*>(buffer);
     memutils::fill_memory(buffer, 0, sizeof(buffer));
 
@@ -138,54 +215,41 @@ int create_fs(deviceno_t device, size_t num_bytes, const char* label)
     super->block_offset = 0;             // which block this node is supposed to live in
     super->flags = 0;                    // [ 60] not related to validity, but matches generic header format for different trees.
     super->magic = Magic64BE<'M','e','T','T','a','F','S','1'>::value;
-    super->generation = 1;
-    super->root = 1 * sectorsize;              // [ 84] location of "root of roots" tree
+    super->generation = generation;
+    super->root = root_tree.root();      // [ 84] location of "root of roots" tree
     super->total_bytes = num_bytes;
-    super->bytes_used = 0;
+    super->bytes_used = allocator.high_water();
     super->sector_size = sectorsize;
     super->node_size = nodesize;
     super->leaf_size = leafsize;
     super->checksum_type = CHECKSUM_TYPE_SHA256;
-    super->root_level = 1;
+    super->root_level = root_tree.root_level();
 //     dev_item_t dev_item;        // [123]
     memutils::copy_string(super->label, label, sizeof(super->label));
     calc_checksum(super, BLOCK_SIZE);
 
     vfs.write(device, 0, buffer, BLOCK_SIZE);
 
-    // generate first root of roots tree
-    fs_node_t* root_node = reinterpret_cast<fs_node_t*>(buffer);
-    memutils::fill_memory(buffer, 0, sizeof(buffer));
-
-    root_node->version = 1;
-    memutils::copy_memory(root_node->fsid, fsid, sizeof(root_node->fsid));
-    root_node->block_offset = 1*sectorsize;             // which block this node is supposed to live in
-    root_node->level = 1;
-    root_node->generation = 1;
-    uuid_generate(root_node->chunk_tree_uuid);
-    root_node->owner = 0;
-    root_node->numItems = 0;
-    calc_checksum(root_node, BLOCK_SIZE);
-
-    // stuff some nodes right next to the root node to make it load faster.
-
-    vfs.write(device, BLOCK_SIZE, buffer, BLOCK_SIZE);
-
     return 1;
 }
 
 int main(int argc, char** argv)
 {
-    if (argc != 4)
+    if (argc < 4 || argc > 7)
     {
-        std::cerr << "mkfs deviceName <create 1 or 0> <byte size>" << std::endl;
+        std::cerr << "mkfs deviceName <create 1 or 0> <byte size> [directory to import [compression [threads]]]"
+                  << std::endl;
+        std::cerr << "  compression: default codec and codecs for tags, e.g. zstd:3,type.jpg=none" << std::endl;
         return 111;
     }
 
     const char* fname = argv[1];
     int create = atoi(argv[2]);
-    size_t size = atoi(argv[3]);
-    block_cache_t cache(256);
+    size_t size = strtoull(argv[3], nullptr, 0);
+    const char* import_dir = argc > 4 ? argv[4] : nullptr;
+    compression_policy_t policy = parse_policy(argc > 5 ? argv[5] : "lz4");
+    unsigned threads = argc > 6 ? strtoul(argv[6], nullptr, 0) : std::thread::hardware_concurrency();
+    block_cache_t cache(import_dir ? 16384 : 256);
     block_device_t dev(fname, create, BLOCK_SIZE);
 
     vfs.set_cache(cache);
@@ -193,7 +257,7 @@ int main(int argc, char** argv)
 
     std::cerr << "Unwritten blocks before: " << cache.unwritten_blocks() << std::endl;
 
-    create_fs(device, size, "test_fs");
+    create_fs(device, size, "test_fs", import_dir, policy, threads);
 
     std::cerr << "Unwritten blocks after: " << cache.unwritten_blocks() << std::endl;
 
@@ -0,0 +1,363 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "objid_set.h"
+#include <algorithm>
+#include <cassert>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Below this size ratio intersections merge both lists, above it they search the larger list for every value
+ * of the smaller one.
+ */
+static const size_t GALLOP_RATIO = 32;
+
+//=====================================================================================================================
+// Sorted array kernels
+//=====================================================================================================================
+
+size_t objid_set_t::intersect_arrays_scalar(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out)
+{
+    size_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb)
+    {
+        uint32_t x = a[i], y = b[j];
+        out[n] = x;
+        n += x == y;
+        i += x <= y;
+        j += y <= x;
+    }
+    return n;
+}
+
+/**
+ * Append the union of a and b to out[0..n), leaving out values equal to the last one already there.
+ */
+static size_t unite_tail(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out, size_t n)
+{
+    size_t i = 0, j = 0;
+    while (i < na || j < nb)
+    {
+        uint32_t v;
+        if (j == nb || (i < na && a[i] < b[j]))
+            v = a[i++];
+        else if (i == na || b[j] < a[i])
+            v = b[j++];
+        else
+        {
+            v = a[i++];
+            ++j;
+        }
+        if (n == 0 || out[n - 1] != v)
+            out[n++] = v;
+    }
+    return n;
+}
+
+size_t objid_set_t::unite_arrays_scalar(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out)
+{
+    return unite_tail(a, na, b, nb, out, 0);
+}
+
+/**
+ * Find every value of the small list in the large one, narrowing the search with exponentially growing steps.
+ */
+static size_t intersect_gallop(const uint32_t* small, size_t ns, const uint32_t* large, size_t nl, uint32_t* out)
+{
+    size_t n = 0, lo = 0;
+    for (size_t i = 0; i < ns && lo < nl; ++i)
+    {
+        uint32_t x = small[i];
+        size_t bound = 1;
+        while (lo + bound < nl && large[lo + bound] < x)
+            bound <<= 1;
+        lo = std::lower_bound(large + lo, large + std::min(lo + bound + 1, nl), x) - large;
+        if (lo < nl && large[lo] == x)
+            out[n++] = x;
+    }
+    return n;
+}
+
+#if defined(__SSE2__)
+
+/**
+ * Compare blocks of four values from both lists all against all, with three rotations of one block.
+ * A value has at most one match, so a value of a found in one block is not found again in later ones.
+ */
+static size_t intersect_sse2(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out)
+{
+    size_t i = 0, j = 0, n = 0;
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+
+        // Matches are about as likely as not in dense lists, storing all four unconditionally avoids mispredictions.
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        for (int k = 0; k < 4; ++k)
+        {
+            out[n] = a[i + k];
+            n += (mask >> k) & 1;
+        }
+
+        uint32_t amax = a[i + 3], bmax = b[j + 3];
+        i += amax <= bmax ? 4 : 0;
+        j += bmax <= amax ? 4 : 0;
+    }
+    return n + objid_set_t::intersect_arrays_scalar(a + i, na - i, b + j, nb - j, out + n);
+}
+
+/**
+ * SSE2 only has signed comparisons, values are kept with the sign bit flipped so that they order as unsigned.
+ */
+static inline __m128i min_biased(__m128i a, __m128i b)
+{
+    __m128i lt = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+}
+
+static inline __m128i max_biased(__m128i a, __m128i b)
+{
+    __m128i lt = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(lt, b), _mm_andnot_si128(lt, a));
+}
+
+/**
+ * Bitonic merge network: from two sorted blocks of four make the sorted lower four in lo and upper four in hi.
+ */
+static inline void merge4(__m128i& lo, __m128i& hi)
+{
+    __m128i b = _mm_shuffle_epi32(hi, _MM_SHUFFLE(0, 1, 2, 3));
+    __m128i l = min_biased(lo, b);
+    __m128i h = max_biased(lo, b);
+
+    __m128i l1 = _mm_unpacklo_epi64(l, h);
+    __m128i h1 = _mm_unpackhi_epi64(l, h);
+    l = min_biased(l1, h1);
+    h = max_biased(l1, h1);
+
+    __m128i u = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(l), _mm_castsi128_ps(h), _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i v = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(l), _mm_castsi128_ps(h), _MM_SHUFFLE(3, 1, 3, 1)));
+    l = min_biased(u, v);
+    h = max_biased(u, v);
+
+    __m128i a = _mm_unpacklo_epi32(l, h);
+    __m128i c = _mm_unpackhi_epi32(l, h);
+    lo = _mm_unpacklo_epi64(a, c);
+    hi = _mm_unpackhi_epi64(a, c);
+}
+
+/**
+ * Merge four values at a time. The next block always comes from the list with the smaller head, so the lower half
+ * of every merge is final. Values present in both lists come out next to each other and are dropped when stored.
+ */
+static size_t unite_sse2(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out)
+{
+    if (na < 4 || nb < 4)
+        return objid_set_t::unite_arrays_scalar(a, na, b, nb, out);
+
+    const __m128i bias = _mm_set1_epi32(int(0x80000000));
+    __m128i lo = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)), bias);
+    __m128i hi = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)), bias);
+    size_t i = 4, j = 4, n = 0;
+    uint32_t block[4];
+    bool from_a;
+
+    while (true)
+    {
+        merge4(lo, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(block), _mm_xor_si128(lo, bias));
+        for (int k = 0; k < 4; ++k)
+        {
+            out[n] = block[k];
+            n += n == 0 || out[n - 1] != block[k];
+        }
+
+        from_a = j == nb || (i < na && a[i] <= b[j]);
+        const uint32_t* next = from_a ? a + i : b + j;
+        if ((from_a ? na - i : nb - j) < 4)
+            break;
+        lo = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(next)), bias);
+        (from_a ? i : j) += 4;
+    }
+
+    // Four merged values are left over, together with the rest of both lists. The list the next block was due from
+    // has less than four values left, merge those first.
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(block), _mm_xor_si128(hi, bias));
+    uint32_t merged[8];
+    if (from_a)
+        return unite_tail(merged, unite_tail(block, 4, a + i, na - i, merged, 0), b + j, nb - j, out, n);
+    return unite_tail(merged, unite_tail(block, 4, b + j, nb - j, merged, 0), a + i, na - i, out, n);
+}
+
+#endif // __SSE2__
+
+size_t objid_set_t::intersect_arrays(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out)
+{
+    if (na > nb)
+    {
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+    if (na == 0)
+        return 0;
+    if (nb / na >= GALLOP_RATIO)
+        return intersect_gallop(a, na, b, nb, out);
+#if defined(__SSE2__)
+    return intersect_sse2(a, na, b, nb, out);
+#else
+    return intersect_arrays_scalar(a, na, b, nb, out);
+#endif
+}
+
+size_t objid_set_t::unite_arrays(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out)
+{
+#if defined(__SSE2__)
+    return unite_sse2(a, na, b, nb, out);
+#else
+    return unite_arrays_scalar(a, na, b, nb, out);
+#endif
+}
+
+//=====================================================================================================================
+// objid_set_t
+//=====================================================================================================================
+
+void objid_set_t::append(uint64_t id)
+{
+    uint32_t high = id >> 32;
+    assert(count == 0 || id > back());
+    if (parts.empty() || parts.back().high != high)
+        parts.push_back({ high, {} });
+    parts.back().low.push_back(uint32_t(id));
+    ++count;
+}
+
+bool objid_set_t::contains(uint64_t id) const
+{
+    uint32_t high = id >> 32;
+    auto c = std::lower_bound(parts.begin(), parts.end(), high,
+        [](const container_t& c, uint32_t h) { return c.high < h; });
+    return c != parts.end() && c->high == high && std::binary_search(c->low.begin(), c->low.end(), uint32_t(id));
+}
+
+uint64_t objid_set_t::front() const
+{
+    assert(count);
+    return uint64_t(parts.front().high) << 32 | parts.front().low.front();
+}
+
+uint64_t objid_set_t::back() const
+{
+    assert(count);
+    return uint64_t(parts.back().high) << 32 | parts.back().low.back();
+}
+
+std::vector<uint64_t> objid_set_t::to_vector() const
+{
+    std::vector<uint64_t> ids;
+    ids.reserve(count);
+    for (auto& c : parts)
+        for (uint32_t low : c.low)
+            ids.push_back(uint64_t(c.high) << 32 | low);
+    return ids;
+}
+
+bool objid_set_t::operator ==(const objid_set_t& other) const
+{
+    if (count != other.count || parts.size() != other.parts.size())
+        return false;
+    for (size_t i = 0; i < parts.size(); ++i)
+        if (parts[i].high != other.parts[i].high || parts[i].low != other.parts[i].low)
+            return false;
+    return true;
+}
+
+objid_set_t objid_set_t::intersect(const objid_set_t& a, const objid_set_t& b)
+{
+    objid_set_t result;
+    auto x = a.parts.begin(), y = b.parts.begin();
+    while (x != a.parts.end() && y != b.parts.end())
+    {
+        if (x->high < y->high)
+            ++x;
+        else if (y->high < x->high)
+            ++y;
+        else
+        {
+            container_t c = { x->high, std::vector<uint32_t>(std::min(x->low.size(), y->low.size())) };
+            c.low.resize(intersect_arrays(x->low.data(), x->low.size(), y->low.data(), y->low.size(), c.low.data()));
+            if (!c.low.empty())
+            {
+                result.count += c.low.size();
+                result.parts.push_back(std::move(c));
+            }
+            ++x;
+            ++y;
+        }
+    }
+    return result;
+}
+
+objid_set_t objid_set_t::unite(const objid_set_t& a, const objid_set_t& b)
+{
+    objid_set_t result;
+    auto x = a.parts.begin(), y = b.parts.begin();
+    while (x != a.parts.end() || y != b.parts.end())
+    {
+        if (y == b.parts.end() || (x != a.parts.end() && x->high < y->high))
+            result.parts.push_back(*x++);
+        else if (x == a.parts.end() || y->high < x->high)
+            result.parts.push_back(*y++);
+        else
+        {
+            container_t c = { x->high, std::vector<uint32_t>(x->low.size() + y->low.size()) };
+            c.low.resize(unite_arrays(x->low.data(), x->low.size(), y->low.data(), y->low.size(), c.low.data()));
+            result.parts.push_back(std::move(c));
+            ++x;
+            ++y;
+        }
+        result.count += result.parts.back().low.size();
+    }
+    return result;
+}
+
+static bool smaller(const objid_set_t* a, const objid_set_t* b)
+{
+    return a->size() < b->size();
+}
+
+objid_set_t objid_set_t::intersect(std::vector<const objid_set_t*> sets)
+{
+    if (sets.empty())
+        return objid_set_t();
+    std::sort(sets.begin(), sets.end(), smaller);
+    objid_set_t result = *sets[0];
+    for (size_t i = 1; i < sets.size() && !result.empty(); ++i)
+        result = intersect(result, *sets[i]);
+    return result;
+}
+
+objid_set_t objid_set_t::unite(std::vector<const objid_set_t*> sets)
+{
+    if (sets.empty())
+        return objid_set_t();
+    std::sort(sets.begin(), sets.end(), smaller);
+    objid_set_t result = *sets[0];
+    for (size_t i = 1; i < sets.size(); ++i)
+        result = unite(result, *sets[i]);
+    return result;
+}
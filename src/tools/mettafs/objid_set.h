@@ -0,0 +1,76 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Sorted set of object ids, the in-memory form of tag posting lists.
+ *
+ * Ids are grouped roaring style into containers by their high 32 bits, every container keeps the low 32 bits of its
+ * ids in a sorted array. Set operations go container by container and work on 32-bit lanes, four at a time with SSE2
+ * where available. Intersections of lists of very different sizes gallop through the larger one instead.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class objid_set_t
+{
+public:
+    struct container_t
+    {
+        uint32_t high;
+        std::vector<uint32_t> low;
+    };
+
+    objid_set_t() : count(0) {}
+
+    /**
+     * Add id after all ids already in the set.
+     */
+    void append(uint64_t id);
+
+    bool contains(uint64_t id) const;
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    uint64_t front() const;
+    uint64_t back() const;
+
+    const std::vector<container_t>& containers() const { return parts; }
+    std::vector<uint64_t> to_vector() const;
+
+    bool operator ==(const objid_set_t& other) const;
+    bool operator !=(const objid_set_t& other) const { return !(*this == other); }
+
+    static objid_set_t intersect(const objid_set_t& a, const objid_set_t& b);
+    static objid_set_t unite(const objid_set_t& a, const objid_set_t& b);
+
+    /**
+     * Intersect starting from the smallest set, so intermediate results stay small. Unite the smallest sets first.
+     */
+    static objid_set_t intersect(std::vector<const objid_set_t*> sets);
+    static objid_set_t unite(std::vector<const objid_set_t*> sets);
+
+    /**
+     * Operations on sorted arrays of unique values. The output needs room for min(na, nb) values for an intersection
+     * and na + nb values for a union.
+     * @return number of values written.
+     */
+    static size_t intersect_arrays(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out);
+    static size_t unite_arrays(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out);
+
+    /**
+     * Plain merge versions, for reference and benchmarking.
+     */
+    static size_t intersect_arrays_scalar(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out);
+    static size_t unite_arrays_scalar(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out);
+
+private:
+    std::vector<container_t> parts;
+    size_t count;
+};
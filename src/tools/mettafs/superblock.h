@@ -143,3 +143,44 @@ struct fs_key_ptr_t {
 struct fs_node_t : public btree_block_header_t {
 	fs_key_ptr_t ptrs[];
 } PACKED;
+
+/**
+ * Trees are found through the root of roots tree, which keeps a root item for every tree under key
+ * (tree objectid, ROOT_ITEM, 0).
+ */
+static const uint64_t EXTENT_TREE_OBJECTID = 2; // data extents and their content hashes
+static const uint64_t OBJECT_TREE_OBJECTID = 3; // files: their metadata, names and extents
+static const uint64_t TAG_TREE_OBJECTID = 4;    // tag index, see tag_index.h
+static const uint8_t ROOT_ITEM = 1;
+
+struct fs_root_item_t
+{
+    fs_location_t root;     // [  0] root block of the tree, 0 for an empty tree
+    uint64_t generation;    // [  8] generation the tree was committed at
+    uint8_t level;          // [ 16] level of the root block
+} PACKED; // 17 bytes
+
+/**
+ * Object tree keys, every object (file) has an inode item, a name item and an extent item for every extent of
+ * its data:
+ *   (objid, OBJECT_INODE_ITEM, 0)          -> object_inode_item_t
+ *   (objid, OBJECT_NAME_ITEM, 0)           -> path name the object was imported from
+ *   (objid, OBJECT_EXTENT_ITEM, file offset) -> object_extent_item_t
+ */
+static const uint64_t FIRST_OBJECTID = 256;
+static const uint8_t OBJECT_INODE_ITEM = 1;
+static const uint8_t OBJECT_NAME_ITEM = 2;
+static const uint8_t OBJECT_EXTENT_ITEM = 3;
+
+struct object_inode_item_t
+{
+    uint64_t size;          // [  0] bytes of data
+    uint64_t mtime;         // [  8] modification time, nanoseconds since the epoch
+    uint32_t mode;          // [ 16] permission bits
+} PACKED; // 20 bytes
+
+struct object_extent_item_t
+{
+    fs_location_t location; // [  0] extent in the extent tree, possibly shared with other objects
+    uint64_t ram_bytes;     // [  8] bytes of file data in the extent
+} PACKED; // 16 bytes
@@ -0,0 +1,520 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "tag_index.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+//=====================================================================================================================
+// tag_trie_t
+//=====================================================================================================================
+
+tag_trie_t::node_t* tag_trie_t::node_t::child(char c) const
+{
+    auto it = std::lower_bound(children.begin(), children.end(), c,
+        [](const std::unique_ptr<node_t>& n, char c) { return n->label[0] < c; });
+    return it != children.end() && (*it)->label[0] == c ? it->get() : nullptr;
+}
+
+uint64_t tag_trie_t::find(const std::string& name) const
+{
+    const node_t* node = &root;
+    size_t pos = 0;
+    while (pos < name.size())
+    {
+        node = node->child(name[pos]);
+        if (!node || name.compare(pos, node->label.size(), node->label) != 0)
+            return 0;
+        pos += node->label.size();
+    }
+    return node->value;
+}
+
+void tag_trie_t::insert(const std::string& name, uint64_t value)
+{
+    node_t* node = &root;
+    size_t pos = 0;
+    while (pos < name.size())
+    {
+        auto it = std::lower_bound(node->children.begin(), node->children.end(), name[pos],
+            [](const std::unique_ptr<node_t>& n, char c) { return n->label[0] < c; });
+
+        if (it == node->children.end() || (*it)->label[0] != name[pos])
+        {
+            std::unique_ptr<node_t> leaf(new node_t);
+            leaf->label = name.substr(pos);
+            leaf->value = value;
+            node->children.insert(it, std::move(leaf));
+            ++count;
+            return;
+        }
+
+        node_t* next = it->get();
+        size_t common = 1;
+        while (common < next->label.size() && pos + common < name.size() && next->label[common] == name[pos + common])
+            ++common;
+
+        // Split the edge where the names part, the new node takes over the old node's place among its siblings.
+        if (common < next->label.size())
+        {
+            std::unique_ptr<node_t> mid(new node_t);
+            mid->label = next->label.substr(0, common);
+            next->label.erase(0, common);
+            mid->children.push_back(std::move(*it));
+            *it = std::move(mid);
+            next = it->get();
+        }
+
+        node = next;
+        pos += common;
+    }
+
+    if (!node->value)
+        ++count;
+    node->value = value;
+}
+
+void tag_trie_t::with_prefix(const std::string& prefix, const std::function<void (const std::string&, uint64_t)>& fn) const
+{
+    const node_t* node = &root;
+    std::string name;
+    size_t pos = 0;
+    while (pos < prefix.size())
+    {
+        node = node->child(prefix[pos]);
+        if (!node)
+            return;
+        size_t len = std::min(node->label.size(), prefix.size() - pos);
+        if (node->label.compare(0, len, prefix, pos, len) != 0)
+            return;
+        name += node->label;
+        pos += node->label.size();
+    }
+    visit(node, name, fn);
+}
+
+void tag_trie_t::visit(const node_t* node, std::string& name, const std::function<void (const std::string&, uint64_t)>& fn) const
+{
+    if (node->value)
+        fn(name, node->value);
+    for (auto& child : node->children)
+    {
+        size_t len = name.size();
+        name += child->label;
+        visit(child.get(), name, fn);
+        name.resize(len);
+    }
+}
+
+//=====================================================================================================================
+// Posting chunks
+//=====================================================================================================================
+
+/**
+ * Gaps are written at most 32 bits at a time, a 64-bit accumulator then never overflows.
+ */
+class bit_writer_t
+{
+    uint8_t* out;
+    uint64_t acc;
+    unsigned used;
+
+public:
+    explicit bit_writer_t(uint8_t* to) : out(to), acc(0), used(0) {}
+
+    void put(uint32_t value, unsigned bits)
+    {
+        acc |= uint64_t(value) << used;
+        used += bits;
+        while (used >= 8)
+        {
+            *out++ = uint8_t(acc);
+            acc >>= 8;
+            used -= 8;
+        }
+    }
+
+    void flush()
+    {
+        if (used)
+            *out++ = uint8_t(acc);
+    }
+};
+
+/**
+ * Read bits at bit offset pos of the gaps, up to 56 bits with a single unaligned load away from the end.
+ */
+static inline uint64_t read_bits(const uint8_t* gaps, size_t size, size_t pos, unsigned bits)
+{
+    size_t byte = pos >> 3;
+    uint64_t word = 0;
+    if (byte + sizeof(word) <= size)
+        memcpy(&word, gaps + byte, sizeof(word));
+    else
+        memcpy(&word, gaps + byte, size - byte);
+    return (word >> (pos & 7)) & ((1ull << bits) - 1);
+}
+
+static fs_key_t name_key(uint64_t tag)
+{
+    fs_key_t key;
+    key.objectid = TAG_NAMES_OBJECTID;
+    key.type = TAG_NAME_ITEM;
+    key.offset = tag;
+    return key;
+}
+
+static fs_key_t posting_key(uint64_t tag, uint64_t objid)
+{
+    fs_key_t key;
+    key.objectid = tag;
+    key.type = TAG_POSTING_ITEM;
+    key.offset = objid;
+    return key;
+}
+
+static unsigned gap_bits(const uint64_t* ids, size_t n)
+{
+    uint64_t gaps = 0;
+    for (size_t i = 1; i < n; ++i)
+        gaps |= ids[i] - ids[i - 1] - 1;
+    return gaps ? 64 - __builtin_clzll(gaps) : 0;
+}
+
+static size_t chunk_bytes(size_t n, unsigned bits)
+{
+    return sizeof(posting_chunk_t) + ((n - 1) * bits + 7) / 8;
+}
+
+static void encode_chunk(const uint64_t* ids, size_t n, unsigned bits, std::vector<char>& out)
+{
+    out.assign(chunk_bytes(n, bits), 0);
+    posting_chunk_t* chunk = reinterpret_cast<posting_chunk_t*>(&out[0]);
+    chunk->count = n;
+    chunk->bits = bits;
+    chunk->reserved = 0;
+
+    bit_writer_t writer(chunk->gaps);
+    for (size_t i = 1; i < n; ++i)
+    {
+        uint64_t gap = ids[i] - ids[i - 1] - 1;
+        if (bits > 32)
+        {
+            writer.put(uint32_t(gap), 32);
+            writer.put(uint32_t(gap >> 32), bits - 32);
+        }
+        else
+            writer.put(uint32_t(gap), bits);
+    }
+    writer.flush();
+}
+
+/**
+ * Decode the chunk starting at first to out, which has room for CHUNK_OBJIDS ids.
+ * @return number of ids.
+ */
+static size_t decode_chunk(uint64_t first, const char* data, size_t size, uint64_t* out)
+{
+    const posting_chunk_t* chunk = reinterpret_cast<const posting_chunk_t*>(data);
+    if (size < sizeof(posting_chunk_t) || chunk->count == 0 || chunk->count > tag_index_t::CHUNK_OBJIDS
+        || chunk->bits > 64 || size < chunk_bytes(chunk->count, chunk->bits))
+        throw std::runtime_error("Corrupt tag posting chunk");
+
+    size_t n = chunk->count;
+    unsigned bits = chunk->bits;
+    const uint8_t* gaps = chunk->gaps;
+    size = chunk_bytes(n, bits) - sizeof(posting_chunk_t);
+    out[0] = first;
+
+    if (bits <= 56)
+    {
+        for (size_t i = 1, pos = 0; i < n; ++i, pos += bits)
+            out[i] = out[i - 1] + read_bits(gaps, size, pos, bits) + 1;
+    }
+    else
+    {
+        for (size_t i = 1, pos = 0; i < n; ++i, pos += bits)
+            out[i] = out[i - 1] + (read_bits(gaps, size, pos, 32) | read_bits(gaps, size, pos + 32, bits - 32) << 32) + 1;
+    }
+    return n;
+}
+
+//=====================================================================================================================
+// tag_index_t
+//=====================================================================================================================
+
+const size_t tag_index_t::CHUNK_OBJIDS;
+
+tag_index_t::tag_index_t(btree_t& t)
+    : tree(t)
+    , counts(1)
+    , tag_names(1)
+{
+}
+
+void tag_index_t::load()
+{
+    names = tag_trie_t();
+    counts.assign(1, 0);
+    tag_names.assign(1, std::string());
+
+    tree.scan(name_key(0), name_key(~0ull), [this](const fs_key_t& key, const char* data, size_t size) {
+        if (size < sizeof(tag_name_item_t) || key.offset == 0)
+            throw std::runtime_error("Corrupt tag name item");
+        const tag_name_item_t* item = reinterpret_cast<const tag_name_item_t*>(data);
+        if (key.offset >= counts.size())
+        {
+            counts.resize(key.offset + 1);
+            tag_names.resize(key.offset + 1);
+        }
+        counts[key.offset] = item->count;
+        tag_names[key.offset].assign(item->name, size - sizeof(tag_name_item_t));
+        names.insert(tag_names[key.offset], key.offset);
+        return true;
+    });
+}
+
+void tag_index_t::build(const std::map<std::string, std::vector<uint64_t>>& tags)
+{
+    if (tree.root() || names.size())
+        throw std::runtime_error("Tag index is not empty");
+
+    btree_bulk_loader_t loader(tree);
+    std::vector<char> buf;
+
+    // Tag ids follow name order, so names and then posting lists of every tag come in key order.
+    uint64_t tag = 1;
+    for (auto& t : tags)
+    {
+        if (t.first.empty() || t.first.size() + sizeof(tag_name_item_t) > tree.max_item_size())
+            throw std::runtime_error("Bad tag name " + t.first);
+        buf.resize(sizeof(tag_name_item_t) + t.first.size());
+        tag_name_item_t* item = reinterpret_cast<tag_name_item_t*>(&buf[0]);
+        item->count = t.second.size();
+        memcpy(item->name, t.first.data(), t.first.size());
+        loader.add(name_key(tag), &buf[0], buf.size());
+
+        names.insert(t.first, tag);
+        counts.push_back(t.second.size());
+        tag_names.push_back(t.first);
+        ++tag;
+    }
+
+    tag = 1;
+    for (auto& t : tags)
+    {
+        const std::vector<uint64_t>& ids = t.second;
+        for (size_t pos = 0; pos < ids.size();)
+        {
+            size_t n = std::min(CHUNK_OBJIDS, ids.size() - pos);
+            unsigned bits;
+            while (chunk_bytes(n, bits = gap_bits(&ids[pos], n)) > tree.max_item_size())
+                n /= 2;
+            encode_chunk(&ids[pos], n, bits, buf);
+            loader.add(posting_key(tag, ids[pos]), &buf[0], buf.size());
+            pos += n;
+        }
+        ++tag;
+    }
+
+    loader.finish();
+}
+
+uint64_t tag_index_t::create_tag(const std::string& name)
+{
+    uint64_t tag = names.find(name);
+    if (tag)
+        return tag;
+
+    if (name.empty() || name.size() + sizeof(tag_name_item_t) > tree.max_item_size())
+        throw std::runtime_error("Bad tag name " + name);
+
+    tag = counts.size();
+    names.insert(name, tag);
+    counts.push_back(0);
+    tag_names.push_back(name);
+    store_name(tag);
+    return tag;
+}
+
+void tag_index_t::store_name(uint64_t tag)
+{
+    const std::string& name = tag_names[tag];
+    std::vector<char> buf(sizeof(tag_name_item_t) + name.size());
+    tag_name_item_t* item = reinterpret_cast<tag_name_item_t*>(&buf[0]);
+    item->count = counts[tag];
+    memcpy(item->name, name.data(), name.size());
+    tree.update(name_key(tag), &buf[0], buf.size());
+}
+
+/**
+ * Find the chunk where objid belongs: the one starting at or before it, or the first chunk of the tag for ids
+ * below all of its objects.
+ * @return false if the tag has no objects.
+ */
+bool tag_index_t::read_chunk(uint64_t tag, uint64_t objid, fs_key_t& key, std::vector<uint64_t>& ids)
+{
+    std::vector<char> data;
+    ids.resize(CHUNK_OBJIDS);
+
+    if (tree.find_floor(posting_key(tag, objid), &key, &data) && key.objectid == tag && key.type == TAG_POSTING_ITEM)
+    {
+        ids.resize(decode_chunk(key.offset, &data[0], data.size(), &ids[0]));
+        return true;
+    }
+
+    size_t n = 0;
+    tree.scan(posting_key(tag, 0), posting_key(tag, ~0ull), [&](const fs_key_t& k, const char* d, size_t size) {
+        key = k;
+        n = decode_chunk(k.offset, d, size, &ids[0]);
+        return false;
+    });
+    ids.resize(n);
+    return n > 0;
+}
+
+/**
+ * Replace the chunk at old_key with ids, in as many chunks as they take. Chunks overflowing after an append
+ * at their end are left full, others are split in even parts.
+ */
+void tag_index_t::write_chunk(uint64_t tag, const fs_key_t* old_key, const std::vector<uint64_t>& ids, bool append)
+{
+    if (old_key && (ids.empty() || ids.front() != old_key->offset))
+        tree.remove(*old_key);
+
+    std::vector<char> buf;
+    size_t parts = (ids.size() + CHUNK_OBJIDS - 1) / CHUNK_OBJIDS;
+    for (size_t pos = 0; pos < ids.size();)
+    {
+        size_t rest = ids.size() - pos;
+        size_t n = std::min(CHUNK_OBJIDS, append ? rest : (rest + parts - 1) / parts);
+        unsigned bits;
+        while (chunk_bytes(n, bits = gap_bits(&ids[pos], n)) > tree.max_item_size())
+            n /= 2;
+        encode_chunk(&ids[pos], n, bits, buf);
+        tree.update(posting_key(tag, ids[pos]), &buf[0], buf.size());
+        pos += n;
+        if (parts > 1)
+            --parts;
+    }
+}
+
+bool tag_index_t::add(const std::string& name, uint64_t objid)
+{
+    uint64_t tag = create_tag(name);
+    fs_key_t key;
+    std::vector<uint64_t> ids;
+
+    if (!read_chunk(tag, objid, key, ids))
+    {
+        ids.push_back(objid);
+        write_chunk(tag, nullptr, ids, false);
+    }
+    else
+    {
+        auto it = std::lower_bound(ids.begin(), ids.end(), objid);
+        if (it != ids.end() && *it == objid)
+            return false;
+        bool append = it == ids.end();
+        ids.insert(it, objid);
+        write_chunk(tag, &key, ids, append);
+    }
+
+    ++counts[tag];
+    store_name(tag);
+    return true;
+}
+
+bool tag_index_t::remove(const std::string& name, uint64_t objid)
+{
+    uint64_t tag = names.find(name);
+    fs_key_t key;
+    std::vector<uint64_t> ids;
+
+    if (!tag || !read_chunk(tag, objid, key, ids))
+        return false;
+
+    auto it = std::lower_bound(ids.begin(), ids.end(), objid);
+    if (it == ids.end() || *it != objid)
+        return false;
+    ids.erase(it);
+    write_chunk(tag, &key, ids, false);
+
+    --counts[tag];
+    store_name(tag);
+    return true;
+}
+
+objid_set_t tag_index_t::objects(uint64_t tag, uint64_t from, uint64_t to)
+{
+    objid_set_t result;
+    if (!tag || tag >= counts.size() || from > to)
+        return result;
+
+    fs_key_t start;
+    if (!tree.find_floor(posting_key(tag, from), &start) || start.objectid != tag || start.type != TAG_POSTING_ITEM)
+        start = posting_key(tag, 0);
+
+    uint64_t ids[CHUNK_OBJIDS];
+    tree.scan(start, posting_key(tag, to), [&](const fs_key_t& key, const char* data, size_t size) {
+        size_t n = decode_chunk(key.offset, data, size, ids);
+        for (size_t i = 0; i < n; ++i)
+            if (ids[i] >= from && ids[i] <= to)
+                result.append(ids[i]);
+        return true;
+    });
+    return result;
+}
+
+objid_set_t tag_index_t::objects_under(const std::string& name)
+{
+    std::vector<objid_set_t> sets;
+    names.with_prefix(name, [&](const std::string& found, uint64_t tag) {
+        if (found.size() == name.size() || found[name.size()] == '.')
+            sets.push_back(objects(tag));
+    });
+
+    std::vector<const objid_set_t*> ptrs;
+    for (auto& s : sets)
+        ptrs.push_back(&s);
+    return objid_set_t::unite(ptrs);
+}
+
+objid_set_t tag_index_t::match_all(const std::vector<std::string>& tags)
+{
+    std::vector<uint64_t> ids;
+    for (auto& name : tags)
+    {
+        uint64_t tag = names.find(name);
+        if (!tag)
+            return objid_set_t();
+        ids.push_back(tag);
+    }
+    if (ids.empty())
+        return objid_set_t();
+
+    std::sort(ids.begin(), ids.end(), [this](uint64_t a, uint64_t b) { return counts[a] < counts[b]; });
+
+    objid_set_t result = objects(ids[0]);
+    for (size_t i = 1; i < ids.size() && !result.empty(); ++i)
+        result = objid_set_t::intersect(result, objects(ids[i], result.front(), result.back()));
+    return result;
+}
+
+objid_set_t tag_index_t::match_any(const std::vector<std::string>& tags)
+{
+    std::vector<objid_set_t> sets;
+    for (auto& name : tags)
+        sets.push_back(objects(name));
+
+    std::vector<const objid_set_t*> ptrs;
+    for (auto& s : sets)
+        ptrs.push_back(&s);
+    return objid_set_t::unite(ptrs);
+}
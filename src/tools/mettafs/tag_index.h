@@ -0,0 +1,156 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Tag index: which objects carry which tags.
+ *
+ * Tag names are dotted paths, like "media.photo.raw". Names map to tag ids through a patricia trie, which also
+ * answers prefix queries for whole branches of the name hierarchy.
+ *
+ * For every tag the tag tree keeps the sorted ids of objects having it, its posting list, in a contiguous range of
+ * chunk items. A chunk holds up to CHUNK_OBJIDS ids, keyed by the first one, with the gaps between the following
+ * ids bit-packed at the width of the largest gap. Densely used tags cost a few bits per object.
+ *
+ * Tag tree keys:
+ *   (TAG_NAMES_OBJECTID, TAG_NAME_ITEM, tag id)  -> tag_name_item_t, number of objects and name of the tag
+ *   (tag id, TAG_POSTING_ITEM, first object id)  -> posting_chunk_t
+ */
+#pragma once
+
+#include "btree.h"
+#include "objid_set.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+static const uint64_t TAG_NAMES_OBJECTID = 0; //!< Tag ids start at 1, all names sort before all posting lists.
+static const uint8_t TAG_NAME_ITEM = 1;
+static const uint8_t TAG_POSTING_ITEM = 2;
+
+struct tag_name_item_t
+{
+    uint64_t count; //!< Number of objects with the tag.
+    char name[];
+} PACKED;
+
+struct posting_chunk_t
+{
+    uint16_t count;   //!< Object ids in the chunk, including the first one in the item key.
+    uint8_t bits;     //!< Width of every packed gap.
+    uint8_t reserved;
+    uint8_t gaps[];   //!< count - 1 values of (id - previous id - 1), LSB first.
+} PACKED;
+
+/**
+ * Patricia trie of tag names. Edges are labelled with whole name fragments, so shared prefixes of dotted names are
+ * stored once and a prefix query walks a single path.
+ */
+class tag_trie_t
+{
+    struct node_t
+    {
+        std::string label; //!< Fragment on the edge leading here.
+        uint64_t value;    //!< Tag id if a name ends here, or 0.
+        std::vector<std::unique_ptr<node_t>> children; //!< Ordered by the first label character.
+
+        node_t() : value(0) {}
+        node_t* child(char c) const;
+    };
+
+    node_t root;
+    size_t count;
+
+    void visit(const node_t* node, std::string& name, const std::function<void (const std::string&, uint64_t)>& fn) const;
+
+public:
+    tag_trie_t() : count(0) {}
+
+    /**
+     * @return tag id for name, 0 if there is no such tag.
+     */
+    uint64_t find(const std::string& name) const;
+    void insert(const std::string& name, uint64_t value);
+
+    /**
+     * Call fn for every name starting with prefix, in name order.
+     */
+    void with_prefix(const std::string& prefix, const std::function<void (const std::string&, uint64_t)>& fn) const;
+
+    size_t size() const { return count; }
+};
+
+class tag_index_t
+{
+public:
+    static const size_t CHUNK_OBJIDS = 128;
+
+    /**
+     * Index kept in tree. Call load() to pick up the tags of an existing tree.
+     */
+    explicit tag_index_t(btree_t& tree);
+
+    void load();
+
+    /**
+     * Write the whole index to the empty tree at once, tags given with the sorted ids of their objects.
+     */
+    void build(const std::map<std::string, std::vector<uint64_t>>& tags);
+
+    /**
+     * @return id of the tag, 0 if there is no such tag.
+     */
+    uint64_t find_tag(const std::string& name) const { return names.find(name); }
+    uint64_t create_tag(const std::string& name);
+    size_t tag_count() const { return names.size(); }
+
+    /**
+     * Number of objects with the tag.
+     */
+    uint64_t tag_size(uint64_t tag) const { return tag < counts.size() ? counts[tag] : 0; }
+
+    /**
+     * Tag an object, creating the tag if needed.
+     * @return false if the object already had the tag.
+     */
+    bool add(const std::string& tag, uint64_t objid);
+    bool remove(const std::string& tag, uint64_t objid);
+
+    /**
+     * Objects with the tag and ids in [from, to]; only the chunks overlapping the range are read.
+     */
+    objid_set_t objects(uint64_t tag, uint64_t from = 0, uint64_t to = ~0ull);
+    objid_set_t objects(const std::string& tag) { return objects(find_tag(tag)); }
+
+    /**
+     * Objects with the tag or any tag below it in the name hierarchy.
+     */
+    objid_set_t objects_under(const std::string& tag);
+
+    /**
+     * Objects with all of the tags. Posting lists are read from the least used tag on, each only in the range
+     * of ids still in the running result.
+     */
+    objid_set_t match_all(const std::vector<std::string>& tags);
+
+    /**
+     * Objects with any of the tags.
+     */
+    objid_set_t match_any(const std::vector<std::string>& tags);
+
+private:
+    btree_t& tree;
+    tag_trie_t names;
+    std::vector<uint64_t> counts; //!< Indexed by tag id.
+    std::vector<std::string> tag_names; //!< Indexed by tag id.
+
+    void store_name(uint64_t tag);
+    bool read_chunk(uint64_t tag, uint64_t objid, fs_key_t& key, std::vector<uint64_t>& ids);
+    void write_chunk(uint64_t tag, const fs_key_t* old_key, const std::vector<uint64_t>& ids, bool append);
+};
@@ -0,0 +1,242 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief Block cache throughput benchmark.
+ *
+ * Runs sequential and random reads and writes through the cache, first with synchronous write-back only,
+ * then with the background write-back and read-ahead engine. Measures how random access scales with the number of
+ * threads sharing the cache, and compares read-only access through the cache with a memory-mapped device.
+ *
+ * Usage: bench_block_cache [-d] [device file]
+ *   -d  open the device for direct I/O, bypassing the host page cache
+ */
+
+/*============================================================================*/
+
+#include "block_cache.h"
+#include "block_device_mapper.h"
+#include <chrono>
+#include <random>
+#include <thread>
+#include <iostream>
+
+static const size_t BLOCK_SIZE = 4096;
+static const size_t CACHE_BLOCKS = 4096;
+static const size_t DEVICE_BLOCKS = 4 * CACHE_BLOCKS;
+static const size_t OPERATIONS = 200000;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static block_device_t* device;
+static size_t last_requests;
+static unsigned device_options;
+
+static void report(const char* what, size_t ops, bench_clock::duration elapsed)
+{
+    size_t requests = device->read_requests() + device->write_requests();
+    double secs = std::chrono::duration<double>(elapsed).count();
+    std::cout << "  " << what << ": " << ops << " ops in " << secs * 1000 << " ms, "
+              << size_t(ops / secs) << " ops/s, " << size_t(ops * BLOCK_SIZE / secs / (1024*1024)) << " MiB/s, "
+              << requests - last_requests << " device requests" << std::endl;
+    last_requests = requests;
+}
+
+static void sequential_write(block_cache_t& cache, deviceno_t dev)
+{
+    char buffer[BLOCK_SIZE] = { 0 };
+    auto start = bench_clock::now();
+    for (block_device_t::blockno_t b = 0; b < DEVICE_BLOCKS; ++b)
+        cache.cached_write(dev, b, buffer, 1, BLOCK_SIZE);
+    cache.flush(dev);
+    report("sequential write", DEVICE_BLOCKS, bench_clock::now() - start);
+}
+
+static void random_write(block_cache_t& cache, deviceno_t dev)
+{
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<block_device_t::blockno_t> pick(0, DEVICE_BLOCKS - 1);
+    char buffer[BLOCK_SIZE] = { 0 };
+
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < OPERATIONS; ++i)
+        cache.cached_write(dev, pick(rng), buffer, 1, BLOCK_SIZE);
+    cache.flush(dev);
+    report("random write", OPERATIONS, bench_clock::now() - start);
+}
+
+static void sequential_read(block_cache_t& cache, deviceno_t dev)
+{
+    char buffer[BLOCK_SIZE];
+    auto start = bench_clock::now();
+    for (block_device_t::blockno_t b = 0; b < DEVICE_BLOCKS; ++b)
+        cache.cached_read(dev, b, buffer, 1, BLOCK_SIZE);
+    report("sequential read", DEVICE_BLOCKS, bench_clock::now() - start);
+}
+
+/**
+ * Read random blocks from the first "working_set" blocks of the device, after warming up the cache.
+ */
+static void random_read(block_cache_t& cache, deviceno_t dev, size_t working_set, const char* what)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<block_device_t::blockno_t> pick(0, working_set - 1);
+    char buffer[BLOCK_SIZE];
+
+    for (block_device_t::blockno_t b = 0; b < working_set && b < CACHE_BLOCKS; ++b)
+        cache.cached_read(dev, b, buffer, 1, BLOCK_SIZE);
+
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < OPERATIONS; ++i)
+        cache.cached_read(dev, pick(rng), buffer, 1, BLOCK_SIZE);
+    report(what, OPERATIONS, bench_clock::now() - start);
+}
+
+/**
+ * Random reads, and writes for one in "write_every" operations, from a number of threads at once.
+ * The working set fits the cache, so this measures cache overhead and contention rather than the device.
+ */
+static void scaling(block_cache_t& cache, deviceno_t dev, size_t nthreads, size_t write_every, const char* what)
+{
+    size_t working_set = CACHE_BLOCKS / 2;
+    std::vector<std::thread> threads;
+
+    auto start = bench_clock::now();
+    for (size_t t = 0; t < nthreads; ++t)
+    {
+        threads.emplace_back([&cache, dev, t, nthreads, working_set, write_every] {
+            std::mt19937 rng(t);
+            std::uniform_int_distribution<block_device_t::blockno_t> pick(0, working_set - 1);
+            char buffer[BLOCK_SIZE] = { 0 };
+
+            for (size_t i = 0; i < OPERATIONS / nthreads; ++i)
+            {
+                if (write_every && i % write_every == 0)
+                    cache.cached_write(dev, pick(rng), buffer, 1, BLOCK_SIZE);
+                else
+                    cache.cached_read(dev, pick(rng), buffer, 1, BLOCK_SIZE);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    auto elapsed = bench_clock::now() - start;
+
+    std::cout << "  " << nthreads << " threads, ";
+    report(what, OPERATIONS / nthreads * nthreads, elapsed);
+}
+
+static void run(const char* fname, bool write_back)
+{
+    block_device_t dev_file(fname, true, BLOCK_SIZE, DEVICE_BLOCKS, device_options);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "bench");
+    device = &dev_file;
+    last_requests = 0;
+    deviceno_t dev = mapper.resolve_device("bench");
+
+    if (write_back)
+        cache.start_write_back();
+
+    std::cout << (write_back ? "Background write-back and read-ahead" : "Synchronous write-back, no read-ahead")
+              << (dev_file.direct_io() ? ", direct I/O:" : ":") << std::endl;
+
+    sequential_write(cache, dev);
+    random_write(cache, dev);
+    cache.flush(dev);
+    sequential_read(cache, dev);
+    cache.flush(dev);
+    random_read(cache, dev, DEVICE_BLOCKS, "random read, mostly miss");
+    random_read(cache, dev, CACHE_BLOCKS / 2, "random read, hit");
+
+    if (write_back)
+    {
+        std::cout << "Scaling over " << cache.shard_count() << " cache shards:" << std::endl;
+        for (size_t nthreads = 1; nthreads <= 8; nthreads *= 2)
+            scaling(cache, dev, nthreads, 0, "random read, hit");
+        for (size_t nthreads = 1; nthreads <= 8; nthreads *= 2)
+            scaling(cache, dev, nthreads, 5, "random read/write 4:1");
+    }
+
+    mapper.unmap_device(dev);
+}
+
+/**
+ * Random blocks used in place through references instead of being copied out.
+ */
+static void random_ref(block_cache_t& cache, deviceno_t dev, size_t working_set, const char* what)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<block_device_t::blockno_t> pick(0, working_set - 1);
+    size_t sum = 0;
+
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < OPERATIONS; ++i)
+    {
+        block_ref_t ref = cache.cached_ref(dev, pick(rng), BLOCK_SIZE);
+        sum += ref.data()[i % BLOCK_SIZE];
+    }
+    report(what, OPERATIONS, bench_clock::now() - start);
+    if (sum == size_t(-1))
+        std::cout << sum; // Keep the loads.
+}
+
+/**
+ * Read-only access to the image left by run(), through the cache and through a memory mapping.
+ */
+static void run_mapped(const char* fname)
+{
+    block_device_t dev_file(fname, false, BLOCK_SIZE, DEVICE_BLOCKS, device_options | block_device_t::READ_ONLY);
+    mapped_block_device_t map_file(fname, BLOCK_SIZE);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "bench");
+    mapper.map_device(map_file, "mapped");
+    deviceno_t dev = mapper.resolve_device("bench");
+    deviceno_t mapped = mapper.resolve_device("mapped");
+
+    device = &dev_file;
+    last_requests = 0;
+    std::cout << "Read-only, cached:" << std::endl;
+    sequential_read(cache, dev);
+    random_read(cache, dev, CACHE_BLOCKS / 2, "random read, hit");
+    random_ref(cache, dev, CACHE_BLOCKS / 2, "random reference, hit");
+
+    device = &map_file;
+    last_requests = 0;
+    std::cout << "Read-only, mapped:" << std::endl;
+    sequential_read(cache, mapped);
+    random_read(cache, mapped, DEVICE_BLOCKS, "random read");
+    random_ref(cache, mapped, DEVICE_BLOCKS, "random reference");
+
+    mapper.unmap_device(mapped);
+    mapper.unmap_device(dev);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "-d")
+    {
+        device_options = block_device_t::DIRECT_IO;
+        --argc;
+        ++argv;
+    }
+    const char* fname = argc > 1 ? argv[1] : "bench_block_cache.img";
+
+    run(fname, false);
+    run(fname, true);
+    run_mapped(fname);
+    return 0;
+}
@@ -0,0 +1,168 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief On-disk B+tree benchmark.
+ *
+ * Bulk loads a tree with the given number of keys, then measures random point lookups, range scans and random inserts
+ * committed in batches, as mettafs would run them through the block cache. Lookups and scans check what they find.
+ *
+ * Usage: bench_btree [keys] [device file]
+ * Returns non-zero if the tree returned wrong results.
+ */
+
+/*============================================================================*/
+
+#include "btree.h"
+#include "block_device_mapper.h"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdlib>
+
+static const size_t NODE_SIZE = 4096;
+static const size_t CACHE_BLOCKS = 65536;
+static const fs_location_t DEVICE_BYTES = 16ull << 30; // Sparse, only the used part is ever written.
+static const size_t LOOKUPS = 1000000;
+static const size_t SCANS = 10000;
+static const size_t SCAN_LENGTH = 100;
+static const size_t INSERTS = 1000000;
+static const size_t COMMIT_EVERY = 10000;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static size_t failures;
+
+/**
+ * Bulk loaded keys are even, inserted keys are odd, so inserts never hit an existing key.
+ */
+static fs_key_t make_key(uint64_t n)
+{
+    fs_key_t key;
+    key.objectid = n;
+    key.type = 1;
+    key.offset = 0;
+    return key;
+}
+
+static void report(const char* what, size_t ops, bench_clock::duration elapsed, block_device_t& dev)
+{
+    static size_t last_requests;
+    size_t requests = dev.read_requests() + dev.write_requests();
+    double secs = std::chrono::duration<double>(elapsed).count();
+    std::cout << "  " << what << ": " << ops << " ops in " << secs * 1000 << " ms, " << size_t(ops / secs) << " ops/s, "
+              << requests - last_requests << " device requests" << std::endl;
+    last_requests = requests;
+}
+
+int main(int argc, char** argv)
+{
+    size_t keys = argc > 1 ? strtoull(argv[1], nullptr, 0) : 10000000;
+    const char* fname = argc > 2 ? argv[2] : "bench_btree.img";
+
+    block_device_t dev_file(fname, true, NODE_SIZE);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "bench");
+    deviceno_t dev = mapper.resolve_device("bench");
+    cache.start_write_back();
+
+    btree_allocator_t allocator(NODE_SIZE, DEVICE_BYTES, NODE_SIZE);
+    btree_t tree(cache, dev, allocator, NODE_SIZE, 1);
+    std::mt19937_64 rng(42);
+
+    std::cout << keys << " keys, " << NODE_SIZE << " byte nodes, " << CACHE_BLOCKS << " cache blocks:" << std::endl;
+
+    auto start = bench_clock::now();
+    btree_bulk_loader_t loader(tree);
+    for (uint64_t i = 0; i < keys; ++i)
+    {
+        uint64_t value = i * 2;
+        loader.add(make_key(i * 2), &value, sizeof(value));
+    }
+    loader.finish();
+    tree.commit();
+    cache.flush(dev);
+    report("bulk load", keys, bench_clock::now() - start, dev_file);
+    std::cout << "  " << int(tree.root_level()) + 1 << " levels, " << allocator.high_water() / NODE_SIZE << " blocks"
+              << std::endl;
+
+    std::uniform_int_distribution<uint64_t> pick(0, keys - 1);
+    std::vector<char> value;
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < LOOKUPS; ++i)
+    {
+        uint64_t n = pick(rng) * 2;
+        if (!tree.find(make_key(n), &value) || value.size() != sizeof(n) || *reinterpret_cast<uint64_t*>(&value[0]) != n)
+            ++failures;
+    }
+    report("random point lookup", LOOKUPS, bench_clock::now() - start, dev_file);
+
+    start = bench_clock::now();
+    size_t scanned = 0;
+    for (size_t i = 0; i < SCANS; ++i)
+    {
+        uint64_t n = pick(rng) * 2;
+        uint64_t expect = n;
+        scanned += tree.scan(make_key(n), make_key(n + 2 * (SCAN_LENGTH - 1)),
+            [&expect](const fs_key_t& key, const char*, size_t) {
+                if (key.objectid != expect)
+                    ++failures;
+                expect += 2;
+                return true;
+            });
+    }
+    report("range scan, keys", scanned, bench_clock::now() - start, dev_file);
+
+    start = bench_clock::now();
+    size_t all = tree.scan(make_key(0), make_key(~0ull), [](const fs_key_t&, const char*, size_t) { return true; });
+    report("full scan, keys", all, bench_clock::now() - start, dev_file);
+    if (all != keys)
+        ++failures;
+
+    start = bench_clock::now();
+    size_t inserted = 0;
+    for (size_t i = 0; i < INSERTS; ++i)
+    {
+        uint64_t n = pick(rng) * 2 + 1;
+        inserted += tree.insert(make_key(n), &n, sizeof(n));
+        if (i % COMMIT_EVERY == COMMIT_EVERY - 1)
+            tree.commit();
+    }
+    tree.commit();
+    cache.flush(dev);
+    report("random insert", INSERTS, bench_clock::now() - start, dev_file);
+    std::cout << "  " << int(tree.root_level()) + 1 << " levels, " << allocator.high_water() / NODE_SIZE << " blocks"
+              << std::endl;
+
+    start = bench_clock::now();
+    for (size_t i = 0; i < LOOKUPS; ++i)
+    {
+        uint64_t n = pick(rng) * 2;
+        if (!tree.find(make_key(n)))
+            ++failures;
+    }
+    report("random point lookup after inserts", LOOKUPS, bench_clock::now() - start, dev_file);
+
+    if (tree.scan(make_key(0), make_key(~0ull), [](const fs_key_t&, const char*, size_t) { return true; }) != keys + inserted)
+        ++failures;
+
+    cache.stop_write_back();
+    mapper.unmap_device(dev);
+
+    if (failures)
+    {
+        std::cerr << failures << " wrong results." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief Extent compression benchmark.
+ *
+ * Stores text-like and random (media-like) extents with every codec, compressing each batch in parallel before
+ * storing it. Reports ingest throughput, space saved and streaming read throughput, then checks that every extent
+ * reads back intact and that random data was skipped on its entropy.
+ *
+ * Usage: bench_compress [megabytes per run] [compressing threads] [device file]
+ * Returns non-zero if the store returned wrong results.
+ */
+
+/*============================================================================*/
+
+#include "extent_store.h"
+#include "work_pool.h"
+#include "block_device_mapper.h"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+static const size_t BLOCK_SIZE = 4096;
+static const size_t CACHE_BLOCKS = 16384;
+static const fs_location_t DEVICE_BYTES = 64ull << 30; // Sparse, only the used part is ever written.
+static const size_t BATCH = 64;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static size_t failures;
+
+static double seconds(bench_clock::duration elapsed)
+{
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+/**
+ * Log-like lines of words from a small vocabulary with numbers thrown in, compresses about as well as source code
+ * or text metadata.
+ */
+static void make_text(uint64_t n, std::vector<char>& data)
+{
+    static const char* words[] = { "block", "cache", "extent", "tree", "node", "leaf", "commit", "tag", "object",
+        "read", "write", "flush", "device", "error", "ok", "=", "->", "{", "}", "generation", "key", "value" };
+    std::mt19937_64 rng(n);
+    size_t size = rng() % 4 ? extent_store_t::MAX_EXTENT : 1 + rng() % extent_store_t::MAX_EXTENT;
+    data.clear();
+    while (data.size() < size)
+    {
+        std::string line = std::to_string(n) + ":" + std::to_string(rng() % 100000);
+        for (size_t w = 2 + rng() % 10; w; --w)
+            line += std::string(" ") + words[rng() % (sizeof(words) / sizeof(words[0]))];
+        line += "\n";
+        data.insert(data.end(), line.begin(), line.end());
+    }
+    data.resize(size);
+}
+
+static void make_random(uint64_t n, std::vector<char>& data)
+{
+    std::mt19937_64 rng(n);
+    size_t size = rng() % 4 ? extent_store_t::MAX_EXTENT : 1 + rng() % extent_store_t::MAX_EXTENT;
+    data.resize(size);
+    for (size_t i = 0; i < size; i += sizeof(uint64_t))
+    {
+        uint64_t x = rng();
+        memcpy(&data[i], &x, std::min(sizeof(x), size - i));
+    }
+}
+
+static void run(const char* name, void (*make)(uint64_t, std::vector<char>&), const char* codec_name,
+    size_t megabytes, work_pool_t& pool, block_cache_t& cache, deviceno_t dev)
+{
+    codec_t codec = codec_t::parse(codec_name);
+    btree_allocator_t allocator(BLOCK_SIZE, DEVICE_BYTES, BLOCK_SIZE);
+    btree_t tree(cache, dev, allocator, BLOCK_SIZE, EXTENT_TREE_OBJECTID);
+    extent_store_t store(tree, allocator, cache, dev);
+
+    std::vector<fs_location_t> locations;
+    std::vector<std::vector<char>> batch(BATCH);
+    std::vector<uint64_t> hashes(BATCH);
+    std::vector<packed_extent_t> packed(BATCH);
+    bench_clock::duration ingest(0);
+    uint64_t bytes = 0, n = 0;
+
+    while (bytes < (uint64_t(megabytes) << 20))
+    {
+        for (size_t i = 0; i < BATCH; ++i, ++n)
+        {
+            make(n, batch[i]);
+            bytes += batch[i].size();
+        }
+
+        auto start = bench_clock::now();
+        pool.for_each(BATCH, [&](size_t i) {
+            hashes[i] = fast_hash64(&batch[i][0], batch[i].size());
+            compress_extent(codec, &batch[i][0], batch[i].size(), BLOCK_SIZE, packed[i]);
+        });
+        for (size_t i = 0; i < BATCH; ++i)
+            locations.push_back(store.store_packed(&batch[i][0], batch[i].size(), hashes[i], packed[i]).location);
+        ingest += bench_clock::now() - start;
+    }
+
+    auto start = bench_clock::now();
+    tree.commit();
+    cache.flush(dev);
+    ingest += bench_clock::now() - start;
+
+    // Stream everything back, checking contents.
+    std::vector<char> expect;
+    uint64_t read_bytes = 0;
+    bench_clock::duration reading(0);
+    for (size_t i = 0; i < locations.size(); ++i)
+    {
+        make(i, expect);
+        size_t pos = 0;
+        bool same = true;
+        start = bench_clock::now();
+        size_t size = store.read(locations[i], [&](const char* data, size_t size) {
+            same = same && pos + size <= expect.size() && memcmp(&expect[pos], data, size) == 0;
+            pos += size;
+        });
+        reading += bench_clock::now() - start;
+        read_bytes += size;
+        if (!same || pos != expect.size() || size != expect.size())
+            ++failures;
+    }
+
+    const extent_store_t::stats_t& stats = store.stats();
+    double mb = double(stats.bytes_in) / (1 << 20);
+    std::cout << "  " << name << ", " << codec_name << ": ingest " << mb / seconds(ingest) << " MB/s, read "
+              << double(read_bytes) / (1 << 20) / seconds(reading) << " MB/s, ratio " << store.compression_ratio()
+              << ", " << stats.compressed << "/" << stats.extents_stored << " compressed, " << stats.entropy_skips
+              << " entropy skips" << std::endl;
+
+    // Random data must be skipped on its entropy and never stored compressed, text must shrink by a third.
+    if (make == make_random && (stats.compressed || (codec.method != COMPRESS_NONE && !stats.entropy_skips)))
+        ++failures;
+    if (make == make_text && codec.method != COMPRESS_NONE && store.compression_ratio() < 1.5)
+        ++failures;
+
+    for (fs_location_t loc : locations)
+        store.release(loc);
+    tree.commit();
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 0) : 256;
+    unsigned threads = argc > 2 ? strtoul(argv[2], nullptr, 0) : std::thread::hardware_concurrency();
+    const char* fname = argc > 3 ? argv[3] : "bench_compress.img";
+
+    block_device_t dev_file(fname, true, BLOCK_SIZE);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "bench");
+    deviceno_t dev = mapper.resolve_device("bench");
+    cache.start_write_back();
+
+    work_pool_t pool(std::max(threads, 1u));
+    std::cout << megabytes << " MB per run, " << pool.threads() << " compressing threads:" << std::endl;
+
+    for (const char* codec : { "none", "lz4", "lz4:9", "zstd", "zstd:9" })
+    {
+        run("text", make_text, codec, megabytes, pool, cache, dev);
+        run("random", make_random, codec, megabytes, pool, cache, dev);
+    }
+
+    cache.stop_write_back();
+    mapper.unmap_device(dev);
+
+    if (failures)
+    {
+        std::cerr << failures << " wrong results." << std::endl;
+        return 1;
+    }
+    return 0;
+}
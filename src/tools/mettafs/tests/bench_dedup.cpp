@@ -0,0 +1,179 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief Deduplicating extent store benchmark.
+ *
+ * Stores a synthetic stream of extents where about a third repeat earlier ones, hashing every batch in parallel
+ * before storing it. Reports hashing and ingest throughput and the dedup ratio, then checks stored data, hash
+ * collision handling and freeing of extents.
+ *
+ * Usage: bench_dedup [megabytes] [hashing threads] [device file]
+ * Returns non-zero if the store returned wrong results.
+ */
+
+/*============================================================================*/
+
+#include "extent_store.h"
+#include "work_pool.h"
+#include "block_device_mapper.h"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+static const size_t BLOCK_SIZE = 4096;
+static const size_t CACHE_BLOCKS = 16384;
+static const fs_location_t DEVICE_BYTES = 64ull << 30; // Sparse, only the used part is ever written.
+static const size_t BATCH = 256;
+static const unsigned DUPLICATE_PERCENT = 33;
+static const size_t CHECKS = 1000;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static size_t failures;
+
+static double seconds(bench_clock::duration elapsed)
+{
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+/**
+ * Contents of extent number n, the same every time. Most extents are full, the rest end files at a random size.
+ */
+static void make_extent(uint64_t n, std::vector<char>& data)
+{
+    std::mt19937_64 rng(n);
+    size_t size = rng() % 4 ? extent_store_t::MAX_EXTENT : 1 + rng() % extent_store_t::MAX_EXTENT;
+    data.resize(size);
+    uint64_t x = rng() | 1;
+    for (size_t i = 0; i < size; i += sizeof(x))
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        memcpy(&data[i], &x, std::min(sizeof(x), size - i));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1024;
+    unsigned threads = argc > 2 ? strtoul(argv[2], nullptr, 0) : std::thread::hardware_concurrency();
+    const char* fname = argc > 3 ? argv[3] : "bench_dedup.img";
+
+    block_device_t dev_file(fname, true, BLOCK_SIZE);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "bench");
+    deviceno_t dev = mapper.resolve_device("bench");
+    cache.start_write_back();
+
+    btree_allocator_t allocator(BLOCK_SIZE, DEVICE_BYTES, BLOCK_SIZE);
+    btree_t tree(cache, dev, allocator, BLOCK_SIZE, EXTENT_TREE_OBJECTID);
+    extent_store_t store(tree, allocator, cache, dev);
+    work_pool_t pool(std::max(threads, 1u));
+    std::mt19937_64 rng(42);
+
+    std::cout << megabytes << " MB in extents of up to " << extent_store_t::MAX_EXTENT / 1024 << " KB, "
+              << pool.threads() << " hashing threads:" << std::endl;
+
+    // Extent numbers in stream order, a repeated number repeats the contents.
+    std::vector<uint64_t> stream;
+    std::vector<fs_location_t> locations;
+    std::vector<std::vector<char>> batch(BATCH);
+    std::vector<uint64_t> hashes(BATCH);
+    bench_clock::duration hashing(0), storing(0);
+    uint64_t bytes = 0, fresh = 0;
+
+    while (bytes < (uint64_t(megabytes) << 20))
+    {
+        for (size_t i = 0; i < BATCH; ++i)
+        {
+            uint64_t n = !stream.empty() && rng() % 100 < DUPLICATE_PERCENT ? stream[rng() % stream.size()] : fresh++;
+            stream.push_back(n);
+            make_extent(n, batch[i]);
+            bytes += batch[i].size();
+        }
+
+        auto start = bench_clock::now();
+        pool.for_each(BATCH, [&](size_t i) { hashes[i] = fast_hash64(&batch[i][0], batch[i].size()); });
+        auto hashed = bench_clock::now();
+        for (size_t i = 0; i < BATCH; ++i)
+            locations.push_back(store.store(&batch[i][0], batch[i].size(), hashes[i]).location);
+        storing += bench_clock::now() - hashed;
+        hashing += hashed - start;
+    }
+
+    auto start = bench_clock::now();
+    tree.commit();
+    cache.flush(dev);
+    storing += bench_clock::now() - start;
+
+    const extent_store_t::stats_t& stats = store.stats();
+    double mb = double(stats.bytes_in) / (1 << 20);
+    std::cout << "  hashing: " << mb / seconds(hashing) << " MB/s" << std::endl;
+    std::cout << "  ingest: " << mb / seconds(hashing + storing) << " MB/s, " << stats.extents_in << " extents in, "
+              << stats.extents_stored << " stored, " << stats.sha_checks << " SHA-256 checks" << std::endl;
+    std::cout << "  dedup ratio: " << store.dedup_ratio() << ", " << allocator.high_water() / (1 << 20)
+              << " MB used" << std::endl;
+
+    // Every extent read back must hold what was stored, repeated contents must share an extent.
+    std::vector<char> expect, got;
+    std::vector<fs_location_t> first(fresh, 0);
+    for (size_t i = 0; i < stream.size(); ++i)
+    {
+        if (!first[stream[i]])
+            first[stream[i]] = locations[i];
+        else if (first[stream[i]] != locations[i])
+            ++failures;
+    }
+    for (size_t i = 0; i < CHECKS; ++i)
+    {
+        size_t k = rng() % stream.size();
+        make_extent(stream[k], expect);
+        store.read(locations[k], got);
+        if (got != expect)
+            ++failures;
+    }
+
+    // Different data under the same fast hash must not be shared.
+    std::vector<char> a(1000, 'a'), b(1000, 'b');
+    extent_store_t::extent_t ea = store.store(&a[0], a.size(), 12345);
+    extent_store_t::extent_t eb = store.store(&b[0], b.size(), 12345);
+    extent_store_t::extent_t ea2 = store.store(&a[0], a.size(), 12345);
+    if (ea.location == eb.location || ea2.location != ea.location || !ea2.shared || eb.shared
+        || stats.collisions == 0)
+        ++failures;
+
+    // Dropping every reference frees all extents.
+    start = bench_clock::now();
+    size_t freed = 0;
+    for (fs_location_t loc : locations)
+        freed += store.release(loc);
+    freed += store.release(ea.location) + store.release(ea2.location) + store.release(eb.location);
+    tree.commit();
+    std::cout << "  release: " << locations.size() / seconds(bench_clock::now() - start) << " refs/s" << std::endl;
+    fs_key_t lo = { 0, 0, 0 }, hi = { ~0ull, 0xff, ~0ull };
+    if (freed != stats.extents_stored || tree.scan(lo, hi, [](const fs_key_t&, const char*, size_t) { return true; }))
+        ++failures;
+
+    cache.stop_write_back();
+    mapper.unmap_device(dev);
+
+    if (failures)
+    {
+        std::cerr << failures << " wrong results." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,319 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief Tag index benchmark.
+ *
+ * Builds the index for a synthetic corpus where every object has 20 to 50 tags out of about 20000 dotted names in
+ * three levels, popular tags chosen much more often than rare ones. Measures index size, multi-tag intersections and
+ * unions, whole-branch queries and incremental tagging, then compares the SIMD and plain set kernels. Query results
+ * are checked against the corpus.
+ *
+ * Usage: bench_tag_index [objects] [device file]
+ * Returns non-zero if the index returned wrong results.
+ */
+
+/*============================================================================*/
+
+#include "tag_index.h"
+#include "block_device_mapper.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdlib>
+
+static const size_t NODE_SIZE = 4096;
+static const size_t CACHE_BLOCKS = 65536;
+static const fs_location_t DEVICE_BYTES = 16ull << 30; // Sparse, only the used part is ever written.
+static const size_t CATEGORIES = 20;
+static const size_t SUBCATEGORIES = 10;
+static const size_t LEAVES = 100;
+static const size_t MIN_TAGS = 20;
+static const size_t MAX_TAGS = 50;
+static const size_t QUERIES = 2000;
+static const size_t BRANCH_QUERIES = 100;
+static const size_t ADDS = 100000;
+static const size_t COMMIT_EVERY = 10000;
+static const size_t KERNEL_VALUES = 1000000;
+static const size_t KERNEL_ROUNDS = 20;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static size_t failures;
+
+static double seconds(bench_clock::duration elapsed)
+{
+    return std::chrono::duration<double>(elapsed).count();
+}
+
+static void report(const char* what, size_t ops, bench_clock::duration elapsed)
+{
+    double secs = seconds(elapsed);
+    std::cout << "  " << what << ": " << ops << " in " << secs * 1000 << " ms, " << size_t(ops / secs) << " per second"
+              << std::endl;
+}
+
+/**
+ * Tag popularity falls off as 1/rank.
+ */
+class zipf_t
+{
+    std::vector<double> cdf;
+
+public:
+    explicit zipf_t(size_t n) : cdf(n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            cdf[i] = sum += 1.0 / (i + 1);
+        for (auto& c : cdf)
+            c /= sum;
+    }
+
+    template <class rng_t>
+    size_t operator ()(rng_t& rng)
+    {
+        double x = std::uniform_real_distribution<double>()(rng);
+        return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), x) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+static objid_set_t reference_all(const std::vector<const std::vector<uint64_t>*>& lists)
+{
+    std::vector<uint64_t> result = *lists[0], next;
+    for (size_t i = 1; i < lists.size(); ++i)
+    {
+        next.clear();
+        std::set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(next));
+        result.swap(next);
+    }
+    objid_set_t set;
+    for (uint64_t id : result)
+        set.append(id);
+    return set;
+}
+
+static objid_set_t reference_any(const std::vector<const std::vector<uint64_t>*>& lists)
+{
+    std::vector<uint64_t> result;
+    for (auto list : lists)
+        result.insert(result.end(), list->begin(), list->end());
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    objid_set_t set;
+    for (uint64_t id : result)
+        set.append(id);
+    return set;
+}
+
+static void bench_kernels(std::mt19937_64& rng)
+{
+    std::vector<uint32_t> a, b, out(2 * KERNEL_VALUES), check(2 * KERNEL_VALUES);
+    for (uint32_t v = 0; a.size() < KERNEL_VALUES; v += 1 + rng() % 4)
+        a.push_back(v);
+    for (uint32_t v = 0; b.size() < KERNEL_VALUES; v += 1 + rng() % 4)
+        b.push_back(v);
+
+    struct kernel_t
+    {
+        const char* name;
+        size_t (*fn)(const uint32_t*, size_t, const uint32_t*, size_t, uint32_t*);
+    };
+    const kernel_t kernels[] = {
+        { "intersect, vector", &objid_set_t::intersect_arrays },
+        { "intersect, scalar", &objid_set_t::intersect_arrays_scalar },
+        { "union, vector", &objid_set_t::unite_arrays },
+        { "union, scalar", &objid_set_t::unite_arrays_scalar },
+    };
+
+    std::cout << "set kernels on two lists of " << KERNEL_VALUES << " ids:" << std::endl;
+    for (size_t k = 0; k < 4; ++k)
+    {
+        size_t n = 0;
+        auto start = bench_clock::now();
+        for (size_t i = 0; i < KERNEL_ROUNDS; ++i)
+            n = kernels[k].fn(&a[0], a.size(), &b[0], b.size(), &out[0]);
+        report(kernels[k].name, KERNEL_ROUNDS * 2 * KERNEL_VALUES, bench_clock::now() - start);
+
+        size_t expect = (k & 2 ? kernels[3] : kernels[1]).fn(&a[0], a.size(), &b[0], b.size(), &check[0]);
+        if (n != expect || !std::equal(out.begin(), out.begin() + n, check.begin()))
+            ++failures;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t objects = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1000000;
+    const char* fname = argc > 2 ? argv[2] : "bench_tag_index.img";
+
+    block_device_t dev_file(fname, true, NODE_SIZE);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "bench");
+    deviceno_t dev = mapper.resolve_device("bench");
+    cache.start_write_back();
+
+    std::mt19937_64 rng(42);
+
+    // Corpus: names of all leaf tags, then tag lists of every object in order of object ids.
+    std::vector<std::string> names;
+    for (size_t c = 0; c < CATEGORIES; ++c)
+        for (size_t s = 0; s < SUBCATEGORIES; ++s)
+            for (size_t l = 0; l < LEAVES; ++l)
+                names.push_back("cat" + std::to_string(c) + ".sub" + std::to_string(s) + ".tag" + std::to_string(l));
+    std::shuffle(names.begin(), names.end(), rng); // Spread popularity over the branches.
+
+    zipf_t popularity(names.size());
+    std::vector<std::vector<uint64_t>> postings(names.size());
+    std::vector<size_t> picked;
+    size_t total = 0;
+    for (uint64_t id = 1; id <= objects; ++id)
+    {
+        size_t n = MIN_TAGS + rng() % (MAX_TAGS - MIN_TAGS + 1);
+        picked.clear();
+        while (picked.size() < n)
+        {
+            size_t t = popularity(rng);
+            if (std::find(picked.begin(), picked.end(), t) == picked.end())
+                picked.push_back(t);
+        }
+        for (size_t t : picked)
+            postings[t].push_back(id);
+        total += n;
+    }
+
+    std::map<std::string, std::vector<uint64_t>> corpus;
+    for (size_t t = 0; t < names.size(); ++t)
+        if (!postings[t].empty())
+            corpus[names[t]].swap(postings[t]);
+
+    std::cout << objects << " objects, " << corpus.size() << " tags, " << total << " postings:" << std::endl;
+
+    btree_allocator_t allocator(NODE_SIZE, DEVICE_BYTES, NODE_SIZE);
+    btree_t tree(cache, dev, allocator, NODE_SIZE, 1);
+    tag_index_t index(tree);
+
+    auto start = bench_clock::now();
+    index.build(corpus);
+    tree.commit();
+    cache.flush(dev);
+    report("bulk build, postings", total, bench_clock::now() - start);
+    std::cout << "  " << allocator.high_water() / NODE_SIZE << " blocks, "
+              << double(allocator.high_water()) / total << " bytes per posting" << std::endl;
+
+    // Queries pick tags by popularity too, so they mix large and small lists and mostly have results.
+    std::vector<std::string> tag_names;
+    for (auto& t : corpus)
+        tag_names.push_back(t.first);
+    zipf_t query_pick(tag_names.size());
+    std::vector<size_t> by_size(tag_names.size());
+    for (size_t i = 0; i < by_size.size(); ++i)
+        by_size[i] = i;
+    std::sort(by_size.begin(), by_size.end(), [&](size_t a, size_t b) {
+        return corpus[tag_names[a]].size() > corpus[tag_names[b]].size();
+    });
+
+    std::vector<std::vector<std::string>> queries(QUERIES);
+    for (auto& q : queries)
+    {
+        size_t n = 2 + rng() % 3;
+        while (q.size() < n)
+            q.push_back(tag_names[by_size[query_pick(rng)]]);
+    }
+
+    size_t matched = 0;
+    start = bench_clock::now();
+    for (auto& q : queries)
+        matched += index.match_all(q).size();
+    report("2-4 tag intersections", QUERIES, bench_clock::now() - start);
+    std::cout << "  " << matched / QUERIES << " objects per result" << std::endl;
+
+    matched = 0;
+    start = bench_clock::now();
+    for (auto& q : queries)
+        matched += index.match_any(q).size();
+    report("2-4 tag unions", QUERIES, bench_clock::now() - start);
+    std::cout << "  " << matched / QUERIES << " objects per result" << std::endl;
+
+    for (size_t i = 0; i < QUERIES; i += 10)
+    {
+        std::vector<const std::vector<uint64_t>*> lists;
+        for (auto& name : queries[i])
+            lists.push_back(&corpus[name]);
+        if (index.match_all(queries[i]) != reference_all(lists) || index.match_any(queries[i]) != reference_any(lists))
+            ++failures;
+    }
+
+    matched = 0;
+    start = bench_clock::now();
+    for (size_t i = 0; i < BRANCH_QUERIES; ++i)
+    {
+        std::string branch = "cat" + std::to_string(rng() % CATEGORIES) + ".sub" + std::to_string(rng() % SUBCATEGORIES);
+        objid_set_t result = index.objects_under(branch);
+        matched += result.size();
+        if (i % 10 == 0)
+        {
+            std::vector<const std::vector<uint64_t>*> lists;
+            for (auto& t : corpus)
+                if (t.first.compare(0, branch.size() + 1, branch + ".") == 0)
+                    lists.push_back(&t.second);
+            if (result != reference_any(lists))
+                ++failures;
+        }
+    }
+    report("branch queries of 100 tags", BRANCH_QUERIES, bench_clock::now() - start);
+    std::cout << "  " << matched / BRANCH_QUERIES << " objects per result" << std::endl;
+
+    std::vector<std::pair<std::string, uint64_t>> adds(ADDS);
+    for (auto& a : adds)
+        a = std::make_pair(tag_names[by_size[query_pick(rng)]], 1 + rng() % (2 * objects));
+
+    size_t added = 0;
+    start = bench_clock::now();
+    for (size_t i = 0; i < ADDS; ++i)
+    {
+        added += index.add(adds[i].first, adds[i].second);
+        if (i % COMMIT_EVERY == COMMIT_EVERY - 1)
+            tree.commit();
+    }
+    tree.commit();
+    cache.flush(dev);
+    report("incremental tag adds", ADDS, bench_clock::now() - start);
+    std::cout << "  " << added << " new postings, " << allocator.high_water() / NODE_SIZE << " blocks" << std::endl;
+
+    for (auto& a : adds)
+    {
+        auto& list = corpus[a.first];
+        auto it = std::lower_bound(list.begin(), list.end(), a.second);
+        if (it == list.end() || *it != a.second)
+            list.insert(it, a.second);
+    }
+    for (size_t i = 0; i < 100; ++i)
+    {
+        auto& name = tag_names[by_size[query_pick(rng)]];
+        std::vector<const std::vector<uint64_t>*> lists(1, &corpus[name]);
+        if (index.objects(name) != reference_any(lists) || index.tag_size(index.find_tag(name)) != corpus[name].size())
+            ++failures;
+    }
+
+    bench_kernels(rng);
+
+    cache.stop_write_back();
+    mapper.unmap_device(dev);
+
+    if (failures)
+    {
+        std::cerr << failures << " wrong results." << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief Block cache multi-threaded stress test.
+ *
+ * Threads read and write random block ranges of one device through a shared cache with the write-back engine running.
+ * Every block carries its number and a version stamp. Each thread owns a set of chunks which only it writes, so it
+ * knows the exact contents of its own blocks; reads may span any blocks and check that versions never go back.
+ * Blocks used in place through references must not change until released.
+ *
+ * Usage: stress_block_cache [device file]
+ * Returns non-zero if any mismatch was found.
+ */
+
+/*============================================================================*/
+
+#include "block_cache.h"
+#include "block_device_mapper.h"
+#include <atomic>
+#include <functional>
+#include <random>
+#include <iostream>
+
+static const size_t BLOCK_SIZE = 512;
+static const size_t CACHE_BLOCKS = 1024;
+static const size_t DEVICE_BLOCKS = 8 * CACHE_BLOCKS;
+static const size_t CHUNK_BLOCKS = 16; //!< Unit of write ownership.
+static const size_t THREADS = 8;
+static const size_t OPERATIONS = 50000; //!< Per thread.
+static const size_t MAX_READ_BLOCKS = 160; //!< Above 64KiB, so large reads are exercised too.
+
+static std::atomic<size_t> failures;
+
+static size_t owner(block_device_t::blockno_t b)
+{
+    return (b / CHUNK_BLOCKS) % THREADS;
+}
+
+static uint32_t word(block_device_t::blockno_t b, uint32_t version, size_t i)
+{
+    return uint32_t(b * 2654435761u) ^ (version * 40503u) ^ uint32_t(i);
+}
+
+static void stamp(char* data, block_device_t::blockno_t b, uint32_t version)
+{
+    uint32_t* words = reinterpret_cast<uint32_t*>(data);
+    words[0] = b;
+    words[1] = version;
+    for (size_t i = 2; i < BLOCK_SIZE / 4; ++i)
+        words[i] = word(b, version, i);
+}
+
+/**
+ * Check block contents are whole and belong to block b.
+ * @return version of the block, or -1 if it is damaged.
+ */
+static int64_t check(const char* data, block_device_t::blockno_t b)
+{
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(data);
+    if (words[0] != b)
+        return -1;
+    for (size_t i = 2; i < BLOCK_SIZE / 4; ++i)
+        if (words[i] != word(b, words[1], i))
+            return -1;
+    return words[1];
+}
+
+static void fail(size_t thread, const char* what, block_device_t::blockno_t b, int64_t got, int64_t expected)
+{
+    if (failures++ < 10)
+        std::cerr << "thread " << thread << ": " << what << " at block " << b << ", version " << got
+                  << ", expected " << expected << std::endl;
+}
+
+static void worker(block_cache_t& cache, deviceno_t dev, size_t thread, std::vector<uint32_t>& versions)
+{
+    std::mt19937 rng(thread + 1);
+    std::vector<uint32_t> seen(DEVICE_BLOCKS, 0); // Latest version observed for every block.
+    std::vector<char> buffer(MAX_READ_BLOCKS * BLOCK_SIZE);
+    block_device_t::blockno_t next = 0;
+
+    for (size_t op = 0; op < OPERATIONS && failures == 0; ++op)
+    {
+        if (rng() % 3 == 0)
+        {
+            // Write a run of blocks inside one of our chunks.
+            block_device_t::blockno_t chunk = (rng() % (DEVICE_BLOCKS / CHUNK_BLOCKS / THREADS)) * THREADS + thread;
+            block_device_t::blockno_t b = chunk * CHUNK_BLOCKS + rng() % CHUNK_BLOCKS;
+            size_t n = 1 + rng() % (CHUNK_BLOCKS - b % CHUNK_BLOCKS);
+
+            for (size_t k = 0; k < n; ++k)
+                stamp(&buffer[k * BLOCK_SIZE], b + k, ++versions[b + k]);
+            cache.cached_write(dev, b, buffer.data(), n, BLOCK_SIZE);
+            continue;
+        }
+
+        if (rng() % 8 == 0)
+        {
+            // Use a block in place, it must not change while referenced.
+            block_device_t::blockno_t b = rng() % DEVICE_BLOCKS;
+            block_ref_t ref = cache.cached_ref(dev, b, BLOCK_SIZE);
+            int64_t version = ref ? check(ref.data(), b) : -1;
+            std::this_thread::yield();
+            if (version < 0 || check(ref.data(), b) != version)
+                fail(thread, "referenced block changed", b, version, seen[b]);
+            else if (version < seen[b])
+                fail(thread, "version went back", b, version, seen[b]);
+            else
+                seen[b] = version;
+            continue;
+        }
+
+        // Read, continuing the previous read now and then to trigger read-ahead.
+        block_device_t::blockno_t b = rng() % 2 ? next : rng() % DEVICE_BLOCKS;
+        if (b >= DEVICE_BLOCKS)
+            b = 0;
+        size_t n = rng() % 16 ? 1 + rng() % 8 : 1 + rng() % MAX_READ_BLOCKS;
+        n = std::min<size_t>(n, DEVICE_BLOCKS - b);
+
+        if (cache.cached_read(dev, b, buffer.data(), n, BLOCK_SIZE) != n)
+        {
+            fail(thread, "short read", b, 0, n);
+            return;
+        }
+
+        for (size_t k = 0; k < n; ++k)
+        {
+            int64_t version = check(&buffer[k * BLOCK_SIZE], b + k);
+            if (version < 0)
+                fail(thread, "damaged block", b + k, version, seen[b + k]);
+            else if (owner(b + k) == thread && version != versions[b + k])
+                fail(thread, "stale own block", b + k, version, versions[b + k]);
+            else if (version < seen[b + k])
+                fail(thread, "version went back", b + k, version, seen[b + k]);
+            else
+                seen[b + k] = version;
+        }
+        next = b + n;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* fname = argc > 1 ? argv[1] : "stress_block_cache.img";
+
+    block_device_t dev_file(fname, true, BLOCK_SIZE, DEVICE_BLOCKS);
+    block_device_mapper_t mapper;
+    block_cache_t cache(CACHE_BLOCKS);
+
+    cache.set_device_mapper(mapper);
+    mapper.set_cache(cache);
+    mapper.map_device(dev_file, "stress");
+    deviceno_t dev = mapper.resolve_device("stress");
+
+    // Write back often and from small thresholds, so blocks keep moving between states.
+    write_back_policy_t policy;
+    policy.dirty_ratio = 0.2;
+    policy.dirty_background_ratio = 0.1;
+    policy.max_age = std::chrono::milliseconds(1);
+    policy.interval = std::chrono::milliseconds(1);
+    policy.max_write_blocks = 8;
+    policy.readahead_min = 4;
+    policy.readahead_max = 32;
+    cache.start_write_back(policy);
+
+    std::vector<uint32_t> versions(DEVICE_BLOCKS, 0);
+    std::vector<char> block(BLOCK_SIZE);
+    for (block_device_t::blockno_t b = 0; b < DEVICE_BLOCKS; ++b)
+    {
+        stamp(block.data(), b, 0);
+        cache.cached_write(dev, b, block.data(), 1, BLOCK_SIZE);
+    }
+    cache.flush(dev);
+
+    std::cout << "Running " << THREADS << " threads on " << cache.shard_count() << " cache shards" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < THREADS; ++t)
+        threads.emplace_back(worker, std::ref(cache), dev, t, std::ref(versions));
+    for (auto& t : threads)
+        t.join();
+
+    // Everything must have reached the device.
+    cache.flush(dev);
+    cache.stop_write_back();
+    for (block_device_t::blockno_t b = 0; b < DEVICE_BLOCKS && failures < 10; ++b)
+    {
+        if (dev_file.read_block(b, block.data(), BLOCK_SIZE) != BLOCK_SIZE)
+            fail(THREADS, "device read failed", b, 0, 0);
+        else if (check(block.data(), b) != versions[b])
+            fail(THREADS, "device has stale block", b, check(block.data(), b), versions[b]);
+    }
+
+    mapper.unmap_device(dev);
+
+    if (failures)
+    {
+        std::cerr << failures << " failures." << std::endl;
+        return 1;
+    }
+    std::cout << "Passed." << std::endl;
+    return 0;
+}
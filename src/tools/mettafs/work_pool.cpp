@@ -0,0 +1,98 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "work_pool.h"
+
+work_pool_t::work_pool_t(unsigned threads)
+    : batch_fn(nullptr)
+    , batch_size(0)
+    , next(0)
+    , busy(0)
+    , round(0)
+    , stopping(false)
+{
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back(&work_pool_t::worker, this);
+}
+
+work_pool_t::~work_pool_t()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& t : workers)
+        t.join();
+}
+
+void work_pool_t::for_each(size_t count, const std::function<void (size_t)>& fn)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        batch_fn = &fn;
+        batch_size = count;
+        next = 0;
+        busy = workers.size();
+        ++round;
+    }
+    work_ready.notify_all();
+
+    run();
+
+    std::unique_lock<std::mutex> guard(lock);
+    work_done.wait(guard, [this] { return busy == 0; });
+    batch_fn = nullptr;
+    if (error)
+    {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void work_pool_t::worker()
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [this, seen] { return stopping || round != seen; });
+            if (stopping)
+                return;
+            seen = round;
+        }
+
+        run();
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--busy == 0)
+            work_done.notify_one();
+    }
+}
+
+/**
+ * Take items one at a time until the batch is exhausted, so threads finishing early pick up the rest.
+ */
+void work_pool_t::run()
+{
+    for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < batch_size;)
+    {
+        try
+        {
+            (*batch_fn)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+}
@@ -0,0 +1,53 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker threads running the same function over batches of independent items, like hashing or compressing extents.
+ * The calling thread works on a batch too, so a pool of one thread has no workers and runs everything in place.
+ */
+class work_pool_t
+{
+public:
+    explicit work_pool_t(unsigned threads = std::thread::hardware_concurrency());
+    ~work_pool_t();
+
+    /**
+     * Call fn for every index below count, returns when all calls are done. The first exception thrown by fn is
+     * thrown again from here.
+     */
+    void for_each(size_t count, const std::function<void (size_t)>& fn);
+
+    unsigned threads() const { return workers.size() + 1; }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    const std::function<void (size_t)>* batch_fn;
+    size_t batch_size;
+    std::atomic<size_t> next;
+    size_t busy;     //!< Workers still running on the current batch.
+    uint64_t round;  //!< Batch number, workers wait for it to change.
+    bool stopping;
+    std::exception_ptr error;
+
+    void worker();
+    void run();
+};
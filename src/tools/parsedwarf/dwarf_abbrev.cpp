@@ -36,32 +36,49 @@ void abbrev_declaration_t::decode(address_t from, size_t& offset)
 
 bool dwarf_debug_abbrev_t::load_abbrev_set(size_t& offset)
 {
-    abbrevs.clear();
+    auto cached = sets.find(offset);
+    if (cached != sets.end())
+    {
+        current = &cached->second;
+        offset = current->end_offset;
+        return true;
+    }
+
+    abbrev_set_t& set = sets[offset];
+    current = &set;
     while (1)
     {
         abbrev_declaration_t abbrev;
 
         abbrev.decode(start, offset);
-        abbrevs.push_back(abbrev);
+        set.abbrevs.push_back(abbrev);
         if (abbrev.abbreviation_code == 0)
             break;
 #if DWARF_DEBUG
         printf("Loaded abbreviation: code %d, tag %s, has_children %d\n", (uint32_t)abbrev.abbreviation_code, tag2name(abbrev.tag), abbrev.has_children);
-#endif
         for (unsigned i = 0; i < abbrev.attributes.size()-1; ++i)
         {
             abbrev_attr_t a;
             a = abbrev.attributes[i];
-#if DWARF_DEBUG
             printf(" attr %s, form %s\n", attr2name(a.name), form2name(a.form));
-#endif
         }
+#endif
     }
+    set.end_offset = offset;
     return true;
 }
 
 abbrev_declaration_t* dwarf_debug_abbrev_t::find_abbrev(uint32_t abbreviation_code)
 {
+    if (!current)
+        return 0;
+    std::vector<abbrev_declaration_t>& abbrevs = current->abbrevs;
+
+    // Compilers number abbreviations from 1 in order, so the code is normally the index.
+    if (abbreviation_code > 0 && abbreviation_code <= abbrevs.size()
+        && abbrevs[abbreviation_code - 1].abbreviation_code == abbreviation_code)
+        return &abbrevs[abbreviation_code - 1];
+
     for (unsigned int i = 0; i < abbrevs.size(); ++i)
     {
         if (abbrevs[i].abbreviation_code == abbreviation_code)
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "leb128.h"
+#include <map>
 #include <vector>
 
 class abbrev_attr_t
@@ -42,17 +43,27 @@ public:
 
 class dwarf_debug_abbrev_t
 {
+    // Abbreviation set of a compilation unit, decoded once and kept for as long as the section is around.
+    struct abbrev_set_t
+    {
+        std::vector<abbrev_declaration_t> abbrevs;
+        size_t end_offset;
+    };
+
     address_t start;
     size_t    size;
-    std::vector<abbrev_declaration_t> abbrevs;
+    std::map<size_t, abbrev_set_t> sets; // key: set offset in the section
+    abbrev_set_t* current;
 
 public:
     dwarf_debug_abbrev_t(address_t st, size_t sz)
         : start(st)
         , size(sz)
+        , current(0)
     {
     }
 
+    // Make the set at offset current, decoding it on first use. Offset is moved past the set.
     bool load_abbrev_set(size_t& offset);
     abbrev_declaration_t* find_abbrev(uint32_t abbreviation_code);
 };
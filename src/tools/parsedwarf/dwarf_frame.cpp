@@ -0,0 +1,506 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2010 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "dwarf_frame.h"
+#include "leb128.h"
+#include "dwarf_debug.h"
+#include <algorithm>
+#include <string.h>
+
+using namespace elf32;
+
+// Read a pointer in given DW_EH_PE_* encoding. Offset is advanced past the pointer even if it cannot be resolved.
+static bool read_encoded(const frame_section_t& section, size_t& offset, uint8_t encoding, uint32_t& value)
+{
+    value = 0;
+    if (encoding == DW_EH_PE_omit)
+        return true;
+
+    uint32_t field_address = section.vaddr + offset;
+    address_t p = section.start + offset;
+    switch (encoding & 0x0f)
+    {
+        case DW_EH_PE_absptr:
+        case DW_EH_PE_udata4:
+        case DW_EH_PE_sdata4:
+            value = *reinterpret_cast<uint32_t*>(p);
+            offset += sizeof(uint32_t);
+            break;
+        case DW_EH_PE_udata2:
+            value = *reinterpret_cast<uint16_t*>(p);
+            offset += sizeof(uint16_t);
+            break;
+        case DW_EH_PE_sdata2:
+            value = *reinterpret_cast<int16_t*>(p);
+            offset += sizeof(int16_t);
+            break;
+        case DW_EH_PE_udata8:
+        case DW_EH_PE_sdata8:
+            value = *reinterpret_cast<uint64_t*>(p);
+            offset += sizeof(uint64_t);
+            break;
+        case DW_EH_PE_uleb128:
+            value = uleb128_t::decode(section.start, offset, -1);
+            break;
+        case DW_EH_PE_sleb128:
+            value = sleb128_t::decode(section.start, offset, -1);
+            break;
+        default:
+            DPRINT("UNSUPPORTED POINTER ENCODING 0x%x\n", encoding);
+            return false;
+    }
+
+    switch (encoding & 0x70)
+    {
+        case DW_EH_PE_absptr:
+            break;
+        case DW_EH_PE_pcrel:
+            value += field_address;
+            break;
+        default:
+            // Text, data and function relative pointers need the loaded image.
+            return false;
+    }
+    // Indirect pointers point into loaded data.
+    return !(encoding & DW_EH_PE_indirect);
+}
+
+bool cie_t::decode(const frame_section_t& section, size_t offset)
+{
+    address_t from = section.start;
+    uint32_t length = *reinterpret_cast<uint32_t*>(from + offset);
+    if (length == 0xffffffff)
+        return false; // DWARF64 is not supported.
+    offset += sizeof(uint32_t);
+    end = offset + length;
+    if (end > section.size)
+        return false;
+
+    uint32_t id = *reinterpret_cast<uint32_t*>(from + offset);
+    offset += sizeof(uint32_t);
+    if (id != (section.is_eh_frame ? 0 : 0xffffffff))
+        return false;
+
+    version = *reinterpret_cast<uint8_t*>(from + offset);
+    offset += sizeof(uint8_t);
+    const char* augmentation = reinterpret_cast<const char*>(from + offset);
+    offset += strlen(augmentation) + 1;
+    if (version >= 4)
+        offset += 2; // address_size and segment_size
+
+    code_alignment_factor = uleb128_t::decode(from, offset, -1);
+    data_alignment_factor = sleb128_t::decode(from, offset, -1);
+    if (version == 1)
+    {
+        return_address_register = *reinterpret_cast<uint8_t*>(from + offset);
+        offset += sizeof(uint8_t);
+    }
+    else
+        return_address_register = uleb128_t::decode(from, offset, -1);
+
+    fde_encoding = DW_EH_PE_absptr;
+    has_augmentation_data = augmentation[0] == 'z';
+    if (has_augmentation_data)
+    {
+        size_t augmentation_length = uleb128_t::decode(from, offset, -1);
+        size_t augmentation_end = offset + augmentation_length;
+        for (const char* a = augmentation + 1; *a; ++a)
+        {
+            if (*a == 'R')
+            {
+                fde_encoding = *reinterpret_cast<uint8_t*>(from + offset);
+                offset += sizeof(uint8_t);
+            }
+            else if (*a == 'L')
+                offset += sizeof(uint8_t);
+            else if (*a == 'P')
+            {
+                uint8_t encoding = *reinterpret_cast<uint8_t*>(from + offset);
+                offset += sizeof(uint8_t);
+                uint32_t personality;
+                read_encoded(section, offset, encoding, personality);
+            }
+            else if (*a != 'S')
+                break; // Unknown augmentation, the rest of its data is skipped by length.
+        }
+        offset = augmentation_end;
+    }
+    else if (strcmp(augmentation, "eh") == 0)
+        offset += sizeof(uint32_t);
+    else if (augmentation[0])
+    {
+        DPRINT("UNKNOWN CIE AUGMENTATION %s\n", augmentation);
+        return false;
+    }
+
+    initial_instructions = offset;
+    return offset <= end;
+}
+
+dwarf_frame_t::dwarf_frame_t(elf_parser_t& elf)
+    : section_count(0)
+{
+    const char* names[] = { ".debug_frame", ".eh_frame" };
+    for (int i = 0; i < 2; ++i)
+    {
+        section_header_t* h = elf.section_header(names[i]);
+        if (!h)
+            continue;
+        frame_section_t& section = sections[section_count++];
+        section.start = elf.start() + h->offset;
+        section.size = h->size;
+        section.vaddr = h->vaddr;
+        section.is_eh_frame = i == 1;
+        load(section);
+    }
+
+    std::sort(fdes.begin(), fdes.end(), [](const fde_t& a, const fde_t& b) {
+        return a.initial_location < b.initial_location;
+    });
+}
+
+void dwarf_frame_t::load(const frame_section_t& section)
+{
+    address_t from = section.start;
+    size_t offset = 0;
+    while (offset + sizeof(uint32_t) <= section.size)
+    {
+        uint32_t length = *reinterpret_cast<uint32_t*>(from + offset);
+        if (length == 0xffffffff)
+            break; // DWARF64 is not supported.
+        if (length == 0)
+        {
+            // Terminator in .eh_frame, padding in .debug_frame.
+            offset += sizeof(uint32_t);
+            continue;
+        }
+        size_t entry_end = offset + sizeof(uint32_t) + length;
+        if (entry_end > section.size)
+            break;
+
+        uint32_t id = *reinterpret_cast<uint32_t*>(from + offset + sizeof(uint32_t));
+        bool is_cie = section.is_eh_frame ? id == 0 : id == 0xffffffff;
+        if (!is_cie)
+        {
+            // In .eh_frame the CIE pointer is relative to the pointer itself.
+            size_t cie_offset = section.is_eh_frame ? offset + sizeof(uint32_t) - id : id;
+            auto cie = cies.find(from + cie_offset);
+            if (cie == cies.end() && cie_offset < section.size)
+            {
+                cie_t decoded;
+                if (decoded.decode(section, cie_offset))
+                    cie = cies.insert(std::make_pair(from + cie_offset, decoded)).first;
+            }
+
+            size_t pos = offset + 2 * sizeof(uint32_t);
+            fde_t fde;
+            if (cie != cies.end()
+                && read_encoded(section, pos, cie->second.fde_encoding, fde.initial_location))
+            {
+                // The range is a plain length in the same format.
+                read_encoded(section, pos, cie->second.fde_encoding & 0x0f, fde.address_range);
+                if (cie->second.has_augmentation_data)
+                {
+                    size_t augmentation_length = uleb128_t::decode(from, pos, -1);
+                    pos += augmentation_length;
+                }
+                fde.section = &section;
+                fde.cie = &cie->second;
+                fde.instructions = pos;
+                fde.end = entry_end;
+                if (fde.address_range && pos <= entry_end)
+                    fdes.push_back(fde);
+            }
+        }
+        offset = entry_end;
+    }
+}
+
+const fde_t* dwarf_frame_t::find_fde(uint32_t pc) const
+{
+    auto it = std::upper_bound(fdes.begin(), fdes.end(), pc, [](uint32_t a, const fde_t& fde) {
+        return a < fde.initial_location;
+    });
+    if (it == fdes.begin() || !(it - 1)->contains(pc))
+        return 0;
+    return &*(it - 1);
+}
+
+static void set_rule(frame_state_t& state, uint32_t reg, int kind, int32_t value)
+{
+    if (reg >= DW_X86_REGS)
+        return;
+    state.rules[reg].kind = static_cast<decltype(state.rules[reg].kind)>(kind);
+    state.rules[reg].value = value;
+}
+
+// Run call frame instructions in [from, to) starting at location pc, stopping before the row past target.
+bool dwarf_frame_t::execute(const fde_t& fde, size_t from, size_t to, uint32_t pc, uint32_t target,
+                            frame_state_t& state, const frame_state_t& initial) const
+{
+    const frame_section_t& section = *fde.section;
+    const cie_t& cie = *fde.cie;
+    address_t start = section.start;
+    std::vector<frame_state_t> remembered;
+
+    size_t offset = from;
+    while (offset < to)
+    {
+        uint8_t opcode = *reinterpret_cast<uint8_t*>(start + offset);
+        ++offset;
+        uint8_t operand = opcode & 0x3f;
+
+        switch (opcode & 0xc0)
+        {
+            case DW_CFA_advance_loc:
+                pc += operand * cie.code_alignment_factor;
+                if (pc > target)
+                    return true;
+                continue;
+            case DW_CFA_offset:
+                set_rule(state, operand, register_rule_t::OFFSET,
+                         uleb128_t::decode(start, offset, -1) * cie.data_alignment_factor);
+                continue;
+            case DW_CFA_restore:
+                if (operand < DW_X86_REGS)
+                    state.rules[operand] = initial.rules[operand];
+                continue;
+        }
+
+        uint32_t reg, delta;
+        switch (opcode)
+        {
+            case DW_CFA_nop:
+                break;
+            case DW_CFA_set_loc:
+                if (!read_encoded(section, offset, cie.fde_encoding, pc))
+                    return false;
+                if (pc > target)
+                    return true;
+                break;
+            case DW_CFA_advance_loc1:
+                delta = *reinterpret_cast<uint8_t*>(start + offset);
+                offset += sizeof(uint8_t);
+                pc += delta * cie.code_alignment_factor;
+                if (pc > target)
+                    return true;
+                break;
+            case DW_CFA_advance_loc2:
+                delta = *reinterpret_cast<uint16_t*>(start + offset);
+                offset += sizeof(uint16_t);
+                pc += delta * cie.code_alignment_factor;
+                if (pc > target)
+                    return true;
+                break;
+            case DW_CFA_advance_loc4:
+                delta = *reinterpret_cast<uint32_t*>(start + offset);
+                offset += sizeof(uint32_t);
+                pc += delta * cie.code_alignment_factor;
+                if (pc > target)
+                    return true;
+                break;
+            case DW_CFA_offset_extended:
+                reg = uleb128_t::decode(start, offset, -1);
+                set_rule(state, reg, register_rule_t::OFFSET,
+                         uleb128_t::decode(start, offset, -1) * cie.data_alignment_factor);
+                break;
+            case DW_CFA_restore_extended:
+                reg = uleb128_t::decode(start, offset, -1);
+                if (reg < DW_X86_REGS)
+                    state.rules[reg] = initial.rules[reg];
+                break;
+            case DW_CFA_undefined:
+                set_rule(state, uleb128_t::decode(start, offset, -1), register_rule_t::UNDEFINED, 0);
+                break;
+            case DW_CFA_same_value:
+                set_rule(state, uleb128_t::decode(start, offset, -1), register_rule_t::SAME_VALUE, 0);
+                break;
+            case DW_CFA_register:
+                reg = uleb128_t::decode(start, offset, -1);
+                set_rule(state, reg, register_rule_t::REGISTER, uleb128_t::decode(start, offset, -1));
+                break;
+            case DW_CFA_remember_state:
+                remembered.push_back(state);
+                break;
+            case DW_CFA_restore_state:
+                if (!remembered.empty())
+                {
+                    state = remembered.back();
+                    remembered.pop_back();
+                }
+                break;
+            case DW_CFA_def_cfa:
+                state.cfa_register = uleb128_t::decode(start, offset, -1);
+                state.cfa_offset = uleb128_t::decode(start, offset, -1);
+                state.cfa_is_expression = false;
+                break;
+            case DW_CFA_def_cfa_register:
+                state.cfa_register = uleb128_t::decode(start, offset, -1);
+                state.cfa_is_expression = false;
+                break;
+            case DW_CFA_def_cfa_offset:
+                state.cfa_offset = uleb128_t::decode(start, offset, -1);
+                break;
+            case DW_CFA_def_cfa_expression:
+                delta = uleb128_t::decode(start, offset, -1);
+                offset += delta;
+                state.cfa_is_expression = true;
+                break;
+            case DW_CFA_expression:
+            case DW_CFA_val_expression:
+                reg = uleb128_t::decode(start, offset, -1);
+                delta = uleb128_t::decode(start, offset, -1);
+                offset += delta;
+                set_rule(state, reg, register_rule_t::EXPRESSION, 0);
+                break;
+            case DW_CFA_offset_extended_sf:
+                reg = uleb128_t::decode(start, offset, -1);
+                set_rule(state, reg, register_rule_t::OFFSET,
+                         sleb128_t::decode(start, offset, -1) * cie.data_alignment_factor);
+                break;
+            case DW_CFA_def_cfa_sf:
+                state.cfa_register = uleb128_t::decode(start, offset, -1);
+                state.cfa_offset = sleb128_t::decode(start, offset, -1) * cie.data_alignment_factor;
+                state.cfa_is_expression = false;
+                break;
+            case DW_CFA_def_cfa_offset_sf:
+                state.cfa_offset = sleb128_t::decode(start, offset, -1) * cie.data_alignment_factor;
+                break;
+            case DW_CFA_val_offset:
+                reg = uleb128_t::decode(start, offset, -1);
+                set_rule(state, reg, register_rule_t::VAL_OFFSET,
+                         uleb128_t::decode(start, offset, -1) * cie.data_alignment_factor);
+                break;
+            case DW_CFA_val_offset_sf:
+                reg = uleb128_t::decode(start, offset, -1);
+                set_rule(state, reg, register_rule_t::VAL_OFFSET,
+                         sleb128_t::decode(start, offset, -1) * cie.data_alignment_factor);
+                break;
+            case DW_CFA_GNU_args_size:
+                uleb128_t::decode(start, offset, -1);
+                break;
+            case DW_CFA_GNU_negative_offset_extended:
+                reg = uleb128_t::decode(start, offset, -1);
+                set_rule(state, reg, register_rule_t::OFFSET,
+                         -int32_t(uleb128_t::decode(start, offset, -1)) * cie.data_alignment_factor);
+                break;
+            default:
+                DPRINT("UNKNOWN CFA OPCODE 0x%x\n", opcode);
+                return false;
+        }
+    }
+    return true;
+}
+
+bool dwarf_frame_t::frame_state(uint32_t pc, frame_state_t& state) const
+{
+    const fde_t* fde = find_fde(pc);
+    if (!fde)
+        return false;
+
+    frame_state_t initial;
+    initial.cfa_register = DW_X86_ESP;
+    initial.cfa_offset = 0;
+    initial.cfa_is_expression = false;
+    for (int i = 0; i < DW_X86_REGS; ++i)
+    {
+        initial.rules[i].kind = register_rule_t::SAME_VALUE;
+        initial.rules[i].value = 0;
+    }
+    initial.return_address_register = fde->cie->return_address_register;
+
+    if (!execute(*fde, fde->cie->initial_instructions, fde->cie->end, fde->initial_location, ~0u, initial, initial))
+        return false;
+    state = initial;
+    return execute(*fde, fde->instructions, fde->end, fde->initial_location, pc, state, initial);
+}
+
+void dwarf_frame_t::unwind(const stack_snapshot_t& snapshot, std::vector<uint32_t>& pcs, size_t max_frames) const
+{
+    uint32_t regs[DW_X86_REGS] = { 0 };
+    bool valid[DW_X86_REGS] = { false };
+    regs[DW_X86_EIP] = snapshot.eip;
+    regs[DW_X86_ESP] = snapshot.esp;
+    regs[DW_X86_EBP] = snapshot.ebp;
+    valid[DW_X86_EIP] = valid[DW_X86_ESP] = valid[DW_X86_EBP] = true;
+
+    for (size_t frame = 0; frame < max_frames && regs[DW_X86_EIP]; ++frame)
+    {
+        pcs.push_back(regs[DW_X86_EIP]);
+
+        uint32_t caller[DW_X86_REGS];
+        bool caller_valid[DW_X86_REGS];
+        // Return addresses point past the call, rules are taken at the call instruction itself.
+        uint32_t pc = frame ? regs[DW_X86_EIP] - 1 : regs[DW_X86_EIP];
+        frame_state_t state;
+        if (frame_state(pc, state))
+        {
+            if (state.cfa_is_expression || state.cfa_register >= DW_X86_REGS || !valid[state.cfa_register])
+                break;
+            uint32_t cfa = regs[state.cfa_register] + state.cfa_offset;
+
+            for (int i = 0; i < DW_X86_REGS; ++i)
+            {
+                const register_rule_t& rule = state.rules[i];
+                caller[i] = 0;
+                caller_valid[i] = false;
+                switch (rule.kind)
+                {
+                    case register_rule_t::SAME_VALUE:
+                        caller[i] = regs[i];
+                        caller_valid[i] = valid[i];
+                        break;
+                    case register_rule_t::OFFSET:
+                        caller_valid[i] = snapshot.read(cfa + rule.value, caller[i]);
+                        break;
+                    case register_rule_t::VAL_OFFSET:
+                        caller[i] = cfa + rule.value;
+                        caller_valid[i] = true;
+                        break;
+                    case register_rule_t::REGISTER:
+                        if (uint32_t(rule.value) < DW_X86_REGS)
+                        {
+                            caller[i] = regs[rule.value];
+                            caller_valid[i] = valid[rule.value];
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            uint32_t ra = state.return_address_register;
+            if (ra >= DW_X86_REGS || !caller_valid[ra])
+                break;
+            caller[DW_X86_EIP] = caller[ra];
+            caller_valid[DW_X86_EIP] = true;
+            // By definition CFA is the stack pointer value in the caller.
+            caller[DW_X86_ESP] = cfa;
+            caller_valid[DW_X86_ESP] = true;
+        }
+        else
+        {
+            // No CFI for this code, try the frame pointer.
+            uint32_t next_ebp, return_address;
+            if (!valid[DW_X86_EBP] || !snapshot.read(regs[DW_X86_EBP], next_ebp)
+                || !snapshot.read(regs[DW_X86_EBP] + 4, return_address))
+                break;
+            std::copy(regs, regs + DW_X86_REGS, caller);
+            std::copy(valid, valid + DW_X86_REGS, caller_valid);
+            caller[DW_X86_ESP] = regs[DW_X86_EBP] + 8;
+            caller[DW_X86_EBP] = next_ebp;
+            caller[DW_X86_EIP] = return_address;
+        }
+
+        // Callers live further up the stack, anything else is garbage.
+        if (caller[DW_X86_ESP] <= regs[DW_X86_ESP])
+            break;
+        std::copy(caller, caller + DW_X86_REGS, regs);
+        std::copy(caller_valid, caller_valid + DW_X86_REGS, valid);
+    }
+}
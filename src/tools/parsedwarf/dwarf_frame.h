@@ -10,30 +10,184 @@
 //
 // Entries in a .debug_frame section are aligned on an addressing unit boundary and come in two forms:
 // A Common Information Entry (CIE) and a Frame Description Entry (FDE).
+// .eh_frame uses the same layout with GCC augmentations: CIE id 0, CIE pointers relative to the FDE and
+// pointer encodings given in the augmentation data.
 //
 #pragma once
 
+#include "types.h"
+#include "elf_parser.h"
+#include <map>
+#include <vector>
+
+// DWARF register numbers on i386.
+enum {
+    DW_X86_EAX = 0,
+    DW_X86_ECX = 1,
+    DW_X86_EDX = 2,
+    DW_X86_EBX = 3,
+    DW_X86_ESP = 4,
+    DW_X86_EBP = 5,
+    DW_X86_ESI = 6,
+    DW_X86_EDI = 7,
+    DW_X86_EIP = 8,
+    DW_X86_REGS
+};
+
+enum {
+    DW_CFA_advance_loc        = 0x40, // high 2 bits, delta in low 6 bits
+    DW_CFA_offset             = 0x80, // high 2 bits, register in low 6 bits
+    DW_CFA_restore            = 0xc0, // high 2 bits, register in low 6 bits
+    DW_CFA_nop                = 0x00,
+    DW_CFA_set_loc            = 0x01,
+    DW_CFA_advance_loc1       = 0x02,
+    DW_CFA_advance_loc2       = 0x03,
+    DW_CFA_advance_loc4       = 0x04,
+    DW_CFA_offset_extended    = 0x05,
+    DW_CFA_restore_extended   = 0x06,
+    DW_CFA_undefined          = 0x07,
+    DW_CFA_same_value         = 0x08,
+    DW_CFA_register           = 0x09,
+    DW_CFA_remember_state     = 0x0a,
+    DW_CFA_restore_state      = 0x0b,
+    DW_CFA_def_cfa            = 0x0c,
+    DW_CFA_def_cfa_register   = 0x0d,
+    DW_CFA_def_cfa_offset     = 0x0e,
+    DW_CFA_def_cfa_expression = 0x0f, // dwarf3
+    DW_CFA_expression         = 0x10, // dwarf3
+    DW_CFA_offset_extended_sf = 0x11, // dwarf3
+    DW_CFA_def_cfa_sf         = 0x12, // dwarf3
+    DW_CFA_def_cfa_offset_sf  = 0x13, // dwarf3
+    DW_CFA_val_offset         = 0x14, // dwarf3
+    DW_CFA_val_offset_sf      = 0x15, // dwarf3
+    DW_CFA_val_expression     = 0x16, // dwarf3
+    DW_CFA_GNU_args_size      = 0x2e,
+    DW_CFA_GNU_negative_offset_extended = 0x2f
+};
+
+// Pointer encodings used in .eh_frame augmentation data.
+enum {
+    DW_EH_PE_absptr   = 0x00,
+    DW_EH_PE_uleb128  = 0x01,
+    DW_EH_PE_udata2   = 0x02,
+    DW_EH_PE_udata4   = 0x03,
+    DW_EH_PE_udata8   = 0x04,
+    DW_EH_PE_sleb128  = 0x09,
+    DW_EH_PE_sdata2   = 0x0a,
+    DW_EH_PE_sdata4   = 0x0b,
+    DW_EH_PE_sdata8   = 0x0c,
+    DW_EH_PE_pcrel    = 0x10,
+    DW_EH_PE_textrel  = 0x20,
+    DW_EH_PE_datarel  = 0x30,
+    DW_EH_PE_funcrel  = 0x40,
+    DW_EH_PE_aligned  = 0x50,
+    DW_EH_PE_indirect = 0x80,
+    DW_EH_PE_omit     = 0xff
+};
+
+// Frame section being decoded, used to resolve pc-relative pointers.
+struct frame_section_t
+{
+    address_t start; // section contents in memory
+    size_t    size;
+    uint32_t  vaddr; // load address of the section, 0 if not loaded
+    bool      is_eh_frame;
+};
+
 /* Resides in: .debug_frame, .eh_frame */
 class cie_t
 {
-    uint32_t  length;
-    uint32_t  CIE_id;
+public:
     uint8_t   version;
-    char*     augmentation;
-    uleb128_t code_alignment_factor;
-    sleb128_t data_alignment_factor;
-    uleb128_t return_address_register;
-    uint8_t*  initial_instructions;
+    uint32_t  code_alignment_factor;
+    int32_t   data_alignment_factor;
+    uint32_t  return_address_register;
+    uint8_t   fde_encoding; // DW_EH_PE_* of FDE addresses
+    bool      has_augmentation_data; // 'z' augmentation, FDEs carry augmentation data too
+    size_t    initial_instructions;
+    size_t    end;
 
-    void decode(address_t from, size_t& offset);
+    // Offset points at the CIE length field.
+    bool decode(const frame_section_t& section, size_t offset);
 };
 
 /* Resides in: .debug_frame, .eh_frame */
 class fde_t
 {
-    uint32_t length;
-    uint32_t CIE_pointer;
+public:
     uint32_t initial_location;
     uint32_t address_range;
-    uint8_t* instructions;
+    const frame_section_t* section;
+    const cie_t* cie;
+    size_t instructions;
+    size_t end;
+
+    bool contains(uint32_t pc) const { return pc >= initial_location && pc - initial_location < address_range; }
+};
+
+// How to recover a register of the caller.
+struct register_rule_t
+{
+    enum {
+        SAME_VALUE, // callee did not touch it
+        UNDEFINED,  // not recoverable
+        OFFSET,     // saved at CFA + value
+        VAL_OFFSET, // value is CFA + value
+        REGISTER,   // copy of register value
+        EXPRESSION  // DWARF expression, not supported
+    } kind;
+    int32_t value;
+};
+
+// Unwind rules for one instruction, a row of the CFI table.
+struct frame_state_t
+{
+    uint32_t cfa_register;
+    int32_t  cfa_offset;
+    bool     cfa_is_expression;
+    register_rule_t rules[DW_X86_REGS];
+    uint32_t return_address_register;
+};
+
+// Words of a stack copied by the kernel, see debugger_t::print_stack_snapshot().
+struct stack_snapshot_t
+{
+    uint32_t eip, esp, ebp;
+    uint32_t base; // address of words[0]
+    std::vector<uint32_t> words;
+
+    bool read(uint32_t address, uint32_t& value) const
+    {
+        if (address < base || (address - base) % 4 || (address - base) / 4 >= words.size())
+            return false;
+        value = words[(address - base) / 4];
+        return true;
+    }
+};
+
+class dwarf_frame_t
+{
+    frame_section_t sections[2]; // .debug_frame and .eh_frame
+    size_t section_count;
+    std::map<address_t, cie_t> cies; // by address of the CIE in memory
+    std::vector<fde_t> fdes;         // sorted by initial_location
+
+    void load(const frame_section_t& section);
+    bool execute(const fde_t& fde, size_t from, size_t to, uint32_t pc, uint32_t target, frame_state_t& state,
+                 const frame_state_t& initial) const;
+
+public:
+    dwarf_frame_t(elf_parser_t& elf);
+    dwarf_frame_t(const dwarf_frame_t&) = delete;
+    dwarf_frame_t& operator=(const dwarf_frame_t&) = delete;
+
+    size_t fde_count() const { return fdes.size(); }
+    const fde_t* find_fde(uint32_t pc) const;
+
+    // Compute unwind rules in effect at pc.
+    bool frame_state(uint32_t pc, frame_state_t& state) const;
+
+    // Walk the stack in snapshot, collecting return addresses starting with snapshot eip. Frames without CFI
+    // are unwound through the EBP chain if it stays inside the snapshot.
+    void unwind(const stack_snapshot_t& snapshot, std::vector<uint32_t>& pcs, size_t max_frames = 64) const;
 };
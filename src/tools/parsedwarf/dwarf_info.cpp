@@ -31,19 +31,12 @@ void cuh_t::dump()
     DPRINT("compilation unit header: unit-length %d bytes, version %04x, debug-abbrev-offset 0x%x, address_size %d\n", unit_length, version, debug_abbrev_offset, address_size);
 }
 
-die_t& die_t::operator=(const die_t& d)
+die_t::~die_t()
 {
-    if (this != &d)
-    {
-        parser = d.parser;
-        abbrev_code = d.abbrev_code;
-        node_attributes = d.node_attributes;
-        tag = d.tag;
-        has_children = d.has_children;
-        parent = d.parent;
-        children = d.children;
-    }
-    return *this;
+    for (auto& attr : node_attributes)
+        delete attr.second;
+    for (auto child : children)
+        delete child;
 }
 
 bool die_t::decode(address_t from, size_t& offset)
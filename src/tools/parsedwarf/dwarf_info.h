@@ -53,10 +53,10 @@ public:
     die_t(dwarf_parser_t& p) : parser(p)
     , abbrev_code(0), tag(0), parent(0)
     {}
-    die_t(const die_t& d) : parser(d.parser), abbrev_code(d.abbrev_code), node_attributes(d.node_attributes)
-    , tag(d.tag), parent(d.parent), children(d.children) // FIXME double-free!
-    {}
-    die_t& operator=(const die_t& d);
+    // A DIE owns its attributes and its subtree.
+    ~die_t();
+    die_t(const die_t&) = delete;
+    die_t& operator=(const die_t&) = delete;
 
     bool decode(address_t from, size_t& offset);
 
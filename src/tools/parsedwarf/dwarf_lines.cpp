@@ -76,7 +76,7 @@ bool lineprogram_regs_t::execute(address_t from, size_t& offset)
                 break;
             case DW_LNS_const_add_pc:
             {
-                address_t operand = address_increment(255) * header.minimum_instruction_length;
+                address_t operand = address_increment(255 - header.opcode_base);
                 address += operand;
                 DPRINT("DW_LNS_const_add_pc (add %u) => %08x\n", operand, address);
                 break;
@@ -135,7 +135,9 @@ bool lineprogram_regs_t::execute(address_t from, size_t& offset)
                         break;
                     }
                     default:
+                        // Skip vendor and later DWARF extensions, e.g. DW_LNE_set_discriminator.
                         DPRINT("UNKNOWN EXTENDED OPCODE 0x%x\n", sub_opcode);
+                        offset = prev_offset + ext_area_length;
                         return false;
                 }
                 if (offset != prev_offset + ext_area_length)
@@ -147,7 +149,9 @@ bool lineprogram_regs_t::execute(address_t from, size_t& offset)
             }
             default:
                 DPRINT("UNKNOWN OPCODE 0x%x\n", opcode);
-                // TODO: skip unknown opcode by reading as many leb128 dummy parameters as specified in standard_opcode_lengths table
+                // Skip unknown opcode by reading as many leb128 dummy parameters as specified in standard_opcode_lengths table.
+                for (uint32_t i = 0; i < (uint32_t)header.standard_opcode_lengths[opcode - 1]; ++i)
+                    uleb128_t::decode(from, offset, -1);
                 return false;
         }
         return append_line; // standard opcodes do not trigger adding a new matrix line by default
@@ -182,6 +186,12 @@ void lnp_header_t::decode(address_t from, size_t& offset)
 
     minimum_instruction_length = *reinterpret_cast<uint8_t*>(from + offset);
     offset += sizeof(uint8_t);
+    maximum_operations_per_instruction = 1;
+    if (version >= 4)
+    {
+        maximum_operations_per_instruction = *reinterpret_cast<uint8_t*>(from + offset);
+        offset += sizeof(uint8_t);
+    }
     default_is_stmt = *reinterpret_cast<uint8_t*>(from + offset);
     offset += sizeof(uint8_t);
     line_base = *reinterpret_cast<int8_t*>(from + offset);
@@ -263,8 +273,11 @@ bool lnp_filename_t::decode(address_t from, size_t& offset)
     }
 
     char* str = s;
-    while (*s++)
+    while (*s)
+    {
+        ++s;
         ++offset;
+    }
     ++offset;
 
     filename = std::string(str, s - str);
@@ -32,6 +32,7 @@ public:
     uint16_t version;
     uint32_t header_length;
     uint8_t  minimum_instruction_length;
+    uint8_t  maximum_operations_per_instruction; // dwarf4, 1 for non-VLIW
     uint8_t  default_is_stmt;
     int8_t   line_base;
     uint8_t  line_range;
@@ -155,6 +156,11 @@ public:
     // Populate state matrix from a given line program.
     bool execute(size_t& offset);
 
+    size_t section_size() const { return size; }
+    // Header and state matrix of the line program run last.
+    const lnp_header_t& program_header() const { return header; }
+    const std::vector<lineprogram_regs_t>& rows() const { return state_matrix; }
+
     std::string file_name(address_t address, address_t low_pc, address_t high_pc);
     int line_number(address_t address, address_t low_pc, address_t high_pc);
 };
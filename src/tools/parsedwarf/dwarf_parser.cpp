@@ -17,7 +17,13 @@
 
 using namespace elf32; // FIXME: only elf32 is supported, will fail on x86-64
 
-dwarf_parser_t::dwarf_parser_t(elf_parser_t& elf) : elf_parser(elf), root(0)
+dwarf_parser_t::dwarf_parser_t(elf_parser_t& elf)
+    : elf_parser(elf)
+    , debug_info(0)
+    , debug_aranges(0)
+    , debug_abbrev(0)
+    , debug_lines(0)
+    , root(0)
 {
     section_header_t* h = elf_parser.section_header(".debug_aranges");
     section_header_t* b = elf_parser.section_header(".debug_abbrev");
@@ -28,7 +34,8 @@ dwarf_parser_t::dwarf_parser_t(elf_parser_t& elf) : elf_parser(elf), root(0)
     {
         debug_abbrev = new dwarf_debug_abbrev_t(elf_parser.start() + b->offset, b->size);
         debug_aranges = new dwarf_debug_aranges_t(elf_parser.start() + h->offset, h->size);
-        debug_lines = new dwarf_debug_lines_t(elf_parser.start() + l->offset, l->size);
+        if (l)
+            debug_lines = new dwarf_debug_lines_t(elf_parser.start() + l->offset, l->size);
         debug_info = new dwarf_debug_info_t(elf_parser.start() + g->offset, g->size, *debug_abbrev);
     }
 #if DWARF_DEBUG
@@ -39,6 +46,7 @@ dwarf_parser_t::dwarf_parser_t(elf_parser_t& elf) : elf_parser(elf), root(0)
 
 dwarf_parser_t::~dwarf_parser_t()
 {
+    delete root;
     delete debug_info;
     delete debug_aranges;
     delete debug_abbrev;
@@ -116,9 +124,10 @@ bool dwarf_parser_t::lookup(address_t addr)
 #endif
 
         size_t abbr_offset = cuh.debug_abbrev_offset;
-        debug_abbrev->load_abbrev_set(abbr_offset); // TODO: cache abbrevs (key: given offset)
+        debug_abbrev->load_abbrev_set(abbr_offset);
 
-        // Build DIE tree for a given compilation unit.
+        // Build DIE tree for a given compilation unit, replacing the previous one.
+        delete root;
         root = build_tree(offset);
 
         die_t* node = 0;
@@ -153,7 +162,7 @@ bool dwarf_parser_t::lookup(address_t addr)
             {
                 cu_node->dump();
                 auto stmt = dynamic_cast<data4_form_reader_t*>(cu_node->node_attributes[DW_AT_stmt_list]);
-                if (stmt)
+                if (stmt && debug_lines)
                 {
                     size_t ofs = stmt->data;
                     if (debug_lines->execute(ofs))
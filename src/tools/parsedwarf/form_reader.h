@@ -18,6 +18,7 @@ public:
     static form_reader_t* create(dwarf_parser_t& parser, uint32_t form); // factory
 
     form_reader_t(dwarf_parser_t& p) : parser(p) {}
+    virtual ~form_reader_t() {}
     virtual bool decode(address_t from, size_t& offset) = 0;
     virtual void print() = 0;
 
@@ -240,7 +241,8 @@ public:
     uleb128_t form;
     form_reader_t* data;
 
-    indirect_form_reader_t(dwarf_parser_t& p) : form_reader_t(p) {}
+    indirect_form_reader_t(dwarf_parser_t& p) : form_reader_t(p), data(0) {}
+    virtual ~indirect_form_reader_t() { delete data; }
     virtual bool decode(address_t from, size_t& offset);
     virtual void print();
 };
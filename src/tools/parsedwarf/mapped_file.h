@@ -0,0 +1,61 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2010 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Read-only memory mapping of a whole file, host only.
+// Pages are loaded on first access, so only the parts of the file actually used are ever read.
+//
+#pragma once
+
+#include "types.h"
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class mapped_file_t
+{
+    void* data;
+    size_t length;
+    uint64_t modified;
+
+public:
+    mapped_file_t(const char* fname)
+        : data(MAP_FAILED)
+        , length(0)
+        , modified(0)
+    {
+        int fd = open(fname, O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error(std::string("cannot open ") + fname);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            length = st.st_size;
+            modified = st.st_mtime;
+            data = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error(std::string("cannot map ") + fname);
+    }
+
+    ~mapped_file_t()
+    {
+        munmap(data, length);
+    }
+
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+    address_t start() const { return reinterpret_cast<address_t>(data); }
+    size_t size() const { return length; }
+    // Modification time in seconds, tells whether data derived from the file is stale.
+    uint64_t mtime() const { return modified; }
+};
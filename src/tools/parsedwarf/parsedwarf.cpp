@@ -8,7 +8,14 @@
 //
 #include <stdlib.h>
 #include <stdexcept>
-#include "raiifile.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "mapped_file.h"
+#include "symbol_index.h"
+#include "dwarf_frame.h"
 #include "elf_parser.h"
 #include "leb128.h"
 #include "dwarf_parser.h"
@@ -17,7 +24,6 @@
 #include "dwarf_info.h"
 
 using namespace std;
-using namespace raii_wrapper;
 using namespace elf32; // FIXME: only elf32 is supported, will fail on x86-64
 
 string strmid(string str, int pos, int len)
@@ -36,20 +42,175 @@ void panic(const char* s)
     exit(-1);
 }
 
+// Backtrace frames are lines "| 0x..." following a "*** Backtrace ***" line.
+static bool parse_frame(const string& str, bool& in_stack_dump, address_t& addr)
+{
+    bool frame = false;
+    if (in_stack_dump)
+    {
+        if (str.find("| ") == 0)
+        {
+            addr = strtoul(strmid(str, 2, 10).c_str(), NULL, 0);
+            frame = true;
+        }
+        else
+            in_stack_dump = false;
+    }
+
+    if (str.find("*** Backtrace ***") == 0)
+    {
+        in_stack_dump = true;
+    }
+    return frame;
+}
+
+/*
+ * Stack snapshots are printed by debugger_t::print_stack_snapshot():
+ * *** Stack snapshot *** eip 0x0010380f esp 0x0011ff40 ebp 0x00000000
+ * @ 0x0011ff40 0x00103898 0x00000001 0x0011ff88 0x00000000 0x0010398e 0x00000000 0x00000000 0x00000000
+ * *** End of snapshot ***
+ * Returns true once a complete snapshot has been read.
+ */
+static bool parse_snapshot(const string& str, bool& in_snapshot, stack_snapshot_t& snapshot)
+{
+    if (str.find("*** Stack snapshot ***") == 0)
+    {
+        snapshot = stack_snapshot_t();
+        in_snapshot = sscanf(str.c_str(), "*** Stack snapshot *** eip %x esp %x ebp %x",
+                             &snapshot.eip, &snapshot.esp, &snapshot.ebp) == 3;
+        snapshot.base = snapshot.esp;
+        return false;
+    }
+    if (!in_snapshot)
+        return false;
+
+    if (str.find("@ ") == 0)
+    {
+        const char* p = str.c_str() + 2;
+        char* next;
+        uint32_t address = strtoul(p, &next, 0);
+        // Words must be contiguous, lines lost from the log end the usable part of the snapshot.
+        if (next != p && address == snapshot.base + snapshot.words.size() * 4)
+        {
+            for (p = next; ; p = next)
+            {
+                uint32_t word = strtoul(p, &next, 0);
+                if (next == p)
+                    break;
+                snapshot.words.push_back(word);
+            }
+        }
+        return false;
+    }
+
+    in_snapshot = false;
+    return str.find("*** End of snapshot ***") == 0;
+}
+
+// Symbolize every backtrace frame of the log at once, printing the log with frames annotated.
+static void symbolize_batch(const char* logfile, const string& cache, const mapped_file_t& image)
+{
+    symbol_index_t index;
+    if (!index.load(cache, image.size(), image.mtime()))
+    {
+        elf_parser_t elf(image.start());
+        dwarf_parser_t dwarf(elf);
+        index.build(dwarf);
+        if (!index.save(cache, image.size(), image.mtime()))
+            cerr << "Cannot write symbol cache " << cache << endl;
+    }
+
+    vector<string> log;
+    vector<size_t> frames;
+    vector<address_t> addresses;
+    string str;
+    ifstream input(logfile, ios::in);
+    bool in_stack_dump = false;
+    bool in_snapshot = false;
+    stack_snapshot_t snapshot;
+    // Call frame information is only decoded if the log has stack snapshots.
+    unique_ptr<elf_parser_t> elf;
+    unique_ptr<dwarf_frame_t> cfi;
+    while (getline(input, str))
+    {
+        address_t addr;
+        if (parse_frame(str, in_stack_dump, addr))
+        {
+            frames.push_back(log.size());
+            addresses.push_back(addr);
+        }
+        log.push_back(str);
+
+        if (parse_snapshot(str, in_snapshot, snapshot))
+        {
+            if (!cfi)
+            {
+                elf.reset(new elf_parser_t(image.start()));
+                cfi.reset(new dwarf_frame_t(*elf));
+            }
+            vector<uint32_t> pcs;
+            cfi->unwind(snapshot, pcs);
+            log.push_back("*** Unwound backtrace *** " + to_string(pcs.size()) + " stack frames:");
+            for (auto pc : pcs)
+            {
+                char line[16];
+                snprintf(line, sizeof(line), "| 0x%08x", pc);
+                frames.push_back(log.size());
+                addresses.push_back(pc);
+                log.push_back(line);
+            }
+        }
+    }
+
+    // Lookups only read the index, so frames are split between threads in contiguous ranges.
+    vector<symbol_location_t> symbols(frames.size());
+    size_t threads = max(1u, thread::hardware_concurrency());
+    size_t per_thread = (frames.size() + threads - 1) / threads;
+    vector<thread> workers;
+    for (size_t begin = 0; begin < frames.size(); begin += per_thread)
+    {
+        size_t end = min(frames.size(), begin + per_thread);
+        workers.emplace_back([&, begin, end]() {
+            for (size_t i = begin; i < end; ++i)
+                index.lookup(addresses[i], symbols[i]);
+        });
+    }
+    for (auto& t : workers)
+        t.join();
+
+    size_t frame = 0;
+    for (size_t i = 0; i < log.size(); ++i)
+    {
+        cout << log[i];
+        if (frame < frames.size() && frames[frame] == i)
+        {
+            const symbol_location_t& sym = symbols[frame++];
+            cout << " " << (sym.function ? sym.function : "??");
+            if (sym.file)
+                cout << " (" << sym.file << ":" << sym.line << ")";
+        }
+        cout << "\n";
+    }
+    cout.flush();
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 4)
-        throw runtime_error("usage: parsedwarf format logfile elf_with_debug\nformat = metta");
+        throw runtime_error("usage: parsedwarf format logfile elf_with_debug [symbol_cache]\nformat = metta | batch");
 
     string format(argv[1]);
 
     // Load binary file with debug info.
-    // TODO: use some sort of mmap()ed access to reduce memory usage.
-    file f(argv[3], fstream::in);
-    size_t fsize = f.size();
-    char* buffer = new char [fsize];
-    f.read(buffer, fsize);
-    address_t start = reinterpret_cast<address_t>(buffer);
+    mapped_file_t image(argv[3]);
+    address_t start = image.start();
+
+    if (format == string("batch"))
+    {
+        symbolize_batch(argv[2], argc > 4 ? argv[4] : string(argv[3]) + ".symcache", image);
+        return 0;
+    }
+
     elf_parser_t elf(start);
     dwarf_parser_t dwarf(elf);
 
@@ -68,33 +229,18 @@ int main(int argc, char** argv)
         | 0x001033d7
         | 0x001032b6
         | 0x001030b6
-        | 0x00102d7e // dwarf_parser_t bugs out on this and next line, FIXME
+        | 0x00102d7e
         | 0x001029fe
         */
         string str;
         ifstream input(argv[2], ios::in);
-        int line = 0;
         bool in_stack_dump = false;
 
         while (getline(input, str))
         {
-            line++;
-
-            if (in_stack_dump)
-            {
-                if (str.find("| ") == 0)
-                {
-                    address_t addr = strtoul(strmid(str, 2, 10).c_str(), NULL, 0);
-                    dwarf.lookup(addr);
-                }
-                else
-                    in_stack_dump = false;
-            }
-
-            if (str.find("*** Backtrace ***") == 0)
-            {
-                in_stack_dump = true;
-            }
+            address_t addr;
+            if (parse_frame(str, in_stack_dump, addr))
+                dwarf.lookup(addr);
         }
     }
     else
@@ -0,0 +1,254 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2010 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include "symbol_index.h"
+#include "dwarf_parser.h"
+#include "dwarf_abbrev.h"
+#include "dwarf_lines.h"
+#include "datarepr.h"
+#include "form_reader.h"
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+
+static const char CACHE_MAGIC[8] = { 'M', 'S', 'Y', 'M', 'I', 'D', 'X', '1' };
+
+struct cache_header_t
+{
+    char magic[8];
+    uint64_t elf_size;
+    uint64_t elf_mtime;
+    uint32_t functions;
+    uint32_t lines;
+    uint32_t strings;
+    uint32_t reserved;
+};
+
+uint32_t symbol_index_t::intern(const std::string& s)
+{
+    auto it = interned.find(s);
+    if (it != interned.end())
+        return it->second;
+    uint32_t offset = strings.size();
+    strings.insert(strings.end(), s.begin(), s.end());
+    strings.push_back(0);
+    interned[s] = offset;
+    return offset;
+}
+
+// Index DIEs of a compilation unit by their offset, so references between them resolve without tree searches.
+static void index_offsets(die_t* node, std::unordered_map<size_t, die_t*>& by_offset)
+{
+    by_offset[node->offs] = node;
+    for (auto child : node->children)
+        index_offsets(child, by_offset);
+}
+
+// Out-of-line definitions and inlined instances get their name from the declaration they refer to.
+static const char* die_name(die_t* node, size_t cu_offset, const std::unordered_map<size_t, die_t*>& by_offset)
+{
+    for (int hops = 0; node && hops < 4; ++hops)
+    {
+        const char* name = node->string_attr(DW_AT_name);
+        if (name)
+            return name;
+
+        auto ref = dynamic_cast<ref4_form_reader_t*>(node->node_attributes[DW_AT_specification]);
+        if (!ref)
+            ref = dynamic_cast<ref4_form_reader_t*>(node->node_attributes[DW_AT_abstract_origin]);
+        if (!ref)
+            return 0;
+        auto target = by_offset.find(ref->data + cu_offset);
+        node = target == by_offset.end() ? 0 : target->second;
+    }
+    return 0;
+}
+
+// DWARF2 and 3 give high_pc as an address, DWARF4 allows a constant offset from low_pc.
+static bool die_range(die_t* node, uint32_t& low_pc, uint32_t& high_pc)
+{
+    auto low = dynamic_cast<addr_form_reader_t*>(node->node_attributes[DW_AT_low_pc]);
+    if (!low)
+        return false;
+    low_pc = low->data;
+
+    form_reader_t* high = node->node_attributes[DW_AT_high_pc];
+    if (auto f = dynamic_cast<addr_form_reader_t*>(high))
+        high_pc = f->data;
+    else if (auto f = dynamic_cast<data1_form_reader_t*>(high))
+        high_pc = low_pc + f->data;
+    else if (auto f = dynamic_cast<data2_form_reader_t*>(high))
+        high_pc = low_pc + f->data;
+    else if (auto f = dynamic_cast<data4_form_reader_t*>(high))
+        high_pc = low_pc + f->data;
+    else if (auto f = dynamic_cast<data8_form_reader_t*>(high))
+        high_pc = low_pc + f->data;
+    else if (auto f = dynamic_cast<udata_form_reader_t*>(high))
+        high_pc = low_pc + uint32_t(f->data);
+    else
+        return false;
+    return high_pc > low_pc;
+}
+
+void symbol_index_t::add_functions(dwarf_parser_t& dwarf)
+{
+    size_t offset = 0;
+    while (offset < dwarf.debug_info->size)
+    {
+        size_t cu_offset = offset;
+        cuh_t cuh = dwarf.debug_info->get_cuh(offset);
+        size_t next_cu = cu_offset + cuh.unit_length + sizeof(uint32_t);
+
+        size_t abbr_offset = cuh.debug_abbrev_offset;
+        dwarf.debug_abbrev->load_abbrev_set(abbr_offset);
+
+        die_t* root = dwarf.build_tree(offset);
+        if (root)
+        {
+            std::unordered_map<size_t, die_t*> by_offset;
+            index_offsets(root, by_offset);
+
+            std::vector<die_t*> pending(1, root);
+            while (!pending.empty())
+            {
+                die_t* node = pending.back();
+                pending.pop_back();
+                pending.insert(pending.end(), node->children.begin(), node->children.end());
+
+                function_t f;
+                if (node->is_subprogram() && die_range(node, f.low_pc, f.high_pc))
+                {
+                    const char* name = die_name(node, cu_offset, by_offset);
+                    f.name = intern(name ? name : "<unnamed>");
+                    functions.push_back(f);
+                }
+            }
+            delete root;
+        }
+        offset = next_cu;
+    }
+
+    std::sort(functions.begin(), functions.end(), [](const function_t& a, const function_t& b) {
+        return a.low_pc < b.low_pc;
+    });
+}
+
+void symbol_index_t::add_lines(dwarf_parser_t& dwarf)
+{
+    dwarf_debug_lines_t& debug_lines = *dwarf.debug_lines;
+
+    size_t offset = 0;
+    while (offset + sizeof(uint32_t) <= debug_lines.section_size())
+    {
+        size_t unit_offset = offset;
+        bool ok = debug_lines.execute(offset);
+        const lnp_header_t& header = debug_lines.program_header();
+        if (ok)
+        {
+            for (auto& row : debug_lines.rows())
+            {
+                line_t l;
+                l.address = row.address;
+                l.line = row.end_sequence ? 0 : row.line;
+                if (row.file >= 1 && size_t(row.file) <= header.file_names.size())
+                    l.file = intern(header.file_names[row.file - 1].filename);
+                else
+                    l.file = intern("<unknown>");
+                lines.push_back(l);
+            }
+        }
+        offset = unit_offset + header.unit_length + sizeof(uint32_t);
+    }
+
+    // An end of sequence sorts before a sequence starting at the same address.
+    std::stable_sort(lines.begin(), lines.end(), [](const line_t& a, const line_t& b) {
+        return a.address < b.address || (a.address == b.address && a.line == 0 && b.line != 0);
+    });
+}
+
+void symbol_index_t::build(dwarf_parser_t& dwarf)
+{
+    functions.clear();
+    lines.clear();
+    strings.clear();
+    interned.clear();
+
+    if (dwarf.debug_info && dwarf.debug_abbrev)
+        add_functions(dwarf);
+    if (dwarf.debug_lines)
+        add_lines(dwarf);
+    interned.clear();
+}
+
+bool symbol_index_t::save(const std::string& fname, uint64_t elf_size, uint64_t elf_mtime) const
+{
+    cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.elf_size = elf_size;
+    header.elf_mtime = elf_mtime;
+    header.functions = functions.size();
+    header.lines = lines.size();
+    header.strings = strings.size();
+
+    std::ofstream out(fname.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(functions.data()), functions.size() * sizeof(function_t));
+    out.write(reinterpret_cast<const char*>(lines.data()), lines.size() * sizeof(line_t));
+    out.write(strings.data(), strings.size());
+    return out.good();
+}
+
+bool symbol_index_t::load(const std::string& fname, uint64_t elf_size, uint64_t elf_mtime)
+{
+    std::ifstream in(fname.c_str(), std::ios::binary);
+    cache_header_t header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.elf_size != elf_size || header.elf_mtime != elf_mtime)
+        return false;
+
+    functions.resize(header.functions);
+    lines.resize(header.lines);
+    strings.resize(header.strings);
+    in.read(reinterpret_cast<char*>(functions.data()), functions.size() * sizeof(function_t));
+    in.read(reinterpret_cast<char*>(lines.data()), lines.size() * sizeof(line_t));
+    in.read(strings.data(), strings.size());
+    if (!in || (!strings.empty() && strings.back() != 0))
+    {
+        functions.clear();
+        lines.clear();
+        strings.clear();
+        return false;
+    }
+    return true;
+}
+
+bool symbol_index_t::lookup(uint32_t addr, symbol_location_t& sym) const
+{
+    sym.function = 0;
+    sym.file = 0;
+    sym.line = 0;
+
+    auto f = std::upper_bound(functions.begin(), functions.end(), addr, [](uint32_t a, const function_t& fn) {
+        return a < fn.low_pc;
+    });
+    if (f != functions.begin() && addr < (f - 1)->high_pc && (f - 1)->name < strings.size())
+        sym.function = &strings[(f - 1)->name];
+
+    auto l = std::upper_bound(lines.begin(), lines.end(), addr, [](uint32_t a, const line_t& ln) {
+        return a < ln.address;
+    });
+    if (l != lines.begin() && (l - 1)->line != 0 && (l - 1)->file < strings.size())
+    {
+        sym.file = &strings[(l - 1)->file];
+        sym.line = (l - 1)->line;
+    }
+
+    return sym.function || sym.file;
+}
@@ -0,0 +1,69 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2010 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Address index for symbolizing many addresses at once.
+//
+// One pass over .debug_info and .debug_line collects function ranges and line table rows into tables sorted by
+// address, after which every lookup is a pair of binary searches. The tables can be saved next to the ELF file
+// and loaded back as long as the ELF file does not change.
+//
+#pragma once
+
+#include "types.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class dwarf_parser_t;
+
+struct symbol_location_t
+{
+    const char* function; // 0 if address is not inside a known function
+    const char* file;     // 0 if there is no line information for address
+    uint32_t line;
+};
+
+class symbol_index_t
+{
+    struct function_t
+    {
+        uint32_t low_pc;
+        uint32_t high_pc; // first address past the function
+        uint32_t name;    // offset in strings
+    };
+
+    struct line_t
+    {
+        uint32_t address;
+        uint32_t file;    // offset in strings
+        uint32_t line;    // 0 marks the end of a sequence, addresses from here on have no line
+    };
+
+    std::vector<function_t> functions; // sorted by low_pc
+    std::vector<line_t> lines;         // sorted by address
+    std::vector<char> strings;         // zero-terminated names
+    std::unordered_map<std::string, uint32_t> interned; // used while building
+
+    uint32_t intern(const std::string& s);
+    void add_functions(dwarf_parser_t& dwarf);
+    void add_lines(dwarf_parser_t& dwarf);
+
+public:
+    // Build the tables from DWARF info, replacing anything in the index.
+    void build(dwarf_parser_t& dwarf);
+
+    // Cache files are tagged with size and modification time of the ELF file they were built from.
+    bool save(const std::string& fname, uint64_t elf_size, uint64_t elf_mtime) const;
+    bool load(const std::string& fname, uint64_t elf_size, uint64_t elf_mtime);
+
+    // Thread-safe, the index is not modified by lookups.
+    bool lookup(uint32_t addr, symbol_location_t& sym) const;
+
+    size_t function_count() const { return functions.size(); }
+    size_t line_count() const { return lines.size(); }
+};
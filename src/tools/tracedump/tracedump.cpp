@@ -0,0 +1,261 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * Format binary trace records written by TRACE() trace points.
+ *
+ * Run with:
+ * tracedump trace.bin nucleus root_domain.comp heap_mod.comp ...
+ *              ^        ^
+ *              |        |
+ *  trace      -+        |
+ *  components ----------+
+ *
+ * Trace is either a raw copy of the trace buffers region saved from an emulator or a kernel log with buffers
+ * printed by debugger_t::print_trace(). Format strings are read from .trace_formats sections of the components.
+ */
+#include <stdexcept>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <map>
+#include <string.h>
+#include "types.h"
+#include "elf.h"
+#include "trace_buffer.h"
+
+using namespace std;
+using namespace elf32;
+
+struct event_t
+{
+    uint32_t cpu;
+    trace_record_t record;
+
+    bool operator < (const event_t& other) const
+    {
+        if (record.timestamp != other.record.timestamp)
+            return record.timestamp < other.record.timestamp;
+        if (cpu != other.cpu)
+            return cpu < other.cpu;
+        return record.sequence < other.record.sequence;
+    }
+};
+
+typedef map<uint32_t, string> format_map;
+
+static vector<char> read_file(const char* fname)
+{
+    ifstream in(fname, ios::in | ios::binary);
+    if (!in)
+        throw runtime_error(string("cannot open ") + fname);
+    return vector<char>(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void load_formats(const char* fname, format_map& formats)
+{
+    vector<char> file = read_file(fname);
+    const header_t* header = reinterpret_cast<const header_t*>(file.data());
+    if (file.size() < sizeof(header_t) || header->magic != ELF_MAGIC || header->elfclass != ELF_CLASS_32)
+        throw runtime_error(string(fname) + " is not an ELF32 file");
+    if (header->shoff + header->shnum * sizeof(section_header_t) > file.size() || header->shstrndx >= header->shnum)
+        throw runtime_error(string(fname) + " has invalid section headers");
+
+    const section_header_t* sections = reinterpret_cast<const section_header_t*>(file.data() + header->shoff);
+    const char* names = file.data() + sections[header->shstrndx].offset;
+    for (size_t i = 0; i < header->shnum; ++i)
+    {
+        const section_header_t& s = sections[i];
+        if (strcmp(names + s.name, ".trace_formats") != 0 || s.offset + s.size > file.size())
+            continue;
+
+        // Strings are NUL terminated and may be padded with more NULs for alignment.
+        const char* p = file.data() + s.offset;
+        const char* end = p + s.size;
+        while (p < end)
+        {
+            string format(p, strnlen(p, end - p));
+            p += format.size() + 1;
+            if (format.empty())
+                continue;
+            uint32_t id = trace_format_id(format.c_str());
+            auto it = formats.find(id);
+            if (it != formats.end() && it->second != format)
+                cerr << "Format id collision " << hex << id << dec << " between \"" << it->second << "\" and \""
+                     << format << "\"" << endl;
+            formats[id] = format;
+        }
+    }
+}
+
+// Collect complete records of one buffer, oldest first.
+static void load_buffer(const trace_buffer_t* buffer, vector<event_t>& events)
+{
+    uint32_t head = buffer->head;
+    uint32_t kept = min<uint32_t>(head, trace_buffer_t::RECORDS);
+    for (uint32_t seq = head - kept; seq != head; ++seq)
+    {
+        const trace_record_t& r = buffer->records[seq % trace_buffer_t::RECORDS];
+        if (r.sequence == seq + 1)
+            events.push_back(event_t{buffer->cpu, r});
+    }
+}
+
+static bool load_image(const vector<char>& image, vector<event_t>& events)
+{
+    bool found = false;
+    for (size_t offset = 0; offset + sizeof(trace_buffer_t) <= image.size(); offset += trace_buffer_t::STRIDE)
+    {
+        const trace_buffer_t* buffer = reinterpret_cast<const trace_buffer_t*>(image.data() + offset);
+        if (buffer->magic != trace_buffer_t::MAGIC)
+            break;
+        load_buffer(buffer, events);
+        found = true;
+    }
+    return found;
+}
+
+/*
+ * Buffers are printed by debugger_t::print_trace():
+ * *** Trace buffer *** cpu 0x00000000 head 0x00000123
+ * T 0x00000122 0x9bd6a2b4 0x00000000 0x0312f7c6 0x00000010 0x00123456 0x00000000 0x00000000
+ * *** End of trace ***
+ */
+static void load_log(const vector<char>& log, vector<event_t>& events)
+{
+    string text(log.begin(), log.end());
+    size_t pos = 0;
+    bool in_trace = false;
+    uint32_t cpu = 0;
+    while (pos < text.size())
+    {
+        size_t eol = text.find('\n', pos);
+        if (eol == string::npos)
+            eol = text.size();
+        string line = text.substr(pos, eol - pos);
+        pos = eol + 1;
+
+        uint32_t head;
+        if (sscanf(line.c_str(), "*** Trace buffer *** cpu %x head %x", &cpu, &head) == 2)
+        {
+            in_trace = true;
+            continue;
+        }
+        if (!in_trace)
+            continue;
+
+        event_t e;
+        uint32_t ts_hi, ts_lo;
+        uint32_t* a = e.record.args;
+        if (sscanf(line.c_str(), "T %x %x %x %x %x %x %x %x", &e.record.sequence, &e.record.format, &ts_hi, &ts_lo,
+                   &a[0], &a[1], &a[2], &a[3]) == 4 + trace_record_t::ARGS)
+        {
+            e.cpu = cpu;
+            e.record.timestamp = (uint64_t(ts_hi) << 32) | ts_lo;
+            events.push_back(e);
+        }
+        else
+            in_trace = false;
+    }
+}
+
+// Expand printf conversions of format, each taking one 32-bit argument.
+static string format_record(const string& format, const uint32_t* args)
+{
+    string out;
+    size_t arg = 0;
+    for (size_t i = 0; i < format.size(); ++i)
+    {
+        if (format[i] != '%')
+        {
+            out += format[i];
+            continue;
+        }
+        if (i + 1 < format.size() && format[i + 1] == '%')
+        {
+            out += '%';
+            ++i;
+            continue;
+        }
+
+        // Keep flags, width and precision, drop length modifiers, values are never wider than 32 bits.
+        string spec("%");
+        size_t j = i + 1;
+        for (; j < format.size() && strchr("-+ #0123456789.", format[j]); ++j)
+            spec += format[j];
+        for (; j < format.size() && strchr("hlLqjzt", format[j]); ++j)
+            ;
+        if (j == format.size())
+        {
+            out += format.substr(i);
+            break;
+        }
+        char conversion = format[j];
+        i = j;
+
+        if (arg == trace_record_t::ARGS)
+        {
+            out += "<missing>";
+            continue;
+        }
+        uint32_t value = args[arg++];
+        char buf[64];
+        switch (conversion)
+        {
+            case 'd': case 'i':
+                snprintf(buf, sizeof(buf), (spec + conversion).c_str(), int32_t(value));
+                break;
+            case 'u': case 'x': case 'X': case 'o': case 'c':
+                snprintf(buf, sizeof(buf), (spec + conversion).c_str(), value);
+                break;
+            case 'p':
+                snprintf(buf, sizeof(buf), "0x%08x", value);
+                break;
+            default: // strings and floats are not traced
+                snprintf(buf, sizeof(buf), "<%%%c 0x%08x>", conversion, value);
+                break;
+        }
+        out += buf;
+    }
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+        throw runtime_error("usage: tracedump trace components...");
+
+    format_map formats;
+    for (int i = 2; i < argc; ++i)
+        load_formats(argv[i], formats);
+
+    vector<event_t> events;
+    vector<char> trace = read_file(argv[1]);
+    if (!load_image(trace, events))
+        load_log(trace, events);
+
+    // Buffers of different CPUs are merged by timestamp, TSCs are assumed to be synchronized.
+    sort(events.begin(), events.end());
+
+    uint64_t start = events.empty() ? 0 : events.front().record.timestamp;
+    for (auto& e : events)
+    {
+        const trace_record_t& r = e.record;
+        printf("[%u] %12llu ", e.cpu, (unsigned long long)(r.timestamp - start));
+        auto it = formats.find(r.format);
+        if (it != formats.end())
+            printf("%s\n", format_record(it->second, r.args).c_str());
+        else
+            printf("<unknown format 0x%08x> 0x%08x 0x%08x 0x%08x 0x%08x\n", r.format,
+                   r.args[0], r.args[1], r.args[2], r.args[3]);
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+// Every trybench translation unit picks its exception system before including exceptions.h.
+#ifndef CONFIG_EXCEPTIONS_UNWIND
+#define CONFIG_EXCEPTIONS_UNWIND 0
+#endif
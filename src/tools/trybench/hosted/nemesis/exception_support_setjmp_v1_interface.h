@@ -0,0 +1,63 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+// Host stand-in for the meddler generated interface, calls go through an ops table like closure calls in the kernel.
+
+#include "types.h"
+
+struct exception_id_t
+{
+    enum { MARKER = 0 };
+
+    char        marker;
+    uint64_t    code;
+    const char* name;
+};
+
+namespace memory_v1 {
+    typedef size_t size;
+}
+
+namespace exception_support_v1 {
+    typedef address_t id;
+    typedef address_t args;
+}
+
+namespace exception_support_setjmp_v1 {
+
+typedef void* context;
+struct closure_t;
+
+struct ops_t
+{
+    void (*raise)(closure_t* self, exception_support_v1::id i, exception_support_v1::args a, const char* filename, uint32_t lineno, const char* funcname);
+    void (*push_context)(closure_t* self, context ctx);
+    void (*pop_context)(closure_t* self, context ctx, const char* filename, uint32_t lineno, const char* funcname);
+    exception_support_v1::args (*allocate_args)(closure_t* self, memory_v1::size size);
+};
+
+struct closure_t
+{
+    const ops_t* d_methods;
+    void*        d_state;
+
+    inline void raise(exception_support_v1::id i, exception_support_v1::args a, const char* filename, uint32_t lineno, const char* funcname)
+    {
+        d_methods->raise(this, i, a, filename, lineno, funcname);
+    }
+    inline void push_context(context ctx) { d_methods->push_context(this, ctx); }
+    inline void pop_context(context ctx, const char* filename, uint32_t lineno, const char* funcname)
+    {
+        d_methods->pop_context(this, ctx, filename, lineno, funcname);
+    }
+    inline exception_support_v1::args allocate_args(memory_v1::size size) { return d_methods->allocate_args(this, size); }
+};
+
+} // namespace exception_support_setjmp_v1
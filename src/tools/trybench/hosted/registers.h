@@ -6,6 +6,11 @@
 // Distributed under the Boost Software License, Version 1.0.
 // (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
 //
-#include "cpu.h"
+#pragma once
 
-cpu_information_t x86_cpu_t::cpu_information(0);
+#include "types.h"
+
+inline address_t read_stack_pointer()
+{
+    return reinterpret_cast<address_t>(__builtin_frame_address(0));
+}
@@ -0,0 +1,15 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include_next <setjmp.h>
+
+// Like runtime/setjmp.nasm, the host versions that do not save the signal mask.
+#define __sjljeh_setjmp(buf)     _setjmp(buf)
+#define __sjljeh_longjmp(buf, j) _longjmp(buf, j)
@@ -0,0 +1,112 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include "trybench.h"
+#define CONFIG_EXCEPTIONS_UNWIND 0
+#include "exceptions.h"
+
+// The setjmp exception system of modules/exceptions_mod/exception_system.cpp, without logging and sanity checks.
+
+static void raise(exception_support_setjmp_v1::closure_t* self, exception_support_v1::id i, exception_support_v1::args a, const char* filename, uint32_t lineno, const char* funcname)
+{
+    xcp_context_t** handlers = reinterpret_cast<xcp_context_t**>(&self->d_state);
+    xcp_context_t* ctx = *handlers;
+
+    while (ctx && ctx->state != xcp_none)
+        ctx = ctx->up;
+    if (!ctx)
+    {
+        fprintf(stderr, "Unhandled exception %s raised from %s:%u\n", xcp_name(i), filename, lineno);
+        abort();
+    }
+
+    ctx->state    = xcp_active;
+    ctx->id       = i;
+    ctx->args     = a;
+    ctx->filename = filename;
+    ctx->line     = lineno;
+    ctx->funcname = funcname;
+    *handlers = ctx->up;
+    xcp_longjmp(ctx->jmp, 1);
+}
+
+static void push_context(exception_support_setjmp_v1::closure_t* self, exception_support_setjmp_v1::context c)
+{
+    xcp_context_t* ctx = reinterpret_cast<xcp_context_t*>(c);
+    xcp_context_t** handlers = reinterpret_cast<xcp_context_t**>(&self->d_state);
+
+    ctx->state = xcp_none;
+    ctx->up = *handlers;
+    ctx->down = reinterpret_cast<xcp_context_t*>(0x1);
+    ctx->args = 0;
+    if (*handlers && (*handlers)->down)
+        (*handlers)->down = ctx;
+    *handlers = ctx;
+}
+
+static void pop_context(exception_support_setjmp_v1::closure_t* self, exception_support_setjmp_v1::context c, const char* filename, uint32_t lineno, const char* funcname)
+{
+    xcp_context_t* ctx = reinterpret_cast<xcp_context_t*>(c);
+    xcp_context_t** handlers = reinterpret_cast<xcp_context_t**>(&self->d_state);
+    xcp_state_t prev_state = ctx->state;
+
+    ctx->state = xcp_popped;
+    *handlers = ctx->up;
+    if (prev_state == xcp_active)
+        raise(self, ctx->id, ctx->args, filename, lineno, funcname);
+}
+
+static exception_support_v1::args allocate_args(exception_support_setjmp_v1::closure_t*, memory_v1::size size)
+{
+    return reinterpret_cast<exception_support_v1::args>(malloc(size));
+}
+
+static const exception_support_setjmp_v1::ops_t methods = { raise, push_context, pop_context, allocate_args };
+static exception_support_setjmp_v1::closure_t closure = { &methods, nullptr };
+static exception_support_setjmp_v1::closure_t* pervasive_exceptions = &closure;
+
+static const exception_id_t raised_id = { exception_id_t::MARKER, 1, "trybench_v1.raised" };
+static const exception_id_t other_id = { exception_id_t::MARKER, 2, "trybench_v1.other" };
+
+static void raise_raised()
+{
+    OS_RAISE(raised_id, 0);
+}
+
+static void guarded(size_t rounds)
+{
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        OS_TRY {
+            work(i, nullptr);
+        }
+        OS_FINALLY {
+        }
+        OS_ENDTRY
+    }
+}
+
+static void raise_catch(size_t rounds)
+{
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        OS_TRY {
+            work(i, raise_raised);
+        }
+        OS_CATCH(other_id) {
+            abort();
+        }
+        OS_CATCH(raised_id) {
+        }
+        OS_ENDTRY
+    }
+}
+
+const try_variant_t setjmp_variant = { "setjmp", guarded, raise_catch };
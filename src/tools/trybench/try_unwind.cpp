@@ -0,0 +1,85 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#include <stdlib.h>
+#include "trybench.h"
+#define CONFIG_EXCEPTIONS_UNWIND 1
+#include "exceptions.h"
+
+// The unwinding exception system of modules/exceptions_mod/exception_system_unwind.cpp, thrown with the host
+// C++ runtime. OS_TRY blocks do not push contexts, push and pop are never called.
+
+static void raise(exception_support_setjmp_v1::closure_t*, exception_support_v1::id i, exception_support_v1::args a, const char* filename, uint32_t lineno, const char* funcname)
+{
+    xcp_context_t record;
+    record.state    = xcp_active;
+    record.id       = i;
+    record.args     = a;
+    record.filename = filename;
+    record.line     = lineno;
+    record.funcname = funcname;
+    throw record;
+}
+
+static void push_context(exception_support_setjmp_v1::closure_t*, exception_support_setjmp_v1::context)
+{
+    abort();
+}
+
+static void pop_context(exception_support_setjmp_v1::closure_t*, exception_support_setjmp_v1::context, const char*, uint32_t, const char*)
+{
+    abort();
+}
+
+static exception_support_v1::args allocate_args(exception_support_setjmp_v1::closure_t*, memory_v1::size size)
+{
+    return reinterpret_cast<exception_support_v1::args>(malloc(size));
+}
+
+static const exception_support_setjmp_v1::ops_t methods = { raise, push_context, pop_context, allocate_args };
+static exception_support_setjmp_v1::closure_t closure = { &methods, nullptr };
+static exception_support_setjmp_v1::closure_t* pervasive_exceptions = &closure;
+
+static const exception_id_t raised_id = { exception_id_t::MARKER, 1, "trybench_v1.raised" };
+static const exception_id_t other_id = { exception_id_t::MARKER, 2, "trybench_v1.other" };
+
+static void raise_raised()
+{
+    OS_RAISE(raised_id, 0);
+}
+
+static void guarded(size_t rounds)
+{
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        OS_TRY {
+            work(i, nullptr);
+        }
+        OS_FINALLY {
+        }
+        OS_ENDTRY
+    }
+}
+
+static void raise_catch(size_t rounds)
+{
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        OS_TRY {
+            work(i, raise_raised);
+        }
+        OS_CATCH(other_id) {
+            abort();
+        }
+        OS_CATCH(raised_id) {
+        }
+        OS_ENDTRY
+    }
+}
+
+const try_variant_t unwind_variant = { "unwind", guarded, raise_catch };
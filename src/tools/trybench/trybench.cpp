@@ -0,0 +1,76 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+/**
+ * @brief OS_TRY overhead benchmark.
+ *
+ * Times a call guarded by a TRY block with either exception system against the plain call, and a raise caught by
+ * the second of two CATCH clauses. See README.md.
+ *
+ * Usage: trybench [rounds]
+ */
+
+/*============================================================================*/
+
+#include "trybench.h"
+#include "macros.h"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock bench_clock;
+
+static volatile size_t sink;
+
+NOINLINE void work(size_t round, void (*raise)())
+{
+    sink = round;
+    if (raise)
+        raise();
+}
+
+static void plain(size_t rounds)
+{
+    for (size_t i = 0; i < rounds; ++i)
+        work(i, nullptr);
+}
+
+// Best of a few runs, in nanoseconds per round.
+static double time_rounds(void (*loop)(size_t), size_t rounds)
+{
+    double best = 0;
+    for (int run = 0; run < 5; ++run)
+    {
+        bench_clock::time_point start = bench_clock::now();
+        loop(rounds);
+        double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / rounds;
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    size_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 0) : 10000000;
+    size_t raise_rounds = rounds / 100 ? rounds / 100 : 1;
+
+    double base = time_rounds(plain, rounds);
+    std::cout << std::fixed << std::setprecision(2)
+              << "plain call:         " << base << " ns" << std::endl;
+
+    for (const try_variant_t* v : { &setjmp_variant, &unwind_variant })
+    {
+        double guarded = time_rounds(v->guarded, rounds);
+        double raised = time_rounds(v->raise_catch, raise_rounds);
+        std::cout << std::setw(6) << v->name << " TRY block:   " << guarded << " ns, overhead " << guarded - base << " ns" << std::endl
+                  << std::setw(6) << v->name << " raise/catch: " << raised << " ns" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+//
+// Part of Metta OS. Check https://atta-metta.net for latest version.
+//
+// Copyright 2007 - 2017, Stanislav Karchebnyy <berkus@atta-metta.net>
+//
+// Distributed under the Boost Software License, Version 1.0.
+// (See file LICENSE_1_0.txt or a copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Exception system under test, try_setjmp.cpp and try_unwind.cpp build exceptions.h with one each.
+ */
+struct try_variant_t
+{
+    const char* name;
+    void (*guarded)(size_t rounds);     // Call work() in a TRY block with a FINALLY clause, never raising.
+    void (*raise_catch)(size_t rounds); // Raise from work() and catch in the second CATCH clause.
+};
+
+extern const try_variant_t setjmp_variant;
+extern const try_variant_t unwind_variant;
+
+/**
+ * Guarded work, calls raise if given. Out of line so that the compiler has to assume it may raise.
+ */
+void work(size_t round, void (*raise)());